@@ -0,0 +1,65 @@
+"""Script to generate the deterministic synthetic inputs of the benchmark suite: a survey-shaped and a periodic random catalog (with jackknife regions),
+radial binning files, a power-law correlation function and the mu bin Legendre factors. The RR counts, jackknife weights and survey correction functions
+are then computed from these catalogs by run_benchmarks.py with the pair_counts code and the correction function scripts."""
+
+import numpy as np
+import os, sys
+
+## PARAMETERS
+if len(sys.argv) not in (2, 3):
+    print("Usage: python make_inputs.py {OUTPUT_DIR} [{N_PARTICLES}]")
+    sys.exit(1)
+outdir = str(sys.argv[1])
+n_part = int(sys.argv[2]) if len(sys.argv) == 3 else 20000
+
+seed = 42 # fixed, so that the inputs are identical on every machine and numpy version with the same generator
+r_edges = np.linspace(20, 120, 6) # radial bins of the covariance
+r_cf_edges = np.linspace(0, 200, 21) # radial bins of the correlation function
+n_mu_cf = 10 # mu bins of the correlation function
+r0, gamma = 10., 1.8 # power-law correlation function xi = (r/r0)^-gamma
+max_l = 2 # maximum Legendre multipole of the LEGENDRE_MIX mu bin factors
+n_mu_mix = 10 # mu bins projected into multipoles in LEGENDRE_MIX mode
+box = 500. # periodic box size in Mpc/h
+shell = (600., 1000.) # radial extent of the survey in Mpc/h
+ra_max, dec_max = 90., 60. # angular extent of the survey in degrees
+
+os.makedirs(outdir, exist_ok=1)
+rng = np.random.default_rng(seed)
+
+## Survey-shaped randoms, uniform in volume within a shell sector, with 8 jackknife regions (4 RA x 2 equal-area declination bands)
+r = np.cbrt(rng.uniform(shell[0]**3, shell[1]**3, n_part))
+ra = rng.uniform(0, ra_max, n_part)
+sin_dec = rng.uniform(0, np.sin(np.radians(dec_max)), n_part)
+cos_dec = np.sqrt(1 - sin_dec**2)
+xyz = np.column_stack([r*cos_dec*np.cos(np.radians(ra)), r*cos_dec*np.sin(np.radians(ra)), r*sin_dec])
+jk = np.minimum((ra/ra_max*4).astype(int), 3) + 4*(sin_dec > np.sin(np.radians(dec_max))/2)
+np.savetxt(os.path.join(outdir, "survey_randoms.txt"), np.column_stack([xyz, np.ones(n_part), jk]), fmt="%.6f %.6f %.6f %.1f %d")
+
+## Periodic randoms in a cubic box, with 8 jackknife octants
+xyz = rng.uniform(0, box, (n_part, 3))
+jk = (xyz[:,0] > box/2) + 2*(xyz[:,1] > box/2) + 4*(xyz[:,2] > box/2)
+np.savetxt(os.path.join(outdir, "periodic_randoms.txt"), np.column_stack([xyz, np.ones(n_part), jk]), fmt="%.6f %.6f %.6f %.1f %d")
+
+## Binning files, in the format of the write_binning_file scripts
+np.savetxt(os.path.join(outdir, "radial_binning_cov.csv"), np.column_stack([r_edges[:-1], r_edges[1:]]))
+np.savetxt(os.path.join(outdir, "radial_binning_corr.csv"), np.column_stack([r_cf_edges[:-1], r_cf_edges[1:]]))
+
+## Power-law correlation function, in the format of the xi_estimator scripts (radial bin centers, mu bin centers, then one row of xi per radial bin)
+r_cen = 0.5*(r_cf_edges[1:] + r_cf_edges[:-1])
+mu_cen = (np.arange(n_mu_cf) + 0.5)/n_mu_cf
+xi = np.outer((r_cen/r0)**-gamma, np.ones(n_mu_cf))
+with open(os.path.join(outdir, "xi_powerlaw.dat"), "w") as f:
+    f.write(" ".join("%.8e" % x for x in r_cen) + "\n")
+    f.write(" ".join("%.8e" % x for x in mu_cen) + "\n")
+    for row in xi:
+        f.write(" ".join("%.8e" % x for x in row) + "\n")
+
+## Mu bin Legendre factors, as in python/mu_bin_legendre_factors.py
+mu_edges = np.linspace(0, 1, n_mu_mix+1)
+leg_mu_factors = np.zeros((max_l//2+1, n_mu_mix))
+for i, ell in enumerate(range(0, max_l+1, 2)):
+    leg_pol_int = np.polynomial.legendre.Legendre.basis(ell).integ()
+    leg_mu_factors[i] = (2*ell+1)*np.diff(leg_pol_int(mu_edges))
+np.savetxt(os.path.join(outdir, "mu_bin_legendre_factors_m%d_l%d.txt" % (n_mu_mix, max_l)), leg_mu_factors.T)
+
+print("Saved benchmark inputs with %d particles per catalog to %s" % (n_part, outdir))
@@ -0,0 +1,395 @@
+// microbench.cpp -- Timings of the core kernels of grid_covariance.cpp in isolation, on the cells of a given random catalog.
+// Each kernel is called in batches on inputs drawn beforehand; the median and median absolute deviation (MAD) of the time per call over the batches
+// are saved to a results file and compared with those of a previous run, so that the effect of an optimization can be measured per kernel.
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <complex>
+#include <algorithm>
+#include <random>
+#include <gsl/gsl_sf.h>
+#include <gsl/gsl_interp.h>
+#include <gsl/gsl_spline.h>
+#include <gsl/gsl_interp2d.h>
+#include <gsl/gsl_spline2d.h>
+#include "../threevector.hh"
+#include <gsl/gsl_rng.h>
+#include "../ransampl/ransampl.h"
+#include "../STimer.cc"
+#include "../cubature/cubature.h"
+#include <limits>
+#include <sys/stat.h>
+
+#define PAGE 4096     // To force some memory alignment.
+
+typedef unsigned long long int uint64;
+
+// Could swap between single and double precision here.
+typedef double Float;
+typedef double3 Float3;
+
+#if (defined POWER || defined THREE_PCF)
+#error "The microbenchmarks only support the 2PCF modes (default, JACKKNIFE, LEGENDRE_MIX and LEGENDRE)"
+#endif
+
+// Define module files
+    #include "../modules/parameters.h"
+    #include "../modules/cell_utilities.h"
+    #include "../modules/grid.h"
+    #include "../modules/correlation_function.h"
+#ifdef LEGENDRE
+    #include "../modules/legendre_utilities.h"
+    #include "../modules/integrals_legendre.h"
+#else
+    #include "../modules/jackknife_weights.h"
+    #include "../modules/integrals.h"
+#ifdef LEGENDRE_MIX
+    #include "../modules/legendre_mix_utilities.h"
+#endif
+#endif
+    #include "../modules/random_draws.h"
+    #include "../modules/driver.h"
+    #include "../modules/compute_integral.h"
+
+CorrelationFunction * RandomDraws::corr;
+
+#define MAX_KERNELS 20
+#define N_INPUTS 1024 // number of inputs drawn for each kernel, cycled through in each batch (a power of two)
+#define N_SETS 64 // number of sets of i, j, k and l cells drawn for the integral kernels (a power of two)
+
+inline double wall_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+1e-9*ts.tv_nsec;
+}
+
+class KernelBenchmark{
+    // Times each kernel and holds the median and MAD of its time per call in ns
+public:
+    int n_kernels = 0;
+    char names[MAX_KERNELS][40];
+    double median[MAX_KERNELS], mad[MAX_KERNELS];
+    int n_repeats; // number of timed batches per kernel
+    static constexpr double batch_seconds = 1e-2; // minimum duration of a batch, long compared to the timer resolution
+    Float sink = 0; // accumulates the kernel outputs, so that the compiler cannot remove the calls
+
+    KernelBenchmark(int _n_repeats){
+        n_repeats = _n_repeats;
+    }
+
+    template<class Kernel> void time(const char *name, Kernel kernel){
+        // Time kernel(i) for inputs i cycling over 0..N_INPUTS-1: the batch size is first doubled until a batch lasts batch_seconds
+        // (which also warms up the caches and branch predictors), then n_repeats batches are timed
+        assert(n_kernels<MAX_KERNELS);
+        long batch = N_INPUTS;
+        while (true){
+            double start = wall_seconds();
+            for (long i = 0; i < batch; i++) kernel(i&(N_INPUTS-1));
+            if (wall_seconds()-start>=batch_seconds) break;
+            batch *= 2;
+        }
+        double *per_call = (double *)malloc(sizeof(double)*n_repeats);
+        for (int r = 0; r < n_repeats; r++){
+            double start = wall_seconds();
+            for (long i = 0; i < batch; i++) kernel(i&(N_INPUTS-1));
+            per_call[r] = (wall_seconds()-start)/batch*1e9;
+        }
+        // Median and MAD are insensitive to the occasional batch interrupted by the operating system
+        std::sort(per_call, per_call+n_repeats);
+        double med = per_call[n_repeats/2];
+        for (int r = 0; r < n_repeats; r++) per_call[r] = fabs(per_call[r]-med);
+        std::sort(per_call, per_call+n_repeats);
+        snprintf(names[n_kernels], sizeof names[n_kernels], "%s", name);
+        median[n_kernels] = med;
+        mad[n_kernels] = per_call[n_repeats/2];
+        printf("  %-22s %10.2f ns/call (MAD %.2f ns, %d batches of %ld calls)\n", name, med, mad[n_kernels], n_repeats, batch);
+        fflush(NULL);
+        n_kernels++;
+        free(per_call);
+    }
+
+#ifdef LEGENDRE
+    void run(Parameters *par, Grid *grid, CorrelationFunction *cf, RandomDraws *rd, SurveyCorrection *sc){
+#else
+    void run(Parameters *par, Grid *grid, CorrelationFunction *cf, RandomDraws *rd, JK_weights *JK){
+#endif
+        // Draw the inputs of all kernels (with a fixed seed, so that they are the same in every run) and time the kernels
+        gsl_rng* rng = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_set(rng, 1);
+#ifdef LEGENDRE
+        Integrals locint(par, cf, cf, cf, 1, 1, 1, 1, sc, sc, sc);
+#elif defined JACKKNIFE
+        Integrals locint(par, cf, cf, cf, JK, JK, JK, 1, 1, 1, 1, JK->product_weights, JK->product_weights, JK->product_weights);
+#else
+        Integrals locint(par, cf, cf, cf, JK, JK, JK, 1, 1, 1, 1);
+#endif
+        compute_integral ci; // only used for its particle draws
+        double p;
+        int n_particles, n_particles1, n_particles2;
+        printf("\nTiming kernels (single-threaded):\n");
+
+        // Separations and pairs of particle positions up to rmax
+        Float r[N_INPUTS], mu[N_INPUTS];
+        Float3 pos1[N_INPUTS], pos2[N_INPUTS];
+        for (int i = 0; i < N_INPUTS; i++){
+            r[i] = par->rmin+(par->rmax-par->rmin)*gsl_rng_uniform(rng);
+            mu[i] = par->mumin+(par->mumax-par->mumin)*gsl_rng_uniform(rng);
+            pos1[i] = grid->p[(int)floor(gsl_rng_uniform(rng)*grid->np)].pos;
+            pos2[i] = pos1[i]+Float3(gsl_rng_uniform(rng)-0.5, gsl_rng_uniform(rng)-0.5, gsl_rng_uniform(rng)-0.5)*par->rmax;
+        }
+#ifndef LEGENDRE
+        time("getbin", [&](int i){ sink += locint.getbin(r[i], mu[i]); });
+#endif
+        time("cleanup_l", [&](int i){
+            Float norm, mu_out;
+            locint.cleanup_l(pos1[i], pos2[i], norm, mu_out);
+            sink += norm+mu_out;
+        });
+        time("xi", [&](int i){ sink += cf->xi(r[i], mu[i]); });
+
+        // Cell draws, with the sampler of the short-distance draws also timed on its own
+        time("random_xidraw", [&](int i){ sink += rd->random_xidraw(rng, &p).x; });
+        time("random_cubedraw", [&](int i){ sink += rd->random_cubedraw(rng, &p).x; });
+        int n_cube = pow(rd->nsidecube, 3);
+        double *cube_probs = (double *)malloc(sizeof(double)*n_cube);
+        for (int i = 0; i < n_cube; i++) cube_probs[i] = rd->xcube[i];
+        ransampl_ws* ws = ransampl_alloc(n_cube);
+        ransampl_set(ws, cube_probs);
+        double ran1[N_INPUTS], ran2[N_INPUTS];
+        for (int i = 0; i < N_INPUTS; i++){
+            ran1[i] = gsl_rng_uniform(rng);
+            ran2[i] = gsl_rng_uniform(rng);
+        }
+        time("ransampl_draw", [&](int i){ sink += ransampl_draw(ws, ran1[i], ran2[i]); });
+
+        // Particle draws from cells drawn as in the main loop (including those outside the grid or empty, which are rejected)
+        integer3 draw_cell[N_INPUTS];
+        Float3 draw_shift[N_INPUTS];
+        for (int i = 0; i < N_INPUTS; i++){
+            integer3 delta = rd->random_cubedraw(rng, &p);
+            draw_cell[i] = grid->cell_id_from_1d(grid->filled[(int)floor(gsl_rng_uniform(rng)*grid->nf)])+delta;
+            draw_shift[i] = grid->cell_sep(delta);
+        }
+        time("draw_particle", [&](int i){
+            Particle particle;
+            int pid;
+            if (ci.draw_particle(draw_cell[i], particle, pid, draw_shift[i], grid, n_particles, rng, n_particles1, n_particles2)==0) sink += particle.w;
+        });
+
+#ifdef JACKKNIFE
+        int jk[N_INPUTS][4], bin_a[N_INPUTS], bin_b[N_INPUTS];
+        for (int i = 0; i < N_INPUTS; i++){
+            for (int j = 0; j < 4; j++) jk[i][j] = (int)floor(gsl_rng_uniform(rng)*JK->n_JK_filled);
+            bin_a[i] = (int)floor(gsl_rng_uniform(rng)*JK->nbins);
+            bin_b[i] = (int)floor(gsl_rng_uniform(rng)*JK->nbins);
+        }
+        time("weight_tensor", [&](int i){ sink += locint.weight_tensor(jk[i][0], jk[i][1], jk[i][2], jk[i][3], bin_a[i], bin_b[i], JK, JK, JK->product_weights); });
+#endif
+#ifdef LEGENDRE
+        Float poly[11];
+        time("legendre_polynomials", [&](int i){
+            legendre_polynomials(mu[i], par->max_l, poly);
+            sink += poly[par->max_l/2];
+        });
+#endif
+
+        // Sets of i, j, k and l cells and particles for the integral kernels, drawn as in the main loop until all draws succeed
+        int mnp = grid->maxnp;
+        Particle *prim_list[N_SETS], pj[N_SETS], pk[N_SETS], pl[N_SETS];
+        int *prim_ids[N_SETS], pln[N_SETS], pj_id[N_SETS], pk_id[N_SETS], pl_id[N_SETS], *bin_ij[N_SETS];
+        Float *w_ij[N_SETS], *xi_ik[N_SETS], *w_ijk[N_SETS];
+#ifdef LEGENDRE
+        Float *factor_ij[N_SETS], *poly_ij[N_SETS];
+#endif
+        long total_pln = 0;
+        for (int s = 0; s < N_SETS; s++){
+            int ec=0;
+            ec+=posix_memalign((void **) &prim_list[s], PAGE, sizeof(Particle)*mnp);
+            ec+=posix_memalign((void **) &prim_ids[s], PAGE, sizeof(int)*mnp);
+            ec+=posix_memalign((void **) &bin_ij[s], PAGE, sizeof(int)*mnp);
+            ec+=posix_memalign((void **) &w_ij[s], PAGE, sizeof(Float)*mnp);
+            ec+=posix_memalign((void **) &xi_ik[s], PAGE, sizeof(Float)*mnp);
+            ec+=posix_memalign((void **) &w_ijk[s], PAGE, sizeof(Float)*mnp);
+#ifdef LEGENDRE
+            ec+=posix_memalign((void **) &factor_ij[s], PAGE, sizeof(Float)*mnp);
+            ec+=posix_memalign((void **) &poly_ij[s], PAGE, sizeof(Float)*mnp*par->mbin);
+#endif
+            assert(ec==0);
+            while (true){
+                int prim_id_1D = grid->filled[(int)floor(gsl_rng_uniform(rng)*grid->nf)];
+                integer3 prim_id = grid->cell_id_from_1d(prim_id_1D);
+                integer3 delta2 = rd->random_cubedraw(rng, &p);
+                integer3 sec_id = prim_id+delta2;
+                Float3 cell_sep2 = grid->cell_sep(delta2);
+                if (ci.draw_particle(sec_id, pj[s], pj_id[s], cell_sep2, grid, n_particles, rng, n_particles1, n_particles2)) continue;
+                integer3 delta3 = rd->random_xidraw(rng, &p);
+                if (ci.draw_particle_without_class(prim_id+delta3, pk[s], pk_id[s], grid->cell_sep(delta3), grid, n_particles, rng)) continue;
+                integer3 delta4 = rd->random_xidraw(rng, &p);
+                if (ci.draw_particle_without_class(sec_id+delta4, pl[s], pl_id[s], cell_sep2+grid->cell_sep(delta4), grid, n_particles, rng)) continue;
+                pln[s] = ci.particle_list(prim_id_1D, prim_list[s], prim_ids[s], grid);
+                break;
+            }
+            total_pln += pln[s];
+        }
+        printf("  (integral kernels on %d sets of cells with %.1f particles per i cell on average)\n", N_SETS, (double)total_pln/N_SETS);
+        // The kernels are timed in order, so that third and fourth read the outputs of second and third for the same set
+#ifdef LEGENDRE
+        time("second", [&](int i){ int s = i&(N_SETS-1); locint.second(prim_list[s], prim_ids[s], pln[s], pj[s], pj_id[s], bin_ij[s], w_ij[s], 1., factor_ij[s], poly_ij[s]); });
+        time("third", [&](int i){ int s = i&(N_SETS-1); locint.third(prim_list[s], prim_ids[s], pln[s], pj[s], pk[s], pj_id[s], pk_id[s], bin_ij[s], w_ij[s], xi_ik[s], w_ijk[s], 1., factor_ij[s], poly_ij[s]); });
+        time("fourth", [&](int i){
+            int s = i&(N_SETS-1);
+            locint.fourth_draw(pj[s], pk[s], pl[s], pj_id[s], pk_id[s], pl_id[s], 1.);
+            locint.fourth(prim_list[s], prim_ids[s], pln[s], pj[s], pk[s], bin_ij[s], w_ijk[s], xi_ik[s], factor_ij[s], poly_ij[s]);
+        });
+#else
+        time("second", [&](int i){ int s = i&(N_SETS-1); locint.second(prim_list[s], prim_ids[s], pln[s], pj[s], pj_id[s], bin_ij[s], w_ij[s], 1., 1., 1.); });
+        time("third", [&](int i){ int s = i&(N_SETS-1); locint.third(prim_list[s], prim_ids[s], pln[s], pj[s], pk[s], pj_id[s], pk_id[s], bin_ij[s], w_ij[s], xi_ik[s], w_ijk[s], 1.); });
+        time("fourth", [&](int i){
+            int s = i&(N_SETS-1);
+            locint.fourth_draw(pj[s], pk[s], pl[s], pj_id[s], pk_id[s], pl_id[s], 1.);
+            locint.fourth(prim_list[s], prim_ids[s], pln[s], pj[s], pk[s], bin_ij[s], w_ijk[s], xi_ik[s]);
+        });
+#endif
+
+        for (int s = 0; s < N_SETS; s++){
+            free(prim_list[s]);
+            free(prim_ids[s]);
+            free(bin_ij[s]);
+            free(w_ij[s]);
+            free(xi_ik[s]);
+            free(w_ijk[s]);
+#ifdef LEGENDRE
+            free(factor_ij[s]);
+            free(poly_ij[s]);
+#endif
+        }
+        ransampl_free(ws);
+        free(cube_probs);
+        gsl_rng_free(rng);
+    }
+
+    void save(const char *fname){
+        FILE *fp = fopen(fname, "w");
+        if (fp==NULL){
+            fprintf(stderr,"Results file %s could not be opened\n", fname);
+            abort();
+        }
+        fprintf(fp, "# kernel median_ns mad_ns\n");
+        for (int k = 0; k < n_kernels; k++) fprintf(fp, "%s %.4f %.4f\n", names[k], median[k], mad[k]);
+        fclose(fp);
+        printf("\nSaved kernel timings to %s\n", fname);
+    }
+
+    int compare(const char *fname){
+        // Compare with the timings of a previous results file. A kernel is flagged as slower (faster) if its median changed by more than 10%
+        // and by more than three times the sum of the two MADs, which is robust to the scatter of the batches. Returns the number of slower kernels
+        FILE *fp = fopen(fname, "r");
+        if (fp==NULL){
+            fprintf(stderr,"Previous results file %s could not be opened\n", fname);
+            abort();
+        }
+        char line[1000], name[40];
+        double old_median, old_mad;
+        int n_slower = 0;
+        printf("\nComparison with %s:\n", fname);
+        printf("  %-22s %12s %12s %8s\n", "kernel", "before [ns]", "now [ns]", "ratio");
+        while (fgets(line, sizeof line, fp)!=NULL){
+            if (line[0]=='#') continue;
+            if (sscanf(line, "%39s %lf %lf", name, &old_median, &old_mad)!=3) continue;
+            for (int k = 0; k < n_kernels; k++){
+                if (strcmp(names[k], name)!=0) continue;
+                double change = median[k]-old_median;
+                bool significant = fabs(change)>0.1*old_median && fabs(change)>3*(mad[k]+old_mad);
+                if (significant && change>0) n_slower++;
+                printf("  %-22s %12.2f %12.2f %8.3f %s\n", name, old_median, median[k], median[k]/old_median, significant ? (change>0 ? "SLOWER" : "faster") : "");
+            }
+        }
+        fclose(fp);
+        if (n_slower>0) printf("\n%d kernel(s) became significantly slower\n", n_slower);
+        return n_slower;
+    }
+};
+
+// ================================ main() =============================
+
+int main(int argc, char *argv[]) {
+    // The options of the microbenchmark come first, followed by the usual grid_covariance options for the same mode
+    const char *results_file = "microbench_results.txt", *compare_file = NULL;
+    int n_repeats = 31;
+    int first = 1;
+    while (first+1<argc){
+        if (!strcmp(argv[first],"-results")) results_file = argv[first+1];
+        else if (!strcmp(argv[first],"-compare")) compare_file = argv[first+1];
+        else if (!strcmp(argv[first],"-repeats")) n_repeats = atoi(argv[first+1]);
+        else break;
+        first += 2;
+    }
+    if (first==argc){
+        fprintf(stderr, "\nUsage for microbench:\n\n");
+        fprintf(stderr, "   ./microbench [-results <file>] [-compare <file>] [-repeats <n>] <grid_covariance options>\n\n");
+        fprintf(stderr, "   -results <file>: File to save the kernel timings to. Default microbench_results.txt\n");
+        fprintf(stderr, "   -compare <file>: Results file of a previous run to compare with; the exit status is 1 if any kernel became significantly slower.\n");
+        fprintf(stderr, "   -repeats <n>: Number of timed batches per kernel. Default 31\n");
+    }
+    assert(n_repeats>0);
+    argv[first-1] = argv[0];
+    Parameters par=Parameters(argc-first+1, argv+first-1);
+
+#ifdef LEGENDRE
+    SurveyCorrection sc(&par,1,1);
+#else
+    JK_weights JK(&par,1,1);
+#endif
+
+    // Read in the particles and put them to a grid, as in grid_covariance.cpp (but without adapting nside)
+    Particle* particles;
+    int np;
+    Float3 shift;
+    if (!par.make_random) {
+#ifdef JACKKNIFE
+        JackknifeAssignment jk_assign(par.jk_assign, par.jk_resolution);
+        particles = read_particles(par.rescale, &np, par.fname, par.rstart, par.nmax, &JK, &jk_assign);
+#else
+        particles = read_particles(par.rescale, &np, par.fname, par.rstart, par.nmax);
+#endif
+        assert(np > 0);
+        par.perbox = compute_bounding_box(&particles, &np, 1, par.rect_boxsize, par.cellsize, par.rmax, shift, par.nside);
+#ifdef PERIODIC
+        par.rect_boxsize = {par.boxsize, par.boxsize, par.boxsize};
+        par.cellsize = par.boxsize / (Float)par.nside;
+#endif
+    }
+    else {
+        np = par.np;
+        particles = make_particles(par.rect_boxsize, np, 0);
+        par.cellsize = par.boxsize / (Float)par.nside;
+        par.perbox = true;
+    }
+    Grid grid(particles, np, par.rect_boxsize, par.cellsize, par.nside, shift, par.nofznorm);
+    free(particles);
+    printf("Average number of particles per grid cell = %6.2f\n", (Float)grid.np/grid.nf);
+#ifdef LEGENDRE
+    sc.rescale(grid.norm, grid.norm);
+#else
+    JK.rescale(grid.norm, grid.norm);
+#endif
+
+    CorrelationFunction cf(par.corname, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
+    RandomDraws rd(&cf, &par, NULL, 0);
+
+    KernelBenchmark bench(n_repeats);
+#ifdef LEGENDRE
+    bench.run(&par, &grid, &cf, &rd, &sc);
+#else
+    bench.run(&par, &grid, &cf, &rd, &JK);
+#endif
+    bench.save(results_file);
+    if (compare_file!=NULL && bench.compare(compare_file)>0) return 1;
+    return 0;
+}
@@ -0,0 +1,180 @@
+"""Script to run the end-to-end benchmark suite. This builds the main code in each mode (and the triple counting code) from the current tree,
+runs them on the synthetic inputs of make_inputs.py and records the wall time, sampling speed and peak memory of each run, together with the
+agreement of the output integrals with stored reference integrals. The results are saved as JSON so that they can be compared across commits."""
+
+import numpy as np
+import argparse, glob, json, os, re, shlex, shutil, subprocess, sys, time
+
+repo_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Mode name: (directory of the Makefile, compile flags, executable, catalog)
+MODES = {"default": (".", "-DOPENMP", "cov", "survey"),
+         "jackknife": (".", "-DOPENMP -DJACKKNIFE", "cov", "survey"),
+         "legendre": (".", "-DOPENMP -DLEGENDRE -DPERIODIC", "cov", "periodic"),
+         "legendre_mix": (".", "-DOPENMP -DLEGENDRE_MIX -DJACKKNIFE", "cov", "survey"),
+         "three_pcf": (".", "-DOPENMP -DTHREE_PCF -DLEGENDRE -DPERIODIC", "cov", "periodic"),
+         "triple": ("triple_counts", "-DOPENMP -DPERIODIC", "triple", "periodic")}
+SOURCES = ["grid_covariance.cpp", "Makefile", "STimer.cc", "threevector.hh", "promote_numeric.h", "modules", "cubature", "ransampl", "triple_counts", "pair_counts"]
+
+parser = argparse.ArgumentParser(description="Run the RascalC end-to-end benchmarks")
+parser.add_argument("output_dir", help="directory for the inputs, builds, outputs and results.json (created if needed)")
+parser.add_argument("--modes", default=",".join(MODES), help="comma-separated list of modes to run (default: all of %s)" % ",".join(MODES))
+parser.add_argument("--nthread", type=int, default=4, help="number of threads of each run (default: 4)")
+parser.add_argument("--particles", type=int, default=20000, help="number of particles of each synthetic catalog (default: 20000)")
+parser.add_argument("--reference", default=os.path.join(repo_dir, "benchmark", "reference"), help="directory of the reference integrals (default: benchmark/reference)")
+parser.add_argument("--save-reference", action="store_true", help="store the output integrals as the new reference instead of comparing with it")
+parser.add_argument("--compare", help="results.json of a previous run (e.g. of another commit) to compare the timings with")
+parser.add_argument("--make-args", default="", help="extra arguments of make, e.g. 'CXX=clang++' (default: none)")
+args = parser.parse_args()
+
+modes = args.modes.split(",")
+for mode in modes:
+    if mode not in MODES: sys.exit("Unknown mode %s; choose from %s" % (mode, ",".join(MODES)))
+outdir = os.path.abspath(args.output_dir)
+indir = os.path.join(outdir, "inputs")
+n_bins, n_mu, n_mu_mix, max_l = 5, 4, 10, 2 # as in make_inputs.py
+
+def run(command, cwd=None, log=None):
+    """Run a command, returning its exit status, wall time in seconds, peak resident memory in MB and standard output"""
+    start = time.time()
+    with open(log, "w") if log else open(os.devnull, "w") as err:
+        proc = subprocess.Popen(command, cwd=cwd, stdout=subprocess.PIPE, stderr=err, universal_newlines=True)
+        stdout = proc.stdout.read()
+        _, status, usage = os.wait4(proc.pid, 0)
+    proc.returncode = status # avoid a second wait
+    return os.waitstatus_to_exitcode(status), time.time() - start, usage.ru_maxrss/1024., stdout
+
+def build(name, make_dir, flags):
+    """Copy the sources to a build directory of their own (so that the object files of different modes do not mix) and run make there"""
+    build_dir = os.path.join(outdir, "build", name)
+    shutil.rmtree(build_dir, ignore_errors=True)
+    os.makedirs(build_dir)
+    ignore = lambda d, names: [n for n in names if n.endswith((".o", ".d")) or ("." not in n and os.path.isfile(os.path.join(d, n)) and os.access(os.path.join(d, n), os.X_OK))] # skip objects and executables of earlier builds
+    for source in SOURCES:
+        if os.path.isdir(os.path.join(repo_dir, source)): shutil.copytree(os.path.join(repo_dir, source), os.path.join(build_dir, source), ignore=ignore)
+        elif os.path.exists(os.path.join(repo_dir, source)): shutil.copy(os.path.join(repo_dir, source), build_dir)
+    command = ["make", "-C", os.path.join(build_dir, make_dir), "CXXFLAGS=-O3 -Wall -MMD " + flags] + shlex.split(args.make_args)
+    status, seconds, _, _ = run(command, log=os.path.join(build_dir, "build.log"))
+    return status, seconds, os.path.join(build_dir, make_dir)
+
+def read_array(fname):
+    return np.load(fname) if fname.endswith(".npy") else np.loadtxt(fname)
+
+def collect_integrals(run_dir):
+    """Full integrals of a run, with their standard errors estimated from the scatter of the subsamples"""
+    integrals = {}
+    for full in sorted(glob.glob(os.path.join(run_dir, "**", "*_full.*"), recursive=True)):
+        prefix, ext = full[:-len("_full.txt")], os.path.splitext(full)[1]
+        subsamples = [f for f in glob.glob(prefix + "_*" + ext) if re.fullmatch(r"\d+", f[len(prefix)+1:-len(ext)])]
+        if len(subsamples) < 2: continue
+        value = read_array(full)
+        error = np.std([read_array(f) for f in subsamples], axis=0, ddof=1)/np.sqrt(len(subsamples))
+        integrals[os.path.relpath(prefix, run_dir)] = (value, error)
+    return integrals
+
+def compare_integrals(integrals, reference_file):
+    """Agreement of the integrals with the reference, as the rms and maximum of (new - reference)/(combined standard error) over all elements.
+    As the Monte Carlo runs are not seeded identically, this is expected to be of order unity for matching results"""
+    if not os.path.exists(reference_file): return None
+    reference = np.load(reference_file)
+    z = []
+    for name, (value, error) in integrals.items():
+        if name + ":value" not in reference or reference[name + ":value"].shape != value.shape: return {"pass": False, "reason": "missing or differently shaped %s" % name}
+        sigma = np.sqrt(error**2 + reference[name + ":error"]**2)
+        good = sigma > 0
+        z.append(((value - reference[name + ":value"])[good]/sigma[good]).ravel())
+    if len(z) == 0: return {"pass": False, "reason": "no integrals with subsamples"}
+    z = np.concatenate(z)
+    rms_z = float(np.sqrt(np.mean(z**2)))
+    return {"files": len(integrals), "elements": int(z.size), "rms_z": rms_z, "max_abs_z": float(np.max(np.abs(z))), "pass": bool(rms_z < 2.)}
+
+def parse_counts(stdout):
+    """Number of sampled and accepted tuples of particles of the largest order, from the run summary"""
+    sampled = re.findall(r"We sampled .*?([0-9.]+e[+-]\d+) (\w+)(?: of particles)?\.", stdout)
+    accepted = re.findall(r"contributions from .*?([0-9.]+e[+-]\d+) (\w+) of particles\.", stdout)
+    counts = {}
+    if sampled: counts["sampled"], counts["unit"] = float(sampled[-1][0]), sampled[-1][1]
+    if accepted: counts["accepted"] = float(accepted[-1][0])
+    return counts
+
+## Inputs: catalogs etc., then RR counts and jackknife weights from the pair_counts code and the periodic survey correction functions
+print("Generating inputs in %s" % indir)
+status, _, _, _ = run([sys.executable, os.path.join(repo_dir, "benchmark", "make_inputs.py"), indir, str(args.particles)])
+if status != 0: sys.exit("Input generation failed")
+status, _, pc_dir = build("pair_counts", "pair_counts", "-DOPENMP")
+if status != 0: sys.exit("pair_counts build failed, see %s" % os.path.join(outdir, "build", "pair_counts", "build.log"))
+for m in (n_mu, n_mu_mix):
+    status, _, _, _ = run([os.path.join(pc_dir, "pair_counts"), "jackknife", os.path.join(indir, "survey_randoms.txt"), os.path.join(indir, "radial_binning_cov.csv"), "1", str(m), str(args.nthread), "0", indir])
+    if status != 0: sys.exit("pair_counts failed")
+for script in ("compute_correction_function.py", "compute_3pcf_correction_function.py"):
+    status, _, _, _ = run([sys.executable, os.path.join(repo_dir, "python", script), os.path.join(indir, "periodic_randoms.txt"), os.path.join(indir, "radial_binning_cov.csv"), indir, "1"])
+    if status != 0: sys.exit("%s failed" % script)
+
+def mode_arguments(mode, catalog, run_dir):
+    inp = lambda name: os.path.join(indir, name)
+    common = ["-in", inp(catalog + "_randoms.txt"), "-binfile", inp("radial_binning_cov.csv"), "-cor", inp("xi_powerlaw.dat"), "-binfile_cf", inp("radial_binning_corr.csv"),
+              "-mbin_cf", "10", "-norm", str(args.particles), "-output", run_dir + "/", "-nthread", str(args.nthread), "-xicut", "200", "-cf_loops", "0"]
+    if catalog == "periodic": common += ["-nside", "15", "-perbox"]
+    else: common += ["-nside", "31"]
+    if mode == "triple": return common + ["-maxloops", "16", "-N2", "10", "-N3", "10"]
+    common += ["-maxloops", "16", "-loopspersample", "2", "-N2", "10", "-N3", "10", "-N4", "10"]
+    jk = lambda m: glob.glob(inp("jackknife_weights_n%d_m%d_j*_11.dat" % (n_bins, m)))[0]
+    rr = lambda m: glob.glob(inp("binned_pair_counts_n%d_m%d_j*_11.dat" % (n_bins, m)))[0]
+    if mode == "default": return common + ["-mbin", str(n_mu), "-RRbin", rr(n_mu)]
+    if mode == "jackknife": return common + ["-mbin", str(n_mu), "-RRbin", rr(n_mu), "-jackknife", jk(n_mu)]
+    if mode == "legendre": return common + ["-max_l", str(max_l), "-phi_file", inp("BinCorrectionFactor_n%d_periodic_11.txt" % n_bins)]
+    if mode == "legendre_mix": return common + ["-mbin", str(n_mu_mix), "-RRbin", rr(n_mu_mix), "-jackknife", jk(n_mu_mix), "-max_l", str(max_l), "-mu_bin_legendre_file", inp("mu_bin_legendre_factors_m%d_l%d.txt" % (n_mu_mix, max_l))]
+    if mode == "three_pcf": return common + ["-max_l", str(max_l), "-phi_file", inp("BinCorrectionFactor3PCF_n%d_periodic.txt" % n_bins), "-N5", "10", "-N6", "10"]
+
+## Build and run each mode
+commit = subprocess.run(["git", "-C", repo_dir, "describe", "--always", "--dirty"], stdout=subprocess.PIPE, universal_newlines=True).stdout.strip()
+results = {"commit": commit, "date": time.strftime("%Y-%m-%d %H:%M:%S"), "nthread": args.nthread, "particles": args.particles, "modes": {}}
+for mode in modes:
+    make_dir, flags, executable, catalog = MODES[mode]
+    result = results["modes"][mode] = {}
+    print("\nBuilding %s (%s)" % (mode, flags))
+    status, result["build_seconds"], exe_dir = build(mode, make_dir, flags)
+    if status != 0:
+        result["status"] = "build failed"
+        print("Build failed, see %s" % os.path.join(outdir, "build", mode, "build.log"))
+        continue
+    run_dir = os.path.join(outdir, "runs", mode)
+    shutil.rmtree(run_dir, ignore_errors=True)
+    os.makedirs(run_dir)
+    print("Running %s" % mode)
+    status, result["wall_seconds"], result["max_rss_mb"], stdout = run([os.path.join(exe_dir, executable)] + mode_arguments(mode, catalog, run_dir), cwd=run_dir, log=os.path.join(run_dir, "stderr.log"))
+    with open(os.path.join(run_dir, "stdout.log"), "w") as f: f.write(stdout)
+    if status != 0:
+        result["status"] = "run failed"
+        print("Run failed with status %d, see %s" % (status, run_dir))
+        continue
+    result["status"] = "ok"
+    result.update(parse_counts(stdout))
+    if "accepted" in result: result["accepted_per_second"] = result["accepted"]/result["wall_seconds"]
+    integrals = collect_integrals(run_dir)
+    reference_file = os.path.join(args.reference, "%s.npz" % mode)
+    if args.save_reference:
+        os.makedirs(args.reference, exist_ok=1)
+        arrays = {}
+        for name, (value, error) in integrals.items(): arrays[name + ":value"], arrays[name + ":error"] = value, error
+        np.savez_compressed(reference_file, **arrays)
+        print("Saved %d reference integrals to %s" % (len(integrals), reference_file))
+    else:
+        result["agreement"] = compare_integrals(integrals, reference_file)
+    print("Finished in %.2f s, peak memory %.1f MB" % (result["wall_seconds"], result["max_rss_mb"]))
+
+results_file = os.path.join(outdir, "results.json")
+with open(results_file, "w") as f: json.dump(results, f, indent=2)
+
+## Summary table, with the ratios to the previous results if given
+previous = json.load(open(args.compare))["modes"] if args.compare else {}
+print("\n%-13s %-12s %10s %10s %14s %10s  %s" % ("mode", "status", "wall [s]", "RSS [MB]", "accepted/s", "rms z", "vs previous" if previous else ""))
+for mode, result in results["modes"].items():
+    line = "%-13s %-12s" % (mode, result["status"])
+    if result["status"] == "ok":
+        agreement = result.get("agreement")
+        line += " %10.2f %10.1f %14.3e %10s" % (result["wall_seconds"], result["max_rss_mb"], result.get("accepted_per_second", np.nan), "%.2f%s" % (agreement["rms_z"], "" if agreement["pass"] else " FAIL") if agreement and "rms_z" in agreement else ("FAIL" if agreement else "-"))
+        old = previous.get(mode, {})
+        if old.get("status") == "ok": line += "  time x%.2f, speed x%.2f" % (result["wall_seconds"]/old["wall_seconds"], result.get("accepted_per_second", np.nan)/old.get("accepted_per_second", np.nan))
+    print(line)
+print("\nSaved results to %s" % results_file)
@@ -0,0 +1,418 @@
+// contract_basis.cpp -- evaluate the integrals computed by grid_covariance.cpp with the -xi_basis option for a new correlation function.
+// The main code saves C2, C3 and C4 decomposed over a top-hat basis of the correlation function, xi = sum_e a_e B_e, in the files
+// {c2,c3,c4}_basis{N_BASIS}_n{N}_m{M}_* of CovMatricesAll/ (and the jackknife integrals, EE1 and EE2 in CovMatricesJack/), with the basis described
+// in CovMatricesAll/xi_basis_n{N}_m{M}.txt. Given the coefficients a_e (the correlation function averaged in each basis bin), this contracts them into
+// the single-field c2, c3 and c4 (and EE1, EE2) files of a normal run (projected into Legendre multipoles if a mu bin Legendre factors file is given),
+// for the full integrals and all subsamples, and copies the outputs that do not depend on the correlation function (RR, bin and total counts),
+// so that the output directory can then be post-processed as usual.
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <glob.h>
+#include <libgen.h>
+#include <algorithm>
+
+// For multi-threading:
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+#define PAGE 4096     // To force some memory alignment.
+
+typedef unsigned long long int uint64;
+
+// Could swap between single and double precision here.
+typedef double Float;
+
+#include "../STimer.cc"
+#include "../modules/npy_utilities.h"
+#include "../modules/subsample_container.h"
+
+STimer TotalTime;
+
+// ========================== Input files ==============================
+
+void load_matrix(const char* basename, const char* index, Float* data, long long n_elements){
+    // Load an integral saved by the C++ code, preferring the binary .npy version (-npy option) or subsample container (-container option) over the text file
+    char fname[1100];
+    snprintf(fname, sizeof fname, "%s_%s.npy", basename, index);
+    if (load_npy(fname, data, n_elements)) return;
+    if (strcmp(index, "full")!=0 && SubsampleContainer::load(basename, atoi(index), data, n_elements*sizeof(Float))) return;
+    snprintf(fname, sizeof fname, "%s_%s.txt", basename, index);
+    int n_rows, n_cols;
+    Float *tmp = read_table(fname, 0, n_rows, n_cols);
+    if ((long long)n_rows*n_cols!=n_elements){
+        fprintf(stderr,"File %s holds %d values instead of the expected %lld\n", fname, n_rows*n_cols, n_elements);
+        abort();
+    }
+    memcpy(data, tmp, sizeof(Float)*n_elements);
+    free(tmp);
+}
+
+bool full_exists(const char* basename){
+    // Whether the full integral basename_full was saved (as .npy or text file)
+    char fname[1100];
+    struct stat st;
+    snprintf(fname, sizeof fname, "%s_full.npy", basename);
+    if (stat(fname, &st)==0) return true;
+    snprintf(fname, sizeof fname, "%s_full.txt", basename);
+    return stat(fname, &st)==0;
+}
+
+int full_rows(const char* basename){
+    // Number of rows of the full integral basename_full, which must exist
+    char fname[1100];
+    int n_dims, n_rows, n_cols;
+    long long shape[8];
+    snprintf(fname, sizeof fname, "%s_full.npy", basename);
+    FILE* fp = open_npy(fname, n_dims, shape);
+    if (fp!=NULL){
+        fclose(fp);
+        return (int)shape[0];
+    }
+    snprintf(fname, sizeof fname, "%s_full.txt", basename);
+    Float *tmp = read_table(fname, 0, n_rows, n_cols);
+    free(tmp);
+    return n_rows;
+}
+
+// ========================== Output files ==============================
+
+void copy_file(const char* src, const char* dest){
+    // Copy a file byte for byte
+    FILE *in = fopen(src, "rb"), *out = fopen(dest, "wb");
+    if (in==NULL || out==NULL){
+        fprintf(stderr,"Could not copy %s to %s\n", src, dest);
+        abort();
+    }
+    char buf[1<<16];
+    size_t n_read;
+    while ((n_read = fread(buf, 1, sizeof buf, in))>0) fwrite(buf, 1, n_read, out);
+    fclose(in);
+    if (fclose(out)!=0){
+        fprintf(stderr,"Failed to write output file %s\n", dest);
+        abort();
+    }
+}
+
+int copy_matching(const char* in_dir, const char* out_dir, const char* pattern){
+    // Copy the files of in_dir matching pattern (in any format, including subsample containers) into out_dir, returning their number
+    char path[1100], outfile[1100];
+    snprintf(path, sizeof path, "%s%s", in_dir, pattern);
+    glob_t g;
+    int n_copied = 0;
+    if (glob(path, 0, NULL, &g)==0){
+        for (size_t i = 0; i < g.gl_pathc; i++){
+            snprintf(path, sizeof path, "%s", g.gl_pathv[i]);
+            snprintf(outfile, sizeof outfile, "%s%s", out_dir, basename(path));
+            copy_file(g.gl_pathv[i], outfile);
+            n_copied++;
+        }
+    }
+    globfree(&g);
+    return n_copied;
+}
+
+bool same_directory(const char* dir1, const char* dir2){
+    // Whether two paths point to the same existing directory
+    struct stat st1, st2;
+    if (stat(dir1, &st1)!=0 || stat(dir2, &st2)!=0) return false;
+    return st1.st_dev==st2.st_dev && st1.st_ino==st2.st_ino;
+}
+
+// ========================== Contraction ==============================
+
+class BasisContraction{
+    // Contracts the decomposed c2 (n_basis x n_bins), c3 (n_basis x n_bins x n_bins) and c4 (n_basis x n_basis x n_bins x n_bins) integrals
+    // in s,mu bins with the basis coefficients, and optionally projects the results into Legendre multipoles
+public:
+    int n_basis, n_bins, n_r, n_mu;
+    Float *coeffs; // basis coefficients, the last one (for separations outside the basis) being 1
+    Float *c2b, *c3b, *c4b; // decomposed integrals of the current sample
+    Float *c2, *c3, *c4; // contracted integrals in s,mu bins (c2 diagonal)
+    int n_l = 0; // number of Legendre multipoles if projecting
+    Float *legendre_factors = NULL; // n_mu x n_l mu bin Legendre factors
+    Float *c2l, *c3l, *c4l; // projected integrals
+
+    BasisContraction(const Float* xi_coeffs, int n_coeffs, int _n_r, int _n_mu){
+        n_basis = n_coeffs+1;
+        n_r = _n_r;
+        n_mu = _n_mu;
+        n_bins = n_r*n_mu;
+        size_t nn = (size_t)n_bins*n_bins;
+        int ec=0;
+        ec+=posix_memalign((void **) &coeffs, PAGE, sizeof(Float)*n_basis);
+        ec+=posix_memalign((void **) &c2b, PAGE, sizeof(Float)*n_basis*n_bins);
+        ec+=posix_memalign((void **) &c3b, PAGE, sizeof(Float)*n_basis*nn);
+        ec+=posix_memalign((void **) &c4b, PAGE, sizeof(Float)*n_basis*n_basis*nn);
+        ec+=posix_memalign((void **) &c2, PAGE, sizeof(Float)*n_bins);
+        ec+=posix_memalign((void **) &c3, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &c4, PAGE, sizeof(Float)*nn);
+        assert(ec==0);
+        for (int e = 0; e < n_coeffs; e++) coeffs[e] = xi_coeffs[e];
+        coeffs[n_basis-1] = 1.;
+    }
+
+    ~BasisContraction(){
+        free(coeffs);
+        free(c2b);
+        free(c3b);
+        free(c4b);
+        free(c2);
+        free(c3);
+        free(c4);
+        if (legendre_factors!=NULL){
+            free(legendre_factors);
+            free(c2l);
+            free(c3l);
+            free(c4l);
+        }
+    }
+
+    void set_legendre(const Float* factors, int n_cols, int max_l){
+        // Use the first max_l/2+1 columns of the mu bin Legendre factors (one row per mu bin) to project into even multipoles
+        n_l = max_l/2+1;
+        assert(n_l<=n_cols);
+        size_t nl = (size_t)n_r*n_l;
+        int ec=0;
+        ec+=posix_memalign((void **) &legendre_factors, PAGE, sizeof(Float)*n_mu*n_l);
+        ec+=posix_memalign((void **) &c2l, PAGE, sizeof(Float)*nl*nl);
+        ec+=posix_memalign((void **) &c3l, PAGE, sizeof(Float)*nl*nl);
+        ec+=posix_memalign((void **) &c4l, PAGE, sizeof(Float)*nl*nl);
+        assert(ec==0);
+        for (int m = 0; m < n_mu; m++)
+            for (int p = 0; p < n_l; p++) legendre_factors[m*n_l+p] = factors[m*n_cols+p];
+    }
+
+    void contract(){
+        // c2 = sum_e a_e c2b[e], c3 = sum_e a_e c3b[e], c4 = sum_ef a_e a_f c4b[e,f]
+        size_t nn = (size_t)n_bins*n_bins;
+        for (int a = 0; a < n_bins; a++){
+            c2[a] = 0;
+            for (int e = 0; e < n_basis; e++) c2[a] += coeffs[e]*c2b[(size_t)e*n_bins+a];
+        }
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int a = 0; a < n_bins; a++){
+            Float *c3_row = c3+(size_t)a*n_bins, *c4_row = c4+(size_t)a*n_bins;
+            for (int b = 0; b < n_bins; b++) c3_row[b] = c4_row[b] = 0;
+            for (int e = 0; e < n_basis; e++){
+                const Float *c3b_row = c3b+e*nn+(size_t)a*n_bins;
+                for (int b = 0; b < n_bins; b++) c3_row[b] += coeffs[e]*c3b_row[b];
+                for (int f = 0; f < n_basis; f++){
+                    Float coeff = coeffs[e]*coeffs[f];
+                    const Float *c4b_row = c4b+((size_t)e*n_basis+f)*nn+(size_t)a*n_bins;
+                    for (int b = 0; b < n_bins; b++) c4_row[b] += coeff*c4b_row[b];
+                }
+            }
+        }
+        if (n_l>0) project();
+    }
+
+    void contract_ee(const Float* eeb, Float* ee, size_t n_elements){
+        // EE = sum_e a_e EEb[e] for EE1 or EE2, with n_elements (jackknife regions x bins) per basis element
+        for (size_t i = 0; i < n_elements; i++){
+            ee[i] = 0;
+            for (int e = 0; e < n_basis; e++) ee[i] += coeffs[e]*eeb[e*n_elements+i];
+        }
+    }
+
+private:
+    void project(){
+        // Project the s,mu-binned integrals into multipoles as in LEGENDRE_MIX mode: out[(r1,p),(r2,q)] = sum_{mu1,mu2} c[(r1,mu1),(r2,mu2)] F_p(mu1) F_q(mu2)
+        size_t nl = (size_t)n_r*n_l;
+        for (size_t i = 0; i < nl*nl; i++) c2l[i] = c3l[i] = c4l[i] = 0;
+        for (int r1 = 0; r1 < n_r; r1++){
+            for (int m1 = 0; m1 < n_mu; m1++){
+                int a = r1*n_mu+m1;
+                const Float *f1 = legendre_factors+m1*n_l;
+                for (int p = 0; p < n_l; p++){
+                    for (int q = 0; q < n_l; q++) c2l[(r1*n_l+p)*nl+r1*n_l+q] += c2[a]*f1[p]*f1[q]; // c2 is diagonal in s,mu bins
+                    for (int r2 = 0; r2 < n_r; r2++){
+                        for (int m2 = 0; m2 < n_mu; m2++){
+                            int b = r2*n_mu+m2;
+                            const Float *f2 = legendre_factors+m2*n_l;
+                            for (int q = 0; q < n_l; q++){
+                                c3l[(r1*n_l+p)*nl+r2*n_l+q] += c3[(size_t)a*n_bins+b]*f1[p]*f2[q];
+                                c4l[(r1*n_l+p)*nl+r2*n_l+q] += c4[(size_t)a*n_bins+b]*f1[p]*f2[q];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+void usage(){
+    fprintf(stderr,"\nUsage:\n");
+    fprintf(stderr,"    ./contract_basis {COVARIANCE_DIR} {N_R_BINS} {N_MU_BINS} {N_SUBSAMPLES} {XI_COEFFICIENTS_FILE} {OUTPUT_DIR} [{MU_BIN_LEGENDRE_FILE} {MAX_L}]\n");
+    fprintf(stderr,"{XI_COEFFICIENTS_FILE} holds the new correlation function in each bin of the basis, one row per radial bin and one column per mu bin,\n");
+    fprintf(stderr,"matching the basis described in {COVARIANCE_DIR}/CovMatricesAll/xi_basis_n{N_R_BINS}_m{N_MU_BINS}.txt.\n");
+    fprintf(stderr,"With a mu bin Legendre factors file, the integrals are projected into the Legendre multipoles up to {MAX_L}, as in LEGENDRE_MIX mode.\n");
+    fprintf(stderr,"Only the single-field integrals are contracted. The number of threads is set by the OMP_NUM_THREADS environment variable.\n\n");
+    exit(1);
+}
+
+// ================================ main() =============================
+
+int main(int argc, char *argv[]) {
+    if (argc!=7 && argc!=9) usage();
+    const char *file_root = argv[1], *coeff_file = argv[5], *outdir = argv[6];
+    int n = atoi(argv[2]), n_mu = atoi(argv[3]), n_samples = atoi(argv[4]), max_l = 0;
+    bool legendre = argc==9;
+    if (legendre) max_l = atoi(argv[8]);
+    if (n<=0 || n_mu<=0 || n_samples<0 || max_l<0 || max_l%2!=0) usage();
+
+    TotalTime.Start();
+#ifdef OPENMP
+    printf("# Running on %d threads\n", omp_get_max_threads());
+#endif
+
+    // Read the basis the integrals were decomposed over, saved by the main code with the -xi_basis option as one row of r_low r_high n_mu_bins per radial bin
+    char basis_file[1000];
+    struct stat st;
+    snprintf(basis_file, sizeof basis_file, "%s/CovMatricesAll/xi_basis_n%d_m%d.txt", file_root, n, n_mu);
+    if (stat(basis_file, &st)!=0){
+        fprintf(stderr,"Basis description file %s not found; the integrals must be computed with the -xi_basis option and %d radial and %d mu bins\n", basis_file, n, n_mu);
+        abort();
+    }
+    int basis_nbin, basis_cols;
+    Float *basis_table = read_table(basis_file, 0, basis_nbin, basis_cols);
+    if (basis_nbin==0 || basis_cols!=3){
+        fprintf(stderr,"Basis description file %s must hold one row of r_low r_high n_mu_bins per radial bin of the basis\n", basis_file);
+        abort();
+    }
+    int basis_mbin = (int)basis_table[2];
+    free(basis_table);
+
+    // Read the basis coefficients, which must have the shape of the basis
+    int n_rows, n_cols;
+    Float *xi_coeffs = read_table(coeff_file, 0, n_rows, n_cols);
+    if (n_rows*n_cols==0){
+        fprintf(stderr,"Correlation function coefficient file %s is empty\n", coeff_file);
+        abort();
+    }
+    if (n_rows!=basis_nbin || n_cols!=basis_mbin){
+        fprintf(stderr,"Correlation function coefficient file %s has %d rows and %d columns, but the integrals were decomposed over a basis of %d radial and %d mu bins (see %s), so it must have %d rows and %d columns\n", coeff_file, n_rows, n_cols, basis_nbin, basis_mbin, basis_file, basis_nbin, basis_mbin);
+        abort();
+    }
+    BasisContraction basis(xi_coeffs, n_rows*n_cols, n, n_mu), jack(xi_coeffs, n_rows*n_cols, n, n_mu);
+    printf("Read the correlation function in %d radial and %d mu bins of the basis from %s\n", n_rows, n_cols, coeff_file);
+    if (legendre){
+        int n_mu_rows, n_l_cols;
+        Float *factors = read_table(argv[7], 0, n_mu_rows, n_l_cols);
+        if (n_mu_rows!=n_mu || n_l_cols<max_l/2+1){
+            fprintf(stderr,"Mu bin Legendre factors file %s has %d rows and %d columns, but needs %d rows and at least %d columns\n", argv[7], n_mu_rows, n_l_cols, n_mu, max_l/2+1);
+            abort();
+        }
+        basis.set_legendre(factors, n_l_cols, max_l);
+        jack.set_legendre(factors, n_l_cols, max_l);
+        free(factors);
+    }
+
+    // Input and output names
+    char in_root[900], out_root[900], in_jack[900], out_jack[900], bin_string[20];
+    int nb = basis.n_basis;
+    snprintf(in_root, sizeof in_root, "%s/CovMatricesAll/", file_root);
+    snprintf(in_jack, sizeof in_jack, "%s/CovMatricesJack/", file_root);
+    if (legendre) snprintf(bin_string, sizeof bin_string, "l%d", max_l);
+    else snprintf(bin_string, sizeof bin_string, "m%d", n_mu);
+    char c2in[1000], c3in[1000], c4in[1000], c2jin[1000], c3jin[1000], c4jin[1000], ee1in[1000], ee2in[1000];
+    snprintf(c2in, sizeof c2in, "%sc2_basis%d_n%d_m%d_11", in_root, nb, n, n_mu);
+    snprintf(c3in, sizeof c3in, "%sc3_basis%d_n%d_m%d_1,11", in_root, nb, n, n_mu);
+    snprintf(c4in, sizeof c4in, "%sc4_basis%d_n%d_m%d_11,11", in_root, nb, n, n_mu);
+    snprintf(c2jin, sizeof c2jin, "%sc2_basis%d_n%d_m%d_11", in_jack, nb, n, n_mu);
+    snprintf(c3jin, sizeof c3jin, "%sc3_basis%d_n%d_m%d_1,11", in_jack, nb, n, n_mu);
+    snprintf(c4jin, sizeof c4jin, "%sc4_basis%d_n%d_m%d_11,11", in_jack, nb, n, n_mu);
+    snprintf(ee1in, sizeof ee1in, "%sEE1_basis%d_n%d_m%d_11", in_jack, nb, n, n_mu);
+    snprintf(ee2in, sizeof ee2in, "%sEE2_basis%d_n%d_m%d_11", in_jack, nb, n, n_mu);
+    if (!full_exists(c4in)){
+        fprintf(stderr,"Decomposed integrals %s_full not found\n", c4in);
+        abort();
+    }
+    char fname[1200];
+    snprintf(fname, sizeof fname, "%s_full.npy", c4in);
+    bool npy = stat(fname, &st)==0; // outputs in the format of the inputs
+    bool jackknife = full_exists(c4jin); // jackknife integrals are decomposed if the main code was run with jackknife weights
+    bool ee = jackknife && !legendre && full_exists(ee1in); // EE1 and EE2 are only used in s,mu bins
+    snprintf(out_root, sizeof out_root, "%s/CovMatricesAll/", outdir);
+    snprintf(out_jack, sizeof out_jack, "%s/CovMatricesJack/", outdir);
+    mkdir(outdir, 0777);
+    mkdir(out_root, 0777);
+    if (jackknife) mkdir(out_jack, 0777);
+
+    size_t nn = (size_t)basis.n_bins*basis.n_bins, n_ee = 0;
+    Float *eeb = NULL, *ee_out = NULL;
+    if (ee){
+        n_ee = (size_t)(full_rows(ee1in)/nb)*basis.n_bins; // jackknife regions x bins for each basis element
+        int ec=0;
+        ec+=posix_memalign((void **) &eeb, PAGE, sizeof(Float)*nb*n_ee);
+        ec+=posix_memalign((void **) &ee_out, PAGE, sizeof(Float)*n_ee);
+        assert(ec==0);
+    }
+    int nl = n*basis.n_l;
+    for (int i = -1; i < n_samples; i++){
+        char index[16], c2out[1000], c3out[1000], c4out[1000];
+        if (i<0) snprintf(index, sizeof index, "full");
+        else snprintf(index, sizeof index, "%d", i);
+        for (int j = 0; j < 1+jackknife; j++){
+            BasisContraction &b = j ? jack : basis;
+            const char *root = j ? out_jack : out_root;
+            load_matrix(j ? c2jin : c2in, index, b.c2b, (long long)nb*b.n_bins);
+            load_matrix(j ? c3jin : c3in, index, b.c3b, (long long)nb*nn);
+            load_matrix(j ? c4jin : c4in, index, b.c4b, (long long)nb*nb*nn);
+            b.contract();
+            snprintf(c2out, sizeof c2out, "%sc2_n%d_%s_11_%s", root, n, bin_string, index);
+            snprintf(c3out, sizeof c3out, "%sc3_n%d_%s_1,11_%s", root, n, bin_string, index);
+            snprintf(c4out, sizeof c4out, "%sc4_n%d_%s_11,11_%s", root, n, bin_string, index);
+            if (legendre){
+                save_array(c2out, b.c2l, nl, nl, npy);
+                save_array(c3out, b.c3l, nl, nl, npy);
+                save_array(c4out, b.c4l, nl, nl, npy);
+            }
+            else{
+                save_array(c2out, b.c2, b.n_bins, 0, npy); // c2 is diagonal, saved as a vector
+                save_array(c3out, b.c3, b.n_bins, b.n_bins, npy);
+                save_array(c4out, b.c4, b.n_bins, b.n_bins, npy);
+            }
+        }
+        if (ee){
+            for (int k = 1; k <= 2; k++){
+                load_matrix(k==1 ? ee1in : ee2in, index, eeb, (long long)(nb*n_ee));
+                jack.contract_ee(eeb, ee_out, n_ee);
+                snprintf(c2out, sizeof c2out, "%sEE%d_n%d_m%d_11_%s", out_jack, k, n, n_mu, index);
+                save_array(c2out, ee_out, (int)(n_ee/basis.n_bins), basis.n_bins, npy); // one row per jackknife region
+            }
+        }
+    }
+    free(eeb);
+    free(ee_out);
+
+    // Copy the outputs that do not depend on the correlation function
+    int n_copied = 0;
+    if (!same_directory(file_root, outdir)){
+        const char *all_patterns[] = {"RR_n%d_*_11_*", "binct_c2_n%d_*_11_*", "binct_c3_n%d_*_1,11_*", "binct_c4_n%d_*_11,11_*", "total_counts_n%d_*_11,11.txt", "xi_basis_n%d_*.txt"};
+        const char *jack_patterns[] = {"RR1_n%d_*_11_*", "RR2_n%d_*_11_*"};
+        char pattern[100];
+        for (size_t k = 0; k < sizeof all_patterns/sizeof all_patterns[0]; k++){
+            snprintf(pattern, sizeof pattern, all_patterns[k], n);
+            n_copied += copy_matching(in_root, out_root, pattern);
+        }
+        for (size_t k = 0; jackknife && k < sizeof jack_patterns/sizeof jack_patterns[0]; k++){
+            snprintf(pattern, sizeof pattern, jack_patterns[k], n);
+            n_copied += copy_matching(in_jack, out_jack, pattern);
+        }
+    }
+
+    TotalTime.Stop();
+    printf("\nContracted the full integrals and %d subsamples over %d basis elements into %s%s%s, and copied %d other files, in %.1f s\n", n_samples, nb, outdir,
+        jackknife ? " (with the jackknife integrals" : "", jackknife ? (ee ? ", EE1 and EE2)" : ")") : "", n_copied, TotalTime.Elapsed());
+    return 0;
+}
@@ -0,0 +1,162 @@
+// convert_to_xyz.cpp -- native version of python/convert_to_xyz.py, converting (RA,Dec,z,w) catalogs to comoving (x,y,z,w) coordinates in Mpc/h.
+// The comoving distance is tabulated once, and the particles are converted in parallel.
+// Input and output files may be space-separated text or binary NumPy .npy files (chosen by the .npy extension); the main code reads either.
+
+#include <sys/time.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+// For multi-threading:
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+#define PAGE 4096     // To force some memory alignment.
+
+typedef unsigned long long int uint64;
+
+// Could swap between single and double precision here.
+typedef double Float;
+
+#include "../STimer.cc"
+#include "../modules/npy_utilities.h"
+#include "../modules/comoving_distance.h"
+
+STimer TotalTime;
+
+Float* read_catalog(const char* fname, long long &n){
+    // Read the (RA,Dec,z,w) columns of a text or .npy catalog into a row-major array with 4 columns
+    Float *data;
+    if (is_npy(fname)){
+        int n_dims;
+        long long shape[8];
+        FILE *fp = open_npy(fname, n_dims, shape);
+        if (fp==NULL){
+            fprintf(stderr,"File %s not found\n", fname);
+            abort();
+        }
+        if (n_dims!=2 || shape[1]<4){
+            fprintf(stderr,"File %s must hold a 2D array with at least 4 columns (RA,Dec,z,w)\n", fname);
+            abort();
+        }
+        n = shape[0];
+        int n_cols = shape[1];
+        data = (Float *)malloc(sizeof(Float)*4*n);
+        Float row[n_cols];
+        for (long long i = 0; i < n; i++){
+            if (fread(row, sizeof(Float), n_cols, fp)!=(size_t)n_cols){
+                fprintf(stderr,"File %s is truncated\n", fname);
+                abort();
+            }
+            memcpy(data+4*i, row, sizeof(Float)*4);
+        }
+        fclose(fp);
+    }
+    else{
+        FILE *fp = fopen(fname, "r");
+        if (fp==NULL){
+            fprintf(stderr,"File %s not found\n", fname);
+            abort();
+        }
+        char line[1000];
+        n = 0;
+        while (fgets(line,1000,fp)!=NULL){
+            if (line[0]=='#') continue;
+            if (line[0]=='\n') continue;
+            n++;
+        }
+        rewind(fp);
+        data = (Float *)malloc(sizeof(Float)*4*n);
+        long long i = 0;
+        while (fgets(line,1000,fp)!=NULL&&i<n){
+            if (line[0]=='#') continue;
+            if (line[0]=='\n') continue;
+            Float *row = data+4*i;
+            if (sscanf(line, "%lf %lf %lf %lf", row, row+1, row+2, row+3)!=4){
+                fprintf(stderr,"Particle %lld has bad format; RA,Dec,z,w are required\n", i);
+                abort();
+            }
+            i++;
+        }
+        fclose(fp);
+    }
+    printf("# Found %lld particles from %s\n", n, fname);
+    return data;
+}
+
+void write_catalog(const char* fname, Float *data, long long n){
+    // Write the (x,y,z,w) catalog as text, in the format of python/convert_to_xyz.py, or as a (n,4) .npy array
+    bool npy = is_npy(fname);
+    FILE *fp = fopen(fname, npy ? "wb" : "w");
+    if (fp==NULL){
+        fprintf(stderr,"Output file %s could not be opened\n", fname);
+        abort();
+    }
+    if (npy){
+        assert(n<=0x7fffffff);
+        write_npy_header(fp, "<f8", n, 4);
+        fwrite(data, sizeof(Float), 4*n, fp);
+    }
+    else for (long long i = 0; i < n; i++) fprintf(fp, "%.8f %.8f %.8f %.8f\n", data[4*i], data[4*i+1], data[4*i+2], data[4*i+3]);
+    if (fclose(fp)!=0){
+        fprintf(stderr,"Failed to write output file %s\n", fname);
+        abort();
+    }
+}
+
+void usage(){
+    fprintf(stderr,"\nUsage:\n");
+    fprintf(stderr,"    ./convert_to_xyz {INFILE} {OUTFILE} [{OMEGA_M} {OMEGA_K} {W_DARK_ENERGY}]\n");
+    fprintf(stderr,"Files ending in .npy are read or written as binary NumPy arrays, else as space-separated text. The number of threads is set by OMP_NUM_THREADS.\n\n");
+    exit(1);
+}
+
+// ================================ main() =============================
+
+int main(int argc, char *argv[]) {
+    Float omega_m, omega_k, w_dark_energy;
+    if (argc==6){
+        omega_m = atof(argv[3]);
+        omega_k = atof(argv[4]);
+        w_dark_energy = atof(argv[5]);
+    }
+    else if (argc==3){ // use defaults (from the BOSS DR12 2016 clustering paper assuming LCDM)
+        omega_m = 0.31;
+        omega_k = 0.;
+        w_dark_energy = -1.;
+    }
+    else usage();
+    const char *infile = argv[1], *outfile = argv[2];
+    printf("\nUsing cosmological parameters as Omega_m = %.2f, Omega_k = %.2f, w = %.2f\n", omega_m, omega_k, w_dark_energy);
+#ifdef OPENMP
+    printf("# Running on %d threads\n", omp_get_max_threads());
+#endif
+
+    TotalTime.Start();
+    printf("\nUsing input file %s in Ra,Dec,z coordinates\n", infile);
+    long long n;
+    Float *data = read_catalog(infile, n);
+    Float zmax = 0.;
+    for (long long i = 0; i < n; i++){
+        if (data[4*i+2]<0){
+            fprintf(stderr,"Particle %lld has negative redshift %.4f\n", i, data[4*i+2]);
+            abort();
+        }
+        zmax = fmax(zmax, data[4*i+2]);
+    }
+
+    printf("Converting z to comoving distances:\n");
+    ComovingDistance dist(omega_m, omega_k, w_dark_energy, zmax, 1e-3);
+    dist.convert(data, n, 4);
+
+    printf("Writing to file %s:\n", outfile);
+    write_catalog(outfile, data, n);
+    TotalTime.Stop();
+    printf("Output positions (of length %lld) written succesfully after %.1f s!\n", n, TotalTime.Elapsed());
+    free(data);
+    return 0;
+}
@@ -18,7 +18,6 @@
 #include "threevector.hh"
 #include <gsl/gsl_rng.h>
 #include "./ransampl/ransampl.h"
-#include "STimer.cc"
 #include "./cubature/cubature.h"
 #include <limits>
 #include <sys/stat.h>
@@ -29,6 +28,36 @@
 #include <sched.h>
 #endif
 
+#ifdef COV_MODE
+// Compiled as one of the modes of the ./cov_all executable (see the Makefile and mode_dispatch.cpp), with COV_MODE naming the mode.
+// Everything below is put in a namespace of this name, so that the differently compiled modes can be linked together, and main() becomes run().
+// The system headers of the modules must therefore be included here, outside the namespace.
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <gsl/gsl_sf_dawson.h>
+#if (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
+namespace COV_MODE {
+#endif
+
+#include "STimer.cc"
+
 // In order to not print the output matrices
 
 #define PAGE 4096     // To force some memory alignment.
@@ -81,9 +110,15 @@ STimer TotalTime;
 // ================================ main() =============================
 
 
+#ifdef COV_MODE
+int run(int argc, char *argv[]) {
+#else
 int main(int argc, char *argv[]) {
+#endif
 
 	Parameters par=Parameters(argc,argv);
+    pin_threads(par.pin_threads, par.nthread); // before any allocation of the threads, so that their memory stays on their NUMA node
+    if (par.huge_pages) enable_huge_pages(); // before the particles are read
 
     int max_no_functions=1; // required number of xi / random_draws / jackknife_weight functions
     int no_fields=1; // number of different fields used
@@ -95,29 +130,24 @@ int main(int argc, char *argv[]) {
     // Define all possible survey correction functions
     SurveyCorrection all_survey[max_no_functions]; // create empty functions
 #ifdef THREE_PCF
-    SurveyCorrection tmp_sc(&par);
-    all_survey[0].copy(&tmp_sc); // save into global memory
+    all_survey[0] = SurveyCorrection(&par); // moved into global memory
 #else
-    SurveyCorrection tmp_sc(&par,1,1);
-    all_survey[0].copy(&tmp_sc); // save into global memory
+    all_survey[0] = SurveyCorrection(&par,1,1); // moved into global memory
 
     if(par.multi_tracers==true){
-        SurveyCorrection tmp_sc12(&par,1,2), tmp_sc2(&par,2,2);
-        all_survey[1].copy(&tmp_sc2);
-        all_survey[2].copy(&tmp_sc12);
+        all_survey[1] = SurveyCorrection(&par,2,2);
+        all_survey[2] = SurveyCorrection(&par,1,2);
     }
 #endif
 #else
     // Read in jackknife weights and RR pair counts (if JACKKNIFE is not defined just includes RR counts)
     JK_weights all_weights[max_no_functions]; // create empty functions
 
-    JK_weights tmp(&par,1,1);
-    all_weights[0].copy(&tmp); // save into global memory
+    all_weights[0] = JK_weights(&par,1,1); // moved into global memory
 
     if(par.multi_tracers==true){
-        JK_weights tmp12(&par,1,2), tmp2(&par,2,2);
-        all_weights[1].copy(&tmp2);
-        all_weights[2].copy(&tmp12);
+        all_weights[1] = JK_weights(&par,2,2);
+        all_weights[2] = JK_weights(&par,1,2);
     }
 #endif
 
@@ -132,7 +162,8 @@ int main(int argc, char *argv[]) {
             if (index == 0) filename = par.fname;
             else filename = par.fname2;
 #ifdef JACKKNIFE
-            all_particles[index] = read_particles(par.rescale, &all_np[index], filename, par.rstart, par.nmax, &all_weights[index]);
+            JackknifeAssignment jk_assign(par.jk_assign, par.jk_resolution);
+            all_particles[index] = read_particles(par.rescale, &all_np[index], filename, par.rstart, par.nmax, &all_weights[index], &jk_assign);
 #else
             all_particles[index] = read_particles(par.rescale, &all_np[index], filename, par.rstart, par.nmax);
 #endif
@@ -154,9 +185,10 @@ int main(int argc, char *argv[]) {
     int nside_attempts = 3; // number of attempts to meet the constraints by changing nside
     bool nside_global_failure = true; // assume failure until success
 
+    Float3 shift; // default value is zero
+
     for (int no_attempt = 0; no_attempt <= nside_attempts; no_attempt++) {
         // Compute bounding box using all particles. Do it inside the attempt loop because nside could change.
-        Float3 shift; // default value is zero
         if (!par.make_random) {
             par.perbox = compute_bounding_box(all_particles, all_np, no_fields, par.rect_boxsize, par.cellsize, par.rmax, shift, par.nside);
 #ifdef PERIODIC
@@ -172,17 +204,12 @@ int main(int argc, char *argv[]) {
             par.perbox = true;
         }
 
-        // Create grid(s) and see if the particle density is acceptable
+        // See if the particle density of the grid(s) would be acceptable; only the filled cells are counted, so no grid is built (and no particles are copied) for rejected attempts
         bool nside_local_success = true; // assume this attempt succeeded be default, can be unset
-        int index;
-        for (index = 0; index < no_fields; index++) {
-            // Now ready to compute!
-            // Sort particles into grid(s)
-            Float nofznorm = par.nofznorm;
-            if (index == 1) nofznorm = par.nofznorm2;
-            Grid tmp_grid(all_particles[index], all_np[index], par.rect_boxsize, par.cellsize, par.nside, shift, nofznorm);
-
-            Float grid_density = (Float)tmp_grid.np/tmp_grid.nf;
+        for (int index = 0; index < no_fields; index++) {
+            int nf = Grid::count_filled_cells(all_particles[index], all_np[index], par.rect_boxsize, par.cellsize, par.nside, shift);
+
+            Float grid_density = (Float)all_np[index]/nf;
             printf("\n RANDOM CATALOG %d DIAGNOSTICS:\n", index+1);
             printf("Average number of particles per grid cell = %6.2f\n", grid_density);
             if (grid_density > max_density) {
@@ -201,31 +228,36 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "# WARNING: grid appears inefficiently fine (average density less than %.0f particles per cell). Setting nside=%d.\n", min_density, par.nside);
                 break; // terminate the inner, tracer loop
             }
-            printf("Average number of particles per max_radius ball = %6.2f\n",
-                    tmp_grid.np*4.0*M_PI/3.0*pow(par.rmax,3.0)/(par.rect_boxsize.x*par.rect_boxsize.y*par.rect_boxsize.z));
-
-            printf("# Done gridding the particles\n");
-            printf("# %d particles in use, %d with positive weight\n", tmp_grid.np, tmp_grid.np_pos);
-            printf("# Weights: Positive particles sum to %f\n", tmp_grid.sumw_pos);
-            printf("#          Negative particles sum to %f\n", tmp_grid.sumw_neg);
-
-            // Now save grid to global memory:
-            all_grid[index].copy(&tmp_grid);
-
-            fflush(NULL);
         }
         if (nside_local_success) {
             nside_global_failure = false; // unset global failure
             break; // terminate attempt loop
         }
-        // finally, if this attempt has failed, destroy the grids that have been copied - the memory allocated inside them is not freed otherwise
-        for (int i = 0; i < index; i++) all_grid[i].~Grid(); // should only be relevant for multi-tracer, when the first tracer succeeds but the second fails
     }
     if (nside_global_failure) { // report and terminate
         fprintf(stderr, "# ERROR: could not meet mean grid density constraints after %d additional attempts.\n", nside_attempts);
         exit(1);
     }
-    for (int index = 0; index < no_fields; index++) free(all_particles[index]); // Particles are now only stored in grid; can't free earlier because of potentially repeated attempts, especially multi-tracer
+
+    for (int index = 0; index < no_fields; index++) {
+        // Now ready to compute!
+        // Sort particles into grid(s), reordering them in place so that they are never held twice
+        Float nofznorm = par.nofznorm;
+        if (index == 1) nofznorm = par.nofznorm2;
+        all_grid[index] = Grid(all_particles[index], all_np[index], par.rect_boxsize, par.cellsize, par.nside, shift, nofznorm, true);
+        all_particles[index] = NULL; // Particles are now only stored in (and owned by) the grid
+        all_grid[index].compress(par.compact_bits);
+
+        printf("Average number of particles per max_radius ball = %6.2f\n",
+                all_grid[index].np*4.0*M_PI/3.0*pow(par.rmax,3.0)/(par.rect_boxsize.x*par.rect_boxsize.y*par.rect_boxsize.z));
+
+        printf("# Done gridding the particles\n");
+        printf("# %d particles in use, %d with positive weight\n", all_grid[index].np, all_grid[index].np_pos);
+        printf("# Weights: Positive particles sum to %f\n", all_grid[index].sumw_pos);
+        printf("#          Negative particles sum to %f\n", all_grid[index].sumw_neg);
+
+        fflush(NULL);
+    }
 
     // Print the resulting grid size to be sure the stderr messages are not missed
     printf("Final grid = %d\n", par.nside);
@@ -255,28 +287,38 @@ int main(int argc, char *argv[]) {
     CorrelationFunction all_cf[max_no_functions];
     RandomDraws all_rd[max_no_functions];
 
-    CorrelationFunction tmp_cf(par.corname, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
-    all_cf[0].copy_function(&tmp_cf);
-    RandomDraws tmp_rd(&tmp_cf,&par,NULL,0);
-    all_rd[0].copy(&tmp_rd);
+    all_cf[0] = CorrelationFunction(par.corname, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
+    all_rd[0] = RandomDraws(&all_cf[0],&par,NULL,0);
 
     if(par.multi_tracers==true){
-         CorrelationFunction tmp_cf12(par.corname12, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin), tmp_cf2(par.corname2, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
-        all_cf[1].copy_function(&tmp_cf2);
-        all_cf[2].copy_function(&tmp_cf12);
-        RandomDraws rd2(&tmp_cf2,&par,NULL,0), rd12(&tmp_cf12,&par,NULL,0);
-        all_rd[1].copy(&rd2);
-        all_rd[2].copy(&rd12);
+        all_cf[1] = CorrelationFunction(par.corname2, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
+        all_cf[2] = CorrelationFunction(par.corname12, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
+        all_rd[1] = RandomDraws(&all_cf[1],&par,NULL,0);
+        all_rd[2] = RandomDraws(&all_cf[2],&par,NULL,0);
     }
 
     // Rescale correlation functions
     rescale_correlation rescale(&par);
     rescale.refine_wrapper(&par, all_grid, all_cf, all_rd, max_no_functions);
 
+    if (par.numa_interleave) {
+        // Spread the shared read-only data over the NUMA nodes, since it was all first touched by the master thread
+        for (int index = 0; index < no_fields; index++) all_grid[index].interleave();
+        for (int index = 0; index < max_no_functions; index++) all_rd[index].interleave();
+#if (!defined LEGENDRE && !defined THREE_PCF && !defined POWER)
+        for (int index = 0; index < max_no_functions; index++) all_weights[index].interleave();
+#endif
+    }
+    for (int index = 0; index < no_fields; index++) {
+        report_huge_pages(index==0 ? "Grid 1 particles" : "Grid 2 particles", all_grid[index].particle_array(), all_grid[index].particle_bytes());
+        report_huge_pages(index==0 ? "Grid 1 cells" : "Grid 2 cells", all_grid[index].c, sizeof(Cell)*all_grid[index].ncells);
+    }
+    all_rd[0].huge_page_report();
+
 #ifdef THREE_PCF
     // Compute threePCF integrals
-    compute_integral(&all_grid[0],&par,&all_cf[0],&all_rd[0],&all_survey[0],1); // final digit is iteration number
-    compute_integral(&all_grid[0],&par,&all_cf[0],&all_rd[0],&all_survey[0],2);
+    compute_integral(&all_grid[0],&par,&all_cf[0],&all_rd[0],&all_survey[0],0); // final digit is iteration number, 0 for the xi_ij and 1 for the xi_jk terms as in integrals_3pcf.h
+    compute_integral(&all_grid[0],&par,&all_cf[0],&all_rd[0],&all_survey[0],1);
 #elif (defined LEGENDRE || defined POWER)
     // Compute integrals
     compute_integral(all_grid,&par,all_cf,all_rd,all_survey,1,1,1,1,1); // final digit is iteration number
@@ -310,3 +352,7 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
+
+#ifdef COV_MODE
+} // namespace COV_MODE
+#endif
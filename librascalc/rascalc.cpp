@@ -0,0 +1,248 @@
+// rascalc.cpp -- librascalc, the main code of grid_covariance.cpp for a single field as a library taking its inputs from arrays instead of files
+// and copying the integrals into the caller's arrays (see rascalc.h). The modules are the same as in the main code, so the results agree with ./cov compiled with the same flags.
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <complex>
+#include <algorithm>
+#include <random>
+#include <gsl/gsl_sf.h>
+#include <gsl/gsl_interp.h>
+#include <gsl/gsl_spline.h>
+#include <gsl/gsl_interp2d.h>
+#include <gsl/gsl_spline2d.h>
+#include "../threevector.hh"
+#include <gsl/gsl_rng.h>
+#include "../ransampl/ransampl.h"
+#include "../STimer.cc"
+#include "../cubature/cubature.h"
+#include <limits>
+#include <sys/stat.h>
+
+// For multi-threading:
+#ifdef OPENMP
+#include <omp.h>
+#include <sched.h>
+#endif
+
+#define PAGE 4096     // To force some memory alignment.
+
+typedef unsigned long long int uint64;
+
+// Could swap between single and double precision here.
+typedef double Float;
+typedef double3 Float3;
+
+#if (defined LEGENDRE || defined POWER || defined THREE_PCF)
+#error "The library only supports the s,mu-binned 2PCF modes (default, JACKKNIFE and LEGENDRE_MIX)"
+#endif
+
+// Define module files
+    #include "../modules/parameters.h"
+    #include "../modules/cell_utilities.h"
+    #include "../modules/grid.h"
+    #include "../modules/correlation_function.h"
+    #include "../modules/jackknife_weights.h"
+    #include "../modules/integrals.h"
+#ifdef LEGENDRE_MIX
+    #include "../modules/legendre_mix_utilities.h"
+#endif
+    #include "../modules/random_draws.h"
+    #include "../modules/driver.h"
+    #include "../modules/compute_integral.h"
+    #include "../modules/rescale_correlation.h"
+
+#include "rascalc.h"
+
+// Get the correlation function into the integrator
+CorrelationFunction * RandomDraws::corr;
+
+static int check_inputs(const rascalc_inputs *in){
+    // Check the inputs which would otherwise lead to a crash, returning nonzero if they are invalid
+    const char *error = NULL;
+    if (in->positions==NULL || in->weights==NULL || in->n_particles<=0) error = "no particles given";
+    else if (in->n_galaxies<=0) error = "the number of galaxies must be positive";
+    else if (in->r_low==NULL || in->r_high==NULL || in->n_r_bins<=0 || in->n_mu_bins<=0) error = "no output binning given";
+    else if (in->r_low_cf==NULL || in->r_high_cf==NULL || in->n_r_bins_cf<=0 || in->n_mu_bins_cf<=0) error = "no correlation function binning given";
+    else if (in->xi==NULL || in->xi_r==NULL || in->xi_mu==NULL) error = "no correlation function given";
+    else if (in->RR==NULL) error = "no RR pair counts given";
+    else if (in->nside<=0 || in->nside%2==0) error = "nside must be odd and positive"; // the probability integrator needs an odd grid size
+    else if (in->nthread<=0) error = "the number of threads must be positive";
+    else if (in->loops_per_sample<=0 || in->max_loops<=0 || in->max_loops%in->loops_per_sample!=0) error = "loops_per_sample must divide max_loops";
+    else if (in->N2<=0 || in->N3<=0 || in->N4<=0) error = "N2, N3 and N4 must be positive";
+#ifdef JACKKNIFE
+    else if (in->jackknife_regions==NULL || in->jackknife_labels==NULL || in->jackknife_weights==NULL || in->n_jackknives<=0) error = "no jackknife regions and weights given";
+#endif
+#ifdef LEGENDRE_MIX
+    else if (in->max_l<0 || in->max_l%2!=0) error = "max_l must be even";
+    else if (in->mu_bin_legendre_factors==NULL) error = "no mu bin Legendre factors given";
+#endif
+#ifdef PERIODIC
+    else if (in->boxsize<=0) error = "the periodic box size must be positive";
+#endif
+    if (error!=NULL){
+        fprintf(stderr,"librascalc: invalid inputs: %s\n",error);
+        return 1;
+    }
+    return 0;
+}
+
+extern "C" {
+
+const char *rascalc_mode(void){
+#if (defined LEGENDRE_MIX && defined PERIODIC)
+    return "legendre_mix_periodic";
+#elif defined LEGENDRE_MIX
+    return "legendre_mix";
+#elif (defined JACKKNIFE && defined PERIODIC)
+    return "jackknife_periodic";
+#elif defined JACKKNIFE
+    return "jackknife";
+#elif defined PERIODIC
+    return "default_periodic";
+#else
+    return "default";
+#endif
+}
+
+int rascalc_output_sizes(const rascalc_inputs *in, rascalc_sizes *sizes){
+    if (check_inputs(in)) return 1;
+    sizes->n_blocks = 1+in->max_loops/in->loops_per_sample;
+#ifdef LEGENDRE_MIX
+    long no_bins = (long)in->n_r_bins*(in->max_l/2+1); // as in Integrals::init
+    sizes->c2 = no_bins*no_bins;
+    sizes->RR = 0;
+    sizes->jack = 0;
+#else
+    long no_bins = (long)in->n_r_bins*in->n_mu_bins;
+    sizes->c2 = no_bins;
+    sizes->RR = no_bins;
+#ifdef JACKKNIFE
+    sizes->jack = no_bins*in->n_jackknives;
+#else
+    sizes->jack = 0;
+#endif
+#endif
+    sizes->c3 = sizes->c4 = no_bins*no_bins;
+    return 0;
+}
+
+int rascalc_compute(const rascalc_inputs *in, rascalc_outputs *out){
+    if (check_inputs(in)) return 1;
+
+    // Set up the parameters as the command-line options would
+    Parameters par(in->r_low, in->r_high, in->n_r_bins, in->r_low_cf, in->r_high_cf, in->n_r_bins_cf);
+    par.mbin = in->n_mu_bins;
+    par.mbin_cf = in->n_mu_bins_cf;
+    par.nofznorm = in->n_galaxies;
+    par.nside = in->nside;
+    par.nthread = in->nthread;
+    par.max_loops = in->max_loops;
+    par.loops_per_sample = in->loops_per_sample;
+    par.no_subsamples = par.max_loops / par.loops_per_sample;
+    par.N2 = in->N2;
+    par.N3 = in->N3;
+    par.N4 = in->N4;
+    par.cf_loops = in->cf_loops;
+    par.xicutoff = in->xicutoff;
+    par.out_file = (char *) "";
+#ifdef PERIODIC
+    par.boxsize = in->boxsize;
+    par.rect_boxsize = {par.boxsize, par.boxsize, par.boxsize};
+#endif
+#ifdef LEGENDRE_MIX
+    par.max_l = in->max_l;
+    new (&par.mu_bin_legendre_factors) MuBinLegendreFactors(in->mu_bin_legendre_factors, par.mbin, par.max_l); // construct in place
+#endif
+#ifdef OPENMP
+    omp_set_num_threads(par.nthread);
+#else
+    par.nthread = 1;
+#endif
+
+    // RR pair counts and jackknife weights
+#ifdef JACKKNIFE
+    JK_weights weights(in->RR, par.nbin*par.mbin, in->jackknife_labels, in->jackknife_weights, in->n_jackknives);
+#else
+    JK_weights weights(in->RR, par.nbin*par.mbin);
+#endif
+
+    // Particles
+    int np = in->n_particles;
+    Particle *particles = (Particle *)malloc(sizeof(Particle)*np);
+    for (int j = 0; j < np; j++) {
+        particles[j].pos.x = in->positions[3*j];
+        particles[j].pos.y = in->positions[3*j+1];
+        particles[j].pos.z = in->positions[3*j+2];
+        particles[j].w = in->weights[j];
+#ifdef JACKKNIFE
+        particles[j].JK = in->jackknife_regions[j];
+#else
+        particles[j].JK = 0.;
+#endif
+        particles[j].rand_class = rand()%2;
+    }
+#ifdef JACKKNIFE
+    collapse_jackknife_labels(particles, np, weights.filled_JKs, weights.n_JK_filled, "the particle array");
+#endif
+    printf("# Using %d particles\n", np);
+
+    // Choose nside to meet the density constraints as in the main code, then put the particles to the grid
+    Float3 shift;
+    Float max_density = 16., min_density = 2.;
+    int nside_attempts = 3; // number of attempts to meet the constraints by changing nside
+    bool success = false;
+    for (int no_attempt = 0; no_attempt <= nside_attempts; no_attempt++) {
+        par.perbox = compute_bounding_box(&particles, &np, 1, par.rect_boxsize, par.cellsize, par.rmax, shift, par.nside);
+#ifdef PERIODIC
+        par.rect_boxsize = {par.boxsize, par.boxsize, par.boxsize}; // restore the given boxsize if periodic
+        par.cellsize = par.boxsize / (Float)par.nside; // set cell size manually
+#endif
+        Float grid_density = (Float)np/Grid::count_filled_cells(particles, np, par.rect_boxsize, par.cellsize, par.nside, shift);
+        printf("Average number of particles per grid cell = %6.2f\n", grid_density);
+        if (grid_density <= max_density && grid_density >= min_density) {
+            success = true;
+            break;
+        }
+        Float aimed_density = (grid_density > max_density) ? cbrt(max_density * max_density * min_density) : cbrt(max_density * min_density * min_density); // aim for density between the limits but closer to the violated one
+        Float nside_approx = cbrt(grid_density/aimed_density) * par.nside; // approximate value of nside to reach this density
+        par.nside = 2 * (int)round((nside_approx + 1)/2) - 1; // round to closest odd integer
+        fprintf(stderr,"# WARNING: Average particle density outside the advised range (%.0f to %.0f particles per cell). Setting nside=%d.\n", min_density, max_density, par.nside);
+    }
+    if (!success) {
+        free(particles);
+        fprintf(stderr, "librascalc: could not meet mean grid density constraints after %d additional attempts.\n", nside_attempts);
+        return 1;
+    }
+    Grid *grid = new Grid(particles, np, par.rect_boxsize, par.cellsize, par.nside, shift, par.nofznorm, true); // the grid now owns the particles
+    printf("Final grid = %d\n", par.nside);
+
+    // Now rescale the RR counts based on the number of particles
+    weights.rescale(grid->norm, grid->norm);
+
+    // Correlation function and random draws
+    CorrelationFunction cf(in->xi, in->xi_r, in->xi_mu, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
+    RandomDraws rd(&cf, &par, NULL, 0);
+    rescale_correlation rescale(&par);
+    rescale.refine_wrapper(&par, grid, &cf, &rd, 1);
+
+    // Compute the integrals into the caller's arrays
+    IntegralArrays memory = {out->c2, out->c3, out->c4, out->RR, out->c2j, out->c3j, out->c4j, out->EE1, out->EE2, out->RR1, out->RR2, {0, 0, 0}};
+    par.memory_output = &memory;
+    compute_integral(grid, &par, &weights, &cf, &rd, 1, 1, 1, 1, 1);
+    for (int i = 0; i < 3; i++) out->counts[i] = memory.counts[i];
+
+    delete grid;
+    free(par.radial_bins_low);
+    free(par.radial_bins_high);
+    free(par.radial_bins_low_cf);
+    free(par.radial_bins_high_cf);
+    return 0;
+}
+
+}
@@ -0,0 +1,75 @@
+/* rascalc.h -- C interface of librascalc, the covariance integrals of the main code (grid_covariance.cpp) as a shared library working on in-memory arrays.
+   The library computes the integrals of one (single-tracer) field in the mode it was compiled for (see the Makefile), without reading or writing any files,
+   so that pipelines can call it directly, e.g. from Python with python/rascalc_lib.py.
+   All arrays are C-ordered (row-major) doubles unless stated otherwise and are only read during the call, except for the outputs. */
+
+#ifndef RASCALC_H
+#define RASCALC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    /* Random particles, as in the -in file */
+    const double *positions; /* n_particles x 3 Cartesian coordinates */
+    const double *weights; /* n_particles weights */
+    const int *jackknife_regions; /* n_particles jackknife region labels (JACKKNIFE modes only) */
+    int n_particles;
+    double n_galaxies; /* number of galaxies, as -norm */
+
+    /* Output binning, as in the -binfile file and -mbin */
+    const double *r_low, *r_high; /* n_r_bins radial bin edges */
+    int n_r_bins, n_mu_bins;
+
+    /* Correlation function, as in the -cor file with the binning of the -binfile_cf file and -mbin_cf */
+    const double *r_low_cf, *r_high_cf; /* n_r_bins_cf radial bin edges */
+    int n_r_bins_cf, n_mu_bins_cf;
+    const double *xi; /* n_r_bins_cf x n_mu_bins_cf correlation function values */
+    const double *xi_r; /* n_r_bins_cf radial bin centers of xi */
+    const double *xi_mu; /* n_mu_bins_cf mu bin centers of xi */
+
+    /* Pair counts and jackknife weights, as in the -RRbin and -jackknife files */
+    const double *RR; /* n_r_bins*n_mu_bins binned RR pair counts */
+    const int *jackknife_labels; /* n_jackknives labels of the non-empty jackknife regions (JACKKNIFE modes only) */
+    const double *jackknife_weights; /* n_jackknives x (n_r_bins*n_mu_bins) jackknife weights (JACKKNIFE modes only) */
+    int n_jackknives;
+
+    /* Legendre moments, as -max_l and the -mu_bin_legendre_file file (LEGENDRE_MIX mode only) */
+    int max_l;
+    const double *mu_bin_legendre_factors; /* n_mu_bins x (max_l/2+1) factors */
+
+    /* Precision and other options, as the options of the same names */
+    int nside, nthread, max_loops, loops_per_sample, N2, N3, N4, cf_loops;
+    double xicutoff;
+    double boxsize; /* side of the periodic box (PERIODIC modes only) */
+} rascalc_inputs;
+
+typedef struct {
+    /* Caller-owned arrays receiving the integrals, each holding n_blocks blocks as given by rascalc_output_sizes():
+       the full integral followed by the integral of each subsample, each in the layout of the corresponding output file of ./cov.
+       Arrays left NULL are not filled. */
+    double *c2, *c3, *c4, *RR; /* as in CovMatricesAll/ (RR not in the LEGENDRE_MIX mode) */
+    double *c2j, *c3j, *c4j, *EE1, *EE2, *RR1, *RR2; /* as in CovMatricesJack/ (JACKKNIFE modes only; EE and RR not in the LEGENDRE_MIX mode) */
+    unsigned long long counts[3]; /* total numbers of pairs, triples and quads used */
+} rascalc_outputs;
+
+typedef struct {
+    int n_blocks; /* 1+max_loops/loops_per_sample */
+    long c2, c3, c4, RR, jack; /* number of elements per block of c2 (and c2j), c3 (and c3j), c4 (and c4j), RR and of EE1, EE2, RR1 and RR2 (zero if not computed) */
+} rascalc_sizes;
+
+/* Name of the compiled mode as for the -mode option of ./cov_all, with "_periodic" appended in the periodic version */
+const char *rascalc_mode(void);
+
+/* Sizes of the output arrays for the given inputs; returns nonzero if the inputs are invalid */
+int rascalc_output_sizes(const rascalc_inputs *in, rascalc_sizes *sizes);
+
+/* Compute the integrals into the output arrays; returns nonzero if the inputs are invalid or no suitable grid size is found */
+int rascalc_compute(const rascalc_inputs *in, rascalc_outputs *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,388 @@
+// merge_subsets.cpp -- native version of python/cat_subsets_of_integrals.py, merging the integrals computed by several independent runs of grid_covariance.cpp.
+// The full estimates of CovMatricesAll/ and CovMatricesJack/ are averaged with weights given by the number of subsamples (loops) used from each run,
+// and the subsamples are renumbered consecutively, or averaged in groups of COLLAPSE_FACTOR. The integrals are streamed one matrix at a time,
+// so the memory use does not grow with the number of runs or subsamples, and subsample files are copied without parsing where possible.
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <glob.h>
+#include <algorithm>
+
+#define PAGE 4096     // To force some memory alignment.
+
+typedef unsigned long long int uint64;
+
+// Could swap between single and double precision here.
+typedef double Float;
+
+#include "../STimer.cc"
+#include "../modules/npy_utilities.h"
+#include "../modules/subsample_container.h"
+
+STimer TotalTime;
+
+// ========================== Input files ==============================
+
+enum Format {MISSING, NPY, TEXT, CONTAINER};
+
+Float* read_sample(const char* basename, const char* index, int &n_rows, int &n_cols, Format &format, char* fname){
+    // Read an integral saved by the C++ code, preferring the .npy file, then the subsample container, then the text file (as the post-processing does)
+    // Returns NULL (with format MISSING) if not found, else an array to be freed, with n_cols = 0 for 1D arrays; the file read is copied into fname (of 1100 chars)
+    Float *data;
+    int n_dims;
+    long long shape[8];
+    snprintf(fname, 1100, "%s_%s.npy", basename, index);
+    FILE *fp = open_npy(fname, n_dims, shape);
+    if (fp!=NULL){
+        assert(n_dims==1 || n_dims==2);
+        n_rows = shape[0];
+        n_cols = n_dims==1 ? 0 : shape[1];
+        fclose(fp);
+        data = (Float *)malloc(sizeof(Float)*n_rows*std::max(n_cols,1));
+        load_npy(fname, data, (long long)n_rows*std::max(n_cols,1));
+        format = NPY;
+        return data;
+    }
+    int64_t rows, cols;
+    if (strcmp(index, "full")!=0 && SubsampleContainer::shape(basename, rows, cols)){
+        n_rows = rows;
+        n_cols = cols;
+        data = (Float *)malloc(sizeof(Float)*n_rows*std::max(n_cols,1));
+        if (SubsampleContainer::load(basename, atoi(index), data, sizeof(Float)*n_rows*std::max(n_cols,1))){
+            snprintf(fname, 1100, "%s_subsamples.bin", basename);
+            format = CONTAINER;
+            return data;
+        }
+        free(data);
+    }
+    snprintf(fname, 1100, "%s_%s.txt", basename, index);
+    struct stat st;
+    if (stat(fname, &st)==0){
+        data = read_table(fname, 0, n_rows, n_cols);
+        if (n_cols==1) n_cols = 0; // vectors are saved one value per line
+        format = TEXT;
+        return data;
+    }
+    format = MISSING;
+    return NULL;
+}
+
+Format preferred_format(const char* basename, const char* index, char* fname){
+    // Format of the file that read_sample would use for this sample, copying its name into fname (of 1100 chars), without reading it
+    struct stat st;
+    snprintf(fname, 1100, "%s_%s.npy", basename, index);
+    if (stat(fname, &st)==0) return NPY;
+    if (strcmp(index, "full")!=0 && SubsampleContainer::contains(basename, atoi(index))){
+        snprintf(fname, 1100, "%s_subsamples.bin", basename);
+        return CONTAINER;
+    }
+    snprintf(fname, 1100, "%s_%s.txt", basename, index);
+    if (stat(fname, &st)==0) return TEXT;
+    return MISSING;
+}
+
+bool sample_exists(const char* basename, int index){
+    char idx[16], fname[1100];
+    snprintf(idx, sizeof idx, "%d", index);
+    return preferred_format(basename, idx, fname)!=MISSING;
+}
+
+void copy_file(const char* src, const char* dest){
+    // Copy a file byte for byte
+    FILE *in = fopen(src, "rb"), *out = fopen(dest, "wb");
+    if (in==NULL || out==NULL){
+        fprintf(stderr,"Could not copy %s to %s\n", src, dest);
+        abort();
+    }
+    char buf[1<<16];
+    size_t n_read;
+    while ((n_read = fread(buf, 1, sizeof buf, in))>0) fwrite(buf, 1, n_read, out);
+    fclose(in);
+    if (fclose(out)!=0){
+        fprintf(stderr,"Failed to write output file %s\n", dest);
+        abort();
+    }
+}
+
+bool same_directory(const char* dir1, const char* dir2){
+    // Whether two paths point to the same existing directory, as os.path.samefile
+    struct stat st1, st2;
+    if (stat(dir1, &st1)!=0 || stat(dir2, &st2)!=0) return false;
+    return st1.st_dev==st2.st_dev && st1.st_ino==st2.st_ino;
+}
+
+bool matches_exist(const char* pattern){
+    glob_t g;
+    bool found = glob(pattern, 0, NULL, &g)==0 && g.gl_pathc>0;
+    globfree(&g);
+    return found;
+}
+
+// ========================== Merging ==============================
+
+class SubsetMerger{
+    // Merges one group of integrals (e.g. c2, c3 and c4 of one field combination) at a time from the input directories into the output directory
+public:
+    int n_inputs, collapse_factor, n_samples_tot;
+    char **input_roots;
+    int *ns_samples;
+    const char *output_root;
+    bool binary; // whether to write .npy rather than text files
+    bool output_is_first; // whether the output directory is the first input directory, whose subsamples need not be copied
+
+    static const int max_arrays = 4;
+
+    SubsetMerger(int _n_inputs, char **_input_roots, int *_ns_samples, int _collapse_factor, const char *_output_root){
+        n_inputs = _n_inputs;
+        input_roots = _input_roots;
+        ns_samples = _ns_samples;
+        collapse_factor = _collapse_factor;
+        output_root = _output_root;
+        n_samples_tot = 0;
+        for (int d = 0; d < n_inputs; d++) n_samples_tot += ns_samples[d];
+        output_is_first = same_directory(input_roots[0], output_root);
+        // Write binary .npy integrals (saved by the C++ code with the -npy or -container options) if any are present, otherwise text files
+        binary = false;
+        char pattern[1100];
+        for (int d = 0; d < n_inputs; d++){
+            snprintf(pattern, sizeof pattern, "%s/CovMatricesAll/c4_*.npy", input_roots[d]);
+            binary |= matches_exist(pattern);
+            snprintf(pattern, sizeof pattern, "%s/CovMatricesAll/c4_*_subsamples.bin", input_roots[d]);
+            binary |= matches_exist(pattern);
+        }
+    }
+
+    int merge(const char* subdir, int n_arrays, char names[][100], const char* description){
+        // Merge the arrays names (without index suffix and extension) of subdir, checking for the presence of all samples before writing anything
+        // Returns 1 if merged, 0 if no samples were found and -1 if some were missing
+        assert(n_arrays<=max_arrays);
+        char basename[1000];
+        bool use_full[n_inputs]; // whether the full estimate of each input can be read instead of its subsamples
+        int n_found = 0;
+        for (int d = 0; d < n_inputs; d++){
+            snprintf(basename, sizeof basename, "%s/%s/%s", input_roots[d], subdir, names[n_arrays-1]);
+            bool has_last = sample_exists(basename, ns_samples[d]-1);
+            // If not collapsing and there are no more and no less samples than we are using, can read averages from the full file
+            use_full[d] = collapse_factor==1 && has_last && !sample_exists(basename, ns_samples[d]);
+            for (int k = 0; k < n_arrays && use_full[d]; k++){
+                char fname[1100];
+                snprintf(basename, sizeof basename, "%s/%s/%s_full", input_roots[d], subdir, names[k]);
+                snprintf(fname, sizeof fname, "%s.npy", basename);
+                struct stat st;
+                if (stat(fname, &st)!=0){
+                    snprintf(fname, sizeof fname, "%s.txt", basename);
+                    if (stat(fname, &st)!=0) use_full[d] = false;
+                }
+            }
+            if (!has_last) break; // end loop if last sample not found
+            n_found += ns_samples[d];
+        }
+        if (n_found==0) return 0;
+        if (n_found<n_samples_tot){
+            printf("ERROR: some %s samples missing: expected %d, found %d\n", description, n_samples_tot, n_found);
+            return -1;
+        }
+
+        Float *sum[max_arrays], *group[max_arrays]; // weighted sums of the full estimates and of the current group of collapsed subsamples
+        int n_rows[max_arrays], n_cols[max_arrays];
+        for (int k = 0; k < n_arrays; k++) sum[k] = group[k] = NULL;
+        char outname[1000], index[16], fname[1100], outfile[1100];
+        for (int d = 0, offset = 0; d < n_inputs; offset += ns_samples[d++]){
+            bool write = !(d==0 && output_is_first); // else the files are already there
+            if (use_full[d]){
+                for (int k = 0; k < n_arrays; k++){
+                    snprintf(basename, sizeof basename, "%s/%s/%s", input_roots[d], subdir, names[k]);
+                    Float *data = load(basename, "full", k, sum, group, n_rows, n_cols);
+                    add(sum[k], data, ns_samples[d], n_rows[k], n_cols[k]);
+                    free(data);
+                }
+                if (!write) continue;
+            }
+            printf("%s %s samples from %s\n", use_full[d] ? "Copying" : "Loading", description, input_roots[d]);
+            for (int i = 0; i < ns_samples[d]; i++){
+                snprintf(index, sizeof index, "%d", i);
+                for (int k = 0; k < n_arrays; k++){
+                    snprintf(basename, sizeof basename, "%s/%s/%s", input_roots[d], subdir, names[k]);
+                    // Files already in the output format are copied rather than parsed
+                    bool copy = collapse_factor==1 && write && preferred_format(basename, index, fname)==(binary ? NPY : TEXT);
+                    Float *data = NULL;
+                    if (!use_full[d] || (write && !copy)) data = load(basename, index, k, sum, group, n_rows, n_cols);
+                    if (!use_full[d]) add(sum[k], data, 1., n_rows[k], n_cols[k]);
+                    if (collapse_factor>1){
+                        // Average adjacent chunks of collapse_factor samples
+                        add(group[k], data, 1./collapse_factor, n_rows[k], n_cols[k]);
+                        if ((offset+i+1)%collapse_factor==0){
+                            snprintf(outname, sizeof outname, "%s/%s/%s_%d", output_root, subdir, names[k], (offset+i)/collapse_factor);
+                            save_array(outname, group[k], n_rows[k], n_cols[k], binary);
+                            memset(group[k], 0, sizeof(Float)*n_rows[k]*std::max(n_cols[k],1));
+                        }
+                    }
+                    else if (write){
+                        snprintf(outname, sizeof outname, "%s/%s/%s_%d", output_root, subdir, names[k], offset+i);
+                        if (copy){
+                            snprintf(outfile, sizeof outfile, "%s.%s", outname, binary ? "npy" : "txt");
+                            copy_file(fname, outfile);
+                        }
+                        else save_array(outname, data, n_rows[k], n_cols[k], binary);
+                    }
+                    free(data);
+                }
+            }
+        }
+
+        // Save the averages of the full estimates
+        for (int k = 0; k < n_arrays; k++){
+            long long n_elements = (long long)n_rows[k]*std::max(n_cols[k],1);
+            for (long long j = 0; j < n_elements; j++) sum[k][j] /= n_samples_tot;
+            snprintf(outname, sizeof outname, "%s/%s/%s_full", output_root, subdir, names[k]);
+            save_array(outname, sum[k], n_rows[k], n_cols[k], binary);
+            free(sum[k]);
+            free(group[k]);
+        }
+        printf("Done with %s\n", description);
+        return 1;
+    }
+
+private:
+    Float* load(const char* basename, const char* index, int k, Float** sum, Float** group, int* n_rows, int* n_cols){
+        // Read a sample of array k, allocating the sums on the first call and checking that all samples have the same shape
+        char fname[1100];
+        int rows, cols;
+        Format format;
+        Float *data = read_sample(basename, index, rows, cols, format, fname);
+        if (data==NULL){
+            fprintf(stderr,"Sample %s of %s not found\n", index, basename);
+            abort();
+        }
+        if (sum[k]==NULL){
+            n_rows[k] = rows;
+            n_cols[k] = cols;
+            sum[k] = (Float *)calloc((size_t)rows*std::max(cols,1), sizeof(Float));
+            group[k] = (Float *)calloc((size_t)rows*std::max(cols,1), sizeof(Float));
+        }
+        else if (rows!=n_rows[k] || cols!=n_cols[k]){
+            fprintf(stderr,"Sample %s of %s has a different shape from the previous samples\n", index, basename);
+            abort();
+        }
+        return data;
+    }
+
+    void add(Float* sum, const Float* data, Float weight, int n_rows, int n_cols){
+        long long n_elements = (long long)n_rows*std::max(n_cols,1);
+        for (long long j = 0; j < n_elements; j++) sum[j] += weight*data[j];
+    }
+};
+
+void usage(){
+    fprintf(stderr,"\nUsage:\n");
+    fprintf(stderr,"    ./merge_subsets {N_R_BINS} {mN_MU_BINS/lMAX_L} {COVARIANCE_INPUT_DIR1} {N_SUBSAMPLES_TO_USE1} [{COVARIANCE_INPUT_DIR2} {N_SUBSAMPLES_TO_USE2} ...] [{COLLAPSE_FACTOR}] {COVARIANCE_OUTPUT_DIR}\n");
+    fprintf(stderr,"Single-field vs multi-field and jackknife integrals are determined automatically. Do not use if subsamples have different numbers of pairs/triples/quadruplets.\n\n");
+    exit(1);
+}
+
+// ================================ main() =============================
+
+int main(int argc, char *argv[]) {
+    if (argc<6) usage();
+    int n = atoi(argv[1]);
+    const char *mstr = argv[2], *output_root = argv[argc-1];
+    int n_args = argc-4; // input directories and subsample numbers, and the optional collapse factor
+    int collapse_factor = 1;
+    if (n_args%2==1) collapse_factor = atoi(argv[argc-2]); // recover the collapse factor if present
+    int n_inputs = n_args/2;
+    char **input_roots = (char **)malloc(sizeof(char*)*n_inputs);
+    int *ns_samples = (int *)malloc(sizeof(int)*n_inputs);
+    for (int d = 0; d < n_inputs; d++){
+        input_roots[d] = argv[3+2*d];
+        ns_samples[d] = atoi(argv[4+2*d]);
+        if (ns_samples[d]<=0){
+            fprintf(stderr,"Number of subsamples to use from %s must be positive\n", input_roots[d]);
+            abort();
+        }
+    }
+    if (collapse_factor<=0){
+        fprintf(stderr,"Collapsing factor must be positive\n");
+        abort();
+    }
+    if (collapse_factor>1 && same_directory(input_roots[0], output_root)){
+        fprintf(stderr,"Only can collapse samples into a different directory\n");
+        abort();
+    }
+    for (int d = 1; d < n_inputs; d++)
+        if (same_directory(input_roots[d], output_root)){
+            fprintf(stderr,"Only first input directory can be the same as the output\n");
+            abort();
+        }
+
+    TotalTime.Start();
+    SubsetMerger merger(n_inputs, input_roots, ns_samples, collapse_factor, output_root);
+    if (merger.n_samples_tot%collapse_factor!=0){
+        fprintf(stderr,"Collapse factor must divide the total number of samples\n");
+        abort();
+    }
+
+    // Create output directories
+    char dir[1100];
+    mkdir(output_root, 0777);
+    snprintf(dir, sizeof dir, "%s/CovMatricesAll", output_root);
+    mkdir(dir, 0777);
+    struct stat st;
+    for (int d = 0; d < n_inputs; d++){
+        snprintf(dir, sizeof dir, "%s/CovMatricesJack", input_roots[d]);
+        if (stat(dir, &st)==0){
+            snprintf(dir, sizeof dir, "%s/CovMatricesJack", output_root);
+            mkdir(dir, 0777);
+            break;
+        }
+    }
+
+    // input indices
+    const int I1[7] = {1,1,1,1,1,2,2};
+    const int I2[7] = {1,2,2,2,1,1,2};
+    const int I3[7] = {1,1,2,1,2,2,2};
+    const int I4[7] = {1,1,1,2,2,2,2};
+
+    bool complete = true; // whether no group of integrals had missing samples
+    for (int ii = 0; ii < 7; ii++){ // loop over all field combinations
+        char index4[8], index3[8], index2[8], description[64];
+        snprintf(index4, sizeof index4, "%d%d,%d%d", I1[ii], I2[ii], I3[ii], I4[ii]);
+        snprintf(index3, sizeof index3, "%d,%d%d", I2[ii], I1[ii], I3[ii]);
+        snprintf(index2, sizeof index2, "%d%d", I1[ii], I2[ii]);
+        char names[4][100];
+        snprintf(names[0], sizeof names[0], "c2_n%d_%s_%s", n, mstr, index2);
+        snprintf(names[1], sizeof names[1], "c3_n%d_%s_%s", n, mstr, index3);
+        snprintf(names[2], sizeof names[2], "c4_n%d_%s_%s", n, mstr, index4);
+
+        // full integrals
+        snprintf(description, sizeof description, "%s full", index4);
+        int status = merger.merge("CovMatricesAll", 3, names, description);
+        complete &= status>=0;
+        if (status!=1) break; // end loop if no full integral has been found or some are missing
+
+        // jackknife integrals
+        snprintf(description, sizeof description, "%s jack", index4);
+        status = merger.merge("CovMatricesJack", 3, names, description);
+        complete &= status>=0;
+        if (status!=1) continue; // skip rest of the loop if no jack integral has been found or some are missing
+
+        // disconnected jackknife integrals. Done separately because absent in mixed Jackknife (LEGENDRE_MIX)
+        snprintf(names[0], sizeof names[0], "EE1_n%d_%s_%s", n, mstr, index2);
+        snprintf(names[1], sizeof names[1], "EE2_n%d_%s_%s", n, mstr, index2);
+        snprintf(names[2], sizeof names[2], "RR1_n%d_%s_%s", n, mstr, index2);
+        snprintf(names[3], sizeof names[3], "RR2_n%d_%s_%s", n, mstr, index2);
+        snprintf(description, sizeof description, "%s disconnected jack", index2);
+        complete &= merger.merge("CovMatricesJack", 4, names, description)>=0;
+    }
+
+    TotalTime.Stop();
+    if (complete) printf("\nMerged %d subsamples from %d directories into %s in %.1f s\n", merger.n_samples_tot/collapse_factor, n_inputs, output_root, TotalTime.Elapsed());
+    else fprintf(stderr,"\nSome integrals were not merged since their samples are missing\n");
+    free(input_roots);
+    free(ns_samples);
+    return complete ? 0 : 1;
+}
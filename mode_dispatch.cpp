@@ -0,0 +1,72 @@
+// mode_dispatch.cpp -- main() of the ./cov_all executable, which holds the main code of grid_covariance.cpp compiled separately for each mode
+// (with the same preprocessor flags as the single-mode ./cov, so each keeps its specialized loops) and chooses between them at run time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The run() functions of grid_covariance.cpp compiled for each mode, in the namespaces given by COV_MODE (see the Makefile)
+#define DECLARE_MODE(name) namespace name { int run(int argc, char *argv[]); }
+DECLARE_MODE(cov_default)
+DECLARE_MODE(cov_default_periodic)
+DECLARE_MODE(cov_jackknife)
+DECLARE_MODE(cov_jackknife_periodic)
+DECLARE_MODE(cov_legendre)
+DECLARE_MODE(cov_legendre_periodic)
+DECLARE_MODE(cov_legendre_mix)
+DECLARE_MODE(cov_legendre_mix_periodic)
+DECLARE_MODE(cov_three_pcf)
+DECLARE_MODE(cov_three_pcf_periodic)
+
+struct CovMode{
+    const char *name; // value of the -mode option
+    const char *flags; // compile-time flags of the single-mode ./cov equivalent to this mode (plus -DPERIODIC for the periodic version)
+    int (*run)(int argc, char *argv[]);
+    int (*run_periodic)(int argc, char *argv[]);
+};
+
+static const CovMode cov_modes[] = {
+    {"default", "", cov_default::run, cov_default_periodic::run},
+    {"jackknife", "-DJACKKNIFE", cov_jackknife::run, cov_jackknife_periodic::run},
+    {"legendre", "-DLEGENDRE", cov_legendre::run, cov_legendre_periodic::run},
+    {"legendre_mix", "-DLEGENDRE_MIX -DJACKKNIFE", cov_legendre_mix::run, cov_legendre_mix_periodic::run},
+    {"three_pcf", "-DTHREE_PCF -DLEGENDRE", cov_three_pcf::run, cov_three_pcf_periodic::run},
+};
+static const int n_cov_modes = sizeof(cov_modes)/sizeof(cov_modes[0]);
+
+int main(int argc, char *argv[]) {
+    // The mode is chosen with the -mode option, which is removed from the arguments. The periodic version is chosen by the usual -perbox option,
+    // which is passed on to the main code like all other options.
+    const char *mode_name = NULL;
+    bool periodic = false;
+    char **args = (char **)malloc(sizeof(char *)*(argc+1));
+    int nargs = 0;
+    for (int i = 0; i < argc; i++){
+        if (i>0 && !strcmp(argv[i],"-mode") && i+1<argc){
+            mode_name = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i],"-perbox")) periodic = true;
+        args[nargs++] = argv[i];
+    }
+    args[nargs] = NULL;
+
+    if (mode_name==NULL) mode_name = "default";
+    for (int m = 0; m < n_cov_modes; m++){
+        if (strcmp(cov_modes[m].name, mode_name)) continue;
+        printf("# Running the %s%s mode (equivalent to ./cov compiled with %s%s)\n", periodic ? "periodic " : "", mode_name, cov_modes[m].flags, periodic ? " -DPERIODIC" : "");
+        fflush(NULL);
+        int ret = periodic ? cov_modes[m].run_periodic(nargs, args) : cov_modes[m].run(nargs, args);
+        free(args);
+        return ret;
+    }
+
+    fprintf(stderr, "\nUnknown mode %s. Usage for cov_all:\n\n", mode_name);
+    fprintf(stderr, "   ./cov_all [-mode <mode>] [-perbox] <options of ./cov>\n\n");
+    fprintf(stderr, "   -mode <mode>: One of");
+    for (int m = 0; m < n_cov_modes; m++) fprintf(stderr, " %s", cov_modes[m].name);
+    fprintf(stderr, ". Default default (s,mu bins without jackknives)\n");
+    fprintf(stderr, "   -perbox: Use the periodic version of the mode\n\n");
+    free(args);
+    return 1;
+}
@@ -3,6 +3,8 @@
 #ifndef CELL_UTILITIES_H
 #define CELL_UTILITIES_H
 
+#include <stdint.h>
+
 // We need a vector floor3 function
 Float3 floor3(float3 p) {
     return Float3(floor(p.x), floor(p.y), floor(p.z));
@@ -25,6 +27,44 @@ class Particle {
     // This is set at read-in at random and used for the EE computation to avoid diagonal non-cancellation.
 };
 
+// Compact storage of a particle in the Grid (see Grid::compress), with T = uint16_t or uint32_t: 12 or 20 bytes instead of 48.
+// The position is stored relative to the center of its cell, as a fixed-point fraction of the cell size, so it is exact to cellsize/2^17 or cellsize/2^33.
+// The weight is kept in single precision and the jackknife region (lower 15 bits) and random class (top bit) share 16 bits.
+
+template <typename T> class CompactParticle {
+  public:
+    float w; // first, so that the 16-bit layout packs into 12 bytes without padding
+    T pos[3];
+    uint16_t JK_class;
+
+    static Float levels() {
+        // Number of fixed-point steps across one cell
+        return (Float)(T)(~(T)0)+1.;
+    }
+
+    void encode(const Particle &particle, Float3 center, Float cellsize) {
+        Float3 offset = (particle.pos-center)/cellsize;
+        Float off[3] = {offset.x, offset.y, offset.z};
+        for (int i = 0; i < 3; i++){
+            Float q = floor((off[i]+0.5)*levels()); // round down to the step, which is decoded at its midpoint
+            pos[i] = (T)fmin(fmax(q, 0.), levels()-1.); // clamp the rounding errors at the cell edges
+        }
+        w = particle.w;
+        int JK = (particle.JK>=0 && particle.JK<32768) ? (int)particle.JK : 0; // the region is only defined (and checked) in the JACKKNIFE mode
+        JK_class = JK | (particle.rand_class<<15);
+    }
+
+    Particle decode(Float3 center, Float cellsize) const {
+        Particle particle;
+        Float step = cellsize/levels();
+        particle.pos = center+Float3((pos[0]+0.5)*step, (pos[1]+0.5)*step, (pos[2]+0.5)*step)-Float3(0.5,0.5,0.5)*cellsize;
+        particle.w = w;
+        particle.JK = JK_class&32767;
+        particle.rand_class = JK_class>>15;
+        return particle;
+    }
+};
+
 
 // ====================  The Cell and Grid classes ==================
 
@@ -0,0 +1,78 @@
+// comoving_distance.h - conversion of (RA,Dec,z) catalogs to comoving Cartesian coordinates, with the comoving distance tabulated once on a fine redshift grid.
+// This replaces the per-particle calls to python/wcdm of python/convert_to_xyz.py.
+
+#ifndef COMOVING_DISTANCE_H
+#define COMOVING_DISTANCE_H
+
+class ComovingDistance{
+    // Comoving (line-of-sight) coordinate distance D_C(z) in Mpc/h for a wCDM cosmology with curvature, i.e. wcdm.coorddist() in units of c/H_0 = 2997.92458 Mpc/h
+    // D_C and its derivative c/H(z) are tabulated at spacing dz, and evaluated by cubic Hermite interpolation, accurate to ~dz^4
+public:
+    Float omega_m, omega_k, omega_x, w_dark_energy;
+    Float zmax, dz;
+    int n_z;
+    Float *D, *dD_dz; // tabulated distance and its derivative
+
+    const Float c_over_H0 = 2997.92458; // Hubble distance in Mpc/h
+
+    Float inv_E(Float z){
+        // Inverse dimensionless Hubble rate H_0/H(z)
+        Float a_inv = 1.+z;
+        return 1./sqrt(omega_m*pow(a_inv,3)+omega_k*pow(a_inv,2)+omega_x*pow(a_inv,3.*(1.+w_dark_energy)));
+    }
+
+    ComovingDistance(Float _omega_m, Float _omega_k, Float _w_dark_energy, Float _zmax, Float _dz){
+        omega_m = _omega_m;
+        omega_k = _omega_k;
+        omega_x = 1.-omega_m-omega_k;
+        w_dark_energy = _w_dark_energy;
+        dz = _dz;
+        n_z = ceil(_zmax/dz)+2;
+        zmax = (n_z-1)*dz;
+        int ec=0;
+        ec+=posix_memalign((void **) &D, PAGE, sizeof(Float)*n_z);
+        ec+=posix_memalign((void **) &dD_dz, PAGE, sizeof(Float)*n_z);
+        assert(ec==0);
+        // Integrate c/H(z) with Simpson's rule on each step
+        D[0] = 0.;
+        dD_dz[0] = c_over_H0*inv_E(0.);
+        for (int i = 1; i < n_z; i++){
+            Float z = i*dz;
+            dD_dz[i] = c_over_H0*inv_E(z);
+            D[i] = D[i-1] + dz/6.*(dD_dz[i-1]+4.*c_over_H0*inv_E(z-0.5*dz)+dD_dz[i]);
+        }
+    }
+
+    ~ComovingDistance(){
+        free(D);
+        free(dD_dz);
+    }
+
+    inline Float distance(Float z){
+        // Comoving distance at redshift 0 <= z <= zmax
+        Float x = z/dz;
+        int i = std::min(std::max((int)x, 0), n_z-2);
+        Float t = x-i, t2 = t*t, t3 = t2*t;
+        return (2*t3-3*t2+1)*D[i] + (t3-2*t2+t)*dz*dD_dz[i] + (-2*t3+3*t2)*D[i+1] + (t3-t2)*dz*dD_dz[i+1];
+    }
+
+    void convert(Float *data, long long n, int n_cols){
+        // Convert the rows of data from (RA,Dec,z,...) in degrees to comoving (x,y,z,...) in Mpc/h in place; other columns are unchanged
+        // The loop has no branches so the compiler can vectorize it, and the rows are split among the threads
+        const Float deg = M_PI/180.;
+#ifdef OPENMP
+#pragma omp parallel for simd schedule(static)
+#endif
+        for (long long i = 0; i < n; i++){
+            Float *row = data+i*n_cols;
+            Float r = distance(row[2]);
+            Float phi = row[0]*deg, theta = row[1]*deg; // theta is the declination here
+            Float cos_dec = cos(theta);
+            row[0] = r*cos_dec*cos(phi);
+            row[1] = r*cos_dec*sin(phi);
+            row[2] = r*sin(theta);
+        }
+    }
+};
+
+#endif
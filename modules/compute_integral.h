@@ -6,12 +6,18 @@
 // Choose relevant class to hold integrals
 #ifdef LEGENDRE
     #include "integrals_legendre.h"
+    #include "output_writer.h"
 #elif defined POWER
     #include "integrals_legendre_power.h"
 #else
     #include "integrals.h"
+    #include "output_writer.h"
+#endif
+#ifdef PERF_COUNTERS
+    #include "perf_counters.h"
 #endif
     class compute_integral{
+        friend class KernelBenchmark; // times the private kernels in benchmark/microbench.cpp
 
     private:
         uint64 cnt2=0,cnt3=0,cnt4=0;
@@ -23,10 +29,11 @@
             // function updates a list of particles for a 1-dimensional ID. Output is number of particles in list.
 
             Cell cell = grid->c[id_1D]; // cell object
+            Float3 center = grid->cell_center(id_1D); // for decoding compressed particles
             int no_particles = 0;
             // copy in list of particles into list
             for (int i = cell.start; i<cell.start+cell.np; i++, no_particles++){
-                part_list[no_particles]=grid->p[i];
+                part_list[no_particles]=grid->particle(i, center);
                 id_list[no_particles]=i;
             }
         return no_particles;
@@ -42,7 +49,7 @@
             Cell cell = grid->c[id_1D];
             if(cell.np==0) return 1; // error if empty cell
             pid = floor(gsl_rng_uniform(locrng)*cell.np) + cell.start; // draw random ID
-            particle = grid->p[pid]; // define particle
+            particle = grid->particle(pid, grid->cell_center(id_1D)); // define particle
             n_particles = cell.np; // no. of particles in cell
             n_particles1 = cell.np1; // no. particles in cell partition 1
             n_particles2 = cell.np2;
@@ -62,7 +69,7 @@
             Cell cell = grid->c[id_1D];
             if(cell.np==0) return 1; // error if empty cell
             pid = floor(gsl_rng_uniform(locrng)*cell.np) + cell.start; // draw random ID
-            particle = grid->p[pid]; // define particle
+            particle = grid->particle(pid, grid->cell_center(id_1D)); // define particle
             n_particles = cell.np; // no. of particles in cell
     #ifdef PERIODIC
             particle.pos+=shift;
@@ -155,6 +162,12 @@
             STimer* LoopTimes = new STimer[par->max_loops];
             STimer initial, TotalTime; // Time initialization
             initial.Start();
+#ifdef PROFILE
+            StageProfile profile(par->max_loops); // per-loop stage counters
+#endif
+#ifdef PERF_COUNTERS
+            PerfCounters perf_totals; // hardware counters summed over threads
+#endif
 
 #ifdef JACKKNIFE
     // --------Compute product weights----------------------
@@ -211,6 +224,10 @@
                 }
             }
 
+            if (par->numa_interleave){
+                if (product_weights12_34!=JK12->product_weights) interleave_memory(product_weights12_34, sizeof(Float)*nbins*nbins);
+                if (product_weights12_23!=JK12->product_weights) interleave_memory(product_weights12_23, sizeof(Float)*nbins*nbins);
+            }
             printf("Computed relevant product weights\n");
 #endif
 
@@ -226,12 +243,25 @@
 #if (defined LEGENDRE || defined POWER)
             Integrals sumint(par, cf12, cf13, cf24, I1, I2, I3, I4,survey_corr_12,survey_corr_23,survey_corr_34); // total integral
             Integrals outint(par, cf12, cf13, cf24, I1, I2, I3, I4, survey_corr_12, survey_corr_23, survey_corr_34); // current output integral
+#ifdef LEGENDRE
+            Integrals writeint(par, cf12, cf13, cf24, I1, I2, I3, I4, survey_corr_12, survey_corr_23, survey_corr_34); // integral being saved by the writer thread
+            Integrals outbuf1(par, cf12, cf13, cf24, I1, I2, I3, I4, survey_corr_12, survey_corr_23, survey_corr_34), outbuf2(par, cf12, cf13, cf24, I1, I2, I3, I4, survey_corr_12, survey_corr_23, survey_corr_34); // output integrals waiting to be saved
+#endif
 #elif defined JACKKNIFE
             Integrals sumint(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4,product_weights12_12,product_weights12_23,product_weights12_34); // total integral
             Integrals outint(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4, product_weights12_12,product_weights12_23, product_weights12_34); // current output integral
+            Integrals writeint(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4, product_weights12_12,product_weights12_23, product_weights12_34); // integral being saved by the writer thread
+            Integrals outbuf1(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4, product_weights12_12,product_weights12_23, product_weights12_34), outbuf2(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4, product_weights12_12,product_weights12_23, product_weights12_34); // output integrals waiting to be saved
 #else
             Integrals sumint(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4); // total integral
             Integrals outint(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4); // current output integral
+            Integrals writeint(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4); // integral being saved by the writer thread
+            Integrals outbuf1(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4), outbuf2(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4); // output integrals waiting to be saved
+#endif
+#ifdef LEGENDRE
+            OutputWriter writer(&writeint, &outbuf1, &outbuf2, false); // saves the subsamples in the background (as text files, the only Legendre output)
+#elif !defined POWER
+            OutputWriter writer(&writeint, &outbuf1, &outbuf2, par->container_output); // saves the subsamples in the background
 #endif
             uint64 tot_pairs=0, tot_triples=0, tot_quads=0; // global number of particle pairs/triples/quads used (including those rejected for being in the wrong bins)
             uint64 cell_attempt2=0,cell_attempt3=0,cell_attempt4=0; // number of j,k,l cells attempted
@@ -307,6 +337,7 @@
 #else
             Integrals locint(par, cf12, cf13, cf24, JK12, JK23, JK34, I1, I2, I3, I4); // Accumulates the integral contribution of each thread
 #endif
+            if (thread==0) locint.huge_page_report("c4 accumulator of thread 0");
             gsl_rng* locrng = gsl_rng_alloc(gsl_rng_default); // one rng per thread
             gsl_rng_set(locrng, seed_step * (unsigned long)thread + seed_shift); // the second number, seed, will not overflow and will be unique for each thread in one run. Here, seed_shift is a random number between 0 and seed_step-1, inclusively. Seed clashes between different runs seem less likely than for the old formula, seed = steps * (nthread+1), with steps being a random number between 1 and UINT_MAX (or ULONG_MAX / nthread) inclusively - there, steps of one run could be a multiple of steps of the other resulting in the same seeds for some threads, which is somewhat more likely than getting the same random number.
 
@@ -321,6 +352,14 @@
             assert(ec==0);
 
             uint64 loc_used_pairs,loc_used_triples, loc_used_quads; // local counts of used pairs/triples/quads
+#ifdef PROFILE
+            StageCounters loc_counters; // stage counters of this thread for the current loop
+            thread_counters = &loc_counters;
+#endif
+#ifdef PERF_COUNTERS
+            PerfCounters loc_perf; // hardware counters of this thread
+            loc_perf.start();
+#endif
     //-----------START FIRST LOOP-----------
     #ifdef OPENMP
     #pragma omp for schedule(dynamic)
@@ -331,6 +370,9 @@
 #endif
                 loc_used_pairs=0; loc_used_triples=0; loc_used_quads=0;
                 LoopTimes[n_loops].Start();
+#ifdef PROFILE
+                loc_counters.reset();
+#endif
 
                 // LOOP OVER ALL FILLED I CELLS
                 for (int n1=0; n1<grid1->nf;n1++){
@@ -359,11 +401,13 @@
                         cell_attempt2+=1; // new cell attempted
 
                         // Draw second cell from i weighted by 1/r^2
+                        PROFILE_SAMPLED_START(draw_start);
                         delta2 = rd13->random_cubedraw(locrng, &p2); // can use any rd class here since drawing as 1/r^2
                         // p2 is the ratio of sampling to true pair distribution here
                         sec_id = prim_id + delta2;
                         cell_sep2 = grid2->cell_sep(delta2);
                         x = draw_particle(sec_id, particle_j, pid_j, cell_sep2, grid2, sln, locrng, sln1, sln2);
+                        PROFILE_SAMPLED_STOP(draw_start, x==1 ? STAGE_REJECT : STAGE_DRAW);
                         if (x==1) continue; // skip failed draws
 
                         used_cell2+=1; // new cell accepted
@@ -377,6 +421,7 @@
                         p2*=1./(grid1->np*(double)sln); // probability is divided by total number of i particles and number of particles in cell
 
                         // Compute C2 integral
+                        PROFILE_START(second_start);
 #ifdef LEGENDRE
                         locint.second(prim_list, prim_ids, pln, particle_j, pid_j, bin_ij, w_ij, p2, factor_ij, poly_ij);
 #elif defined POWER
@@ -384,16 +429,19 @@
 #else
                         locint.second(prim_list, prim_ids, pln, particle_j, pid_j, bin_ij, w_ij, p2, p21, p22);
 #endif
+                        PROFILE_STOP(second_start, STAGE_SECOND);
 
                         // LOOP OVER N3 K CELLS
                         for (int n3=0; n3<par->N3; n3++){
                             cell_attempt3+=1; // new third cell attempted
 
                             // Draw third cell from i weighted by xi(r)
+                            PROFILE_SAMPLED_START(draw_start);
                             delta3 = rd13->random_xidraw(locrng, &p3); // use 1-3 random draw class here for xi_13
                             thi_id = prim_id + delta3;
                             cell_sep3 = grid3->cell_sep(delta3);
                             x = draw_particle_without_class(thi_id,particle_k,pid_k,cell_sep3,grid3,tln,locrng); // draw from third grid
+                            PROFILE_SAMPLED_STOP(draw_start, x==1 ? STAGE_REJECT : STAGE_DRAW);
                             if (x==1) continue; // skip failed draws
                             if ((pid_j==pid_k) && (I2==I3)) continue; // skip jk self-counts
 
@@ -402,6 +450,7 @@
                             p3*=p2/(double)tln; // update probability
 
                             // Compute third integral
+                            PROFILE_START(third_start);
 #ifdef LEGENDRE
                             locint.third(prim_list, prim_ids, pln, particle_j, particle_k, pid_j, pid_k, bin_ij, w_ij, xi_ik, w_ijk, p3,factor_ij,poly_ij);
 #elif defined POWER
@@ -409,14 +458,17 @@
 #else
                             locint.third(prim_list, prim_ids, pln, particle_j, particle_k, pid_j, pid_k, bin_ij, w_ij, xi_ik, w_ijk, p3);
 #endif
+                            PROFILE_STOP(third_start, STAGE_THIRD);
 
                             // LOOP OVER N4 L CELLS
                             for (int n4=0; n4<par->N4; n4++){
                                 cell_attempt4+=1; // new fourth cell attempted
 
                                 // Draw fourth cell from j cell weighted by xi_24(r)
+                                PROFILE_SAMPLED_START(draw_start);
                                 delta4 = rd24->random_xidraw(locrng,&p4);
                                 x = draw_particle_without_class(sec_id+delta4,particle_l,pid_l,cell_sep2+grid4->cell_sep(delta4),grid4,fln,locrng); // draw from 4th grid
+                                PROFILE_SAMPLED_STOP(draw_start, x==1 ? STAGE_REJECT : STAGE_DRAW);
                                 if (x==1) continue; // skip failed draws
                                 if (((pid_l==pid_j) && (I4==I2)) || ((pid_l==pid_k) && (I4==I3))) continue; // skip jl and kl self-counts
 
@@ -426,15 +478,25 @@
 
 
                                 // Now compute the four-point integral
-#ifdef LEGENDRE
-                                locint.fourth(prim_list, prim_ids, pln, particle_j, particle_k, particle_l, pid_j, pid_k, pid_l, bin_ij, w_ijk, xi_ik, p4, factor_ij, poly_ij);
-#elif defined POWER
+                                PROFILE_START(fourth_start);
+#ifdef POWER
                                 locint.fourth(prim_list, prim_ids, pln, particle_j, particle_k, particle_l, pid_j, pid_k, pid_l, bin_ij, w_ijk, xi_ik, p4, poly_ij);
 #else
-                                locint.fourth(prim_list, prim_ids, pln, particle_j, particle_k, particle_l, pid_j, pid_k, pid_l, bin_ij, w_ijk, xi_ik, p4);
+                                locint.fourth_draw(particle_j, particle_k, particle_l, pid_j, pid_k, pid_l, p4); // collect the l particle, added for all i particles below
 #endif
+                                PROFILE_STOP(fourth_start, STAGE_FOURTH);
 
                             }
+#ifndef POWER
+                            // Add the four-point integral of all l particles of this k particle
+                            PROFILE_START(fourth_start);
+#ifdef LEGENDRE
+                            locint.fourth(prim_list, prim_ids, pln, particle_j, particle_k, bin_ij, w_ijk, xi_ik, factor_ij, poly_ij);
+#else
+                            locint.fourth(prim_list, prim_ids, pln, particle_j, particle_k, bin_ij, w_ijk, xi_ik);
+#endif
+                            PROFILE_STOP(fourth_start, STAGE_FOURTH);
+#endif
                         }
                     }
                 }
@@ -444,6 +506,7 @@
                 tot_triples+=loc_used_triples;
                 tot_quads+=loc_used_quads;
 
+                PROFILE_START(reduction_start); // includes the wait for the lock
     #ifdef OPENMP
     #pragma omp critical // only one processor can access at once
     #endif
@@ -481,28 +544,44 @@
                 // Save output if the group is done
                 if (completed_loops % par->loops_per_sample == 0) {
                     sumint.sum_ints(&outint); // add to grand total
-                    char output_string[50];
-                    snprintf(output_string, 50, "%d", subsample_index);
 #ifndef POWER
                     outint.normalize(grid1->norm, grid2->norm, grid3->norm, grid4->norm, (Float)used_pairs_per_sample, (Float)used_triples_per_sample, (Float)used_quads_per_sample);
 #else
                     outint.normalize(grid1->norm, grid2->norm, grid3->norm, grid4->norm, (Float)used_pairs_per_sample, (Float)used_triples_per_sample, (Float)used_quads_per_sample, par->power_norm);
 #endif
+                    PROFILE_START(io_start);
+#ifndef POWER
+                    writer.submit(&outint, subsample_index); // hand over to the writer thread; outint now holds an already saved subsample
+#else
+                    char output_string[50];
+                    snprintf(output_string, 50, "%d", subsample_index);
                     outint.save_integrals(output_string, 0);
-#ifdef JACKKNIFE
-                    outint.save_jackknife_integrals(output_string);
 #endif
+                    PROFILE_STOP(io_start, STAGE_IO);
                     // Reset the current output sample variables
                     outint.reset();
                     used_pairs_per_sample = used_triples_per_sample = used_quads_per_sample = 0;
                 }
                 locint.sum_total_counts(cnt2, cnt3, cnt4);
                 locint.reset();
-
+                PROFILE_STOP(reduction_start, STAGE_REDUCTION);
                 }
 
             LoopTimes[n_loops].Stop();
+#ifdef PROFILE
+            profile.record_loop(n_loops, thread, &loc_counters, LoopTimes[n_loops].Elapsed());
+#endif
             } // end cycle loop
+#ifdef PROFILE
+            thread_counters = NULL;
+#endif
+#ifdef PERF_COUNTERS
+            loc_perf.stop();
+    #ifdef OPENMP
+    #pragma omp critical
+    #endif
+            perf_totals.sum(&loc_perf);
+#endif
 
             // Free up allocated memory at end of process
             free(prim_list);
@@ -514,6 +593,9 @@
 
     //-----------REPORT + SAVE OUTPUT---------------
         TotalTime.Stop();
+#ifndef POWER
+        writer.finish(); // make sure all subsamples are saved
+#endif
 
         // Normalize the accumulated results, using the RR counts
 #ifndef POWER
@@ -544,9 +626,26 @@
 
         printf("\nTrial speed: %.2e quads per core per second\n",double(tot_quads)/(runtime*double(par->nthread)));
         printf("Acceptance speed: %.2e quads per core per second\n",double(cnt4)/(runtime*double(par->nthread)));
+#ifdef PERF_COUNTERS
+        perf_totals.report(cnt4);
+#endif
 
         char out_string[5];
         snprintf(out_string, 5, "full");
+#ifdef PROFILE
+        thread_counters = &profile.final_counters;
+#endif
+        PROFILE_START(io_start);
+#if (!defined LEGENDRE && !defined POWER)
+        if (sumint.in_memory()) {
+            // Library interface: hand the results to the caller's arrays instead of saving them
+            sumint.store_arrays(0);
+            par->memory_output->counts[0] = tot_pairs;
+            par->memory_output->counts[1] = tot_triples;
+            par->memory_output->counts[2] = tot_quads;
+        }
+        else {
+#endif
         sumint.save_integrals(out_string,1); // save integrals to file
         sumint.save_counts(tot_pairs,tot_triples,tot_quads); // save total pair/triple/quads attempted to file
 #ifdef POWER
@@ -556,6 +655,14 @@
 #elif defined JACKKNIFE
         sumint.save_jackknife_integrals(out_string);
         printf("Printed jackknife integrals to file in the %sCovMatricesJack/ directory\n",par->out_file);
+#endif
+#if (!defined LEGENDRE && !defined POWER)
+        }
+#endif
+        PROFILE_STOP(io_start, STAGE_IO);
+#ifdef PROFILE
+        thread_counters = NULL;
+        profile.save(par->out_file, nbin, mbin, I1, I2, I3, I4, par->nthread);
 #endif
         fflush(NULL);
         return;
@@ -17,10 +17,11 @@ class compute_integral{
             // function updates a list of particles for a 1-dimensional ID. Output is number of particles in list.
             
             Cell cell = grid->c[id_1D]; // cell object 
+            Float3 center = grid->cell_center(id_1D); // for decoding compressed particles
             int no_particles = 0;
             // copy in list of particles into list
             for (int i = cell.start; i<cell.start+cell.np; i++, no_particles++){
-                part_list[no_particles]=grid->p[i];
+                part_list[no_particles]=grid->particle(i, center);
                 id_list[no_particles]=i;
             }
             
@@ -36,7 +37,7 @@ class compute_integral{
             Cell cell = grid->c[id_1D];
             if(cell.np==0) return 1; // error if empty cell
             pid = floor(gsl_rng_uniform(locrng)*cell.np) + cell.start; // draw random ID
-            particle = grid->p[pid]; // define particle
+            particle = grid->particle(pid, grid->cell_center(id_1D)); // define particle
             n_particles = cell.np; // no. of particles in cell 
     #ifdef PERIODIC
             particle.pos+=shift;
@@ -87,10 +88,10 @@ class compute_integral{
             // Decide which thread we are in
             int thread = omp_get_thread_num();
             assert(omp_get_num_threads()<=par->nthread);
-            if (thread==0) printf("# Starting integral computation %d of %d on %d threads.\n", iter_no, tot_iter, omp_get_num_threads());        
+            if (thread==0) printf("# Starting integral computation %d of %d on %d threads.\n", iter_no+1, tot_iter, omp_get_num_threads());        
 #else
             int thread = 0;
-            printf("# Starting integral computation %d of %d single threaded.\n",iter_no,tot_iter);
+            printf("# Starting integral computation %d of %d single threaded.\n",iter_no+1,tot_iter);
             { // start loop
 #endif
             
@@ -254,8 +255,8 @@ class compute_integral{
                                     
                                     p5*=p4/(double)filn;
                                     
-                                    // Now compute the four-point integral
-                                    locint.fifth(prim_list, prim_ids, pln, particle_j, particle_k, particle_l, particle_m, pid_j, pid_k, pid_l, pid_m, p5, w_ijkl, bins_ijk, correction_ijk, legendre_ijk, xi_pass, xi_pass2, norm_kl, bin_kl, w_ijklm, xi_pass3, norm_lm, bin_lm, iter_no); 
+                                    // Collect the m particle for the five-point integral
+                                    locint.fifth_draw(prim_ids, pln, particle_j, particle_k, particle_l, particle_m, pid_m, p5, w_ijkl, norm_kl, bin_kl, w_ijklm, xi_pass3, norm_lm, bin_lm, iter_no); 
                                     
                                     // LOOP OVER N6 N CELLS
                                     for (int n6=0; n6<par->N6; n6++){
@@ -280,10 +281,16 @@ class compute_integral{
                                         
                                         p6*=p5/(double)siln;
                                         
-                                        // Now compute the four-point integral
-                                        locint.sixth(prim_list, prim_ids, pln, particle_j, particle_k, particle_l, particle_m, particle_n, pid_j, pid_k, pid_l, pid_m, pid_n, p6, w_ijklm, bins_ijk, correction_ijk, legendre_ijk, xi_pass, xi_pass2, xi_pass3, norm_lm, bin_lm, iter_no); 
+                                        // Collect the n particle for the six-point integral
+                                        locint.sixth_draw(particle_k, particle_l, particle_m, particle_n, pid_n, p6, xi_pass2, xi_pass3, norm_lm, bin_lm, iter_no); 
                                     }
+                                    
+                                    // Add the six-point integral of all n particles of this m particle
+                                    locint.sixth(prim_ids, pln, w_ijklm, bins_ijk, correction_ijk, legendre_ijk, xi_pass, xi_pass2, iter_no);
                                 }
+                                
+                                // Add the five-point integral of all m particles of this l particle
+                                locint.fifth(prim_ids, pln, particle_k, w_ijkl, bins_ijk, correction_ijk, legendre_ijk, xi_pass, xi_pass2, iter_no);
                             }
                         }
                     }
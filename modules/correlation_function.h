@@ -3,16 +3,33 @@
 #ifndef CORRELATION_FUNCTION_H
 #define CORRELATION_FUNCTION_H
 
+#include "stage_profile.h"
+#include <memory>
+
 class CorrelationFunction{
     /* Reads and stores a 2d correlation function. Values in between the grid positions of the input
     * are interpolated using gsl_interp2d
     */
     private:
+        struct Tables{
+            // The grid and interpolation tables, which are not modified once set up and hence shared by all copies of the function
+            double *x = NULL, *y = NULL, *z = NULL;
+            gsl_interp2d* interp_2d = NULL;
+            gsl_spline* corfu1d = NULL;
+            ~Tables(){
+                if (interp_2d) gsl_interp2d_free(interp_2d);
+                if (corfu1d) gsl_spline_free(corfu1d);
+                free(x);
+                free(y);
+                free(z);
+            }
+        };
+        std::shared_ptr<Tables> tables; // owns x, y, z, interp_2d and corfu1d below
         int xsize, ysize;
         double *x,*y,*z;
         double rmin,rmax,mumin,mumax;
         bool mudim = 0;
-        gsl_interp_accel *xa, *ya, *x1a;
+        gsl_interp_accel *xa = NULL, *ya = NULL, *x1a = NULL; // the accelerators hold the last interval looked up, so each copy has its own
         gsl_interp2d* interp_2d;
         gsl_spline* corfu1d;
         bool interp_setup = 0;
@@ -35,6 +52,7 @@ class CorrelationFunction{
             // xi values beyond the maximal radius in the correlation function file read in are extrapolated
             // as a simple r^-4 power law for each mu bin independently (may lead to different signs for
             // neighbouring mu bins if the correlation function is noisy and fluctuates around 0)
+            PROFILE_SAMPLED_SCOPE(STAGE_XI);
             if(mudim){
                 assert(mu>=0);
                 if(r>rmax){
@@ -173,7 +191,9 @@ class CorrelationFunction{
         }
     public:
         void copy_function(CorrelationFunction *cf){
-        // Copy a preexisting correlation function into this object
+        // Copy a preexisting correlation function into this object, sharing its (read-only) tables
+            if (cf==this) return;
+            release();
             xsize=cf->xsize;
             ysize=cf->ysize;
             rmin=cf->rmin;
@@ -181,55 +201,60 @@ class CorrelationFunction{
             mumin=cf->mumin;
             mumax=cf->mumax;
             mudim=cf->mudim;
+            tables=cf->tables;
+            x=cf->x;
+            y=cf->y;
+            z=cf->z;
+            interp_2d=cf->interp_2d;
+            corfu1d=cf->corfu1d;
+            interp_setup=cf->interp_setup;
+            alloc_accelerators();
+        }
 
-            // Allocate memory
-            x = (double *)malloc(sizeof(double)*xsize);
-            y = (double *)malloc(sizeof(double)*ysize);
-            z = (double *)malloc(sizeof(double)*xsize*ysize);
-
-            // Read in x,y,z grids
-            int ct=0;
-            for(int i=0;i<xsize;i++){
-                x[i]=cf->x[i];
-                for(int j=0;j<ysize;j++){
-                    z[ct]=cf->z[ct];
-                    ct++;
-                }
-            }
-            for(int j=0;j<ysize;j++) y[j]=cf->y[j];
-            // activate the interpolator function here
-            interpolate();
+        CorrelationFunction& operator=(CorrelationFunction&& cf){
+        // Move assignment: take over the tables and accelerators of cf without copying
+            if (this==&cf) return *this;
+            release();
+            xsize=cf.xsize;
+            ysize=cf.ysize;
+            rmin=cf.rmin;
+            rmax=cf.rmax;
+            mumin=cf.mumin;
+            mumax=cf.mumax;
+            mudim=cf.mudim;
+            tables=std::move(cf.tables);
+            x=cf.x;
+            y=cf.y;
+            z=cf.z;
+            interp_2d=cf.interp_2d;
+            corfu1d=cf.corfu1d;
+            interp_setup=cf.interp_setup;
+            xa=cf.xa;
+            ya=cf.ya;
+            x1a=cf.x1a;
+            cf.xa=cf.ya=cf.x1a=NULL;
+            cf.interp_setup=0;
+            return *this;
         }
 
     private:
-        void copy(int& _xsize, int& _ysize, double ** _x, double ** _y, double ** _z, double& _rmin,
-                double& _rmax, double& _mumin, double& _mumax, bool& _mudim){
-            // Copy correlation function object
-
-            _xsize=xsize;
-            _ysize=ysize;
-            _rmin=rmin;
-            _rmax=rmax;
-            _mumin=mumin;
-            _mumax=mumax;
-            _mudim=mudim;
-
-            *_x = (double *)malloc(sizeof(double)*xsize);
-            *_y = (double *)malloc(sizeof(double)*ysize);
-            *_z = (double *)malloc(sizeof(double)*xsize*ysize);
-
-            int ct=0;
-            for(int i=0;i<xsize;i++){
-                (*_x)[i]=x[i];
-                for(int j=0;j<ysize;j++){
-                    (*_z)[ct]=z[ct];
-                    ct++;
-                }
+        void alloc_accelerators(){
+            if (!interp_setup) return;
+            if (mudim) {
+                xa = gsl_interp_accel_alloc();
+                ya = gsl_interp_accel_alloc();
             }
+            x1a = gsl_interp_accel_alloc();
+        }
 
-            for(int j=0;j<ysize;j++){
-                (*_y)[j]=y[j];
-            }
+        void release(){
+            // Free the accelerators and drop this copy's reference to the tables
+            if (xa) gsl_interp_accel_free(xa);
+            if (ya) gsl_interp_accel_free(ya);
+            if (x1a) gsl_interp_accel_free(x1a);
+            xa=ya=x1a=NULL;
+            tables.reset();
+            interp_setup=0;
         }
 
         void interpolate(){
@@ -248,32 +273,67 @@ class CorrelationFunction{
                 y1[i]/=col;
             }
 
+            tables = std::make_shared<Tables>(); // takes ownership of x, y and z
+            tables->x = x;
+            tables->y = y;
+            tables->z = z;
             if(mudim){
                 interp_2d=gsl_interp2d_alloc(gsl_interp2d_bicubic, ysize, xsize);
                 gsl_interp2d_init(interp_2d, y, x, z, ysize, xsize);
-                xa = gsl_interp_accel_alloc();
-                ya = gsl_interp_accel_alloc();
+                tables->interp_2d = interp_2d;
             }
 
             corfu1d=gsl_spline_alloc(gsl_interp_cspline, xsize);
-            gsl_spline_init(corfu1d, x, y1, xsize);
-            x1a = gsl_interp_accel_alloc();
+            gsl_spline_init(corfu1d, x, y1, xsize); // this copies y1
+            tables->corfu1d = corfu1d;
+            free(y1);
             interp_setup = 1;
+            alloc_accelerators();
         }
     public:
         CorrelationFunction(){
             // empty constructor
         }
         CorrelationFunction(CorrelationFunction* corr){
-            // Copy constructor
-
-            corr->copy(xsize,ysize,&x,&y,&z,rmin,rmax,mumin,mumax,mudim);
-            interpolate();
+            // Copy constructor, sharing the tables of corr (e.g. to give each thread its own accelerators)
+            copy_function(corr);
+        }
+        CorrelationFunction(CorrelationFunction&& corr){
+            // Move constructor
+            *this = std::move(corr);
         }
     CorrelationFunction(const char *filename, int nbin, Float *r_low, Float *r_high, int mbin, Float dmu){
         // Construct from input file
 
         readData(filename,&x,&y,&z,&xsize,&ysize);
+        setup(nbin, r_low, r_high, mbin, dmu);
+    }
+    CorrelationFunction(const Float *xi_values, const Float *r_values, const Float *mu_values, int nbin, Float *r_low, Float *r_high, int mbin, Float dmu){
+        // Construct from arrays with the contents of the input file (for the library interface in librascalc/): nbin radial bin centers, mbin mu bin centers
+        // and the nbin x mbin correlation function values, which are then treated exactly as if read from file
+
+        int offset = (r_values[0]!=0.); // add an r=0 entry if there is none, as in readData
+        xsize = nbin+offset;
+        ysize = mbin;
+        x = (double *)malloc(sizeof(double)*xsize);
+        y = (double *)malloc(sizeof(double)*ysize);
+        z = (double *)malloc(sizeof(double)*xsize*ysize);
+        if (offset) {
+            x[0] = 0.;
+            for (int j = 0; j < ysize; j++) z[j] = 0.;
+        }
+        for (int i = 0; i < nbin; i++) {
+            x[i+offset] = r_values[i];
+            for (int j = 0; j < ysize; j++) z[(i+offset)*ysize+j] = xi_values[i*mbin+j];
+        }
+        for (int j = 0; j < ysize; j++) y[j] = mu_values[j];
+        printf("# Using %d radial and %d mu bins of the correlation function\n", xsize-1, ysize);
+        setup(nbin, r_low, r_high, mbin, dmu);
+    }
+
+private:
+    void setup(int nbin, Float *r_low, Float *r_high, int mbin, Float dmu){
+        // Check the correlation function grid against the binning, multiply by r^2 and set up the interpolation
 
         if (xsize != nbin+1) {
           fprintf(stderr,"%d r-bins found in correlation function file but %d specified in parameters.\n", xsize-1, nbin);
@@ -316,6 +376,8 @@ class CorrelationFunction{
         interpolate();
 
     }
+
+public:
     CorrelationFunction(Float* xi_array, Float * r_array, Float* mu_array, int nbin, int mbin){
         // Construct from input array
 
@@ -354,17 +416,8 @@ class CorrelationFunction{
     }
 
     ~CorrelationFunction() {
-        // Destructor
-
-        if (mudim) {
-            gsl_interp2d_free(interp_2d);
-            gsl_interp_accel_free(xa);
-            gsl_interp_accel_free(ya);
-        }
-        if (interp_setup) {
-            gsl_spline_free(corfu1d);
-            gsl_interp_accel_free(x1a);
-        }
+        // Destructor; the tables are freed with their last copy
+        release();
     }
 
 };
@@ -1,10 +1,15 @@
 // driver.h - this contains various c++ functions to create particles in random positions / read them in from file. Based on code by Alex Wiegand.
 #include "cell_utilities.h"
+#include "npy_utilities.h"
+#include "huge_pages.h"
 #ifndef LEGENDRE
 #ifndef POWER
     #include "jackknife_weights.h"
 #endif
 #endif
+#ifdef JACKKNIFE
+#include "jackknife_assignment.h"
+#endif
 
 #ifndef DRIVER_H
 #define DRIVER_H
@@ -14,7 +19,9 @@
 Particle *make_particles(Float3 rect_boxsize, int np, int index) {
     // Make np random particles
     srand48(index+1); // For reproducibility but not identical for different tracers
-    Particle *p = (Particle *)malloc(sizeof(Particle)*np);
+    Particle *p;
+    int ec=huge_page_alloc((void **) &p, sizeof(Particle)*np);
+    assert(ec==0);
     for (int j=0; j<np; j++) {
         p[j].pos.x = drand48()*rect_boxsize.x;
         p[j].pos.y = drand48()*rect_boxsize.y;
@@ -31,48 +38,68 @@ Particle *make_particles(Float3 rect_boxsize, int np, int index) {
 }
 
 #ifdef JACKKNIFE
-Particle *read_particles(Float rescale, int *np, const char *filename, const int rstart, uint64 nmax, const JK_weights *JK) {
+Particle *read_particles(Float rescale, int *np, const char *filename, const int rstart, uint64 nmax, const JK_weights *JK, JackknifeAssignment *assign) {
 #else
 Particle *read_particles(Float rescale, int *np, const char *filename, const int rstart, uint64 nmax) {
 #endif
     // This will read particles from a file, space-separated x,y,z,w,JK for weight w, (jackknife region JK)
+    // In the JACKKNIFE mode, the regions may instead be assigned from the particle positions by assign, in which case the JK column is not needed
+    // Files ending in .npy are instead read as a binary (n,4) or (n,5) array of doubles with the same columns, e.g. as written by convert_to_xyz/
     // Particle positions will be rescaled by the variable 'rescale'.
     // For example, if rescale==boxsize, then inputting the unit cube will cover the periodic volume
     char line[1000];
     int j=0,n=0;
     FILE *fp;
-    int stat;
+    int stat = 0;
     double tmp[5];
-
-    fp = fopen(filename, "r");
+    bool npy = is_npy(filename);
+
+    if (npy) {
+        int n_dims;
+        long long shape[8];
+        fp = open_npy(filename, n_dims, shape);
+        if (fp!=NULL&&(n_dims!=2||shape[1]<4||shape[1]>5)) {
+            fprintf(stderr,"File %s must hold an array of shape (n,4) or (n,5)\n", filename); abort();
+        }
+        if (fp!=NULL) {
+            n = std::min((uint64)shape[0], nmax);
+            stat = shape[1];
+        }
+    }
+    else fp = fopen(filename, "r");
     if (fp==NULL) {
         fprintf(stderr,"File %s not found\n", filename); abort();
     }
 
-#ifdef JACKKNIFE
-    // Store filled jackknives in local memory to avoid file corruption
-    int tmp_n_JK = JK->n_JK_filled;
-    int tmp_filled_JK[tmp_n_JK];
-    for(int ii=0;ii<tmp_n_JK;ii++) tmp_filled_JK[ii]=JK->filled_JKs[ii];
-#endif
-    
     // Count lines to construct the correct size
-    while (fgets(line,1000,fp)!=NULL&&(uint)n<nmax) {
-        if (line[0]=='#') continue;
-        if (line[0]=='\n') continue;
-        n++;
+    if (!npy) {
+        while (fgets(line,1000,fp)!=NULL&&(uint)n<nmax) {
+            if (line[0]=='#') continue;
+            if (line[0]=='\n') continue;
+            n++;
+        }
+        rewind(fp);
     }
-    rewind(fp);
     
     *np = n;
-    Particle *p = (Particle *)malloc(sizeof(Particle)*n);
+    Particle *p;
+    int ec=huge_page_alloc((void **) &p, sizeof(Particle)*n);
+    assert(ec==0);
     printf("# Found %d particles from %s\n", n, filename);
     printf("# Rescaling input positions by factor %f\n", rescale);
     
-    while (fgets(line,1000,fp)!=NULL&&j<n) {
-        if (line[0]=='#') continue;
-        if (line[0]=='\n') continue;
-        stat=sscanf(line, "%lf %lf %lf %lf %lf", tmp, tmp+1, tmp+2, tmp+3, tmp+4);
+    while (j<n) {
+        if (npy) {
+            if (fread(tmp, sizeof(double), stat, fp)!=(size_t)stat) {
+                fprintf(stderr,"File %s is truncated\n", filename); abort();
+            }
+        }
+        else {
+            if (fgets(line,1000,fp)==NULL) break;
+            if (line[0]=='#') continue;
+            if (line[0]=='\n') continue;
+            stat=sscanf(line, "%lf %lf %lf %lf %lf", tmp, tmp+1, tmp+2, tmp+3, tmp+4);
+        }
 
         if (stat<4) {
         	fprintf(stderr,"Particle %d has bad format\n", j); // Not enough coordinates
@@ -87,25 +114,16 @@ Particle *read_particles(Float rescale, int *np, const char *filename, const int
         // Get the weights from line 4 if present, else fill with +1/-1 depending on the value of rstart
         // For grid_covariance rstart is typically not used
 #ifdef JACKKNIFE
-        if(stat!=5)
-		   if(rstart>0&&j>=rstart)
-			   p[j].w = -1.;
-		   else
-			   p[j].w = 1.;
-		else{
-		   if(rstart>0&&j>=rstart)
-			   p[j].w = -tmp[stat-2]; //read in weights
-		   else
-			   p[j].w = tmp[stat-2]; 
-        int tmp_JK = tmp[stat-1]; // read in JK region
-		
-		// Collapse jacknife indices to only include filled JKs:
-		p[j].JK=-1;
-        
-        for (int x=0;x<tmp_n_JK;x++){
-            if (tmp_filled_JK[x]==tmp_JK) p[j].JK=x;
+        if(stat!=5&&assign->scheme==JackknifeAssignment::FILE_COLUMN) {
+            fprintf(stderr,"Particle %d has no jackknife region; x,y,z,w,JK are required unless the regions are assigned with -jk_assign\n", j);
+            abort();
         }
-        assert(p[j].JK!=-1); // ensure we find jackknife index		    
+        else{
+            if(rstart>0&&j>=rstart)
+                p[j].w = -tmp[3]; // read in weights
+            else
+                p[j].w = tmp[3];
+            p[j].JK = (stat==5) ? tmp[4] : -1; // read in JK region (collapsed to the filled JKs below)
 #else
         if((stat!=4)&&(stat!=5))
             if(rstart>0&&j>=rstart)
@@ -123,6 +141,11 @@ Particle *read_particles(Float rescale, int *np, const char *filename, const int
 		j++;
     }
     fclose(fp);
+#ifdef JACKKNIFE
+    // Assign the jackknife regions from the positions if required, then collapse the region labels to only include filled JKs
+    if (assign->scheme!=JackknifeAssignment::FILE_COLUMN) assign->assign(p, n);
+    collapse_jackknife_labels(p, n, JK->filled_JKs, JK->n_JK_filled, filename);
+#endif
     printf("# Done reading the particles\n");
     
     return p;
@@ -1,5 +1,8 @@
 //grid class for grid_covariance.cpp file (modified from Alex Wiegand)
 #include "cell_utilities.h"
+#include "numa_utilities.h"
+#include "huge_pages.h"
+#include <vector>
 
 #ifndef GRID_H
 #define GRID_H
@@ -8,15 +11,19 @@ class Grid {
   public:
     Float3 rect_boxsize; // 3D dimensions of the periodic volume
     int nside, ncells;       // Grid size (per linear and per volume)
-    Cell *c;		// The list of cells
+    Cell *c = NULL;		// The list of cells
     Float cellsize;   // Size of one cell
     Float max_boxsize; // largest dimension of the cuboid box
-    Particle *p;	// Pointer to the list of particles
+    Particle *p = NULL;	// Pointer to the list of particles (NULL once compressed)
+    int compact_bits = 0; // Bits per position coordinate of the compressed particles (16 or 32), 0 if not compressed
+    CompactParticle<uint16_t> *p16 = NULL; // The compressed particles (see compress)
+    CompactParticle<uint32_t> *p32 = NULL;
+    Float3 origin; // Position of the corner of the first cell (the shift of the non-periodic grid)
     int np,np1,np2;		// Number of particles (total and number in each partition
     integer3 nside_cuboid; // number of cells along each dimension of cuboidal box
     int np_pos;		// Number of particles
-    int *pid;		// The original ordering
-    int *filled; //List of filled cells
+    int *pid = NULL;		// The original ordering
+    int *filled = NULL; //List of filled cells
     int nf;      //Number of filled cells
     int maxnp;   //Max number of particles in a single cell
     Float norm; // sum_weights randoms / sum_weights galaxies for normalization
@@ -76,46 +83,93 @@ class Grid {
         return pos-cellsize*(floor3(pos/cellsize)+Float3(0.5,0.5,0.5));
     }
 
+    Float3 cell_center(int id_1D) {
+        // Return the center of a cell, relative to which the compressed particles are stored.
+        // This is zero if the particles are not compressed, or for the periodic grid whose positions are already cell-centered.
+#ifndef PERIODIC
+        if (compact_bits>0) return origin+cellsize*(Float3(cell_id_from_1d(id_1D))+Float3(0.5,0.5,0.5));
+#endif
+        return Float3(0.,0.,0.);
+    }
+
+    inline Particle particle(int i, Float3 center) {
+        // Return particle i, decoding it if the particles are compressed; center must be cell_center() of its cell
+        if (compact_bits==16) return p16[i].decode(center, cellsize);
+        if (compact_bits==32) return p32[i].decode(center, cellsize);
+        return p[i];
+    }
+
+    size_t particle_bytes() {
+        // Memory used by the list of particles
+        if (compact_bits==16) return sizeof(CompactParticle<uint16_t>)*np;
+        if (compact_bits==32) return sizeof(CompactParticle<uint32_t>)*np;
+        return sizeof(Particle)*np;
+    }
+
+    const void *particle_array() {
+        // The list of particles in its current format
+        if (compact_bits==16) return p16;
+        if (compact_bits==32) return p32;
+        return p;
+    }
+
     Float3 cell_sep(integer3 sep) {
         // Return the position difference corresponding to a cell separation
         return cellsize*sep;
     }
     
-    void copy(Grid *g){
-        // Copy grid object
-        rect_boxsize=g->rect_boxsize; 
-        nside=g->nside;
-        ncells=g->ncells;
-        cellsize=g->cellsize;
-        max_boxsize=g->max_boxsize;
-        np=g->np;
-        np1=g->np1;
-        np2=g->np2;
-        nside_cuboid = g->nside_cuboid;
-        np_pos = g->np_pos;
-        norm = g->norm;
-        nf=g->nf;
-        maxnp=g->maxnp;
-        sumw_pos=g->sumw_pos;
-        sumw_neg=g->sumw_neg;
-        sum_weights=g->sum_weights;
-        
-        // Allocate memory:
-        p = (Particle *)malloc(sizeof(Particle)*np);
-        pid = (int *)malloc(sizeof(int)*np);
-        c  = (Cell *)malloc(sizeof(Cell)*ncells);
-        filled = (int *)malloc(sizeof(int)*nf);
-	
-        // Copy in lists elementwise
-        for(int j=0;j<ncells;j++) c[j]=g->c[j];
-        for(int j=0;j<np;j++) p[j]=g->p[j];
-        for(int j=0;j<np;j++) pid[j]=g->pid[j];
-        for(int j=0;j<nf;j++) filled[j]=g->filled[j];
+    Grid(Grid&& g){
+        // Move constructor: take over the arrays of g, leaving it empty
+        *this = std::move(g);
+    }
+
+    Grid& operator=(Grid&& g){
+        // Move assignment: release the arrays of this grid and take over those of g without copying
+        if (this==&g) return *this;
+        free(p);
+        free(p16);
+        free(p32);
+        free(pid);
+        free(c);
+        free(filled);
+        rect_boxsize=g.rect_boxsize;
+        nside=g.nside;
+        ncells=g.ncells;
+        cellsize=g.cellsize;
+        max_boxsize=g.max_boxsize;
+        np=g.np;
+        np1=g.np1;
+        np2=g.np2;
+        nside_cuboid = g.nside_cuboid;
+        np_pos = g.np_pos;
+        norm = g.norm;
+        nf=g.nf;
+        maxnp=g.maxnp;
+        sumw_pos=g.sumw_pos;
+        sumw_neg=g.sumw_neg;
+        sum_weights=g.sum_weights;
+        origin=g.origin;
+        compact_bits=g.compact_bits;
+        p=g.p;
+        p16=g.p16;
+        p32=g.p32;
+        pid=g.pid;
+        c=g.c;
+        filled=g.filled;
+        g.p=NULL;
+        g.p16=NULL;
+        g.p32=NULL;
+        g.pid=NULL;
+        g.c=NULL;
+        g.filled=NULL;
+        return *this;
     }
 
     ~Grid() {
 	// The destructor
         free(p);
+        free(p16);
+        free(p32);
         free(pid);
         free(c);
         free(filled);
@@ -126,27 +180,56 @@ class Grid {
        //empty constructor
     }
 
-    Grid(Particle *input, int _np, Float3 _rect_boxsize, Float _cellsize, int _nside, Float3 shift, Float nofznorm) {
+    void interleave() {
+        // Spread the particles and cells, which all threads read, over the NUMA nodes
+        interleave_memory(particle_array(), particle_bytes());
+        interleave_memory(pid, sizeof(int)*np);
+        interleave_memory(c, sizeof(Cell)*ncells);
+        interleave_memory(filled, sizeof(int)*nf);
+    }
+
+    static int count_filled_cells(Particle *input, int _np, Float3 _rect_boxsize, Float _cellsize, int _nside, Float3 shift) {
+        // Number of cells the particles would fill in a grid constructed with the same arguments, without copying the particles.
+        // This allows nside to be chosen before the grid is created.
+        Grid g;
+        g.set_geometry(_rect_boxsize, _cellsize, _nside);
+        std::vector<bool> used(g.ncells, false);
+        int nf = 0;
+        for (int j=0; j<_np; j++) {
+#ifdef PERIODIC
+            int id = g.pos_to_cell(input[j].pos);
+#else
+            int id = g.pos_to_cell(input[j].pos - shift);
+#endif
+            if (!used[id]) {
+                used[id] = true;
+                nf++;
+            }
+        }
+        return nf;
+    }
+
+    Grid(Particle *input, int _np, Float3 _rect_boxsize, Float _cellsize, int _nside, Float3 shift, Float nofznorm, bool in_place = false) {
         // The constructor: the input set of particles is copied into a
         // new list, which is ordered by cell.
         // After this, Grid is self-sufficient; one could discard *input
-        rect_boxsize = _rect_boxsize;
-        nside = _nside;
-        assert(nside<1025);   // Can't guarantee won't spill int32 if bigger
+        // With in_place, the input list (which must be malloc'ed) is instead reordered in place and owned by the grid,
+        // so that the particles are never held twice; the caller must then not use or free it.
+        set_geometry(_rect_boxsize, _cellsize, _nside);
+        origin = shift;
         np = _np;
-        cellsize = _cellsize;
         np_pos = 0;
-        max_boxsize=fmax(rect_boxsize.x,fmax(rect_boxsize.y,rect_boxsize.z));
-        assert(max_boxsize>0&&nside>0&&np>=0);
-        nside_cuboid = integer3(ceil3(rect_boxsize/cellsize));
-        ncells = nside_cuboid.x*nside_cuboid.y*nside_cuboid.z;
+        assert(np>=0);
             
-        p = (Particle *)malloc(sizeof(Particle)*np);
-        pid = (int *)malloc(sizeof(int)*np);
-        printf("# Allocating %6.3f MB of particles\n", (sizeof(Particle)+sizeof(int))*np/1024.0/1024.0);
+        int ec=0;
+        if (in_place) p = input;
+        else ec+=huge_page_alloc((void **) &p, sizeof(Particle)*np);
+        ec+=huge_page_alloc((void **) &pid, sizeof(int)*np);
+        printf("# Allocating %6.3f MB of particles\n", ((in_place ? 0 : sizeof(Particle))+sizeof(int))*np/1024.0/1024.0);
         printf("# Allocating %6.3f MB of cells\n", (sizeof(Cell))*ncells/1024.0/1024.0);
 
-        c = (Cell *)malloc(sizeof(Cell)*ncells);
+        ec+=huge_page_alloc((void **) &c, sizeof(Cell)*ncells);
+        assert(ec==0);
 
         // Now we want to copy the particles, but do so into grid order.
         // First, figure out the cell for each particle
@@ -199,25 +282,47 @@ class Grid {
         for (int j=0; j<np; j++) {
             Cell *thiscell = c+cell[j];
             int index = thiscell->start+thiscell->np;
-            p[index] = input[j];
+            Particle *pj = input+j; // the particle at its final position if copying, otherwise in place until reordered below
+            if (!in_place) {
+                p[index] = input[j];
+                pj = p+index;
+            }
 #ifdef PERIODIC
-            p[index].pos = cell_centered_pos(input[j].pos);
+            pj->pos = cell_centered_pos(input[j].pos);
                 // Switch to cell-centered positions
 #endif
             pid[index] = j;	 // Storing the original index
+            if (in_place) cell[j] = index; // the cell is no longer needed, store the destination instead
 
         
             thiscell->np += 1;
-            if(p[index].rand_class==0){
+            if(pj->rand_class==0){
                 thiscell->np1+=1;
                 np1++;
             }
-            if(p[index].rand_class==1){
+            if(pj->rand_class==1){
                 thiscell->np2+=1;
                 np2++;
             }
         }
 
+        if (in_place) {
+            // Move each particle to its destination by following the cycles of the permutation, marking the placed ones with -1
+            for (int j=0; j<np; j++) {
+                if (cell[j]<0) continue;
+                Particle moving = p[j];
+                int k = cell[j];
+                cell[j] = -1;
+                while (k!=j) {
+                    std::swap(moving, p[k]);
+                    int next = cell[k];
+                    cell[k] = -1;
+                    k = next;
+                }
+                p[j] = moving;
+            }
+        }
+
         // Checking that all is well.
         int tot = 0;
         maxnp=0;
@@ -238,6 +343,51 @@ class Grid {
         return;
         }
 
+    void compress(int bits) {
+        // Replace the particles by compact copies (see CompactParticle in cell_utilities.h) with positions of the given number of bits (16 or 32) relative to
+        // the cell centers, single precision weights and 16-bit jackknife regions and classes, then free the full list.
+        // The particles are decoded on the fly by particle(), so that several times more of them fit in the caches and memory.
+        if (bits==0||compact_bits>0) return;
+        assert(bits==16||bits==32);
+#ifdef JACKKNIFE
+        for (int j=0; j<np; j++)
+            if (p[j].JK<0||p[j].JK>=32768) {
+                fprintf(stderr,"Jackknife region %d is too large for the compressed particles; run without -compact\n", (int)p[j].JK);
+                abort();
+            }
+#endif
+        compact_bits = bits;
+        int ec = (bits==16) ? huge_page_alloc((void **) &p16, sizeof(CompactParticle<uint16_t>)*np) : huge_page_alloc((void **) &p32, sizeof(CompactParticle<uint32_t>)*np);
+        assert(ec==0);
+        Float max_error = 0.;
+        for (int n=0; n<nf; n++) {
+            int id = filled[n];
+            Float3 center = cell_center(id);
+            for (int j=c[id].start; j<c[id].start+c[id].np; j++) {
+                if (bits==16) p16[j].encode(p[j], center, cellsize);
+                else p32[j].encode(p[j], center, cellsize);
+                Float3 error = particle(j, center).pos-p[j].pos;
+                max_error = fmax(max_error, fmax(fabs(error.x), fmax(fabs(error.y), fabs(error.z))));
+            }
+        }
+        free(p);
+        p = NULL;
+        printf("# Compressed the particles to %6.3f MB (%d-bit positions, largest position error %.2e)\n", particle_bytes()/1024.0/1024.0, bits, max_error);
+    }
+
+private:
+    void set_geometry(Float3 _rect_boxsize, Float _cellsize, int _nside) {
+        // Set the box and cell dimensions
+        rect_boxsize = _rect_boxsize;
+        nside = _nside;
+        assert(nside<1025);   // Can't guarantee won't spill int32 if bigger
+        cellsize = _cellsize;
+        max_boxsize=fmax(rect_boxsize.x,fmax(rect_boxsize.y,rect_boxsize.z));
+        assert(max_boxsize>0&&nside>0);
+        nside_cuboid = integer3(ceil3(rect_boxsize/cellsize));
+        ncells = nside_cuboid.x*nside_cuboid.y*nside_cuboid.z;
+    }
+
 };   // End Grid class
 
 #endif
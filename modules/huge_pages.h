@@ -0,0 +1,88 @@
+// huge_pages.h - optional backing of the large arrays by 2 MB (transparent) huge pages on Linux, enabled with the -hugepages option.
+// The random cell and particle draws and the scattered updates of the c3/c4 accumulators touch many different pages, so with 4 kB pages most accesses
+// to large grids, samplers and bin counts also miss the TLB. Arrays of at least one huge page are therefore aligned to huge pages and advised (madvise) to be
+// backed by them. Transparent huge pages are used rather than MAP_HUGETLB, since they need no pages reserved by the administrator and the arrays
+// can still be released with free() as everywhere else; the kernel falls back to normal pages if no huge page is available.
+
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE 2097152 // size of the huge pages requested (2 MB on x86-64 and most arm64 kernels)
+
+static bool huge_pages_enabled = false;
+
+void advise_huge_pages(void *ptr, size_t bytes){
+    // Advise the kernel to back the whole huge pages within the array by huge pages; pages already touched are collapsed into huge pages later by the kernel
+#if (defined __linux__ && defined MADV_HUGEPAGE)
+    if (!huge_pages_enabled || ptr==NULL || bytes<HUGE_PAGE) return;
+    unsigned long start = ((unsigned long)ptr+HUGE_PAGE-1) & ~(unsigned long)(HUGE_PAGE-1), end = ((unsigned long)ptr+bytes) & ~(unsigned long)(HUGE_PAGE-1);
+    if (end<=start) return;
+    if (madvise((void *)start, end-start, MADV_HUGEPAGE)!=0){
+        static bool warned = false;
+        if (!warned) fprintf(stderr, "# WARNING: the kernel does not support huge pages for the arrays (madvise failed); using normal pages.\n");
+        warned = true;
+    }
+#endif
+}
+
+int huge_page_alloc(void **ptr, size_t bytes){
+    // Allocate as posix_memalign(ptr, PAGE, bytes), returning nonzero on failure, but if huge pages are enabled, arrays of at least one huge page are
+    // rounded up to whole huge pages and advised to be backed by them before they are first touched
+    if (!huge_pages_enabled || bytes<HUGE_PAGE) return posix_memalign(ptr, PAGE, bytes);
+    size_t rounded = (bytes+HUGE_PAGE-1)/HUGE_PAGE*HUGE_PAGE;
+    int ec = posix_memalign(ptr, HUGE_PAGE, rounded);
+    if (ec==0) advise_huge_pages(*ptr, rounded);
+    return ec;
+}
+
+void enable_huge_pages(){
+    // Switch on huge page allocations and report the system setting, which decides whether they are used
+    huge_pages_enabled = true;
+#ifdef __linux__
+    char mode[100] = "unavailable";
+    FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (fp!=NULL){
+        if (fgets(mode, 100, fp)==NULL) strcpy(mode, "unavailable");
+        fclose(fp);
+        mode[strcspn(mode, "\n")] = '\0';
+    }
+    printf("# Requesting %d kB huge pages for the large arrays; transparent huge pages of the system: %s\n", HUGE_PAGE/1024, mode);
+    if (strstr(mode, "[never]")!=NULL || !strcmp(mode, "unavailable")) fprintf(stderr, "# WARNING: transparent huge pages are disabled on this system, so normal pages are used.\n");
+#else
+    fprintf(stderr, "# WARNING: huge pages are only supported on Linux; using normal pages.\n");
+#endif
+}
+
+void report_huge_pages(const char *name, const void *ptr, size_t bytes){
+    // Print how much of an array is currently backed by huge pages, estimated from the huge pages (AnonHugePages) of the mappings holding it in /proc/self/smaps,
+    // in proportion to the part of each mapping taken by the array
+    if (!huge_pages_enabled || ptr==NULL || bytes==0) return;
+#ifdef __linux__
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (fp==NULL) return;
+    unsigned long start = (unsigned long)ptr, end = start+bytes, vma_start = 0, vma_end = 0;
+    double huge_bytes = 0.;
+    bool overlap = false;
+    char line[512];
+    while (fgets(line, 512, fp)!=NULL){
+        unsigned long a, b, kb;
+        if (sscanf(line, "%lx-%lx ", &a, &b)==2){
+            vma_start = a;
+            vma_end = b;
+            overlap = (a<end && b>start);
+        }
+        else if (overlap && sscanf(line, "AnonHugePages: %lu kB", &kb)==1){
+            double shared = (double)(std::min(end, vma_end)-std::max(start, vma_start));
+            huge_bytes += kb*1024.*shared/(vma_end-vma_start);
+        }
+    }
+    fclose(fp);
+    printf("# %s: %.1f of %.1f MB in huge pages\n", name, huge_bytes/1024./1024., bytes/1024./1024.);
+#endif
+}
+
+#endif
@@ -6,16 +6,28 @@
 #include "parameters.h"
 #include "correlation_function.h"
 #include "cell_utilities.h"
+#include "huge_pages.h"
 #include "jackknife_weights.h"
+#include "npy_utilities.h"
+#include "subsample_container.h"
 #ifdef LEGENDRE_MIX
 #include "legendre_mix_utilities.h"
 #endif
 #include <stdio.h>
 #include <algorithm>
 
+struct IntegralArrays{
+    // Arrays (owned by the caller of the library interface in librascalc/) receiving the normalized integrals instead of the output files.
+    // Each holds 1+no_subsamples blocks in the layout of the corresponding output file: the full integral followed by the subsample integrals. NULL arrays are skipped.
+    Float *c2, *c3, *c4, *RR; // as in CovMatricesAll/ (RR only in the s,mu-binned modes)
+    Float *c2j, *c3j, *c4j, *EE1, *EE2, *RR1, *RR2; // as in CovMatricesJack/ (EE and RR only in the s,mu-binned JACKKNIFE mode)
+    uint64 counts[3]; // total numbers of pairs, triples and quads used, as in the total_counts file
+};
+
 class Integrals{
+    friend class KernelBenchmark; // times the private kernels in benchmark/microbench.cpp
 private:
-    CorrelationFunction *cf12, *cf13, *cf24;
+    CorrelationFunction *cf12 = NULL, *cf13 = NULL, *cf24 = NULL; // this object's copies of the correlation functions, sharing their tables
     int nbin, mbin, no_bins, size2;
     Float rmin,rmax,mumin,mumax,dmu; //Ranges in r and mu
     Float *r_high, *r_low; // Max and min of each radial bin
@@ -38,11 +50,58 @@ private:
     MuBinLegendreFactors* mu_bin_legendre;
 #endif
     char* out_file;
+    bool npy; // whether to save outputs as binary .npy files instead of text
+    IntegralArrays *memory; // arrays to copy the outputs into instead of saving them, if not NULL
+    SubsampleContainer **containers = NULL; // one appendable file per output array for the subsample estimates, created on first use
+    Float ***container_data; // address of the array saved in each container, so that swap_integrals leaves them valid
+    int n_containers = 0;
+    static const int max_containers = 19; // c2, c3, c4, RR (and the decomposed c2, c3, c4) in CovMatricesAll/ and c2, c3, c4, EE1, EE2, RR1, RR2 (and the decomposed c2, c3, c4, EE1, EE2) in CovMatricesJack/
     bool box,rad=0; // Flags to decide whether we have a periodic box + if we have a radial correlation function only
     int I1, I2, I3, I4; // indices for which fields to use for each particle
 
     uint64 *binct, *binct3, *binct4; // Arrays to accumulate bin counts
 
+    // The l particles drawn for the current j and k particles are collected by fourth_draw() and added to C4 for all i particles at once by fourth()
+    int max_draws, n_draws = 0, n_slots = 0; // maximum and current number of collected l particles, and number of distinct k-l bins (slots) among them
+    int *bin_slot = NULL; // slot of each k-l bin, -1 if no collected l particle falls in it
+    int *slot_bin = NULL, *slot_count = NULL; // k-l bin and number of l particles of each slot
+    Float *slot_sum = NULL; // sum of the l factors w_l*xi_jl/prob (with symmetry factor) in each slot
+    int *draw_slot = NULL, *draw_id = NULL; // slot and particle index of each collected l particle, to remove the il self-counts
+    Float *draw_value = NULL; // l factor of each collected l particle
+#ifdef JACKKNIFE
+    int n_jk_sums = 0; // number of distinct (slot, jackknife region) pairs among the collected l particles
+    int *draw_JK = NULL, *jk_sum_slot = NULL, *jk_sum_region = NULL; // jackknife region of each l particle; slot and region of each pair
+    Float *jk_sum = NULL; // sum of the l factors for each pair
+    Float *slot_jk_fixed = NULL, *slot_jk_region = NULL, *slot_jk_weight = NULL; // parts of the jackknife weights summed in each slot: independent of i, for the current region of i, and for the current i
+#endif
+
+    // Decomposition of C2, C3 and C4 over a top-hat basis of the correlation function (-xi_basis), see basis_element().
+    // With xi = sum_e a_e B_e, C2 = sum_e a_e c2b[e], C3 = sum_e a_e c3b[e] and C4 = sum_ef a_e a_f c4b[e,f], where the last element
+    // (with a_e = 1) holds the constant part of 1+xi in C2 and the contributions of separations outside the basis, using the input xi.
+    // The arrays are always binned in s,mu (sm_bins = nbin*mbin), as c2b[e,a], c3b[e,a,b] and c4b[e,f,a,b], and normalized as in the s,mu-binned modes.
+    int n_basis = 0, basis_nbin, basis_mbin, sm_bins; // number of basis elements including the last one, 0 if not decomposing
+    Float *basis_low, *basis_high; // radial bin edges of the basis
+    Float *c2b = NULL, *c3b = NULL, *c4b = NULL;
+#ifdef JACKKNIFE
+    Float *c2jb = NULL, *c3jb = NULL, *c4jb = NULL; // the jackknife integrals decomposed in the same way
+#ifndef LEGENDRE_MIX
+    Float *EE1b = NULL, *EE2b = NULL; // EEaA1 and EEaA2 decomposed as EE1b[e,A,a] (with no constant part)
+#endif
+#endif
+    int *basis_ik = NULL, basis_ik_size = 0; // basis element of each i-k pair of the current triple, for fourth()
+    int *draw_basis = NULL; // basis element of the j-l pair of each collected l particle
+    Float *draw_basis_value = NULL; // l factor of each collected l particle without xi_jl (unless outside the basis)
+    // As in fourth(), the l factors are summed for each k-l bin and j-l basis element, and contracted with the i factors in fourth_basis()
+    int n_basis_sums = 0; // number of distinct (k-l bin, basis element) pairs among the collected l particles
+    int *basis_sum_bin = NULL, *basis_sum_element = NULL; // k-l bin and basis element of each pair
+    Float *basis_sum = NULL; // sum of the l factors of each pair
+#ifdef JACKKNIFE
+    int n_basis_jk_sums = 0; // number of distinct (pair, jackknife region) combinations
+    int *basis_jk_sum_pair = NULL, *basis_jk_sum_region = NULL; // pair and region of each combination
+    Float *basis_jk_sum = NULL; // sum of the l factors for each combination
+    Float *basis_jk_fixed = NULL, *basis_jk_region = NULL, *basis_jk_weight = NULL; // parts of the jackknife weights summed for each pair, as slot_jk_fixed etc.
+#endif
+
 public:
     Integrals(){};
 #ifdef JACKKNIFE
@@ -79,6 +138,8 @@ public:
         size2 = no_bins; // 2-pt matrices are diagonal, store as 1-dimensional
         #endif
         out_file = par->out_file; // output directory
+        npy = par->npy_output;
+        memory = par->memory_output;
 
         int ec=0;
         // Initialize the binning
@@ -86,16 +147,33 @@ public:
         ec+=posix_memalign((void **) &Ra, PAGE, sizeof(double)*size2);
 #endif
         ec+=posix_memalign((void **) &c2, PAGE, sizeof(double)*size2);
-        ec+=posix_memalign((void **) &c3, PAGE, sizeof(double)*no_bins*no_bins);
-        ec+=posix_memalign((void **) &c4, PAGE, sizeof(double)*no_bins*no_bins);
+        ec+=huge_page_alloc((void **) &c3, sizeof(double)*no_bins*no_bins);
+        ec+=huge_page_alloc((void **) &c4, sizeof(double)*no_bins*no_bins);
         ec+=posix_memalign((void **) &binct, PAGE, sizeof(uint64)*size2);
-        ec+=posix_memalign((void **) &binct3, PAGE, sizeof(uint64)*no_bins*no_bins);
-        ec+=posix_memalign((void **) &binct4, PAGE, sizeof(uint64)*no_bins*no_bins);
+        ec+=huge_page_alloc((void **) &binct3, sizeof(uint64)*no_bins*no_bins);
+        ec+=huge_page_alloc((void **) &binct4, sizeof(uint64)*no_bins*no_bins);
+        max_draws = par->N4; // at most N4 l particles are drawn per k particle
+        ec+=posix_memalign((void **) &bin_slot, PAGE, sizeof(int)*mbin*nbin);
+        ec+=posix_memalign((void **) &slot_bin, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &slot_count, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &slot_sum, PAGE, sizeof(Float)*max_draws);
+        ec+=posix_memalign((void **) &draw_slot, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &draw_id, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &draw_value, PAGE, sizeof(Float)*max_draws);
+#ifdef JACKKNIFE
+        ec+=posix_memalign((void **) &draw_JK, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &jk_sum_slot, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &jk_sum_region, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &jk_sum, PAGE, sizeof(Float)*max_draws);
+        ec+=posix_memalign((void **) &slot_jk_fixed, PAGE, sizeof(Float)*max_draws);
+        ec+=posix_memalign((void **) &slot_jk_region, PAGE, sizeof(Float)*max_draws);
+        ec+=posix_memalign((void **) &slot_jk_weight, PAGE, sizeof(Float)*max_draws);
+#endif
 #ifdef JACKKNIFE
         n_jack = fmax(fmax(JK12->n_JK_filled,JK23->n_JK_filled),JK34->n_JK_filled); // number of non-empty jackknives
         ec+=posix_memalign((void **) &c2j, PAGE, sizeof(double)*size2);
-        ec+=posix_memalign((void **) &c3j, PAGE, sizeof(double)*no_bins*no_bins);
-        ec+=posix_memalign((void **) &c4j, PAGE, sizeof(double)*no_bins*no_bins);
+        ec+=huge_page_alloc((void **) &c3j, sizeof(double)*no_bins*no_bins);
+        ec+=huge_page_alloc((void **) &c4j, sizeof(double)*no_bins*no_bins);
 
 #ifndef LEGENDRE_MIX
         ec+=posix_memalign((void **) &EEaA1, PAGE, sizeof(double)*no_bins*n_jack);
@@ -105,7 +183,40 @@ public:
 #endif
 #endif
 
+        sm_bins = mbin*nbin;
+        if (par->xi_basis_file!=NULL){
+            basis_nbin = par->xi_basis_nbin;
+            basis_mbin = par->xi_basis_mbin;
+            basis_low = par->xi_basis_low;
+            basis_high = par->xi_basis_high;
+            n_basis = basis_nbin*basis_mbin+1;
+            ec+=posix_memalign((void **) &c2b, PAGE, sizeof(Float)*n_basis*sm_bins);
+            ec+=huge_page_alloc((void **) &c3b, sizeof(Float)*n_basis*sm_bins*sm_bins);
+            ec+=huge_page_alloc((void **) &c4b, sizeof(Float)*n_basis*n_basis*sm_bins*sm_bins);
+            ec+=posix_memalign((void **) &draw_basis, PAGE, sizeof(int)*max_draws);
+            ec+=posix_memalign((void **) &draw_basis_value, PAGE, sizeof(Float)*max_draws);
+            ec+=posix_memalign((void **) &basis_sum_bin, PAGE, sizeof(int)*max_draws);
+            ec+=posix_memalign((void **) &basis_sum_element, PAGE, sizeof(int)*max_draws);
+            ec+=posix_memalign((void **) &basis_sum, PAGE, sizeof(Float)*max_draws);
+#ifdef JACKKNIFE
+            ec+=posix_memalign((void **) &c2jb, PAGE, sizeof(Float)*n_basis*sm_bins);
+            ec+=huge_page_alloc((void **) &c3jb, sizeof(Float)*n_basis*sm_bins*sm_bins);
+            ec+=huge_page_alloc((void **) &c4jb, sizeof(Float)*n_basis*n_basis*sm_bins*sm_bins);
+#ifndef LEGENDRE_MIX
+            ec+=posix_memalign((void **) &EE1b, PAGE, sizeof(Float)*n_basis*n_jack*no_bins);
+            ec+=posix_memalign((void **) &EE2b, PAGE, sizeof(Float)*n_basis*n_jack*no_bins);
+#endif
+            ec+=posix_memalign((void **) &basis_jk_sum_pair, PAGE, sizeof(int)*max_draws);
+            ec+=posix_memalign((void **) &basis_jk_sum_region, PAGE, sizeof(int)*max_draws);
+            ec+=posix_memalign((void **) &basis_jk_sum, PAGE, sizeof(Float)*max_draws);
+            ec+=posix_memalign((void **) &basis_jk_fixed, PAGE, sizeof(Float)*max_draws);
+            ec+=posix_memalign((void **) &basis_jk_region, PAGE, sizeof(Float)*max_draws);
+            ec+=posix_memalign((void **) &basis_jk_weight, PAGE, sizeof(Float)*max_draws);
+#endif
+        }
+
         assert(ec==0);
+        for (int j = 0; j < mbin*nbin; j++) bin_slot[j] = -1;
         reset();
 
         box=par->perbox;
@@ -125,6 +236,9 @@ public:
     }
 
     ~Integrals() {
+        delete cf12;
+        delete cf13;
+        delete cf24;
 #ifndef LEGENDRE_MIX
         free(Ra);
 #endif
@@ -134,6 +248,51 @@ public:
         free(binct);
         free(binct3);
         free(binct4);
+        free(bin_slot);
+        free(slot_bin);
+        free(slot_count);
+        free(slot_sum);
+        free(draw_slot);
+        free(draw_id);
+        free(draw_value);
+#ifdef JACKKNIFE
+        free(draw_JK);
+        free(jk_sum_slot);
+        free(jk_sum_region);
+        free(jk_sum);
+        free(slot_jk_fixed);
+        free(slot_jk_region);
+        free(slot_jk_weight);
+#endif
+        free(c2b);
+        free(c3b);
+        free(c4b);
+        free(basis_ik);
+        free(draw_basis);
+        free(draw_basis_value);
+        free(basis_sum_bin);
+        free(basis_sum_element);
+        free(basis_sum);
+#ifdef JACKKNIFE
+        free(c2jb);
+        free(c3jb);
+        free(c4jb);
+#ifndef LEGENDRE_MIX
+        free(EE1b);
+        free(EE2b);
+#endif
+        free(basis_jk_sum_pair);
+        free(basis_jk_sum_region);
+        free(basis_jk_sum);
+        free(basis_jk_fixed);
+        free(basis_jk_region);
+        free(basis_jk_weight);
+#endif
+        if (n_containers>0){
+            for (int i = 0; i < n_containers; i++) delete containers[i];
+            free(containers);
+            free(container_data);
+        }
 #ifdef JACKKNIFE
         free(c2j);
         free(c3j);
@@ -147,6 +306,11 @@ public:
 #endif
     }
 
+    void huge_page_report(const char *name){
+        // Report how much of the largest accumulator is backed by huge pages
+        report_huge_pages(name, c4, sizeof(Float)*no_bins*no_bins);
+    }
+
     void reset(){
         for (int j = 0; j < size2; j++) {
 #ifndef LEGENDRE_MIX
@@ -175,6 +339,56 @@ public:
             RRaA1[j] = 0;
             RRaA2[j] = 0;
         }
+#endif
+        if (n_basis){
+            size_t size_b = (size_t)n_basis*sm_bins;
+            for (size_t j = 0; j < size_b; j++) c2b[j] = 0;
+            for (size_t j = 0; j < size_b*sm_bins; j++) c3b[j] = 0;
+            for (size_t j = 0; j < size_b*n_basis*sm_bins; j++) c4b[j] = 0;
+#ifdef JACKKNIFE
+            for (size_t j = 0; j < size_b; j++) c2jb[j] = 0;
+            for (size_t j = 0; j < size_b*sm_bins; j++) c3jb[j] = 0;
+            for (size_t j = 0; j < size_b*n_basis*sm_bins; j++) c4jb[j] = 0;
+#ifndef LEGENDRE_MIX
+            for (size_t j = 0; j < (size_t)n_basis*n_jack*no_bins; j++) EE1b[j] = EE2b[j] = 0;
+#endif
+#endif
+        }
+    }
+
+    void swap_integrals(Integrals* ints){
+        // Exchange the accumulated arrays with those of ints (constructed with the same parameters), without copying
+#ifndef LEGENDRE_MIX
+        std::swap(Ra, ints->Ra);
+#endif
+        std::swap(c2, ints->c2);
+        std::swap(c3, ints->c3);
+        std::swap(c4, ints->c4);
+        std::swap(binct, ints->binct);
+        std::swap(binct3, ints->binct3);
+        std::swap(binct4, ints->binct4);
+#ifdef JACKKNIFE
+        std::swap(c2j, ints->c2j);
+        std::swap(c3j, ints->c3j);
+        std::swap(c4j, ints->c4j);
+#ifndef LEGENDRE_MIX
+        std::swap(EEaA1, ints->EEaA1);
+        std::swap(EEaA2, ints->EEaA2);
+        std::swap(RRaA1, ints->RRaA1);
+        std::swap(RRaA2, ints->RRaA2);
+#endif
+#endif
+        std::swap(c2b, ints->c2b);
+        std::swap(c3b, ints->c3b);
+        std::swap(c4b, ints->c4b);
+#ifdef JACKKNIFE
+        std::swap(c2jb, ints->c2jb);
+        std::swap(c3jb, ints->c3jb);
+        std::swap(c4jb, ints->c4jb);
+#ifndef LEGENDRE_MIX
+        std::swap(EE1b, ints->EE1b);
+        std::swap(EE2b, ints->EE2b);
+#endif
 #endif
     }
 
@@ -189,6 +403,14 @@ public:
         return which_bin*mbin + floor((mu-mumin)/dmu);
     }
 
+    inline int basis_element(Float r, Float mu){
+        // Index of the top-hat basis element containing the separation (r, mu), or n_basis-1 if it is outside all basis bins
+        Float* r_higher = std::upper_bound(basis_high, basis_high + basis_nbin, r);
+        int r_bin = r_higher - basis_high;
+        if ((r_bin==basis_nbin)||(r<basis_low[r_bin])) return n_basis-1;
+        return r_bin*basis_mbin + std::min(int(mu*basis_mbin), basis_mbin-1);
+    }
+
     inline void second(const Particle* pi_list, const int* prim_ids, int pln, const Particle pj, const int pj_id, int* &bin, Float* &wij, const double prob, const double prob1, const double prob2){
         // Accumulates the two point integral C2. Also outputs an array of bin values for later reuse.
         // Prob. here is defined as g_ij / f_ij where g_ij is the sampling PDF and f_ij is the true data PDF for picking pairs (equal to n_i/N n_j/N for N particles)
@@ -198,7 +420,8 @@ public:
         Float rav;
 #endif
         Particle pi;
-        int tmp_bin;
+        int tmp_bin, element = 0;
+        Float basis_xi = 0; // xi of the basis element of the pair (1 inside the basis), see basis_element()
 #ifdef JACKKNIFE
         Float c2vj,JK_weight;
 #ifndef LEGENDRE_MIX
@@ -233,6 +456,18 @@ public:
                 // Compute jackknife weight tensor:
                 JK_weight = weight_tensor(int(pi.JK), int(pj.JK), int(pi.JK), int(pj.JK), tmp_bin, tmp_bin, JK12, JK12, product_weights12_12);
 #endif
+                if (n_basis){
+                    // The constant part goes to the last basis element, as does xi outside the basis
+                    element = basis_element(rij_mag, rij_mu);
+                    basis_xi = (element==n_basis-1) ? tmp_xi : 1.;
+                    Float c2v0 = tmp_weight*tmp_weight / prob*2.;
+                    c2b[(n_basis-1)*sm_bins+tmp_bin] += c2v0;
+                    c2b[element*sm_bins+tmp_bin] += c2v0*basis_xi;
+#ifdef JACKKNIFE
+                    c2jb[(n_basis-1)*sm_bins+tmp_bin] += c2v0*JK_weight;
+                    c2jb[element*sm_bins+tmp_bin] += c2v0*basis_xi*JK_weight;
+#endif
+                }
 #ifdef LEGENDRE_MIX
                 c2v /= JK12->RR_pair_counts[tmp_bin] * JK12->RR_pair_counts[tmp_bin]; // normalize by product of RR counts in the current s,mu bin - same for all Legendre multipoles
 #ifdef JACKKNIFE
@@ -275,6 +510,10 @@ public:
                     EEaA1[jk_bin_j]+=tmp_weight/prob1*tmp_xi/2.;
                     RRaA1[jk_bin_i]+=tmp_weight/prob1/2;
                     RRaA1[jk_bin_j]+=tmp_weight/prob1/2;
+                    if (n_basis){
+                        EE1b[(size_t)element*n_jack*no_bins+jk_bin_i]+=tmp_weight/prob1*basis_xi/2.;
+                        EE1b[(size_t)element*n_jack*no_bins+jk_bin_j]+=tmp_weight/prob1*basis_xi/2.;
+                    }
                 }
                 // If both in random set-1
                 if((pi.rand_class==1)&&(pj.rand_class==1)){
@@ -284,6 +523,10 @@ public:
                     EEaA2[jk_bin_j]+=tmp_weight/prob2*tmp_xi/2;
                     RRaA2[jk_bin_i]+=tmp_weight/prob2/2;
                     RRaA2[jk_bin_j]+=tmp_weight/prob2/2;
+                    if (n_basis){
+                        EE2b[(size_t)element*n_jack*no_bins+jk_bin_i]+=tmp_weight/prob2*basis_xi/2;
+                        EE2b[(size_t)element*n_jack*no_bins+jk_bin_j]+=tmp_weight/prob2*basis_xi/2;
+                    }
                 }
 #endif
 #endif
@@ -303,6 +546,12 @@ public:
 #endif
         cleanup_l(pj.pos,pk.pos,rjk_mag,rjk_mu);
         tmp_bin = getbin(rjk_mag, rjk_mu); // define j-k s,mu bin
+        if ((n_basis)&&(pln>basis_ik_size)){
+            free(basis_ik);
+            basis_ik_size = pln;
+            int ec=posix_memalign((void **) &basis_ik, PAGE, sizeof(int)*basis_ik_size);
+            assert(ec==0);
+        }
 
         for(int i=0;i<pln;i++){ // Iterate over particle in pi_list
             if(((pk_id==pj_id)&&(I2==I3))||((prim_ids[i]==pk_id)&&(I1==I3))||(wij[i]==-1)){
@@ -324,6 +573,7 @@ public:
             // save arrays for later
             xi_ik[i]=xi_ik_tmp;
             wijk[i]=tmp_weight;
+            if (n_basis) basis_ik[i] = basis_element(rik_mag, rik_mu);
             if ((tmp_bin < 0) || (tmp_bin >= mbin*nbin)){
                 // Don't add contributions of this to C3 - but STILL save xi_ik etc. for later
                 continue; // if not in correct bin
@@ -334,6 +584,16 @@ public:
             // Compute jackknife weight tensor:
             JK_weight = weight_tensor(int(pi.JK), int(pj.JK), int(pj.JK), int(pk.JK), bin_ij[i], tmp_bin, JK12, JK23, product_weights12_23);
 #endif
+            if (n_basis){
+                int element = basis_ik[i];
+                Float c3v0 = tmp_weight*pj.w/prob*4.;
+                if (element==n_basis-1) c3v0 *= xi_ik_tmp;
+                size_t basis_bin = ((size_t)element*sm_bins+bin_ij[i])*sm_bins+tmp_bin;
+                c3b[basis_bin] += c3v0;
+#ifdef JACKKNIFE
+                c3jb[basis_bin] += c3v0*JK_weight;
+#endif
+            }
 #ifdef LEGENDRE_MIX
             c3v /= JK12->RR_pair_counts[bin_ij[i]] * JK23->RR_pair_counts[tmp_bin]; // normalize by product of RR counts in the current s,mu bins - same for all Legendre multipoles
 #ifdef JACKKNIFE
@@ -372,80 +632,252 @@ public:
 #endif
         }
     }
-    inline void fourth(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const Particle pl, const int pj_id, const int pk_id, const int pl_id, const int* bin_ij, const Float* wijk, const Float* xi_ik, const double prob){
-        // Accumulates the four point integral C4.
-        // First define variables
-        Particle pi;
-        Float rjl_mag, rjl_mu, rkl_mag, rkl_mu, c4v, xi_jl, tmp_weight;
+    inline void fourth_draw(const Particle pj, const Particle pk, const Particle pl, const int pj_id, const int pk_id, const int pl_id, const double prob){
+        // Collects one l particle for the four point integral C4 of the current j and k particles, which is accumulated by fourth() once all N4 l particles are drawn.
+        // The C4 contribution of each i-l pair factorizes into an i factor w_i*w_j*w_k*xi_ik and an l factor w_l*xi_jl/prob, so the l factors are summed in each k-l bin here.
+        Float rjl_mag, rjl_mu, rkl_mag, rkl_mu, xi_jl;
         int tmp_bin;
-#ifndef LEGENDRE_MIX
-        int tmp_full_bin;
-#endif
+        if(((pj_id==pl_id)&&(I2==I4))||((pk_id==pl_id)&&(I3==I4))) return; // don't self-count
         cleanup_l(pl.pos,pk.pos,rkl_mag,rkl_mu);
-#ifdef JACKKNIFE
-        Float c4vj,JK_weight;
-#endif
         tmp_bin = getbin(rkl_mag, rkl_mu); // define k-l s,mu bin
 
         if ((tmp_bin < 0) || (tmp_bin >= mbin*nbin)) return; // if not in correct bin
+        assert(n_draws<max_draws);
         cleanup_l(pl.pos,pj.pos,rjl_mag,rjl_mu);
         xi_jl = cf24->xi(rjl_mag, rjl_mu); // j-l correlation
 
+        int slot = bin_slot[tmp_bin];
+        if (slot==-1){ // first l particle in this bin
+            slot = n_slots++;
+            bin_slot[tmp_bin] = slot;
+            slot_bin[slot] = tmp_bin;
+            slot_count[slot] = 0;
+            slot_sum[slot] = 0;
+        }
+        Float l_factor = pl.w/prob*2.*xi_jl; // with xi_ik*xi_jl = xi_il*xi_jk symmetry factor
+        slot_count[slot]++;
+        slot_sum[slot] += l_factor;
+        draw_slot[n_draws] = slot;
+        draw_id[n_draws] = pl_id;
+        draw_value[n_draws] = l_factor;
+#ifdef JACKKNIFE
+        // The jackknife weight tensor depends on the region of l only through linear terms, so the l factors are also summed for each region within the slot
+        int JKl = int(pl.JK), sum;
+        draw_JK[n_draws] = JKl;
+        for (sum = 0; sum < n_jk_sums; sum++)
+            if ((jk_sum_slot[sum]==slot)&&(jk_sum_region[sum]==JKl)) break;
+        if (sum==n_jk_sums){
+            jk_sum_slot[sum] = slot;
+            jk_sum_region[sum] = JKl;
+            jk_sum[sum] = 0;
+            n_jk_sums++;
+        }
+        jk_sum[sum] += l_factor;
+#endif
+        if (n_basis){
+            // Sum the l factors for the decomposed C4 in each k-l bin and basis element of the j-l pair (and jackknife region)
+            int element = basis_element(rjl_mag, rjl_mu), pair;
+            Float basis_value = (element==n_basis-1) ? l_factor : pl.w/prob*2.;
+            draw_basis[n_draws] = element;
+            draw_basis_value[n_draws] = basis_value;
+            for (pair = 0; pair < n_basis_sums; pair++)
+                if ((basis_sum_bin[pair]==tmp_bin)&&(basis_sum_element[pair]==element)) break;
+            if (pair==n_basis_sums){
+                basis_sum_bin[pair] = tmp_bin;
+                basis_sum_element[pair] = element;
+                basis_sum[pair] = 0;
+                n_basis_sums++;
+            }
+            basis_sum[pair] += basis_value;
+#ifdef JACKKNIFE
+            for (sum = 0; sum < n_basis_jk_sums; sum++)
+                if ((basis_jk_sum_pair[sum]==pair)&&(basis_jk_sum_region[sum]==JKl)) break;
+            if (sum==n_basis_jk_sums){
+                basis_jk_sum_pair[sum] = pair;
+                basis_jk_sum_region[sum] = JKl;
+                basis_jk_sum[sum] = 0;
+                n_basis_jk_sums++;
+            }
+            basis_jk_sum[sum] += basis_value;
+#endif
+        }
+        n_draws++;
+    }
+
+    inline void fourth(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const int* bin_ij, const Float* wijk, const Float* xi_ik){
+        // Accumulates the four point integral C4 for the l particles collected by fourth_draw(), contracting the l factors of each k-l bin with the i factors.
+        // This needs one update per i particle and k-l bin instead of one per i-l pair.
+        Float c4v, c4vj = 0, tmp_weight;
+#ifdef JACKKNIFE
+        // The weight tensor (see weight_tensor) is summed over the l particles of each slot in parts: first those independent of i
+        Float JK_weight;
+        int Ji, last_Ji = -1, Jj = int(pj.JK), Jk = int(pk.JK), nbins = JK12->nbins;
+        jk_fixed_parts(n_slots, slot_sum, slot_bin, n_jk_sums, jk_sum_slot, jk_sum_region, jk_sum, Jj, Jk, slot_jk_fixed);
+#endif
         for(int i=0;i<pln;i++){ // Iterate over particle in pi_list
             if(wijk[i]==-1) continue; // skip incorrect bins / ij self counts
-            if(((prim_ids[i]==pl_id)&&(I1==I4))||((pj_id==pl_id)&&(I2==I4))||((pk_id==pl_id)&&(I3==I4))) continue; // don't self-count
-
-            pi = pi_list[i];
-            tmp_weight = wijk[i]*pl.w; // product of weights, w_i*w_j*w_k*w_l
+            tmp_weight = wijk[i]*xi_ik[i]; // i factor, w_i*w_j*w_k*xi_ik
+#ifdef JACKKNIFE
+            Ji = int(pi_list[i].JK);
+            if (Ji!=last_Ji){
+                // Then the parts depending only on the region of i, which is mostly the same for all particles of the i cell
+                jk_region_parts(n_slots, slot_sum, n_jk_sums, jk_sum_slot, jk_sum_region, jk_sum, Ji, Jk, slot_jk_fixed, slot_jk_region);
+                last_Ji = Ji;
+            }
+            // and the parts depending on the i-j bin
+            jk_bin_parts(n_slots, n_jk_sums, jk_sum_slot, jk_sum_region, jk_sum, bin_ij[i], slot_jk_region, slot_jk_weight);
+#endif
+            for (int slot = 0; slot < n_slots; slot++){
+                c4v = tmp_weight*slot_sum[slot];
+#ifdef JACKKNIFE
+                int tmp_bin = slot_bin[slot];
+                JK_weight = slot_jk_weight[slot] + slot_sum[slot]*(product_weights12_34[bin_ij[i]*nbins+tmp_bin] - 0.5*(JK34->weights[Ji*nbins+tmp_bin]+JK12->weights[Jk*nbins+bin_ij[i]]));
+                c4vj = tmp_weight*JK_weight;
+#endif
+                add_fourth(bin_ij[i], slot_bin[slot], c4v, c4vj, slot_count[slot]);
+            }
+        }
+        if (I1==I4){
+            // Remove the il self-counts included above. The particle indices prim_ids of the i cell are consecutive (see particle_list in compute_integral.h)
+            for (int d = 0; d < n_draws; d++){
+                int i = draw_id[d]-prim_ids[0];
+                if ((i<0)||(i>=pln)||(prim_ids[i]!=draw_id[d])) continue; // l particle is not in the i cell
+                if(wijk[i]==-1) continue;
+                int tmp_bin = slot_bin[draw_slot[d]];
+                c4v = -wijk[i]*xi_ik[i]*draw_value[d];
+#ifdef JACKKNIFE
+                c4vj = c4v*weight_tensor(int(pi_list[i].JK), int(pj.JK), int(pk.JK), draw_JK[d], bin_ij[i], tmp_bin, JK12, JK34, product_weights12_34);
+#endif
+                add_fourth(bin_ij[i], tmp_bin, c4v, c4vj, -1);
+            }
+        }
+        if (n_basis) fourth_basis(pi_list, prim_ids, pln, pj, pk, bin_ij, wijk, xi_ik);
+        // Clear the collected l particles for the next k particle
+        for (int slot = 0; slot < n_slots; slot++) bin_slot[slot_bin[slot]] = -1;
+        n_draws = 0;
+        n_slots = 0;
+        n_basis_sums = 0;
+#ifdef JACKKNIFE
+        n_jk_sums = 0;
+        n_basis_jk_sums = 0;
+#endif
+    }
 
-            // Now compute the integral;
-            c4v = tmp_weight/prob*2.*xi_ik[i]*xi_jl; // with xi_ik*xi_jl = xi_il*xi_jk symmetry factor
+private:
+    inline void fourth_basis(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const int* bin_ij, const Float* wijk, const Float* xi_ik){
+        // Adds the C4 contributions of the collected l particles to the decomposed integrals as in fourth(), contracting the l factors summed for each
+        // k-l bin and j-l basis element with the i factors, whose basis element is that of the i-k pair, then removing the il self-counts
+        size_t block = (size_t)sm_bins*sm_bins;
 #ifdef JACKKNIFE
-            // Compute jackknife weight tensor:
-            JK_weight = weight_tensor(int(pi.JK), int(pj.JK), int(pk.JK), int(pl.JK), bin_ij[i], tmp_bin, JK12, JK34, product_weights12_34);
+        int Ji, last_Ji = -1, Jj = int(pj.JK), Jk = int(pk.JK), nbins = JK12->nbins;
+        jk_fixed_parts(n_basis_sums, basis_sum, basis_sum_bin, n_basis_jk_sums, basis_jk_sum_pair, basis_jk_sum_region, basis_jk_sum, Jj, Jk, basis_jk_fixed);
+#endif
+        for(int i=0;i<pln;i++){
+            if(wijk[i]==-1) continue;
+            int element = basis_ik[i];
+            Float i_factor = (element==n_basis-1) ? wijk[i]*xi_ik[i] : wijk[i];
+            size_t row = (size_t)element*n_basis*block + (size_t)bin_ij[i]*sm_bins;
+#ifdef JACKKNIFE
+            Ji = int(pi_list[i].JK);
+            if (Ji!=last_Ji){
+                jk_region_parts(n_basis_sums, basis_sum, n_basis_jk_sums, basis_jk_sum_pair, basis_jk_sum_region, basis_jk_sum, Ji, Jk, basis_jk_fixed, basis_jk_region);
+                last_Ji = Ji;
+            }
+            jk_bin_parts(n_basis_sums, n_basis_jk_sums, basis_jk_sum_pair, basis_jk_sum_region, basis_jk_sum, bin_ij[i], basis_jk_region, basis_jk_weight);
 #endif
-#ifdef LEGENDRE_MIX
-            c4v /= JK12->RR_pair_counts[bin_ij[i]] * JK34->RR_pair_counts[tmp_bin]; // normalize by product of RR counts in the current s,mu bins - same for all Legendre multipoles
+            for (int pair = 0; pair < n_basis_sums; pair++){
+                size_t basis_bin = row + basis_sum_element[pair]*block + basis_sum_bin[pair];
+                c4b[basis_bin] += i_factor*basis_sum[pair];
 #ifdef JACKKNIFE
-            c4vj = c4v * JK_weight / (1.-product_weights12_34[bin_ij[i]*mbin*nbin+tmp_bin]); // additionally divide by 1 - sum of products of jackknife weights for the current s,mu bins
+                int tmp_bin = basis_sum_bin[pair];
+                c4jb[basis_bin] += i_factor*(basis_jk_weight[pair] + basis_sum[pair]*(product_weights12_34[bin_ij[i]*nbins+tmp_bin] - 0.5*(JK34->weights[Ji*nbins+tmp_bin]+JK12->weights[Jk*nbins+bin_ij[i]])));
 #endif
-            int r_bin1 = bin_ij[i] / mbin;
-            int mu_bin1 = bin_ij[i] % mbin;
-            Float* factors1 = mu_bin_legendre->get_factors(mu_bin1);
-            int r_bin2 = tmp_bin / mbin;
-            int mu_bin2 = tmp_bin % mbin;
-            Float* factors2 = mu_bin_legendre->get_factors(mu_bin2);
-            // Now add to relevant multipole bins
-            int out_bin, tmp_out_bin;
-            for (int p_bin = 0; p_bin < n_l; p_bin++) { // iterate over all Legendre moments
-                tmp_out_bin = (r_bin1 * n_l + p_bin) * no_bins + n_l * r_bin2; // the bin is indexed by [r_bin1, p_bin, r_bin2, q_bin], the latter will be added later.
-                for (int q_bin = 0; q_bin < n_l; q_bin++) { // second Legendre moment index
-                    out_bin = tmp_out_bin + q_bin; // output bin 1D index finalized
+            }
+        }
+        if (I1==I4){
+            for (int d = 0; d < n_draws; d++){
+                int i = draw_id[d]-prim_ids[0];
+                if ((i<0)||(i>=pln)||(prim_ids[i]!=draw_id[d])) continue; // l particle is not in the i cell
+                if(wijk[i]==-1) continue;
+                int element = basis_ik[i], tmp_bin = slot_bin[draw_slot[d]];
+                Float c4v = -((element==n_basis-1) ? wijk[i]*xi_ik[i] : wijk[i])*draw_basis_value[d];
+                size_t basis_bin = (size_t)element*n_basis*block + (size_t)bin_ij[i]*sm_bins + draw_basis[d]*block + tmp_bin;
+                c4b[basis_bin] += c4v;
+#ifdef JACKKNIFE
+                c4jb[basis_bin] += c4v*weight_tensor(int(pi_list[i].JK), int(pj.JK), int(pk.JK), draw_JK[d], bin_ij[i], tmp_bin, JK12, JK34, product_weights12_34);
+#endif
+            }
+        }
+    }
 
-                    // Now add to integral with correct kernel
-                    c4[out_bin] += c4v * factors1[p_bin] * factors2[q_bin]; // multiply by product of factors
-                    binct4[out_bin]++; // only count actual contributions to bin
+    inline void add_fourth(const int bin_a, const int bin_b, Float c4v, Float c4vj, const int count){
+        // Adds a contribution c4v (and c4vj with jackknife weights) of count i-l pairs in the i-j bin bin_a and k-l bin bin_b to C4
+#ifdef LEGENDRE_MIX
+        c4v /= JK12->RR_pair_counts[bin_a] * JK34->RR_pair_counts[bin_b]; // normalize by product of RR counts in the current s,mu bins - same for all Legendre multipoles
+#ifdef JACKKNIFE
+        c4vj /= JK12->RR_pair_counts[bin_a] * JK34->RR_pair_counts[bin_b] * (1.-product_weights12_34[bin_a*mbin*nbin+bin_b]); // additionally divide by 1 - sum of products of jackknife weights for the current s,mu bins
+#endif
+        int r_bin1 = bin_a / mbin;
+        int mu_bin1 = bin_a % mbin;
+        Float* factors1 = mu_bin_legendre->get_factors(mu_bin1);
+        int r_bin2 = bin_b / mbin;
+        int mu_bin2 = bin_b % mbin;
+        Float* factors2 = mu_bin_legendre->get_factors(mu_bin2);
+        // Now add to relevant multipole bins
+        int out_bin, tmp_out_bin;
+        for (int p_bin = 0; p_bin < n_l; p_bin++) { // iterate over all Legendre moments
+            tmp_out_bin = (r_bin1 * n_l + p_bin) * no_bins + n_l * r_bin2; // the bin is indexed by [r_bin1, p_bin, r_bin2, q_bin], the latter will be added later.
+            for (int q_bin = 0; q_bin < n_l; q_bin++) { // second Legendre moment index
+                out_bin = tmp_out_bin + q_bin; // output bin 1D index finalized
+
+                // Now add to integral with correct kernel
+                c4[out_bin] += c4v * factors1[p_bin] * factors2[q_bin]; // multiply by product of factors
+                binct4[out_bin] += count; // only count actual contributions to bin
 #ifdef JACKKNIFE
-                    c4j[out_bin] += c4vj * factors1[p_bin] * factors2[q_bin]; // multiply by product of factors
-                    // WARNING: disconnected term missing
+                c4j[out_bin] += c4vj * factors1[p_bin] * factors2[q_bin]; // multiply by product of factors
+                // WARNING: disconnected term missing
 #endif
-                }
             }
+        }
 #else
-            tmp_full_bin = bin_ij[i]*no_bins+tmp_bin;
-            // Add to local counts
-            c4[tmp_full_bin]+=c4v;
-            binct4[tmp_full_bin]++;
+        int tmp_full_bin = bin_a*no_bins+bin_b;
+        // Add to local counts
+        c4[tmp_full_bin]+=c4v;
+        binct4[tmp_full_bin]+=count;
 #ifdef JACKKNIFE
-            c4vj = c4v*JK_weight;
-            c4j[tmp_full_bin]+=c4vj;
+        c4j[tmp_full_bin]+=c4vj;
 #endif
 #endif
-        }
     }
 
 #ifdef JACKKNIFE
 private:
+    // The jackknife weight tensor summed over the l particles of each group (slot, or k-l bin and basis element) with sums[g] of the l factors,
+    // of which jk_vals[t] fall in group jk_group[t] and region jk_region[t], is built in three parts by fourth() and fourth_basis()
+    inline void jk_fixed_parts(int n_groups, const Float* sums, const int* bins, int n_jk, const int* jk_group, const int* jk_region, const Float* jk_vals, int Jj, int Jk, Float* fixed){
+        // The parts independent of i
+        int nbins = JK12->nbins;
+        for (int g = 0; g < n_groups; g++)
+            fixed[g] = sums[g]*((Float)(Jj==Jk)/4. - 0.5*JK34->weights[Jj*nbins+bins[g]]);
+        for (int t = 0; t < n_jk; t++)
+            if (jk_region[t]==Jj) fixed[jk_group[t]] += jk_vals[t]/4.;
+    }
+
+    inline void jk_region_parts(int n_groups, const Float* sums, int n_jk, const int* jk_group, const int* jk_region, const Float* jk_vals, int Ji, int Jk, const Float* fixed, Float* region){
+        // Plus the parts depending only on the region Ji of i
+        for (int g = 0; g < n_groups; g++) region[g] = fixed[g] + sums[g]*(Float)(Ji==Jk)/4.;
+        for (int t = 0; t < n_jk; t++)
+            if (jk_region[t]==Ji) region[jk_group[t]] += jk_vals[t]/4.;
+    }
+
+    inline void jk_bin_parts(int n_groups, int n_jk, const int* jk_group, const int* jk_region, const Float* jk_vals, int bin_a, const Float* region, Float* weight){
+        // Plus the parts depending on the i-j bin bin_a; the rest depends on both i and the k-l bin
+        int nbins = JK12->nbins;
+        for (int g = 0; g < n_groups; g++) weight[g] = region[g];
+        for (int t = 0; t < n_jk; t++)
+            weight[jk_group[t]] -= 0.5*jk_vals[t]*JK12->weights[jk_region[t]*nbins+bin_a];
+    }
+
     inline Float weight_tensor(const int Ji, const int Jj, const int Jk, const int Jl, const int bin_a, const int bin_b, JK_weights *JK_XY, JK_weights *JK_ZW, Float *product_weights){
         // Compute the jackknife weight tensor for jackknife regions J_i, J_j, J_k, J_l and w_aA weight matrix w_matrix. NB: J_x are collapsed jackknife indices here - only using the non-empty regions.
         // JK_weights class holds list of filled JKs, number of filled JKs and the weight matrix.
@@ -525,6 +957,23 @@ public:
             }
         }
 #endif
+        if (n_basis){
+            size_t size_b = (size_t)n_basis*sm_bins;
+            for (size_t j = 0; j < size_b; j++) c2b[j] += ints->c2b[j];
+            for (size_t j = 0; j < size_b*sm_bins; j++) c3b[j] += ints->c3b[j];
+            for (size_t j = 0; j < size_b*n_basis*sm_bins; j++) c4b[j] += ints->c4b[j];
+#ifdef JACKKNIFE
+            for (size_t j = 0; j < size_b; j++) c2jb[j] += ints->c2jb[j];
+            for (size_t j = 0; j < size_b*sm_bins; j++) c3jb[j] += ints->c3jb[j];
+            for (size_t j = 0; j < size_b*n_basis*sm_bins; j++) c4jb[j] += ints->c4jb[j];
+#ifndef LEGENDRE_MIX
+            for (size_t j = 0; j < (size_t)n_basis*n_jack*no_bins; j++){
+                EE1b[j] += ints->EE1b[j];
+                EE2b[j] += ints->EE2b[j];
+            }
+#endif
+#endif
+        }
     }
 #ifdef JACKKNIFE
     void frobenius_difference_sum(Integrals* ints, int n_loop, Float &frobC2, Float &frobC3, Float &frobC4, Float &frobC2j, Float &frobC3j, Float &frobC4j){
@@ -658,7 +1107,48 @@ public:
             }
         }
 #endif
+        if (n_basis) normalize_basis(corrf2*n_pairs, corrf3*n_triples, corrf4*n_quads, n_pairs);
     }
+
+private:
+    void normalize_basis(Float norm2, Float norm3, Float norm4, Float n_pairs){
+        // Normalize the decomposed integrals as C2, C3 and C4 (and the jackknife integrals and EEaA) in the s,mu-binned modes, including the RR counts
+        for (int e = 0; e < n_basis; e++){
+            for (int a = 0; a < sm_bins; a++){
+                Float Ra = JK12->RR_pair_counts[a];
+                c2b[e*sm_bins+a] /= norm2*Ra*Ra;
+#ifdef JACKKNIFE
+                c2jb[e*sm_bins+a] /= norm2*Ra*Ra*(1.-product_weights12_12[a*sm_bins+a]);
+#endif
+                size_t row = ((size_t)e*sm_bins+a)*sm_bins;
+                for (int b = 0; b < sm_bins; b++){
+                    Float Rab3 = Ra*JK23->RR_pair_counts[b];
+                    c3b[row+b] /= norm3*Rab3;
+#ifdef JACKKNIFE
+                    c3jb[row+b] /= norm3*Rab3*(1.-product_weights12_23[a*sm_bins+b]);
+#endif
+                }
+                for (int f = 0; f < n_basis; f++){
+                    row = (((size_t)e*n_basis+f)*sm_bins+a)*sm_bins;
+                    for (int b = 0; b < sm_bins; b++){
+                        Float Rab4 = Ra*JK34->RR_pair_counts[b];
+                        c4b[row+b] /= norm4*Rab4;
+#ifdef JACKKNIFE
+                        c4jb[row+b] /= norm4*Rab4*(1.-product_weights12_34[a*sm_bins+b]);
+#endif
+                    }
+                }
+            }
+#if (defined JACKKNIFE && !defined LEGENDRE_MIX)
+            for (size_t i = (size_t)e*n_jack*no_bins; i < (size_t)(e+1)*n_jack*no_bins; i++){
+                EE1b[i] /= (n_pairs*0.25);
+                EE2b[i] /= (n_pairs*0.25);
+            }
+#endif
+        }
+    }
+
+public:
     void save_counts(uint64 pair_counts,uint64 triple_counts,uint64 quad_counts){
         // Print the counts for each integral (used for combining the estimates outside of C++)
         // This is the number of counts used in each loop [always the same]
@@ -671,186 +1161,244 @@ public:
 
         fflush(NULL);
         fclose(CountsFile);
+
+        if (n_basis){
+            // Describe the basis of the decomposed integrals, for contracting them with the coefficients of xi (see contract_basis)
+            char basis_file[1000];
+            snprintf(basis_file, sizeof basis_file, "%sCovMatricesAll/xi_basis_n%d_m%d.txt",out_file,nbin,mbin);
+            FILE * BasisFile = fopen(basis_file,"w");
+            fprintf(BasisFile,"# xi basis: %d radial bins (r_low r_high) by %d mu bins, with %d elements including the last\n",basis_nbin,basis_mbin,n_basis);
+            for (int i = 0; i < basis_nbin; i++) fprintf(BasisFile,"%.8e %.8e %d\n",basis_low[i],basis_high[i],basis_mbin);
+            fflush(NULL);
+            fclose(BasisFile);
+        }
     }
 
 
     void save_integrals(char* suffix, bool save_all) {
     /* Print integral outputs to file.
         * In txt files {c2,c3,c4,RR}_n{nbin}_m{mbin}.txt there are lists of the outputs of c2,c3,c4 and RR_a that are already normalized and multiplied by combinatoric factors. The n and m strings specify the number of n and m bins present.
+        * If binary output is requested, the same arrays are written as .npy files with the same base names.
         */
         // Create output files
 
         char c2name[1000], c3name[1000], c4name[1000];
 #ifdef LEGENDRE_MIX
-        snprintf(c2name, sizeof c2name, "%sCovMatricesAll/c2_n%d_l%d_%d%d_%s.txt", out_file, nbin, max_l, I1, I2, suffix);
-        snprintf(c3name, sizeof c3name, "%sCovMatricesAll/c3_n%d_l%d_%d,%d%d_%s.txt", out_file, nbin, max_l, I2, I1, I3, suffix);
-        snprintf(c4name, sizeof c4name, "%sCovMatricesAll/c4_n%d_l%d_%d%d,%d%d_%s.txt", out_file, nbin, max_l, I1, I2, I3, I4, suffix);
+        snprintf(c2name, sizeof c2name, "%sCovMatricesAll/c2_n%d_l%d_%d%d_%s", out_file, nbin, max_l, I1, I2, suffix);
+        snprintf(c3name, sizeof c3name, "%sCovMatricesAll/c3_n%d_l%d_%d,%d%d_%s", out_file, nbin, max_l, I2, I1, I3, suffix);
+        snprintf(c4name, sizeof c4name, "%sCovMatricesAll/c4_n%d_l%d_%d%d,%d%d_%s", out_file, nbin, max_l, I1, I2, I3, I4, suffix);
+        save_array(c2name, c2, no_bins, no_bins, npy);
 #else
-        snprintf(c2name, sizeof c2name, "%sCovMatricesAll/c2_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1, I2, suffix);
-        snprintf(c3name, sizeof c3name, "%sCovMatricesAll/c3_n%d_m%d_%d,%d%d_%s.txt", out_file, nbin, mbin, I2, I1, I3, suffix);
-        snprintf(c4name, sizeof c4name, "%sCovMatricesAll/c4_n%d_m%d_%d%d,%d%d_%s.txt", out_file, nbin, mbin, I1, I2, I3, I4,suffix);
-#endif
-#ifndef LEGENDRE_MIX
+        snprintf(c2name, sizeof c2name, "%sCovMatricesAll/c2_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1, I2, suffix);
+        snprintf(c3name, sizeof c3name, "%sCovMatricesAll/c3_n%d_m%d_%d,%d%d_%s", out_file, nbin, mbin, I2, I1, I3, suffix);
+        snprintf(c4name, sizeof c4name, "%sCovMatricesAll/c4_n%d_m%d_%d%d,%d%d_%s", out_file, nbin, mbin, I1, I2, I3, I4,suffix);
         char RRname[1000];
-        snprintf(RRname, sizeof RRname, "%sCovMatricesAll/RR_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1,I2,suffix);
-#endif
-        FILE * C2File = fopen(c2name,"w"); // for c2 part of integral
-        FILE * C3File = fopen(c3name,"w"); // for c3 part of integral
-        FILE * C4File = fopen(c4name,"w"); // for c4 part of integral
-#ifndef LEGENDRE_MIX
-        FILE * RRFile = fopen(RRname,"w"); // for RR part of integral
+        snprintf(RRname, sizeof RRname, "%sCovMatricesAll/RR_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1,I2,suffix);
+        save_array(c2name, c2, no_bins, 0, npy); // c2 is diagonal, saved as a vector
+        save_array(RRname, Ra, no_bins, 0, npy);
 #endif
+        save_array(c3name, c3, no_bins, no_bins, npy);
+        save_array(c4name, c4, no_bins, no_bins, npy);
 
-#ifndef LEGENDRE_MIX
-        for (int j = 0; j < no_bins; j++) {
-            fprintf(C2File,"%le\n", c2[j]);
-            fprintf(RRFile,"%le\n", Ra[j]);
-        }
-#endif
-
-        for(int i = 0; i < no_bins; i++) {
-            for(int j = 0; j < no_bins; j++) {
-#ifdef LEGENDRE_MIX
-                fprintf(C2File, "%le\t", c2[i*no_bins+j]);
-#endif
-                fprintf(C3File, "%le\t", c3[i*no_bins+j]);
-                fprintf(C4File, "%le\t", c4[i*no_bins+j]);
-            }
+        if (save_all) {
+            char bin4name[1000], bin3name[1000], bin2name[1000];
 #ifdef LEGENDRE_MIX
-            fprintf(C2File, "\n");
+            snprintf(bin4name, sizeof bin4name, "%sCovMatricesAll/binct_c4_n%d_l%d_%d%d,%d%d_%s", out_file, nbin, max_l, I1, I2, I3, I4, suffix);
+            snprintf(bin3name, sizeof bin3name, "%sCovMatricesAll/binct_c3_n%d_l%d_%d,%d%d_%s", out_file, nbin, max_l, I2, I1, I3, suffix);
+            snprintf(bin2name, sizeof bin2name, "%sCovMatricesAll/binct_c2_n%d_l%d_%d%d_%s", out_file, nbin, max_l, I1, I2, suffix);
+            save_array(bin2name, binct, no_bins, no_bins, npy);
+#else
+            snprintf(bin4name, sizeof bin4name, "%sCovMatricesAll/binct_c4_n%d_m%d_%d%d,%d%d_%s", out_file, nbin, mbin, I1, I2, I3, I4, suffix);
+            snprintf(bin3name, sizeof bin3name, "%sCovMatricesAll/binct_c3_n%d_m%d_%d,%d%d_%s", out_file, nbin, mbin, I2, I1, I3, suffix);
+            snprintf(bin2name, sizeof bin2name, "%sCovMatricesAll/binct_c2_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1, I2,suffix);
+            save_array(bin2name, binct, no_bins, 0, npy);
 #endif
-            fprintf(C3File, "\n"); // new line each end of row
-            fprintf(C4File, "\n");
+            save_array(bin3name, binct3, no_bins, no_bins, npy);
+            save_array(bin4name, binct4, no_bins, no_bins, npy);
+        }
+        if (n_basis){
+            // The decomposed integrals are in s,mu bins in all modes, with one row per basis element (c2), or per element and first bin (c3, c4)
+            snprintf(c2name, sizeof c2name, "%sCovMatricesAll/c2_basis%d_n%d_m%d_%d%d_%s", out_file, n_basis, nbin, mbin, I1, I2, suffix);
+            snprintf(c3name, sizeof c3name, "%sCovMatricesAll/c3_basis%d_n%d_m%d_%d,%d%d_%s", out_file, n_basis, nbin, mbin, I2, I1, I3, suffix);
+            snprintf(c4name, sizeof c4name, "%sCovMatricesAll/c4_basis%d_n%d_m%d_%d%d,%d%d_%s", out_file, n_basis, nbin, mbin, I1, I2, I3, I4, suffix);
+            save_array(c2name, c2b, n_basis, sm_bins, npy);
+            save_array(c3name, c3b, n_basis*sm_bins, sm_bins, npy);
+            save_array(c4name, c4b, n_basis*n_basis*sm_bins, sm_bins, npy);
         }
+    }
 
-        fflush(NULL);
+    void save_subsample(int index) {
+    /* Append the (normalized) integrals of subsample index to the subsample containers, {c2,c3,c4,RR}_n{nbin}_m{mbin}_{fields}_subsamples.bin
+        * in CovMatricesAll/ (and the jackknife integrals in CovMatricesJack/), instead of writing a new set of files for each subsample.
+        */
+        if (n_containers==0) open_containers();
+        for (int i = 0; i < n_containers; i++) containers[i]->append(index, *container_data[i]);
+    }
 
-        // Close open files
-        fclose(C2File);
-        fclose(C3File);
-        fclose(C4File);
+    bool in_memory(){
+        return memory!=NULL;
+    }
+
+    void store_arrays(int block){
+        // Copy the (normalized) integrals into the given block of the caller's arrays: 0 for the full integrals, 1+index for subsample index
+        store_array(memory->c2, c2, size2, block);
+        store_array(memory->c3, c3, no_bins*no_bins, block);
+        store_array(memory->c4, c4, no_bins*no_bins, block);
 #ifndef LEGENDRE_MIX
-        fclose(RRFile);
+        store_array(memory->RR, Ra, size2, block);
 #endif
-        if (save_all) {
-            char bin4name[1000], bin3name[1000], bin2name[1000];
+#ifdef JACKKNIFE
+        store_array(memory->c2j, c2j, size2, block);
+        store_array(memory->c3j, c3j, no_bins*no_bins, block);
+        store_array(memory->c4j, c4j, no_bins*no_bins, block);
+#ifndef LEGENDRE_MIX
+        store_array(memory->EE1, EEaA1, n_jack*no_bins, block);
+        store_array(memory->EE2, EEaA2, n_jack*no_bins, block);
+        store_array(memory->RR1, RRaA1, n_jack*no_bins, block);
+        store_array(memory->RR2, RRaA2, n_jack*no_bins, block);
+#endif
+#endif
+    }
+
+private:
+    void store_array(Float *dest, Float *data, int size, int block){
+        if (dest!=NULL) memcpy(dest+(size_t)block*size, data, sizeof(Float)*size);
+    }
+
+    void open_containers(){
+        // Create the containers with the same base names as the per-subsample files
+        containers = (SubsampleContainer **)malloc(sizeof(SubsampleContainer*)*max_containers);
+        container_data = (Float ***)malloc(sizeof(Float**)*max_containers);
+        char name[1000];
+        int c2_cols = size2==no_bins ? 0 : no_bins; // c2 is saved as a vector unless in LEGENDRE_MIX mode
 #ifdef LEGENDRE_MIX
-            snprintf(bin4name, sizeof bin4name, "%sCovMatricesAll/binct_c4_n%d_l%d_%d%d,%d%d_%s.txt", out_file, nbin, max_l, I1, I2, I3, I4, suffix);
-            snprintf(bin3name, sizeof bin3name, "%sCovMatricesAll/binct_c3_n%d_l%d_%d,%d%d_%s.txt", out_file, nbin, max_l, I2, I1, I3, suffix);
-            snprintf(bin2name, sizeof bin2name, "%sCovMatricesAll/binct_c2_n%d_l%d_%d%d_%s.txt", out_file, nbin, max_l, I1, I2, suffix);
+        snprintf(name, sizeof name, "%sCovMatricesAll/c2_n%d_l%d_%d%d", out_file, nbin, max_l, I1, I2);
 #else
-            snprintf(bin4name, sizeof bin4name, "%sCovMatricesAll/binct_c4_n%d_m%d_%d%d,%d%d_%s.txt", out_file, nbin, mbin, I1, I2, I3, I4, suffix);
-            snprintf(bin3name, sizeof bin3name, "%sCovMatricesAll/binct_c3_n%d_m%d_%d,%d%d_%s.txt", out_file, nbin, mbin, I2, I1, I3, suffix);
-            snprintf(bin2name, sizeof bin2name, "%sCovMatricesAll/binct_c2_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1, I2,suffix);
+        snprintf(name, sizeof name, "%sCovMatricesAll/c2_n%d_m%d_%d%d", out_file, nbin, mbin, I1, I2);
 #endif
-            FILE * Bin4File = fopen(bin4name, "w");
-            FILE * Bin3File = fopen(bin3name, "w");
-            FILE * Bin2File = fopen(bin2name, "w");
-
-#ifndef LEGENDRE_MIX
-            for (int j=0; j<no_bins; j++) {
-                fprintf(Bin2File,"%llu\n",binct[j]);
-            }
+        add_container(name, &c2, no_bins, c2_cols);
+#ifdef LEGENDRE_MIX
+        snprintf(name, sizeof name, "%sCovMatricesAll/c3_n%d_l%d_%d,%d%d", out_file, nbin, max_l, I2, I1, I3);
+#else
+        snprintf(name, sizeof name, "%sCovMatricesAll/c3_n%d_m%d_%d,%d%d", out_file, nbin, mbin, I2, I1, I3);
 #endif
-
-            for(int i=0; i<no_bins; i++){
-                for(int j=0; j<no_bins; j++){
-                    fprintf(Bin4File, "%llu\t", binct4[i*no_bins+j]);
-                    fprintf(Bin3File, "%llu\t", binct3[i*no_bins+j]);
+        add_container(name, &c3, no_bins, no_bins);
 #ifdef LEGENDRE_MIX
-                    fprintf(Bin2File, "%llu\t", binct[i*no_bins+j]);
+        snprintf(name, sizeof name, "%sCovMatricesAll/c4_n%d_l%d_%d%d,%d%d", out_file, nbin, max_l, I1, I2, I3, I4);
+#else
+        snprintf(name, sizeof name, "%sCovMatricesAll/c4_n%d_m%d_%d%d,%d%d", out_file, nbin, mbin, I1, I2, I3, I4);
 #endif
-                }
-                fprintf(Bin4File,"\n");
-                fprintf(Bin3File,"\n");
+        add_container(name, &c4, no_bins, no_bins);
+#ifndef LEGENDRE_MIX
+        snprintf(name, sizeof name, "%sCovMatricesAll/RR_n%d_m%d_%d%d", out_file, nbin, mbin, I1, I2);
+        add_container(name, &Ra, no_bins, 0);
+#endif
+        if (n_basis){
+            snprintf(name, sizeof name, "%sCovMatricesAll/c2_basis%d_n%d_m%d_%d%d", out_file, n_basis, nbin, mbin, I1, I2);
+            add_container(name, &c2b, n_basis, sm_bins);
+            snprintf(name, sizeof name, "%sCovMatricesAll/c3_basis%d_n%d_m%d_%d,%d%d", out_file, n_basis, nbin, mbin, I2, I1, I3);
+            add_container(name, &c3b, n_basis*sm_bins, sm_bins);
+            snprintf(name, sizeof name, "%sCovMatricesAll/c4_basis%d_n%d_m%d_%d%d,%d%d", out_file, n_basis, nbin, mbin, I1, I2, I3, I4);
+            add_container(name, &c4b, n_basis*n_basis*sm_bins, sm_bins);
+        }
+#ifdef JACKKNIFE
 #ifdef LEGENDRE_MIX
-                fprintf(Bin2File,"\n");
+        snprintf(name, sizeof name, "%sCovMatricesJack/c2_n%d_l%d_%d%d", out_file, nbin, max_l, I1, I2);
+        add_container(name, &c2j, no_bins, c2_cols);
+        snprintf(name, sizeof name, "%sCovMatricesJack/c3_n%d_l%d_%d,%d%d", out_file, nbin, max_l, I2, I1, I3);
+        add_container(name, &c3j, no_bins, no_bins);
+        snprintf(name, sizeof name, "%sCovMatricesJack/c4_n%d_l%d_%d%d,%d%d", out_file, nbin, max_l, I1, I2, I3, I4);
+        add_container(name, &c4j, no_bins, no_bins);
+#else
+        snprintf(name, sizeof name, "%sCovMatricesJack/c2_n%d_m%d_%d%d", out_file, nbin, mbin, I1, I2);
+        add_container(name, &c2j, no_bins, c2_cols);
+        snprintf(name, sizeof name, "%sCovMatricesJack/c3_n%d_m%d_%d,%d%d", out_file, nbin, mbin, I2, I1, I3);
+        add_container(name, &c3j, no_bins, no_bins);
+        snprintf(name, sizeof name, "%sCovMatricesJack/c4_n%d_m%d_%d%d,%d%d", out_file, nbin, mbin, I1, I2, I3, I4);
+        add_container(name, &c4j, no_bins, no_bins);
+        snprintf(name, sizeof name, "%sCovMatricesJack/EE1_n%d_m%d_%d%d", out_file, nbin, mbin, I1, I2);
+        add_container(name, &EEaA1, n_jack, no_bins);
+        snprintf(name, sizeof name, "%sCovMatricesJack/EE2_n%d_m%d_%d%d", out_file, nbin, mbin, I1, I2);
+        add_container(name, &EEaA2, n_jack, no_bins);
+        snprintf(name, sizeof name, "%sCovMatricesJack/RR1_n%d_m%d_%d%d", out_file, nbin, mbin, I1, I2);
+        add_container(name, &RRaA1, n_jack, no_bins);
+        snprintf(name, sizeof name, "%sCovMatricesJack/RR2_n%d_m%d_%d%d", out_file, nbin, mbin, I1, I2);
+        add_container(name, &RRaA2, n_jack, no_bins);
+#endif
+        if (n_basis){
+            snprintf(name, sizeof name, "%sCovMatricesJack/c2_basis%d_n%d_m%d_%d%d", out_file, n_basis, nbin, mbin, I1, I2);
+            add_container(name, &c2jb, n_basis, sm_bins);
+            snprintf(name, sizeof name, "%sCovMatricesJack/c3_basis%d_n%d_m%d_%d,%d%d", out_file, n_basis, nbin, mbin, I2, I1, I3);
+            add_container(name, &c3jb, n_basis*sm_bins, sm_bins);
+            snprintf(name, sizeof name, "%sCovMatricesJack/c4_basis%d_n%d_m%d_%d%d,%d%d", out_file, n_basis, nbin, mbin, I1, I2, I3, I4);
+            add_container(name, &c4jb, n_basis*n_basis*sm_bins, sm_bins);
+#ifndef LEGENDRE_MIX
+            snprintf(name, sizeof name, "%sCovMatricesJack/EE1_basis%d_n%d_m%d_%d%d", out_file, n_basis, nbin, mbin, I1, I2);
+            add_container(name, &EE1b, n_basis*n_jack, no_bins);
+            snprintf(name, sizeof name, "%sCovMatricesJack/EE2_basis%d_n%d_m%d_%d%d", out_file, n_basis, nbin, mbin, I1, I2);
+            add_container(name, &EE2b, n_basis*n_jack, no_bins);
 #endif
-            }
-            fclose(Bin4File);
-            fclose(Bin2File);
-            fclose(Bin3File);
         }
+#endif
     }
 
+    void add_container(const char* name, Float** data, int n_rows, int n_cols){
+        assert(n_containers<max_containers);
+        containers[n_containers] = new SubsampleContainer(name, "<f8", n_rows, n_cols, sizeof(Float));
+        container_data[n_containers++] = data;
+    }
+
+public:
 #ifdef JACKKNIFE
     void save_jackknife_integrals(char* suffix) {
     /* Print jackknife integral outputs to file.
         * In txt files {c2,c3,c4,RR}_n{nbin}_m{mbin}.txt there are lists of the outputs of c2,c3,c4 and RR_a that are already normalized and multiplied by combinatoric factors. The n and m strings specify the number of n and m bins present.
+        * If binary output is requested, the same arrays are written as .npy files with the same base names.
         */
         // Create output files
 
         char c2name[1000], c3name[1000], c4name[1000];
 #ifdef LEGENDRE_MIX
-        snprintf(c2name, sizeof c2name, "%sCovMatricesJack/c2_n%d_l%d_%d%d_%s.txt", out_file, nbin, max_l, I1, I2, suffix);
-        snprintf(c3name, sizeof c3name, "%sCovMatricesJack/c3_n%d_l%d_%d,%d%d_%s.txt", out_file, nbin, max_l, I2, I1, I3, suffix);
-        snprintf(c4name, sizeof c4name, "%sCovMatricesJack/c4_n%d_l%d_%d%d,%d%d_%s.txt", out_file, nbin, max_l, I1, I2, I3, I4, suffix);
+        snprintf(c2name, sizeof c2name, "%sCovMatricesJack/c2_n%d_l%d_%d%d_%s", out_file, nbin, max_l, I1, I2, suffix);
+        snprintf(c3name, sizeof c3name, "%sCovMatricesJack/c3_n%d_l%d_%d,%d%d_%s", out_file, nbin, max_l, I2, I1, I3, suffix);
+        snprintf(c4name, sizeof c4name, "%sCovMatricesJack/c4_n%d_l%d_%d%d,%d%d_%s", out_file, nbin, max_l, I1, I2, I3, I4, suffix);
+        save_array(c2name, c2j, no_bins, no_bins, npy);
 #else
-        snprintf(c2name, sizeof c2name, "%sCovMatricesJack/c2_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1, I2, suffix);
-        snprintf(c3name, sizeof c3name, "%sCovMatricesJack/c3_n%d_m%d_%d,%d%d_%s.txt", out_file, nbin, mbin, I2, I1, I3, suffix);
-        snprintf(c4name, sizeof c4name, "%sCovMatricesJack/c4_n%d_m%d_%d%d,%d%d_%s.txt", out_file, nbin, mbin, I1, I2, I3, I4, suffix);
-#endif
-        FILE * C2File = fopen(c2name,"w"); // for c2 part of integral
-        FILE * C3File = fopen(c3name,"w"); // for c3 part of integral
-        FILE * C4File = fopen(c4name,"w"); // for c4 part of integral
-#ifndef LEGENDRE_MIX
+        snprintf(c2name, sizeof c2name, "%sCovMatricesJack/c2_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1, I2, suffix);
+        snprintf(c3name, sizeof c3name, "%sCovMatricesJack/c3_n%d_m%d_%d,%d%d_%s", out_file, nbin, mbin, I2, I1, I3, suffix);
+        snprintf(c4name, sizeof c4name, "%sCovMatricesJack/c4_n%d_m%d_%d%d,%d%d_%s", out_file, nbin, mbin, I1, I2, I3, I4, suffix);
+        save_array(c2name, c2j, no_bins, 0, npy);
+
         char RR1name[1000];
-        snprintf(RR1name,sizeof RR1name, "%sCovMatricesJack/RR1_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1,I2,suffix);
+        snprintf(RR1name,sizeof RR1name, "%sCovMatricesJack/RR1_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1,I2,suffix);
         char RR2name[1000];
-        snprintf(RR2name,sizeof RR2name, "%sCovMatricesJack/RR2_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1,I2,suffix);
+        snprintf(RR2name,sizeof RR2name, "%sCovMatricesJack/RR2_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1,I2,suffix);
         char EE1name[1000];
-        snprintf(EE1name,sizeof EE1name, "%sCovMatricesJack/EE1_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1,I2,suffix);
+        snprintf(EE1name,sizeof EE1name, "%sCovMatricesJack/EE1_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1,I2,suffix);
         char EE2name[1000];
-        snprintf(EE2name,sizeof EE2name, "%sCovMatricesJack/EE2_n%d_m%d_%d%d_%s.txt", out_file, nbin, mbin, I1,I2,suffix);
-        FILE * EE1File = fopen(EE1name, "w"); // for EE1 integral
-        FILE * EE2File = fopen(EE2name,"w"); // for EE2 integral
-        FILE * RR1File = fopen(RR1name, "w"); // for RR1 integral
-        FILE * RR2File = fopen(RR2name,"w"); // for RR2 integral
-        for (int j = 0; j < no_bins; j++) {
-            fprintf(C2File,"%le\n",c2j[j]);
-        }
-#endif
-        for (int i = 0; i < no_bins; i++) {
-            for (int j = 0; j < no_bins; j++) {
-                fprintf(C3File, "%le\t", c3j[i*no_bins+j]);
-                fprintf(C4File, "%le\t", c4j[i*no_bins+j]);
-#ifdef LEGENDRE_MIX
-                fprintf(C2File, "%le\t", c2j[i*no_bins+j]);
-#endif
-            }
-            fprintf(C3File,"\n"); // new line each end of row
-            fprintf(C4File,"\n");
-#ifdef LEGENDRE_MIX
-            fprintf(C2File,"\n");
-#endif
-        }
-#ifndef LEGENDRE_MIX
-        for (int i = 0; i < n_jack; i++){
-            for (int j = 0; j < no_bins; j++) {
-                fprintf(EE1File, "%le\t", EEaA1[i*no_bins+j]);
-                fprintf(EE2File, "%le\t", EEaA2[i*no_bins+j]);
-                fprintf(RR1File, "%le\t", RRaA1[i*no_bins+j]);
-                fprintf(RR2File, "%le\t", RRaA2[i*no_bins+j]);
-            }
-            fprintf(EE1File,"\n");
-            fprintf(EE2File,"\n");
-            fprintf(RR1File,"\n");
-            fprintf(RR2File,"\n");
-        }
-#endif
-
-        fflush(NULL);
-
-        // Close open files
-        fclose(C2File);
-        fclose(C3File);
-        fclose(C4File);
+        snprintf(EE2name,sizeof EE2name, "%sCovMatricesJack/EE2_n%d_m%d_%d%d_%s", out_file, nbin, mbin, I1,I2,suffix);
+        save_array(EE1name, EEaA1, n_jack, no_bins, npy); // one row per jackknife region
+        save_array(EE2name, EEaA2, n_jack, no_bins, npy);
+        save_array(RR1name, RRaA1, n_jack, no_bins, npy);
+        save_array(RR2name, RRaA2, n_jack, no_bins, npy);
+#endif
+        save_array(c3name, c3j, no_bins, no_bins, npy);
+        save_array(c4name, c4j, no_bins, no_bins, npy);
+        if (n_basis){
+            // Decomposed as in save_integrals(); EE1 and EE2 have one block of jackknife regions per basis element
+            snprintf(c2name, sizeof c2name, "%sCovMatricesJack/c2_basis%d_n%d_m%d_%d%d_%s", out_file, n_basis, nbin, mbin, I1, I2, suffix);
+            snprintf(c3name, sizeof c3name, "%sCovMatricesJack/c3_basis%d_n%d_m%d_%d,%d%d_%s", out_file, n_basis, nbin, mbin, I2, I1, I3, suffix);
+            snprintf(c4name, sizeof c4name, "%sCovMatricesJack/c4_basis%d_n%d_m%d_%d%d,%d%d_%s", out_file, n_basis, nbin, mbin, I1, I2, I3, I4, suffix);
+            save_array(c2name, c2jb, n_basis, sm_bins, npy);
+            save_array(c3name, c3jb, n_basis*sm_bins, sm_bins, npy);
+            save_array(c4name, c4jb, n_basis*n_basis*sm_bins, sm_bins, npy);
 #ifndef LEGENDRE_MIX
-        fclose(EE1File);
-        fclose(EE2File);
-        fclose(RR1File);
-        fclose(RR2File);
+            snprintf(EE1name,sizeof EE1name, "%sCovMatricesJack/EE1_basis%d_n%d_m%d_%d%d_%s", out_file, n_basis, nbin, mbin, I1,I2,suffix);
+            snprintf(EE2name,sizeof EE2name, "%sCovMatricesJack/EE2_basis%d_n%d_m%d_%d%d_%s", out_file, n_basis, nbin, mbin, I1,I2,suffix);
+            save_array(EE1name, EE1b, n_basis*n_jack, no_bins, npy);
+            save_array(EE2name, EE2b, n_basis*n_jack, no_bins, npy);
 #endif
+        }
     }
 #endif
 
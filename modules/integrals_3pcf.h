@@ -2,14 +2,96 @@
 #include "parameters.h"
 #include "correlation_function.h"
 #include "cell_utilities.h"
+#include "huge_pages.h"
 #include "legendre_utilities.h"
 
 #ifndef INTEGRALS_3PCF_H
 #define INTEGRALS_3PCF_H
 
+class DrawColumns{
+    // Contributions of the particles drawn last in the C5 or C6 integrand (m or n) for fixed j, k, l (and m) particles.
+    // Each drawn particle adds its factor times the correction factors and Legendre polynomials of its triangle to the columns (second triangle bin and multipole)
+    // of the output matrix; these column sums are multiplied with the rows of all i particles at once by Integrals::contract().
+private:
+    int nbin, mbin, max_cols; // max_cols is the maximum number of columns of one drawn particle
+public:
+    int n_draws = 0, n_cols = 0; // numbers of drawn particles and of columns with contributions
+    int *cols = NULL; // list of the columns with contributions
+    Float *col_sum = NULL; // summed contributions for each column of the output matrix
+    int *col_count = NULL; // number of contributions for each column
+    int *draw_id = NULL, *draw_n_cols = NULL, *draw_cols = NULL; // index, number of columns and columns of each drawn particle, to remove the self-counts with the i particles
+    Float *draw_vals = NULL; // contributions of each drawn particle to its columns
+
+    void init(int _nbin, int _mbin, int max_draws){
+        nbin = _nbin;
+        mbin = _mbin;
+        max_cols = 3*mbin;
+        int array_len = nbin*nbin*mbin;
+        int ec=0;
+        ec+=posix_memalign((void **) &cols, PAGE, sizeof(int)*array_len);
+        ec+=posix_memalign((void **) &col_sum, PAGE, sizeof(Float)*array_len);
+        ec+=posix_memalign((void **) &col_count, PAGE, sizeof(int)*array_len);
+        ec+=posix_memalign((void **) &draw_id, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &draw_n_cols, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &draw_cols, PAGE, sizeof(int)*max_draws*max_cols);
+        ec+=posix_memalign((void **) &draw_vals, PAGE, sizeof(Float)*max_draws*max_cols);
+        assert(ec==0);
+        for (int j=0; j<array_len; j++){
+            col_sum[j] = 0;
+            col_count[j] = 0;
+        }
+    }
+
+    ~DrawColumns(){
+        free(cols);
+        free(col_sum);
+        free(col_count);
+        free(draw_id);
+        free(draw_n_cols);
+        free(draw_cols);
+        free(draw_vals);
+    }
+
+    inline void add(const int id, const Float factor, const int bins[6], const Float correction_factor[3], const Float legendre[]){
+        // Add a drawn particle with index id and the given factor, for the three orientations of its triangle (skipped if the correction factor is -1, i.e. for incorrect bins)
+        int col, n_draw_cols=0;
+        Float val;
+        for(int bin_index=0;bin_index<3;bin_index++){
+            if(correction_factor[bin_index]==-1) continue;
+            int tmp_radial_bin = (bins[bin_index*2]*nbin+bins[bin_index*2+1])*mbin;
+            for(int q_bin=0;q_bin<mbin;q_bin++){
+                col = tmp_radial_bin+q_bin;
+                val = factor*correction_factor[bin_index]*legendre[bin_index*mbin+q_bin];
+                if(col_count[col]==0) cols[n_cols++] = col;
+                col_count[col]++;
+                col_sum[col] += val;
+                draw_cols[n_draws*max_cols+n_draw_cols] = col;
+                draw_vals[n_draws*max_cols+n_draw_cols] = val;
+                n_draw_cols++;
+            }
+        }
+        draw_id[n_draws] = id;
+        draw_n_cols[n_draws] = n_draw_cols;
+        n_draws++;
+    }
+
+    inline void clear(){
+        for(int k=0;k<n_cols;k++){
+            col_sum[cols[k]] = 0;
+            col_count[cols[k]] = 0;
+        }
+        n_cols = 0;
+        n_draws = 0;
+    }
+
+    inline int max_columns(){
+        return max_cols;
+    }
+};
+
 class Integrals{
 public:
-    CorrelationFunction *cf;
+    CorrelationFunction *cf = NULL; // this object's copy of the correlation function, sharing its tables
     
 private:
     int nbin, mbin, max_l, array_len,max_leg,n_param,mbin_leg;
@@ -21,6 +103,7 @@ private:
     
     uint64 *binct3, *binct4, *binct5, *binct6; // Arrays to accumulate bin counts
     SurveyCorrection *sc; // survey correction function
+    DrawColumns draws5, draws6; // m and n particles collected by fifth_draw() and sixth_draw()
     
 public:
     Integrals(){};
@@ -44,17 +127,19 @@ public:
         int ec=0;
         array_len = nbin*nbin*mbin;
         // Initialize the binning
-        ec+=posix_memalign((void **) &c3, PAGE, sizeof(double)*array_len*array_len);
-        ec+=posix_memalign((void **) &c4, PAGE, sizeof(double)*array_len*array_len);
-        ec+=posix_memalign((void **) &c5, PAGE, sizeof(double)*array_len*array_len);
-        ec+=posix_memalign((void **) &c6, PAGE, sizeof(double)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &c3, sizeof(double)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &c4, sizeof(double)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &c5, sizeof(double)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &c6, sizeof(double)*array_len*array_len);
 
-        ec+=posix_memalign((void **) &binct3, PAGE, sizeof(uint64)*array_len*array_len);
-        ec+=posix_memalign((void **) &binct4, PAGE, sizeof(uint64)*array_len*array_len);
-        ec+=posix_memalign((void **) &binct5, PAGE, sizeof(uint64)*array_len*array_len);
-        ec+=posix_memalign((void **) &binct6, PAGE, sizeof(uint64)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &binct3, sizeof(uint64)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &binct4, sizeof(uint64)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &binct5, sizeof(uint64)*array_len*array_len);
+        ec+=huge_page_alloc((void **) &binct6, sizeof(uint64)*array_len*array_len);
         
         assert(ec==0);
+        draws5.init(nbin, mbin, par->N5); // at most N5 m particles per l particle
+        draws6.init(nbin, mbin, par->N6); // at most N6 n particles per m particle
         reset();
         
         box=par->perbox;
@@ -70,6 +155,7 @@ public:
     }
 
     ~Integrals() {
+        delete cf;
         free(c3);
         free(c4);
         free(c5);
@@ -447,14 +533,14 @@ public:
         }
     }
 
-    inline void fifth(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const Particle pl, Particle pm, const int pj_id, const int pk_id, const int pl_id, const int pm_id, const double prob, const Float* wijkl, const int* bins_ijk, const Float* all_correction_factor_ijk, const Float* all_legendre_ijk, const Float* xi_pass, const Float* xi_pass2, const Float norm_kl, const int bin_kl, Float* &wijklm, Float &xi_pass3, Float &norm_lm, int &bin_lm, int index){
-        // Accumulates the five point integral C5.
+    inline void fifth_draw(const int* prim_ids, const int pln, const Particle pj, const Particle pk, const Particle pl, const Particle pm, const int pm_id, const double prob, const Float* wijkl, const Float norm_kl, const int bin_kl, Float* &wijklm, Float &xi_pass3, Float &norm_lm, int &bin_lm, int index){
+        // Collects one m particle for the five point integral C5 of the current j, k and l particles, which is accumulated by fifth() once all N5 m particles are drawn.
+        // The C5 contribution factorizes into an i part (weights, xi_ij or xi_il, and the ijk triangle) and an m part (w_m/prob, xi_lm or xi_jm, and the klm triangle); the m parts are summed here.
+        // Also outputs the weights w_ijklm and the j-m correlation function for sixth_draw() and sixth().
         
-        Float norm_klm[3],ang_klm[3],los_tmp, tmp_xi1,tmp_xi2, polynomials_tmp[mbin_leg];
-        Float all_correction_factor_klm[3],all_legendre_klm[3*mbin],tmp_weight,c5v, this_poly, correction_factor1, correction_factor2, tmp_phi_inv;
-        int bins_klm[6], bin_1,bin_2,bin_3,bin_4,tmp_radial_bin, tmp_radial_bin2, out_bin;
-        Particle pi;
-        bool dont_compute=false;
+        Float norm_klm[3],ang_klm[3],los_tmp, tmp_xi1, polynomials_tmp[mbin_leg];
+        Float all_correction_factor_klm[3],all_legendre_klm[3*mbin], tmp_phi_inv;
+        int bins_klm[6], bin_1,bin_2;
         
         // Define triangle sides independent of i
         triangle_bins(pk.pos,pl.pos,pm.pos,norm_klm,ang_klm,norm_kl,2);
@@ -473,12 +559,18 @@ public:
             xi_pass3 = tmp_xi1; // save for next integrator
         }        
 
+        // Define weights for the next integrator
+        for(int i=0;i<pln;i++){ // Iterate over particle in pi_list
+            if((prim_ids[i]==pm_id)||(wijkl[i]==-1)) wijklm[i]=-1; // self-counts
+            else wijklm[i] = wijkl[i]*pm.w;
+        }
+
         // Compute radial bins for this triangle
         int x = all_bins(norm_klm,bins_klm,bin_kl,2);
         bin_lm = bins_klm[5];
         
         // Check if there are any correct radial bins
-        if(x==3) dont_compute=true;
+        if(x==3) return;
         
         // Preload correction factors and Legendre polynomials
         for(int bin_index=0;bin_index<3;bin_index++){
@@ -505,69 +597,25 @@ public:
             for(int p_bin=0;p_bin<mbin;p_bin++) all_legendre_klm[bin_index*mbin+p_bin]=polynomials_tmp[p_bin];
         }
         
-        for(int i=0;i<pln;i++){ // Iterate over particle in pi_list
-            
-            // First check for any self-counts;
-            if((prim_ids[i]==pm_id)||(wijkl[i]==-1)){
-                wijklm[i]=-1;
-                continue;
-            }
-            pi = pi_list[i]; // first particle
-            
-            // Define weights and correlation function
-            tmp_weight = wijkl[i]*pm.w; // 
-            wijklm[i] = tmp_weight; // save for later
-            
-            // Skip if there are no correct triangle configurations
-            if (dont_compute) continue;
-            
-            if(index==0) tmp_xi2 = xi_pass[i]; // xi_ij
-            else tmp_xi2 = xi_pass2[i]; // xi_il
-            
-            // Now compute integral contribution
-            if(index==0) c5v = 9.*tmp_weight*pk.w/prob*tmp_xi1 * tmp_xi2;
-            else c5v = 18.*tmp_weight*pk.w/prob*tmp_xi1 * tmp_xi2;
-            
-            for(int bin_index=0;bin_index<3;bin_index++){
-                // Load correction factor
-                correction_factor1 = all_correction_factor_ijk[i*3+bin_index];
-                if(correction_factor1==-1) continue;
-                
-                bin_1 = bins_ijk[i*6+bin_index*2];
-                bin_2 = bins_ijk[i*6+bin_index*2+1];
-                tmp_radial_bin = (bin_1*nbin+bin_2)*mbin;
-                
-                for(int bin_index2=0;bin_index2<3;bin_index2++){
-                    correction_factor2 = all_correction_factor_klm[bin_index2];
-                    if(correction_factor2==-1) continue;
-           
-                    bin_3 = bins_klm[bin_index2*2];
-                    bin_4 = bins_klm[bin_index2*2+1];
-                    
-                    // Add to relevant Legendre bins
-                    tmp_radial_bin2 = (bin_3*nbin+bin_4)*mbin;
-                    for(int p_bin=0;p_bin<mbin;p_bin++){
-                        this_poly = all_legendre_ijk[(i*3+bin_index)*mbin+p_bin];
-                        for(int q_bin=0;q_bin<mbin;q_bin++){
-                            out_bin = (tmp_radial_bin+p_bin)*array_len+tmp_radial_bin2+q_bin;
-                        
-                            // Add to integral (extra 4 is from 2x symmetry in each angle kernel)
-                            c5[out_bin] += c5v*this_poly*all_legendre_klm[bin_index2*mbin+q_bin]*correction_factor1*correction_factor2*4.;
-                            binct5[out_bin]++;
-                        }
-                    }
-                }
-            }
-        }
+        draws5.add(pm_id, pm.w/prob*tmp_xi1, bins_klm, all_correction_factor_klm, all_legendre_klm);
+    }
+    
+    inline void fifth(const int* prim_ids, const int pln, const Particle pk, const Float* wijkl, const int* bins_ijk, const Float* all_correction_factor_ijk, const Float* all_legendre_ijk, const Float* xi_pass, const Float* xi_pass2, int index){
+        // Accumulates the five point integral C5 for the m particles collected by fifth_draw().
+        Float factor;
+        if(index==0) factor = 9.*pk.w; 
+        else factor = 18.*pk.w;
+        if(index==0) contract(c5, binct5, &draws5, prim_ids, pln, wijkl, xi_pass, factor, bins_ijk, all_correction_factor_ijk, all_legendre_ijk); // with xi_ij
+        else contract(c5, binct5, &draws5, prim_ids, pln, wijkl, xi_pass2, factor, bins_ijk, all_correction_factor_ijk, all_legendre_ijk); // with xi_il
     }
     
-    inline void sixth(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const Particle pl, const Particle pm, const Particle pn, const int pj_id, const int pk_id, const int pl_id, const int pm_id, const int pn_id, const double prob, const Float* wijklm, const int* bins_ijk,  const Float* all_correction_factor_ijk, const Float* all_legendre_ijk, const Float* xi_pass, const Float* xi_pass2, const Float xi_pass3, const Float norm_lm, const int bin_lm, int index){
-        // Accumulates the six point integral C6.
+    inline void sixth_draw(const Particle pk, const Particle pl, const Particle pm, const Particle pn, const int pn_id, const double prob, const Float* xi_pass2, const Float xi_pass3, const Float norm_lm, const int bin_lm, int index){
+        // Collects one n particle for the six point integral C6 of the current j, k, l and m particles, which is accumulated by sixth() once all N6 n particles are drawn.
+        // As for C5, the n part (w_n/prob, xi_mn*xi_kl or xi_jm*xi_kn, and the lmn triangle) is summed here.
          
-        Float norm_lmn[3],ang_lmn[3],norm_tmp,los_tmp, tmp_xi1,tmp_xi2,tmp_xi3, polynomials_tmp[mbin_leg],correction_factor1,correction_factor2,this_poly;
-        Float all_correction_factor_lmn[3],all_legendre_lmn[3*mbin],c6v,tmp_phi_inv;
-        int bins_lmn[6], bin_1,bin_2,bin_3,bin_4,tmp_radial_bin,tmp_radial_bin2,out_bin;
-        Particle pi;
+        Float norm_lmn[3],ang_lmn[3],norm_tmp,los_tmp, tmp_xi1,tmp_xi2, polynomials_tmp[mbin_leg];
+        Float all_correction_factor_lmn[3],all_legendre_lmn[3*mbin],tmp_phi_inv;
+        int bins_lmn[6], bin_1,bin_2;
         
         // Define triangle sides independent of i
         triangle_bins(pl.pos,pm.pos,pn.pos,norm_lmn,ang_lmn,norm_lm,2);
@@ -613,24 +661,58 @@ public:
             for(int p_bin=0;p_bin<mbin;p_bin++) all_legendre_lmn[bin_index*mbin+p_bin]=polynomials_tmp[p_bin];
         }
         
+        draws6.add(pn_id, pn.w/prob*tmp_xi1*tmp_xi2, bins_lmn, all_correction_factor_lmn, all_legendre_lmn);
+    }
+    
+    inline void sixth(const int* prim_ids, const int pln, const Float* wijklm, const int* bins_ijk, const Float* all_correction_factor_ijk, const Float* all_legendre_ijk, const Float* xi_pass, const Float* xi_pass2, int index){
+        // Accumulates the six point integral C6 for the n particles collected by sixth_draw().
+        if(index==0) contract(c6, binct6, &draws6, prim_ids, pln, wijklm, xi_pass, 9., bins_ijk, all_correction_factor_ijk, all_legendre_ijk); // with xi_ij
+        else contract(c6, binct6, &draws6, prim_ids, pln, wijklm, xi_pass2, 6., bins_ijk, all_correction_factor_ijk, all_legendre_ijk); // with xi_il
+    }
+
+private:
+    inline void contract(Float* c, uint64* binct, DrawColumns* draws, const int* prim_ids, const int pln, const Float* weights, const Float* xi_i, const Float factor, const int* bins_ijk, const Float* all_correction_factor_ijk, const Float* all_legendre_ijk){
+        // Adds the particles collected in draws to the integral c for all i particles: the row of each i particle and triangle orientation,
+        // factor*weights[i]*xi_i[i] times its correction factor and Legendre polynomials, is multiplied with the summed columns.
+        // The collected particles are then cleared for the next draws.
+        
+        Float row_factor, this_row, correction_factor1;
+        int bin_1, bin_2, tmp_radial_bin, row_bin, col;
+        
         for(int i=0;i<pln;i++){ // Iterate over particle in pi_list
+            if(weights[i]==-1) continue; // skip incorrect bins and self-counts with the earlier particles
+            row_factor = factor*weights[i]*xi_i[i]*4.; // extra 4 is from 2x symmetry in each angle kernel
             
-            // First check for any self-counts;
-            if((prim_ids[i]==pn_id)||(wijklm[i]==-1)){
-                continue;
+            for(int bin_index=0;bin_index<3;bin_index++){
+                // Load correction factor
+                correction_factor1 = all_correction_factor_ijk[i*3+bin_index];
+                if(correction_factor1==-1) continue;
+                
+                bin_1 = bins_ijk[i*6+bin_index*2];
+                bin_2 = bins_ijk[i*6+bin_index*2+1];
+                tmp_radial_bin = (bin_1*nbin+bin_2)*mbin;
+                
+                for(int p_bin=0;p_bin<mbin;p_bin++){
+                    this_row = row_factor*correction_factor1*all_legendre_ijk[(i*3+bin_index)*mbin+p_bin];
+                    row_bin = (tmp_radial_bin+p_bin)*array_len;
+                    for(int k=0;k<draws->n_cols;k++){
+                        col = draws->cols[k];
+                        c[row_bin+col] += this_row*draws->col_sum[col];
+                        binct[row_bin+col] += draws->col_count[col];
+                    }
+                }
             }
-            pi = pi_list[i]; // first particle
-            
-            // Define correlation functions
-            if(index==0) tmp_xi3 = xi_pass[i]; // xi_ij
-            else tmp_xi3 = xi_pass2[i]; // xi_il
-            
-            // Now compute integral contribution
-            if(index==0) c6v = 9.*wijklm[i]*pn.w/prob * tmp_xi1 * tmp_xi2 * tmp_xi3;
-            else c6v = 6.*wijklm[i]*pn.w/prob * tmp_xi1 * tmp_xi2 * tmp_xi3;
+        }
+        
+        // Remove the self-counts of the collected particles with the i particles. The particle indices prim_ids of the i cell are consecutive (see particle_list)
+        int max_cols = draws->max_columns();
+        for(int d=0;d<draws->n_draws;d++){
+            int i = draws->draw_id[d]-prim_ids[0];
+            if((i<0)||(i>=pln)||(prim_ids[i]!=draws->draw_id[d])) continue; // drawn particle is not in the i cell
+            if(weights[i]==-1) continue;
+            row_factor = factor*weights[i]*xi_i[i]*4.;
             
             for(int bin_index=0;bin_index<3;bin_index++){
-                // Load correction factor
                 correction_factor1 = all_correction_factor_ijk[i*3+bin_index];
                 if(correction_factor1==-1) continue;
                 
@@ -638,28 +720,18 @@ public:
                 bin_2 = bins_ijk[i*6+bin_index*2+1];
                 tmp_radial_bin = (bin_1*nbin+bin_2)*mbin;
                 
-                for(int bin_index2=0;bin_index2<3;bin_index2++){
-                    correction_factor2 = all_correction_factor_lmn[bin_index2];
-                    if(correction_factor2==-1) continue;
-           
-                    bin_3 = bins_lmn[bin_index2*2];
-                    bin_4 = bins_lmn[bin_index2*2+1];
-                    
-                    // Add to relevant Legendre bins
-                    tmp_radial_bin2 = (bin_3*nbin+bin_4)*mbin;
-                    for(int p_bin=0;p_bin<mbin;p_bin++){
-                        this_poly = all_legendre_ijk[(i*3+bin_index)*mbin+p_bin];
-                        for(int q_bin=0;q_bin<mbin;q_bin++){
-                            out_bin = (tmp_radial_bin+p_bin)*array_len+tmp_radial_bin2+q_bin;
-                                                    
-                            // Add to integral (extra 4 is from 2x symmetry in each angle kernel)
-                            c6[out_bin] += c6v*this_poly*all_legendre_lmn[bin_index2*mbin+q_bin]*correction_factor1*correction_factor2*4.;
-                            binct6[out_bin]++;
-                        }
+                for(int p_bin=0;p_bin<mbin;p_bin++){
+                    this_row = row_factor*correction_factor1*all_legendre_ijk[(i*3+bin_index)*mbin+p_bin];
+                    row_bin = (tmp_radial_bin+p_bin)*array_len;
+                    for(int k=0;k<draws->draw_n_cols[d];k++){
+                        col = draws->draw_cols[d*max_cols+k];
+                        c[row_bin+col] -= this_row*draws->draw_vals[d*max_cols+k];
+                        binct[row_bin+col]--;
                     }
                 }
             }
         }
+        draws->clear();
     }
 
 public:
@@ -2,6 +2,7 @@
 #include "parameters.h"
 #include "correlation_function.h"
 #include "cell_utilities.h"
+#include "huge_pages.h"
 #include "legendre_utilities.h"
 #include <algorithm>
 
@@ -10,7 +11,7 @@
 
 class Integrals{
 public:
-    CorrelationFunction *cf12, *cf13, *cf24;
+    CorrelationFunction *cf12 = NULL, *cf13 = NULL, *cf24 = NULL; // this object's copies of the correlation functions, sharing their tables
 
 private:
     int nbin, mbin, max_l;
@@ -23,6 +24,14 @@ private:
     uint64 *binct, *binct3, *binct4; // Arrays to accumulate bin counts
     SurveyCorrection *sc12,*sc23,*sc34; // survey correction function
 
+    // The l particles drawn for the current j and k particles are collected by fourth_draw() and added to C4 for all i particles at once by fourth()
+    int max_draws, n_draws = 0, n_slots = 0; // maximum and current number of collected l particles, and number of distinct radial k-l bins (slots) among them
+    int *bin_slot = NULL; // slot of each radial k-l bin, -1 if no collected l particle falls in it
+    int *slot_bin = NULL, *slot_count = NULL; // radial k-l bin and number of l particles of each slot
+    Float *slot_poly = NULL; // sum of the l factors w_l*xi_jl/prob*correction*L_q(mu_kl) (with symmetry factor) in each slot, for each polynomial q
+    int *draw_slot = NULL, *draw_id = NULL; // slot and particle index of each collected l particle, to remove the il self-counts
+    Float *draw_poly = NULL; // l factors of each collected l particle
+
 public:
     Integrals(){};
 
@@ -49,15 +58,25 @@ public:
 
         int ec=0;
         // Initialize the binning
-        ec+=posix_memalign((void **) &c2, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &c3, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &c4, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
-
-        ec+=posix_memalign((void **) &binct, PAGE, sizeof(uint64)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &binct3, PAGE, sizeof(uint64)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &binct4, PAGE, sizeof(uint64)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c2, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c3, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c4, sizeof(double)*nbin*mbin*nbin*mbin);
+
+        ec+=huge_page_alloc((void **) &binct, sizeof(uint64)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &binct3, sizeof(uint64)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &binct4, sizeof(uint64)*nbin*mbin*nbin*mbin);
+
+        max_draws = par->N4; // at most N4 l particles are drawn per k particle
+        ec+=posix_memalign((void **) &bin_slot, PAGE, sizeof(int)*nbin);
+        ec+=posix_memalign((void **) &slot_bin, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &slot_count, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &slot_poly, PAGE, sizeof(Float)*max_draws*mbin);
+        ec+=posix_memalign((void **) &draw_slot, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &draw_id, PAGE, sizeof(int)*max_draws);
+        ec+=posix_memalign((void **) &draw_poly, PAGE, sizeof(Float)*max_draws*mbin);
 
         assert(ec==0);
+        for (int j=0; j<nbin; j++) bin_slot[j] = -1;
         reset();
 
         box=par->perbox;
@@ -73,12 +92,27 @@ public:
     }
 
     ~Integrals() {
+        delete cf12;
+        delete cf13;
+        delete cf24;
         free(c2);
         free(c3);
         free(c4);
         free(binct);
         free(binct3);
         free(binct4);
+        free(bin_slot);
+        free(slot_bin);
+        free(slot_count);
+        free(slot_poly);
+        free(draw_slot);
+        free(draw_id);
+        free(draw_poly);
+    }
+
+    void huge_page_report(const char *name){
+        // Report how much of the largest accumulator is backed by huge pages
+        report_huge_pages(name, c4, sizeof(Float)*nbin*mbin*nbin*mbin);
     }
 
     void reset(){
@@ -92,6 +126,16 @@ public:
         }
     }
 
+    void swap_integrals(Integrals* ints){
+        // Exchange the accumulated arrays with those of ints (constructed with the same parameters), without copying
+        std::swap(c2, ints->c2);
+        std::swap(c3, ints->c3);
+        std::swap(c4, ints->c4);
+        std::swap(binct, ints->binct);
+        std::swap(binct3, ints->binct3);
+        std::swap(binct4, ints->binct4);
+    }
+
     inline int get_radial_bin(Float r){
         // Computes radial bin
 
@@ -219,47 +263,82 @@ public:
         }
     }
 
-    inline void fourth(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const Particle pl, const int pj_id, const int pk_id, const int pl_id, const int* bin_ij, const Float* wijk, const Float* xi_ik, const double prob, const Float* factor_ij, const Float* poly_ij){
-        // Accumulates the four point integral C4.
-
-        // First define variables
-        Particle pi;
-        Float rjl_mag, rjl_mu, rkl_mag, rkl_mu, c4v, xi_jl, tmp_weight;
-        int tmp_bin, tmp_full_bin;
+    inline void fourth_draw(const Particle pj, const Particle pk, const Particle pl, const int pj_id, const int pk_id, const int pl_id, const double prob){
+        // Collects one l particle for the four point integral C4 of the current j and k particles, which is accumulated by fourth() once all N4 l particles are drawn.
+        // The C4 contribution of each i-l pair factorizes into an i factor (w_i*w_j*w_k*xi_ik times the i-j correction and polynomials) and an l factor, so the l factors are summed in each radial k-l bin here.
+        Float rjl_mag, rjl_mu, rkl_mag, rkl_mu, xi_jl;
+        int tmp_bin;
+        if(((pj_id==pl_id)&&(I2==I4))||((pk_id==pl_id)&&(I3==I4))) return; // don't self-count
         cleanup_l(pl.pos,pk.pos,rkl_mag,rkl_mu);
 
-        int max_bin = nbin, out_bin;
-        Float correction_factors, polynomials_kl[mbin];
+        Float l_factor, polynomials_kl[mbin];
         tmp_bin = get_radial_bin(rkl_mag); // radial kl bin
 
-        if ((tmp_bin<0)||(tmp_bin>=max_bin)) return; // if not in correct bin
+        if ((tmp_bin<0)||(tmp_bin>=nbin)) return; // if not in correct bin
+        assert(n_draws<max_draws);
         cleanup_l(pl.pos,pj.pos,rjl_mag,rjl_mu);
         xi_jl = cf24->xi(rjl_mag, rjl_mu); // j-l correlation
 
         // load all legendre polynomials
         legendre_polynomials(rkl_mu, max_l, polynomials_kl);
 
+        int slot = bin_slot[tmp_bin];
+        if (slot==-1){ // first l particle in this bin
+            slot = n_slots++;
+            bin_slot[tmp_bin] = slot;
+            slot_bin[slot] = tmp_bin;
+            slot_count[slot] = 0;
+            for(int q_bin=0;q_bin<mbin;q_bin++) slot_poly[slot*mbin+q_bin] = 0;
+        }
+        l_factor = pl.w/prob*2.*xi_jl*sc34->correction_function(tmp_bin,rkl_mu); // with xi_ik*xi_jl = xi_il*xi_jk symmetry factor
+        slot_count[slot]++;
+        for(int q_bin=0;q_bin<mbin;q_bin++){
+            draw_poly[n_draws*mbin+q_bin] = l_factor*polynomials_kl[q_bin];
+            slot_poly[slot*mbin+q_bin] += draw_poly[n_draws*mbin+q_bin];
+        }
+        draw_slot[n_draws] = slot;
+        draw_id[n_draws] = pl_id;
+        n_draws++;
+    }
+
+    inline void fourth(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const int* bin_ij, const Float* wijk, const Float* xi_ik, const Float* factor_ij, const Float* poly_ij){
+        // Accumulates the four point integral C4 for the l particles collected by fourth_draw(), contracting the l factors of each radial k-l bin with the i factors.
+        // This needs one update per i particle and k-l bin instead of one per i-l pair.
+        Float c4v;
         for(int i=0;i<pln;i++){ // Iterate over particle in pi_list
             if(wijk[i]==-1) continue; // skip incorrect bins / ij self counts
-            if(((prim_ids[i]==pl_id)&&(I1==I4))||((pj_id==pl_id)&&(I2==I4))||((pk_id==pl_id)&&(I3==I4))) continue; // don't self-count
-
-            pi = pi_list[i];
-            tmp_weight = wijk[i]*pl.w; // product of weights, w_i*w_j*w_k*w_l
-
-            // Now compute the integral;
-            c4v = tmp_weight/prob*2.*xi_ik[i]*xi_jl; // with xi_ik*xi_jl = xi_il*xi_jk symmetry factor
-            correction_factors = factor_ij[i]*sc34->correction_function(tmp_bin,rkl_mu);
-
-            // Now add to relevant bins
-            for(int p_bin=0;p_bin<mbin;p_bin++){ // iterate over all legendre polynomials
-                tmp_full_bin = (bin_ij[i]*mbin+p_bin)*nbin*mbin+tmp_bin*mbin;
-                for(int q_bin=0;q_bin<mbin;q_bin++){ // second polynomial
-                    out_bin = tmp_full_bin+q_bin; // output bin
+            c4v = wijk[i]*xi_ik[i]*factor_ij[i]; // i factor
+            for (int slot = 0; slot < n_slots; slot++)
+                add_fourth(bin_ij[i], slot_bin[slot], c4v, poly_ij+i*mbin, slot_poly+slot*mbin, slot_count[slot]);
+        }
+        if (I1==I4){
+            // Remove the il self-counts included above. The particle indices prim_ids of the i cell are consecutive (see particle_list in compute_integral.h)
+            for (int d = 0; d < n_draws; d++){
+                int i = draw_id[d]-prim_ids[0];
+                if ((i<0)||(i>=pln)||(prim_ids[i]!=draw_id[d])) continue; // l particle is not in the i cell
+                if(wijk[i]==-1) continue;
+                c4v = -wijk[i]*xi_ik[i]*factor_ij[i];
+                add_fourth(bin_ij[i], slot_bin[draw_slot[d]], c4v, poly_ij+i*mbin, draw_poly+d*mbin, -1);
+            }
+        }
+        // Clear the collected l particles for the next k particle
+        for (int slot = 0; slot < n_slots; slot++) bin_slot[slot_bin[slot]] = -1;
+        n_draws = 0;
+        n_slots = 0;
+    }
 
-                    // Now add to integral with correct kernel
-                    c4[out_bin]+=c4v*correction_factors*poly_ij[i*mbin+p_bin]*polynomials_kl[q_bin];
-                    binct4[out_bin]++; // only count actual contributions to bin
-                }
+private:
+    inline void add_fourth(const int bin_a, const int bin_b, const Float c4v, const Float* poly_i, const Float* poly_l, const int count){
+        // Adds the contribution c4v*poly_i[p]*poly_l[q] of count i-l pairs in the radial i-j bin bin_a and k-l bin bin_b to C4
+        int tmp_full_bin, out_bin;
+        for(int p_bin=0;p_bin<mbin;p_bin++){ // iterate over all legendre polynomials
+            tmp_full_bin = (bin_a*mbin+p_bin)*nbin*mbin+bin_b*mbin;
+            for(int q_bin=0;q_bin<mbin;q_bin++){ // second polynomial
+                out_bin = tmp_full_bin+q_bin; // output bin
+
+                // Now add to integral with correct kernel
+                c4[out_bin]+=c4v*poly_i[p_bin]*poly_l[q_bin];
+                binct4[out_bin]+=count; // only count actual contributions to bin
             }
         }
     }
@@ -2,6 +2,7 @@
 #include "parameters.h"
 #include "correlation_function.h"
 #include "cell_utilities.h"
+#include "huge_pages.h"
 #include "legendre_utilities.h"
 
 #ifndef INTEGRALS_LEGENDRE_POWER_H
@@ -9,7 +10,7 @@
 
 class Integrals{
 public:
-    CorrelationFunction *cf12, *cf13, *cf24;
+    CorrelationFunction *cf12 = NULL, *cf13 = NULL, *cf24 = NULL; // this object's copies of the correlation functions, sharing their tables
 private:
     int nbin, mbin, max_l,max_legendre;
     Float rmin,rmax,mumin,mumax,R0; //Ranges in r and mu and truncation radius
@@ -48,13 +49,13 @@ public:
 
         int ec=0;
         // Initialize the binning
-        ec+=posix_memalign((void **) &c2, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &c3, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &c4, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c2, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c3, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c4, sizeof(double)*nbin*mbin*nbin*mbin);
 
-        ec+=posix_memalign((void **) &binct, PAGE, sizeof(uint64)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &binct3, PAGE, sizeof(uint64)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &binct4, PAGE, sizeof(uint64)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &binct, sizeof(uint64)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &binct3, sizeof(uint64)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &binct4, sizeof(uint64)*nbin*mbin*nbin*mbin);
 
         assert(ec==0);
         reset();
@@ -73,6 +74,9 @@ public:
     }
 
     ~Integrals() {
+        delete cf12;
+        delete cf13;
+        delete cf24;
         free(c2);
         free(c3);
         free(c4);
@@ -81,6 +85,11 @@ public:
         free(binct4);
     }
 
+    void huge_page_report(const char *name){
+        // Report how much of the largest accumulator is backed by huge pages
+        report_huge_pages(name, c4, sizeof(Float)*nbin*mbin*nbin*mbin);
+    }
+
     void reset(){
         for (int j=0; j<nbin*mbin*nbin*mbin; j++) {
             c2[j]=0;
@@ -2,40 +2,172 @@
 #include "parameters.h"
 #include "correlation_function.h"
 #include "cell_utilities.h"
+#include "huge_pages.h"
 #include "legendre_utilities.h"
 
 #ifndef INTEGRALS_POWER_H
 #define INTEGRALS_POWER_H
 
+// NB: this kernel-interpolating version of the power spectrum integrals is not wired into any build. The POWER mode of compute_integral.h uses
+// integrals_legendre_power.h, and the KernelInterp class needed here (power_spectra/power_mod/kernel_interp.h) is not in this tree, so the POWER mode
+// cannot currently be built. A caller of this class must construct one KernelTable and pass it to the Integrals of every thread; none does so yet.
+
+// The kernel vectors of the pairs are buffered in panels of RANK_K_PANEL rows and added to the accumulators as rank-k updates (see rank_k_update),
+// in tiles of RANK_K_TILE matrix columns and register blocks of RANK_K_ROWS x RANK_K_COLS elements
+#define RANK_K_PANEL 64
+#define RANK_K_TILE 64
+#define RANK_K_ROWS 4
+#define RANK_K_COLS 8
+
+#define UNBINNED // use the spherical Bessel kernels j0(kr) at the k-bin centers rather than the bin-averaged kernels of KernelInterp
+
+#define KERNEL_TABLE_TOLERANCE 1e-6 // largest interpolation error of the tabulated kernels, relative to the largest kernel
+#define KERNEL_TABLE_MAX_NODES 1048576 // limit of the table refinement
+
+class KernelTable{
+    // The radial kernels of all k-bins (and multipoles, for the bin-averaged kernels) tabulated on a uniform grid in r from 0 to R0, so that
+    // the kernels of each pair, triple and quad are interpolated from one row of the table instead of evaluating sin(kr)/kr or KernelInterp::kernel() for every bin.
+    // The kernels are interpolated with the cubic polynomial through the four nearest nodes. The grid is refined until the error, checked between all nodes, is below
+    // KERNEL_TABLE_TOLERANCE of the largest kernel. The table is to be built once by the caller and shared by the Integrals of all threads (see the note above).
+private:
+    int nbin, mbin;
+    int nk; // kernels per node: one per k-bin for j0(kr), which is the same for all multipoles, else one per k-bin and multipole
+    int n_nodes; // number of nodes, at r = m*R0/(n_nodes-1)
+    Float R0, inv_h;
+    Float *r_low, *r_high; // edges of the k-bins
+    KernelInterp *kernel_interp; // bin-averaged kernels
+    Float *table = NULL; // table[m*nk+idx] is kernel idx at node m
+
+public:
+    KernelTable(Parameters *par, KernelInterp *_kernel_interp){
+        nbin = par->nbin;
+        mbin = par->mbin;
+        R0 = par->R0;
+        r_low = par->radial_bins_low;
+        r_high = par->radial_bins_high;
+        kernel_interp = _kernel_interp;
+#ifdef UNBINNED
+        nk = nbin;
+#else
+        nk = nbin*mbin;
+#endif
+        // Start with about four nodes per radian of the fastest oscillation and refine until accurate
+        n_nodes = 16+(int)ceil(4.*R0*r_high[nbin-1]);
+        Float max_error, max_kernel;
+        while(true){
+            build();
+            max_kernel = 0.;
+            for(int j=0;j<n_nodes*nk;j++) max_kernel = fmax(max_kernel,fabs(table[j]));
+            max_error = 0.;
+            for(int m=0;m<n_nodes-1;m++){
+                for(int s=1;s<4;s++){
+                    Float r = (m+0.25*s)/inv_h;
+                    for(int idx=0;idx<nk;idx++) max_error = fmax(max_error,fabs(interpolate(idx,r)-kernel(idx,r)));
+                }
+            }
+            if(max_error<=KERNEL_TABLE_TOLERANCE*max_kernel) break;
+            if(2*n_nodes>KERNEL_TABLE_MAX_NODES){
+                fprintf(stderr,"The power spectrum kernels could not be tabulated to a relative error of %.1e with %d nodes (error %.1e)\n",KERNEL_TABLE_TOLERANCE,n_nodes,max_error/max_kernel);
+                abort();
+            }
+            n_nodes *= 2;
+        }
+        printf("# Tabulated the power spectrum kernels at %d radii (%.2f MB, largest relative interpolation error %.1e)\n",n_nodes,sizeof(Float)*n_nodes*nk/1024./1024.,max_error/max_kernel);
+    }
+
+    ~KernelTable(){
+        free(table);
+    }
+
+    inline void evaluate(Float r, const Float *legendre, Float *this_kernel){
+        // Fill this_kernel[ii*mbin+jj] with the kernel of k-bin ii and multipole 2*jj at separation r (0 <= r <= R0) times the Legendre polynomial legendre[jj]
+        Float x = r*inv_h;
+        int m = std::min(std::max((int)x,1),n_nodes-3); // nodes m-1 to m+2 are used
+        Float t = x-m;
+        Float w0 = -t*(t-1.)*(t-2.)/6., w1 = (t+1.)*(t-1.)*(t-2.)/2., w2 = -(t+1.)*t*(t-2.)/2., w3 = (t+1.)*t*(t-1.)/6.;
+        const Float *T0 = table+(m-1)*nk, *T1 = T0+nk, *T2 = T1+nk, *T3 = T2+nk;
+#ifdef UNBINNED
+        for(int ii=0;ii<nbin;ii++){
+            Float value = w0*T0[ii]+w1*T1[ii]+w2*T2[ii]+w3*T3[ii];
+            for(int jj=0;jj<mbin;jj++) this_kernel[ii*mbin+jj] = value*legendre[jj];
+        }
+#else
+        for(int ii=0;ii<nbin;ii++){
+            for(int jj=0;jj<mbin;jj++){
+                int idx = ii*mbin+jj;
+                this_kernel[idx] = (w0*T0[idx]+w1*T1[idx]+w2*T2[idx]+w3*T3[idx])*legendre[jj];
+            }
+        }
+#endif
+    }
+
+private:
+    Float kernel(int idx, Float r){
+        // Exact kernel idx at separation r
+#ifdef UNBINNED
+        Float kr = r*0.5*(r_low[idx]+r_high[idx]);
+        return (kr==0) ? 1. : sin(kr)/kr;
+#else
+        int ii = idx/mbin, jj = idx%mbin;
+        Float k_low = (ii==0) ? r_low[0] : r_high[ii-1]; // the bins are taken to be contiguous
+        return kernel_interp->kernel(jj*2.,r*r_high[ii])-kernel_interp->kernel(jj*2.,r*k_low);
+#endif
+    }
+
+    Float interpolate(int idx, Float r){
+        // Interpolated kernel idx at separation r, as in evaluate()
+        Float x = r*inv_h;
+        int m = std::min(std::max((int)x,1),n_nodes-3);
+        Float t = x-m;
+        return -t*(t-1.)*(t-2.)/6.*table[(m-1)*nk+idx]+(t+1.)*(t-1.)*(t-2.)/2.*table[m*nk+idx]
+            -(t+1.)*t*(t-2.)/2.*table[(m+1)*nk+idx]+(t+1.)*t*(t-1.)/6.*table[(m+2)*nk+idx];
+    }
+
+    void build(){
+        // Fill the table for the current number of nodes
+        free(table);
+        int ec = posix_memalign((void **) &table, PAGE, sizeof(Float)*n_nodes*nk);
+        assert(ec==0);
+        inv_h = (n_nodes-1)/R0;
+        for(int m=0;m<n_nodes;m++)
+            for(int idx=0;idx<nk;idx++) table[m*nk+idx] = kernel(idx,m/inv_h);
+    }
+};
+
 class Integrals{
 public:
-    CorrelationFunction *cf12, *cf13, *cf24;
+    CorrelationFunction *cf12 = NULL, *cf13 = NULL, *cf24 = NULL; // this object's copies of the correlation functions, sharing their tables
 private:
     int nbin, mbin, max_legendre;
     Float R0; // truncation radius
     Float rmin,rmax,mumin,mumax; //Ranges in r and mu
     Float *r_high, *r_low; // Max and min of each radial bin
     Float *c2, *c3, *c4; // Arrays to accumulate integrals
+    Float *panel2 = NULL, *coef2 = NULL; // buffered kernel vectors k_t of the pairs and their weights, adding sum_t coef2_t k_t k_t^T to c2
+    Float *panel3_left = NULL, *panel3_right = NULL, *panel4_left = NULL, *panel4_right = NULL; // buffered vector pairs, adding sum_t left_t right_t^T to c3 and c4
+    int n2 = 0, n3 = 0, n4 = 0; // number of rows in the panels
+    bool c2_complete = true; // whether the lower triangle of c2 is up to date with the upper one (see flush)
+    int nb_pad; // length of the panel rows, nbin*mbin padded with zeros to whole register blocks
     char* out_file;
     bool box; // Flags to decide whether we have a periodic box
     int I1, I2, I3, I4; // indices for which fields to use for each particle
 
     SurveyCorrection *sc12,*sc23,*sc34; // survey correction function
-    KernelInterp *kernel_interp; // kernel interpolation function
+    KernelTable *kernel_table; // tabulated kernels, shared between the threads
 
 public:
     uint64 used_pairs, used_triples, used_quads; // total number of particles used
 public:
     Integrals(){};
 
-    Integrals(Parameters *par, CorrelationFunction *_cf12, CorrelationFunction *_cf13, CorrelationFunction *_cf24, int _I1, int _I2, int _I3, int _I4, SurveyCorrection *_sc12, SurveyCorrection *_sc23, SurveyCorrection *_sc34, KernelInterp *_kernel_interp){
+    Integrals(Parameters *par, CorrelationFunction *_cf12, CorrelationFunction *_cf13, CorrelationFunction *_cf24, int _I1, int _I2, int _I3, int _I4, SurveyCorrection *_sc12, SurveyCorrection *_sc23, SurveyCorrection *_sc34, KernelTable *_kernel_table){
         sc12 = _sc12;
         sc23 = _sc23;
         sc34 = _sc34;
         cf12 = new CorrelationFunction(_cf12);
         cf13 = new CorrelationFunction(_cf13);
         cf24 = new CorrelationFunction(_cf24);
-        kernel_interp = new KernelInterp(_kernel_interp);
+        kernel_table = _kernel_table;
         I1=_I1;
         I2=_I2;
         I3=_I3;
@@ -52,11 +184,27 @@ public:
 
         int ec=0;
         // Initialize the binning
-        ec+=posix_memalign((void **) &c2, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &c3, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
-        ec+=posix_memalign((void **) &c4, PAGE, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c2, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c3, sizeof(double)*nbin*mbin*nbin*mbin);
+        ec+=huge_page_alloc((void **) &c4, sizeof(double)*nbin*mbin*nbin*mbin);
+
+        // Initialize the panels, whose padding stays zero
+        nb_pad = (nbin*mbin+RANK_K_COLS-1)/RANK_K_COLS*RANK_K_COLS;
+        ec+=posix_memalign((void **) &panel2, PAGE, sizeof(Float)*RANK_K_PANEL*nb_pad);
+        ec+=posix_memalign((void **) &coef2, PAGE, sizeof(Float)*RANK_K_PANEL);
+        ec+=posix_memalign((void **) &panel3_left, PAGE, sizeof(Float)*RANK_K_PANEL*nb_pad);
+        ec+=posix_memalign((void **) &panel3_right, PAGE, sizeof(Float)*RANK_K_PANEL*nb_pad);
+        ec+=posix_memalign((void **) &panel4_left, PAGE, sizeof(Float)*RANK_K_PANEL*nb_pad);
+        ec+=posix_memalign((void **) &panel4_right, PAGE, sizeof(Float)*RANK_K_PANEL*nb_pad);
 
         assert(ec==0);
+        for (int j=0; j<RANK_K_PANEL*nb_pad; j++) {
+            panel2[j]=0;
+            panel3_left[j]=0;
+            panel3_right[j]=0;
+            panel4_left[j]=0;
+            panel4_right[j]=0;
+        }
         reset();
         box=par->perbox;
 
@@ -71,9 +219,23 @@ public:
     }
 
     ~Integrals() {
+        delete cf12;
+        delete cf13;
+        delete cf24;
         free(c2);
         free(c3);
         free(c4);
+        free(panel2);
+        free(coef2);
+        free(panel3_left);
+        free(panel3_right);
+        free(panel4_left);
+        free(panel4_right);
+    }
+
+    void huge_page_report(const char *name){
+        // Report how much of the largest accumulator is backed by huge pages
+        report_huge_pages(name, c4, sizeof(Float)*nbin*mbin*nbin*mbin);
     }
 
     void reset(){
@@ -85,15 +247,67 @@ public:
         used_pairs = 0;
         used_triples = 0;
         used_quads = 0;
+        n2 = n3 = n4 = 0; // discard the buffered updates
+        c2_complete = true;
     }
 
+    void flush(){
+        // Add the buffered kernel vectors to the accumulators and complete the symmetric c2; this must be done before they are read
+        flush_panels();
+        if(c2_complete) return;
+        for(int a=0;a<nbin*mbin;a++)
+            for(int b=0;b<a;b++) c2[a*nbin*mbin+b] = c2[b*nbin*mbin+a];
+        c2_complete = true;
+    }
+
+private:
+    void flush_panels(){
+        // Add the buffered kernel vectors to the accumulators; only the upper triangle of c2 is updated, so it is completed later by flush()
+        if(n2>0){
+            rank_k_update(c2, panel2, panel2, coef2, n2, true);
+            c2_complete = false;
+        }
+        if(n3>0) rank_k_update(c3, panel3_left, panel3_right, NULL, n3, false);
+        if(n4>0) rank_k_update(c4, panel4_left, panel4_right, NULL, n4, false);
+        n2 = n3 = n4 = 0;
+    }
+
+    void rank_k_update(Float *c, const Float *left, const Float *right, const Float *coef, int k, bool symmetric){
+        // Add sum_t coef_t left_t right_t^T (with coef_t = 1 if coef is NULL) over the k rows of the panels to the square matrix c.
+        // Each block of RANK_K_ROWS x RANK_K_COLS matrix elements is summed over all k rows in registers and added to the matrix once, instead of reading and
+        // writing the matrix for every pair; the columns are processed in tiles so that their part of the right panel stays in cache for all row blocks.
+        // For symmetric updates (left = right) only the upper triangle is updated; it is copied to the lower one by flush().
+        const int nb = nbin*mbin;
+        for(int b0=0;b0<nb;b0+=RANK_K_TILE){
+            int b1 = std::min(b0+RANK_K_TILE,nb);
+            for(int a=0;a<(symmetric?b1:nb);a+=RANK_K_ROWS){
+                for(int b=b0;b<b1;b+=RANK_K_COLS){
+                    if(symmetric&&b+RANK_K_COLS<=a) continue; // block below the diagonal
+                    Float acc[RANK_K_ROWS][RANK_K_COLS] = {{0.}};
+                    for(int t=0;t<k;t++){
+                        const Float *l = left+t*nb_pad+a, *r = right+t*nb_pad+b;
+                        Float ct = (coef==NULL) ? 1. : coef[t];
+                        for(int i=0;i<RANK_K_ROWS;i++){
+                            Float li = ct*l[i];
+                            for(int j=0;j<RANK_K_COLS;j++) acc[i][j]+=li*r[j];
+                        }
+                    }
+                    for(int i=0;i<RANK_K_ROWS&&a+i<nb;i++)
+                        for(int j=0;j<RANK_K_COLS&&b+j<nb;j++)
+                            if(!symmetric||b+j>=a+i) c[(a+i)*nb+b+j]+=acc[i][j];
+                }
+            }
+        }
+    }
+
+public:
+
     inline void second(const Particle* pi_list, const int* prim_ids, int pln, const Particle pj, const int pj_id, Float* &wij, const double prob, Float* &kernel_ij){
         // Accumulates the two point integral C2.
         // Prob. here is defined as g_ij / f_ij where g_ij is the sampling PDF and f_ij is the true data PDF for picking pairs (equal to n_i/N n_j/N for N particles)
-        Float tmp_weight, tmp_xi, rij_mag, rij_mu, c2v, tmp_phi_inv, this_kernel[nbin*mbin], old_kernel[mbin];
-        Float new_kr, old_kr, new_kernel, legendre[max_legendre/2+1];
+        Float tmp_weight, tmp_xi, rij_mag, rij_mu, c2v, tmp_phi_inv;
+        Float legendre[max_legendre/2+1];
         Particle pi;
-        int tmp_bin;
 
         for(int i=0;i<pln;i++){ // Iterate over particle in pi_list
             if((prim_ids[i]==pj_id)&&(I1==I2)){
@@ -117,7 +331,6 @@ public:
             tmp_phi_inv=0.;
             for(int l_i=0;l_i<sc12->l_bins;l_i++) tmp_phi_inv+=legendre[l_i]*sc12->inv_correction_function(l_i*2,rij_mu);
 
-#define UNBINNED
 #ifdef UNBINNED
             tmp_weight = pi.w*pj.w*pair_weight(rij_mag)/tmp_phi_inv; // w_i*w_j*W(r_ij; R_0)*Phi_ij
 #else
@@ -128,40 +341,13 @@ public:
 
             // Now add to relevant bins
             c2v = tmp_weight*tmp_weight*(1.+tmp_xi) / prob*2.; // c2 contribution with symmetry factor
-            // Now compute multipole row elements
-#ifdef UNBINNED
-            for(int ii=0;ii<nbin;ii++){
-                old_kr = rij_mag*0.5*(r_low[ii]+r_high[ii]);
-                new_kr = sin(old_kr)/old_kr;
-                for(int jj=0;jj<mbin;jj++){
-                    this_kernel[ii*mbin+jj] = new_kr*legendre[jj];
-                }
-            }
-#else
-            for(int ii=0;ii<nbin;ii++){
-                if(ii==0) old_kr = rij_mag*r_low[ii];
-                new_kr = rij_mag*r_high[ii];
-                for(int jj=0;jj<mbin;jj++){
-                    if(ii==0) old_kernel[jj] = kernel_interp->kernel(jj*2.,old_kr);
-                    new_kernel = kernel_interp->kernel(jj*2,new_kr);
-                    this_kernel[ii*mbin+jj] = legendre[jj]*(new_kernel - old_kernel[jj]);
-                    kernel_ij[i*nbin*mbin+ii*mbin+jj] = this_kernel[ii*mbin+jj];
-                    old_kernel[jj] = new_kernel;
-                }
-                old_kr = new_kr;
-            }
-#endif
-            // Fill up matrix
-            for(int a=0;a<nbin;a++){
-                for(int p=0;p<mbin;p++){
-                    tmp_bin = (a*mbin+p)*nbin*mbin;
-                    for(int b=0;b<nbin;b++){
-                        for(int q=0;q<mbin;q++){
-                            c2[tmp_bin+b*mbin+q]+=c2v*this_kernel[a*mbin+p]*this_kernel[b*mbin+q];
-                        }
-                    }
-                }
-            }
+            // Now compute multipole row elements, which are kept in kernel_ij for the C3 and C4 contributions
+            Float *this_kernel = kernel_ij+i*nbin*mbin;
+            kernel_table->evaluate(rij_mag, legendre, this_kernel);
+            // Buffer the kernel vector for the rank-k update of the matrix
+            memcpy(panel2+n2*nb_pad, this_kernel, sizeof(Float)*nbin*mbin);
+            coef2[n2++] = c2v;
+            if(n2==RANK_K_PANEL) flush_panels();
         }
     }
 
@@ -169,9 +355,11 @@ public:
         // Accumulates the three point integral C3. Also outputs an array of xi_ik and bin_ik values for later reuse.
         // First define variables:
         Particle pi;
-        Float rik_mag, rik_mu, rjk_mag, rjk_mu, c3v, tmp_phi_inv=0, this_kernel[nbin*mbin], old_kernel[mbin];
-        Float tmp_weight, tmp_kernel, xi_ik_tmp, new_kr, old_kr, new_kernel, legendre_jk[max_legendre/2+1];
-        int tmp_bin;
+        Float rik_mag, rik_mu, rjk_mag, rjk_mu, c3v, tmp_phi_inv=0;
+        Float tmp_weight, tmp_kernel, xi_ik_tmp, legendre_jk[max_legendre/2+1];
+        // The matrix rows of all i share the j-k kernel vector, so their kernel_ij vectors are summed with weights c3v into one left vector of the panels
+        Float *this_kernel = panel3_right+n3*nb_pad, *left = panel3_left+n3*nb_pad;
+        bool used = false;
         // Define jk distance and angle
         cleanup_l(pj.pos,pk.pos,rjk_mag,rjk_mu);
 
@@ -186,29 +374,11 @@ public:
             for(int l_i=0;l_i<sc23->l_bins;l_i++) tmp_phi_inv+=legendre_jk[l_i]*sc23->inv_correction_function(l_i*2,rjk_mu);
 
             // Now compute multipole row elements
-#ifdef UNBINNED
-            for(int ii=0;ii<nbin;ii++){
-                old_kr = rjk_mag*0.5*(r_low[ii]+r_high[ii]);
-                new_kr = sin(old_kr)/old_kr;
-                for(int jj=0;jj<mbin;jj++){
-                    this_kernel[ii*mbin+jj] = new_kr*legendre_jk[jj];
-                }
-            }
+            kernel_table->evaluate(rjk_mag, legendre_jk, this_kernel);
         }
-            tmp_kernel = pj.w*pair_weight(rjk_mag)*4./(tmp_phi_inv*prob);
+#ifdef UNBINNED
+        tmp_kernel = pj.w*pair_weight(rjk_mag)*4./(tmp_phi_inv*prob);
 #else
-            for(int ii=0;ii<nbin;ii++){
-                if(ii==0) old_kr = rjk_mag*r_low[ii];
-                new_kr = rjk_mag*r_high[ii];
-                for(int jj=0;jj<mbin;jj++){
-                    if(ii==0) old_kernel[jj] = kernel_interp->kernel(jj*2.,old_kr);
-                    new_kernel = kernel_interp->kernel(jj*2,new_kr);
-                    this_kernel[ii*mbin+jj] = legendre_jk[jj]*(new_kernel - old_kernel[jj]);
-                    old_kernel[jj] = new_kernel;
-                }
-                old_kr = new_kr;
-            }
-        }
         tmp_kernel = pj.w*pair_weight(rjk_mag)*4./(tmp_phi_inv*pow(rjk_mag,3)*prob);
 #endif
 
@@ -233,27 +403,22 @@ public:
 
             // Now compute the integral;
             c3v = tmp_kernel*tmp_weight*xi_ik_tmp; // include symmetry factor
-            // Fill up matrix
-            for(int a=0;a<nbin;a++){
-                for(int p=0;p<mbin;p++){
-                    tmp_bin = (a*mbin+p)*nbin*mbin;
-                    for(int b=0;b<nbin;b++){
-                        for(int q=0;q<mbin;q++){
-                            c3[tmp_bin+b*mbin+q]+=c3v*kernel_ij[i*mbin*nbin+a*mbin+p]*this_kernel[b*mbin+q];
-                        }
-                    }
-                }
-            }
+            if(!used) for(int a=0;a<nbin*mbin;a++) left[a]=0.;
+            used = true;
+            for(int a=0;a<nbin*mbin;a++) left[a]+=c3v*kernel_ij[i*mbin*nbin+a];
         }
+        if(used&&(++n3==RANK_K_PANEL)) flush_panels();
     }
 
     inline void fourth(const Particle* pi_list, const int* prim_ids, const int pln, const Particle pj, const Particle pk, const Particle pl, const int pj_id, const int pk_id, const int pl_id, const Float* wijk, const Float* xi_ik, const double prob, const Float* kernel_ij){
         // Accumulates the four point integral C4.
         // First define variables
         Particle pi;
-        Float rjl_mag, rjl_mu, rkl_mag, rkl_mu, c4v, xi_jl, tmp_phi_inv=0,this_kernel[nbin*mbin],tmp_weight;
-        Float old_kernel[mbin], new_kr, old_kr, new_kernel, legendre_kl[max_legendre/2+1];
-        int tmp_bin;
+        Float rjl_mag, rjl_mu, rkl_mag, rkl_mu, c4v, xi_jl, tmp_phi_inv=0,tmp_weight;
+        Float legendre_kl[max_legendre/2+1];
+        // As in third(), the kernel_ij vectors are summed into one left vector for the shared k-l kernel vector
+        Float *this_kernel = panel4_right+n4*nb_pad, *left = panel4_left+n4*nb_pad;
+        bool used = false;
 
         cleanup_l(pl.pos,pk.pos,rkl_mag,rkl_mu);
         if(rkl_mag>R0) return; // if k-l separation too large
@@ -263,27 +428,7 @@ public:
 
         // Compute 1/Phi_kl function
         // Now compute multipole matrix elements
-#ifdef UNBINNED
-            for(int ii=0;ii<nbin;ii++){
-                old_kr = rkl_mag*0.5*(r_low[ii]+r_high[ii]);
-                new_kr = sin(old_kr)/old_kr;
-                for(int jj=0;jj<mbin;jj++){
-                    this_kernel[ii*mbin+jj] = new_kr*legendre_kl[jj];
-                }
-            }
-#else
-        for(int ii=0;ii<nbin;ii++){
-            if(ii==0) old_kr = rkl_mag*r_low[ii];
-            new_kr = rkl_mag*r_high[ii];
-            for(int jj=0;jj<mbin;jj++){
-                if(ii==0) old_kernel[jj] = kernel_interp->kernel(jj*2.,old_kr);
-                new_kernel = kernel_interp->kernel(jj*2,new_kr);
-                this_kernel[ii*mbin+jj] = legendre_kl[jj]*(new_kernel - old_kernel[jj]);
-                old_kernel[jj] = new_kernel;
-            }
-            old_kr = new_kr;
-        }
-#endif
+        kernel_table->evaluate(rkl_mag, legendre_kl, this_kernel);
         // Define 2PCF
         cleanup_l(pl.pos,pj.pos,rjl_mag,rjl_mu);
         xi_jl = cf24->xi(rjl_mag, rjl_mu); // j-l correlation
@@ -302,18 +447,11 @@ public:
 
             // Now compute the integral;
             c4v = wijk[i]*tmp_weight*xi_ik[i]; // with xi_ik*xi_jl = xi_il*xi_jk symmetry factor
-            // Fill up matrix
-            for(int a=0;a<nbin;a++){
-                for(int p=0;p<mbin;p++){
-                    tmp_bin = (a*mbin+p)*nbin*mbin;
-                    for(int b=0;b<nbin;b++){
-                        for(int q=0;q<mbin;q++){
-                            c4[tmp_bin+b*mbin+q]+=c4v*kernel_ij[i*mbin*nbin+a*mbin+p]*this_kernel[b*mbin+q];
-                        }
-                    }
-                }
-            }
+            if(!used) for(int a=0;a<nbin*mbin;a++) left[a]=0.;
+            used = true;
+            for(int a=0;a<nbin*mbin;a++) left[a]+=c4v*kernel_ij[i*mbin*nbin+a];
         }
+        if(used&&(++n4==RANK_K_PANEL)) flush_panels();
     }
     inline Float pair_weight(Float sep){
         // Compute weight function W(r;R_0)
@@ -341,6 +479,8 @@ public:
 public:
     void sum_ints(Integrals* ints) {
         // Add the values accumulated in ints to the corresponding internal sums
+        flush();
+        ints->flush();
         for(int i=0;i<nbin*mbin*nbin*mbin;i++){
             c2[i]+=ints->c2[i];
             c3[i]+=ints->c3[i];
@@ -349,6 +489,8 @@ public:
     }
     void frobenius_difference_sum(Integrals* ints, int n_loop, Float &frobC2, Float &frobC3, Float &frobC4){
         // Add the values accumulated in ints to the corresponding internal sums and compute the Frobenius norm difference between integrals
+        flush();
+        ints->flush();
         Float n_loops = (Float)n_loop;
         Float self_c2=0, diff_c2=0;
         Float self_c3=0, diff_c3=0;
@@ -387,6 +529,7 @@ public:
         // n_pair etc. are the number of PARTICLE pairs etc. attempted (not including rejected cells, but including pairs which don't fall in correct bin ranges)
         // NB: norm_factor is V*<(nw)^2> or Sum nw^2 for the galaxies
         // To avoid recomputation
+        flush();
         double corrf2 = norm1*norm2; // correction factor for densities of random points
         double corrf3 = corrf2*norm3;
         double corrf4 = corrf3*norm4;;
@@ -436,6 +579,7 @@ public:
         * In txt files {c2,c3,c4}_leg_n{nbin}_m{mbin}.txt there are lists of the outputs of c2,c3,c4 that are already normalized and multiplied by combinatoric factors. The n and m strings specify the number of n and m bins present.
         */
         // Create output files
+        flush();
 
         char c2name[1000];
         snprintf(c2name, sizeof c2name, "%sPowerCovMatrices/c2_leg_n%d_l%d_%d%d_%s.txt", out_file,nbin, (mbin-1)*2,I1,I2,suffix);
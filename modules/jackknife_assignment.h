@@ -0,0 +1,128 @@
+// jackknife_assignment.h - assignment of particles to jackknife regions from their positions on loading, replacing python/create_jackknives.py,
+// and the collapse of the region labels to the indices of the non-empty jackknife regions.
+
+#ifndef JACKKNIFE_ASSIGNMENT_H
+#define JACKKNIFE_ASSIGNMENT_H
+
+#include <unordered_map>
+
+int healpix_ring_vec2pix(int nside, Float x, Float y, Float z){
+    // HEALPix pixel containing the direction (x,y,z) in the RING ordering scheme, as healpy.vec2pix(nside,x,y,z) with nest=False (Gorski et al. 2005)
+    Float r = sqrt(x*x+y*y+z*z);
+    Float cos_theta = z/r, za = fabs(cos_theta);
+    Float phi = atan2(y,x);
+    if (phi<0) phi += 2.*M_PI;
+    Float tt = fmod(2.*phi/M_PI, 4.); // in [0,4)
+    long long nl4 = 4*(long long)nside, ncap = 2*(long long)nside*(nside-1), npix = 12*(long long)nside*nside;
+    if (za<=2./3.){
+        // Equatorial region
+        Float temp1 = nside*(0.5+tt), temp2 = nside*cos_theta*0.75;
+        long long jp = (long long)(temp1-temp2); // index of ascending edge line
+        long long jm = (long long)(temp1+temp2); // index of descending edge line
+        long long ir = nside+1+jp-jm; // ring number counted from cos_theta = 2/3, in {1,2*nside+1}
+        long long kshift = 1-(ir&1);
+        long long ip = (jp+jm-nside+kshift+1)/2;
+        ip = ((ip%nl4)+nl4)%nl4;
+        return ncap+(ir-1)*nl4+ip;
+    }
+    else{
+        // Polar caps; sqrt(3(1-za)) is computed from the transverse distance to keep precision near the poles
+        Float tp = tt-(int)tt;
+        Float tmp = (za<0.99) ? nside*sqrt(3.*(1.-za)) : nside*sqrt(x*x+y*y)/r/sqrt((1.+za)/3.);
+        long long jp = (long long)(tp*tmp);
+        long long jm = (long long)((1.-tp)*tmp);
+        long long ir = jp+jm+1; // ring number counted from the closest pole
+        long long ip = (long long)(tt*ir);
+        ip = ((ip%(4*ir))+4*ir)%(4*ir);
+        if (cos_theta>0) return 2*ir*(ir-1)+ip;
+        else return npix-2*ir*(ir+1)+ip;
+    }
+}
+
+class JackknifeAssignment{
+    // Labels each particle with a jackknife region computed from its position, as an alternative to reading the region from the particle file
+    // The schemes are HEALPix pixels (as create_jackknives.py), equal-area angular tiles in RA and Dec, or cubic Cartesian tiles
+public:
+    enum Scheme {FILE_COLUMN, HEALPIX, ANGULAR, CARTESIAN};
+    Scheme scheme;
+    Float resolution; // HEALPix NSIDE, number of equal-area declination bands (each with twice as many RA tiles), or side-length of Cartesian tiles
+
+    JackknifeAssignment(const char* name, Float _resolution){
+        resolution = _resolution;
+        if (!strcmp(name,"file")) scheme = FILE_COLUMN;
+        else if (!strcmp(name,"healpix")) scheme = HEALPIX;
+        else if (!strcmp(name,"angular")) scheme = ANGULAR;
+        else if (!strcmp(name,"cartesian")) scheme = CARTESIAN;
+        else{
+            fprintf(stderr,"Unknown jackknife assignment scheme %s; use file, healpix, angular or cartesian\n", name);
+            abort();
+        }
+        if (scheme!=FILE_COLUMN&&resolution<=0){
+            fprintf(stderr,"The resolution of the %s jackknife assignment must be positive\n", name);
+            abort();
+        }
+        if (scheme==HEALPIX&&(resolution!=(int)resolution||resolution>8192)){
+            fprintf(stderr,"The HEALPix NSIDE must be an integer no larger than 8192\n");
+            abort();
+        }
+    }
+
+    inline int region(Float3 pos){
+        // Jackknife region label of the position
+        if (scheme==HEALPIX) return healpix_ring_vec2pix((int)resolution, pos.x, pos.y, pos.z);
+        else if (scheme==ANGULAR){
+            int n_dec = ceil(resolution), n_ra = 2*n_dec;
+            Float r = pos.norm();
+            Float phi = atan2(pos.y, pos.x);
+            if (phi<0) phi += 2.*M_PI;
+            int i_ra = std::min((int)(phi/(2.*M_PI)*n_ra), n_ra-1);
+            int i_dec = std::min((int)((pos.z/r+1.)/2.*n_dec), n_dec-1); // equal-area bands in sin(Dec)
+            return i_dec*n_ra+i_ra;
+        }
+        else{
+            // Tiles are indexed from the origin, so the labels are the same for all particle sets; 1024 tiles are allowed along each axis
+            long long ix = floor(pos.x/resolution)+512, iy = floor(pos.y/resolution)+512, iz = floor(pos.z/resolution)+512;
+            if (ix<0||ix>=1024||iy<0||iy>=1024||iz<0||iz>=1024){
+                fprintf(stderr,"Particle at {%.2f,%.2f,%.2f} is beyond the 1024 Cartesian jackknife tiles of side %.2f about the origin\n", pos.x, pos.y, pos.z, resolution);
+                abort();
+            }
+            return (ix*1024+iy)*1024+iz;
+        }
+    }
+
+    void assign(Particle *p, int np){
+        // Set the jackknife region label of each particle
+        assert(scheme!=FILE_COLUMN);
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int j = 0; j < np; j++) p[j].JK = region(p[j].pos);
+    }
+};
+
+void collapse_jackknife_labels(Particle *p, int np, const int *filled_JKs, int n_JK_filled, const char *filename){
+    // Replace the jackknife region label of each particle by its index in the list of non-empty regions (from the jackknife weights file), using a hash map
+    std::unordered_map<int,int> index;
+    index.reserve(2*n_JK_filled);
+    for (int x = 0; x < n_JK_filled; x++) index[filled_JKs[x]] = x;
+    int missing = -1;
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int j = 0; j < np; j++){
+        std::unordered_map<int,int>::const_iterator it = index.find((int)p[j].JK);
+        if (it!=index.end()) p[j].JK = it->second;
+        else{
+#ifdef OPENMP
+#pragma omp critical
+#endif
+            missing = j; // any such particle is reported below
+        }
+    }
+    if (missing>=0){
+        fprintf(stderr,"Particle %d of %s is in jackknife region %d, which is not in the jackknife weights file\n", missing, filename, (int)p[missing].JK);
+        abort();
+    }
+}
+
+#endif
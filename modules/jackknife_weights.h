@@ -3,50 +3,58 @@
 #ifndef JACKKNIFE_WEIGHTS_H
 #define JACKKNIFE_WEIGHTS_H
 
+#include "numa_utilities.h"
+
 // This class stores the RR count weights for a given jackknife
 class JK_weights{
 public:
-    Float* RR_pair_counts; // houses the weighted pair counts summed over jackknife regions.
+    Float* RR_pair_counts = NULL; // houses the weighted pair counts summed over jackknife regions.
     int nbins; // total number of bins
 #ifdef JACKKNIFE
-    Float* weights; // houses the weights for each bin for this jackknife
-    int* filled_JKs; // houses indices for the filled jackknife arrays
+    Float* weights = NULL; // houses the weights for each bin for this jackknife
+    int* filled_JKs = NULL; // houses indices for the filled jackknife arrays
     int n_JK_filled; // number of non-empty jackknife regions
-    Float* product_weights; // houses a matrix of SUM_A{w_aA*w_bA} terms for later use with indexing bin_a*nbins+bin_b
+    Float* product_weights = NULL; // houses a matrix of SUM_A{w_aA*w_bA} terms for later use with indexing bin_a*nbins+bin_b
 #endif
     
 public: 
     
-    void copy(JK_weights *JK){
-        // Copy JK_weights object
-        nbins=JK->nbins;
-        RR_pair_counts = (Float *)malloc(sizeof(Float)*nbins);
+    JK_weights& operator=(JK_weights&& JK){
+        // Move assignment: release the arrays of this object and take over those of JK without copying
+        if (this==&JK) return *this;
+        free(RR_pair_counts);
+        nbins=JK.nbins;
+        RR_pair_counts=JK.RR_pair_counts;
+        JK.RR_pair_counts=NULL;
 #ifdef JACKKNIFE
-        n_JK_filled=JK->n_JK_filled;
-        weights = (Float *)malloc(sizeof(Float)*nbins*n_JK_filled);
-        filled_JKs = (int *)malloc(sizeof(int)*n_JK_filled);
-        product_weights = (Float *)malloc(sizeof(Float)*nbins*nbins);
-        int ct=0;
+        free(weights);
+        free(product_weights);
+        free(filled_JKs);
+        n_JK_filled=JK.n_JK_filled;
+        weights=JK.weights;
+        filled_JKs=JK.filled_JKs;
+        product_weights=JK.product_weights;
+        JK.weights=NULL;
+        JK.filled_JKs=NULL;
+        JK.product_weights=NULL;
 #endif
-        for(int i=0;i<nbins;i++){
-            RR_pair_counts[i]=JK->RR_pair_counts[i];
+        return *this;
+    }
+
+    JK_weights(JK_weights&& JK){
+        // Move constructor
+        *this = std::move(JK);
+    }
+    
+    void interleave(){
+        // Spread the weights, which all threads read, over the NUMA nodes
+        interleave_memory(RR_pair_counts, sizeof(Float)*nbins);
 #ifdef JACKKNIFE
-            for(int j=0;j<nbins;j++){
-                product_weights[ct]=JK->product_weights[ct];
-                ct++;
-            }
-        }
-        ct=0;
-        for(int i=0;i<n_JK_filled;i++){
-            filled_JKs[i]=JK->filled_JKs[i];
-            for(int j=0;j<nbins;j++){
-                weights[ct]=JK->weights[ct];
-                ct++;
-            }
+        interleave_memory(weights, sizeof(Float)*nbins*n_JK_filled);
+        interleave_memory(product_weights, sizeof(Float)*nbins*nbins);
 #endif
-        }
     }
-    
+
     void rescale(Float norm1, Float norm2){
         // Rescale the RR pair counts by a factor (N_gal1/N_rand1)*(N_gal2/N_rand2)
         Float rescale_factor = norm1*norm2;
@@ -70,9 +78,6 @@ public:
     
     JK_weights(){};
     
-    // Assignment operator creation
-    JK_weights& operator=(const JK_weights& jk);
-    
     JK_weights(Parameters *par, int index1, int index2){
         
         // This reads in weights for each jackknife region for each bin from file.
@@ -190,7 +195,43 @@ public:
         
         printf("Read in jackknife weights successfully.\n"); 
         
+        compute_product_weights();
+#endif
+    }
+
+#ifdef JACKKNIFE
+    JK_weights(const Float *RR, int _nbins, const int *jk_labels, const Float *jk_weights, int n_jk){
+        // Construct from arrays (for the library interface in librascalc/): the RR counts of each bin, and for each non-empty jackknife the label and the weights of each bin,
+        // indexed as in the jackknife weights file
+        nbins = _nbins;
+        n_JK_filled = n_jk;
+#else
+    JK_weights(const Float *RR, int _nbins){
+        // Construct from the array of RR counts of each bin (for the library interface in librascalc/)
+        nbins = _nbins;
+#endif
+        int ec=0;
+        ec+=posix_memalign((void **) &RR_pair_counts, PAGE, sizeof(Float)*nbins);
+#ifdef JACKKNIFE
+        ec+=posix_memalign((void **) &weights, PAGE, sizeof(Float)*nbins*n_JK_filled);
+        ec+=posix_memalign((void **) &filled_JKs, PAGE, sizeof(int)*n_JK_filled);
+        ec+=posix_memalign((void **) &product_weights, PAGE, sizeof(Float)*nbins*nbins);
+#endif
+        assert(ec==0);
+        for(int i=0;i<nbins;i++) RR_pair_counts[i]=RR[i];
+#ifdef JACKKNIFE
+        for(int i=0;i<n_JK_filled;i++) filled_JKs[i]=jk_labels[i];
+        for(int i=0;i<nbins*n_JK_filled;i++) weights[i]=jk_weights[i];
+        printf("\n# Using %d non-empty jackknives\n",n_JK_filled);
+        compute_product_weights();
+#endif
+    }
+
+#ifdef JACKKNIFE
+private:
+    void compute_product_weights(){
         // Compute SUM_A(w_aA*w_bA) for all jackknives
+        for(int i=0;i<nbins*nbins;i++) product_weights[i]=0.;
         int partial_bin=0,partial_bin2;
         Float this_weight;
         for (int x=0;x<n_JK_filled;x++){
@@ -207,8 +248,8 @@ public:
         }
         
         printf("Computed product weights successfully.\n");        
-#endif
     }
+#endif
 };
   
 #endif
@@ -88,6 +88,16 @@ public:
             
         }
 
+    MuBinLegendreFactors(const Float* factors, int _mbin, int max_l){
+        // Construct from an array of the factors, indexed as in the file (for the library interface in librascalc/)
+        mbin = _mbin;
+        n_l = max_l/2+1;
+        int ec = 0;
+        ec += posix_memalign((void **) &data_array, PAGE, sizeof(Float)*n_l*mbin);
+        assert(ec == 0);
+        for(int i = 0; i < n_l*mbin; i++) data_array[i] = factors[i];
+    }
+
     ~MuBinLegendreFactors() {
         // The destructor
         free(data_array);
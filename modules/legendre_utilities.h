@@ -88,7 +88,7 @@ class SurveyCorrection{
     // this class stores the correction functions for each bin, giving the difference between the true and estimated RR counts. It is created by reading in coefficients to recompute smooth Phi(mu) functions for each radial bin.
     
 public:        
-    Float* phi_coeffs; // houses polynomial coefficients for the correction function
+    Float* phi_coeffs = NULL; // houses polynomial coefficients for the correction function
 #ifdef THREE_PCF
     int n_param = 7;
     int max_l;
@@ -100,18 +100,25 @@ private:
     int nbin; // number of radial bins (equal to par->nbin)
     
 public:
-    void copy(SurveyCorrection *sc){
-        // Copy survey correction object
-        n_param=sc->n_param;
-        nbin=sc->nbin;
+    SurveyCorrection& operator=(SurveyCorrection&& sc){
+        // Move assignment: release the coefficients of this object and take over those of sc without copying
+        if (this==&sc) return *this;
+        free(phi_coeffs);
+        n_param=sc.n_param;
+        nbin=sc.nbin;
 #ifdef THREE_PCF
-        phi_coeffs=(Float *)malloc(sizeof(Float)*nbin*nbin*n_param);
-        for(int i=0;i<nbin*nbin*n_param;i++) phi_coeffs[i]=sc->phi_coeffs[i];
+        max_l=sc.max_l;
 #else
-        mu_crit=sc->mu_crit;
-        phi_coeffs=(Float *)malloc(sizeof(Float)*nbin*n_param);
-        for(int i=0;i<nbin*n_param;i++) phi_coeffs[i]=sc->phi_coeffs[i];
+        mu_crit=sc.mu_crit;
 #endif
+        phi_coeffs=sc.phi_coeffs;
+        sc.phi_coeffs=NULL;
+        return *this;
+    }
+
+    SurveyCorrection(SurveyCorrection&& sc){
+        // Move constructor
+        *this = std::move(sc);
     }
     
     void rescale(Float norm1, Float norm2){
@@ -124,9 +131,6 @@ public:
     // Empty operator
     SurveyCorrection(){};
     
-    // Assignment operator creation
-    SurveyCorrection& operator=(const SurveyCorrection& survey_corr);
-    
 #ifdef THREE_PCF
     SurveyCorrection(Parameters *par){
         // This initializes the function and reads in the relevant polynomial coefficients for each radial bin. 
@@ -0,0 +1,373 @@
+// matrix_utilities.h - dense linear algebra for the post-processing of the covariance matrix integrals, acting on row-major n x n matrices of Floats
+
+#ifndef MATRIX_UTILITIES_H
+#define MATRIX_UTILITIES_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <algorithm>
+
+class MatrixFactorization{
+    // Factorization of a square matrix for repeated linear solves, A x = b.
+    // Covariance matrices are symmetric positive definite, so a Cholesky factorization A = L L^T is tried first;
+    // if this fails (e.g. a poorly converged or non-symmetric matrix) it falls back to an LU factorization with partial pivoting.
+public:
+    int n;
+    bool cholesky; // whether the Cholesky factorization succeeded
+    bool singular; // whether the matrix is (numerically) singular, in which case the solutions are non-finite
+    Float *L; // lower triangular Cholesky factor, or the combined unit lower and upper LU factors
+    Float *Lt; // transposed Cholesky factor, so that both triangular solves run along rows
+    int *perm; // LU row permutation
+    int perm_sign; // sign of the LU row permutation
+
+    MatrixFactorization(int _n){
+        n = _n;
+        int ec=0;
+        ec+=posix_memalign((void **) &L, PAGE, sizeof(Float)*n*n);
+        ec+=posix_memalign((void **) &Lt, PAGE, sizeof(Float)*n*n);
+        assert(ec==0);
+        perm = (int *)malloc(sizeof(int)*n);
+    }
+
+    ~MatrixFactorization(){
+        free(L);
+        free(Lt);
+        free(perm);
+    }
+
+    void factorize(const Float* A){
+        cholesky = is_symmetric(A) && cholesky_decompose(A);
+        if (!cholesky) lu_decompose(A);
+    }
+
+    void solve(const Float* b, Float* x){
+        // Solve A x = b; x and b may be the same array
+        if (cholesky){
+            // Forward substitution with L, then back substitution with L^T
+            for (int i = 0; i < n; i++){
+                Float tmp = b[i];
+                const Float* Li = L+i*n;
+                for (int k = 0; k < i; k++) tmp -= Li[k]*x[k];
+                x[i] = tmp/Li[i];
+            }
+            for (int i = n-1; i >= 0; i--){
+                Float tmp = x[i];
+                const Float* Lti = Lt+i*n;
+                for (int k = i+1; k < n; k++) tmp -= Lti[k]*x[k];
+                x[i] = tmp/Lti[i];
+            }
+        }
+        else{
+            Float *y = (Float *)malloc(sizeof(Float)*n);
+            for (int i = 0; i < n; i++) y[i] = b[perm[i]];
+            for (int i = 0; i < n; i++){
+                const Float* Li = L+i*n;
+                for (int k = 0; k < i; k++) y[i] -= Li[k]*y[k];
+            }
+            for (int i = n-1; i >= 0; i--){
+                const Float* Li = L+i*n;
+                for (int k = i+1; k < n; k++) y[i] -= Li[k]*y[k];
+                y[i] /= Li[i];
+            }
+            for (int i = 0; i < n; i++) x[i] = y[i];
+            free(y);
+        }
+    }
+
+    void solve_matrix(const Float* B, Float* X){
+        // Solve A X = B for all columns of B at once; X and B may be the same array.
+        // The substitutions update whole rows of X, which are contiguous and vectorize, rather than solving one column at a time.
+        if (X!=B){
+            if (cholesky) for (int i = 0; i < n*n; i++) X[i] = B[i];
+            else for (int i = 0; i < n; i++)
+                for (int j = 0; j < n; j++) X[i*n+j] = B[perm[i]*n+j];
+        }
+        else if (!cholesky){
+            Float *tmp = (Float *)malloc(sizeof(Float)*n*n);
+            for (int i = 0; i < n*n; i++) tmp[i] = B[i];
+            for (int i = 0; i < n; i++)
+                for (int j = 0; j < n; j++) X[i*n+j] = tmp[perm[i]*n+j];
+            free(tmp);
+        }
+        // Forward substitution with the lower triangular factor (unit diagonal for LU)
+        for (int i = 0; i < n; i++){
+            Float* Xi = X+i*n;
+            const Float* Li = L+i*n;
+            for (int k = 0; k < i; k++){
+                Float Lik = Li[k];
+                const Float* Xk = X+k*n;
+                for (int j = 0; j < n; j++) Xi[j] -= Lik*Xk[j];
+            }
+            if (cholesky){
+                Float inv_diag = 1./Li[i];
+                for (int j = 0; j < n; j++) Xi[j] *= inv_diag;
+            }
+        }
+        // Back substitution with the upper triangular factor
+        const Float* U = cholesky ? Lt : L;
+        for (int i = n-1; i >= 0; i--){
+            Float* Xi = X+i*n;
+            const Float* Ui = U+i*n;
+            for (int k = i+1; k < n; k++){
+                Float Uik = Ui[k];
+                const Float* Xk = X+k*n;
+                for (int j = 0; j < n; j++) Xi[j] -= Uik*Xk[j];
+            }
+            Float inv_diag = 1./Ui[i];
+            for (int j = 0; j < n; j++) Xi[j] *= inv_diag;
+        }
+    }
+
+    void inverse(Float* Ainv){
+        // Compute the inverse matrix by solving against the identity
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) Ainv[i*n+j] = (i==j);
+        solve_matrix(Ainv, Ainv);
+    }
+
+    void log_determinant(Float &sign, Float &logdet){
+        // Sign and logarithm of the absolute value of the determinant, as numpy.linalg.slogdet
+        sign = cholesky ? 1. : perm_sign;
+        logdet = 0.;
+        for (int i = 0; i < n; i++){
+            Float diag = L[i*n+i];
+            if (diag==0){
+                sign = 0.;
+                logdet = -INFINITY;
+                return;
+            }
+            if (diag<0) sign = -sign;
+            logdet += log(fabs(diag));
+        }
+        if (cholesky) logdet *= 2.;
+    }
+
+private:
+    bool is_symmetric(const Float* A){
+        // Symmetric up to rounding errors, e.g. from projecting mu bins into Legendre multipoles
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < i; j++)
+                if (fabs(A[i*n+j]-A[j*n+i])>1e-10*(fabs(A[i*n+j])+fabs(A[j*n+i]))) return false;
+        return true;
+    }
+
+    bool cholesky_decompose(const Float* A){
+        // Cholesky-Banachiewicz algorithm, proceeding along rows of A
+        singular = false;
+        for (int i = 0; i < n; i++){
+            Float* Li = L+i*n;
+            for (int j = 0; j <= i; j++){
+                const Float* Lj = L+j*n;
+                Float tmp = A[i*n+j];
+                for (int k = 0; k < j; k++) tmp -= Li[k]*Lj[k];
+                if (i==j){
+                    if (!(tmp>0)) return false; // not positive definite (or NaN)
+                    Li[i] = sqrt(tmp);
+                }
+                else Li[j] = tmp/Lj[j];
+            }
+            for (int j = i+1; j < n; j++) Li[j] = 0.;
+        }
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) Lt[i*n+j] = L[j*n+i];
+        return true;
+    }
+
+    void lu_decompose(const Float* A){
+        // Doolittle LU decomposition with partial pivoting, P A = L U, storing both factors in L
+        singular = false;
+        perm_sign = 1;
+        for (int i = 0; i < n*n; i++) L[i] = A[i];
+        for (int i = 0; i < n; i++) perm[i] = i;
+        for (int k = 0; k < n; k++){
+            int pivot = k;
+            for (int i = k+1; i < n; i++) if (fabs(L[i*n+k])>fabs(L[pivot*n+k])) pivot = i;
+            if (pivot!=k){
+                for (int j = 0; j < n; j++) std::swap(L[k*n+j], L[pivot*n+j]);
+                std::swap(perm[k], perm[pivot]);
+                perm_sign = -perm_sign;
+            }
+            Float diag = L[k*n+k];
+            if (diag==0){
+                singular = true;
+                continue;
+            }
+            for (int i = k+1; i < n; i++){
+                Float* Li = L+i*n;
+                const Float* Lk = L+k*n;
+                Li[k] /= diag;
+                Float factor = Li[k];
+                for (int j = k+1; j < n; j++) Li[j] -= factor*Lk[j];
+            }
+        }
+    }
+};
+
+void matrix_multiply(const Float* A, const Float* B, Float* C, int n){
+    // C = A B, looping over rows of B for contiguous memory access
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < n; i++){
+        Float* Ci = C+i*n;
+        for (int j = 0; j < n; j++) Ci[j] = 0.;
+        for (int k = 0; k < n; k++){
+            Float Aik = A[i*n+k];
+            const Float* Bk = B+k*n;
+            for (int j = 0; j < n; j++) Ci[j] += Aik*Bk[j];
+        }
+    }
+}
+
+void symmetric_eigensystem(const Float* A, int n, Float* eigvals, Float* eigvecs){
+    // Eigenvalues (in ascending order) and eigenvectors (the columns of eigvecs) of the symmetric matrix A
+    // via Householder reduction to tridiagonal form and the implicit QL algorithm (the EISPACK tred2 and tql2 routines)
+    Float *V = eigvecs, *d = eigvals;
+    Float *e = (Float *)malloc(sizeof(Float)*n);
+    for (int i = 0; i < n*n; i++) V[i] = A[i];
+
+    // Householder tridiagonalization
+    for (int j = 0; j < n; j++) d[j] = V[(n-1)*n+j];
+    for (int i = n-1; i > 0; i--){
+        Float scale = 0., h = 0.;
+        for (int k = 0; k < i; k++) scale += fabs(d[k]);
+        if (scale==0.){
+            e[i] = d[i-1];
+            for (int j = 0; j < i; j++){
+                d[j] = V[(i-1)*n+j];
+                V[i*n+j] = 0.;
+                V[j*n+i] = 0.;
+            }
+        }
+        else{
+            for (int k = 0; k < i; k++){
+                d[k] /= scale;
+                h += d[k]*d[k];
+            }
+            Float f = d[i-1];
+            Float g = sqrt(h);
+            if (f>0) g = -g;
+            e[i] = scale*g;
+            h -= f*g;
+            d[i-1] = f-g;
+            for (int j = 0; j < i; j++) e[j] = 0.;
+            for (int j = 0; j < i; j++){
+                f = d[j];
+                V[j*n+i] = f;
+                g = e[j]+V[j*n+j]*f;
+                for (int k = j+1; k <= i-1; k++){
+                    g += V[k*n+j]*d[k];
+                    e[k] += V[k*n+j]*f;
+                }
+                e[j] = g;
+            }
+            f = 0.;
+            for (int j = 0; j < i; j++){
+                e[j] /= h;
+                f += e[j]*d[j];
+            }
+            Float hh = f/(h+h);
+            for (int j = 0; j < i; j++) e[j] -= hh*d[j];
+            for (int j = 0; j < i; j++){
+                f = d[j];
+                g = e[j];
+                for (int k = j; k <= i-1; k++) V[k*n+j] -= (f*e[k]+g*d[k]);
+                d[j] = V[(i-1)*n+j];
+                V[i*n+j] = 0.;
+            }
+        }
+        d[i] = h;
+    }
+    // Accumulate the transformations
+    for (int i = 0; i < n-1; i++){
+        V[(n-1)*n+i] = V[i*n+i];
+        V[i*n+i] = 1.;
+        Float h = d[i+1];
+        if (h!=0.){
+            for (int k = 0; k <= i; k++) d[k] = V[k*n+i+1]/h;
+            for (int j = 0; j <= i; j++){
+                Float g = 0.;
+                for (int k = 0; k <= i; k++) g += V[k*n+i+1]*V[k*n+j];
+                for (int k = 0; k <= i; k++) V[k*n+j] -= g*d[k];
+            }
+        }
+        for (int k = 0; k <= i; k++) V[k*n+i+1] = 0.;
+    }
+    for (int j = 0; j < n; j++){
+        d[j] = V[(n-1)*n+j];
+        V[(n-1)*n+j] = 0.;
+    }
+    V[(n-1)*n+n-1] = 1.;
+    e[0] = 0.;
+
+    // Implicit QL iterations on the tridiagonal matrix
+    for (int i = 1; i < n; i++) e[i-1] = e[i];
+    e[n-1] = 0.;
+    Float f = 0., tst1 = 0., eps = pow(2.,-52.);
+    for (int l = 0; l < n; l++){
+        tst1 = fmax(tst1, fabs(d[l])+fabs(e[l]));
+        int m = l;
+        while (m < n){
+            if (fabs(e[m])<=eps*tst1) break;
+            m++;
+        }
+        if (m > l){
+            do{
+                Float g = d[l];
+                Float p = (d[l+1]-g)/(2.*e[l]);
+                Float r = hypot(p, 1.);
+                if (p<0) r = -r;
+                d[l] = e[l]/(p+r);
+                d[l+1] = e[l]*(p+r);
+                Float dl1 = d[l+1];
+                Float h = g-d[l];
+                for (int i = l+2; i < n; i++) d[i] -= h;
+                f += h;
+                p = d[m];
+                Float c = 1., c2 = c, c3 = c, el1 = e[l+1], s = 0., s2 = 0.;
+                for (int i = m-1; i >= l; i--){
+                    c3 = c2;
+                    c2 = c;
+                    s2 = s;
+                    g = c*e[i];
+                    h = c*p;
+                    r = hypot(p, e[i]);
+                    e[i+1] = s*r;
+                    s = e[i]/r;
+                    c = p/r;
+                    p = c*d[i]-s*g;
+                    d[i+1] = h+s*(c*g+s*d[i]);
+                    for (int k = 0; k < n; k++){
+                        h = V[k*n+i+1];
+                        V[k*n+i+1] = s*V[k*n+i]+c*h;
+                        V[k*n+i] = c*V[k*n+i]-s*h;
+                    }
+                }
+                p = -s*s2*c3*el1*e[l]/dl1;
+                e[l] = s*p;
+                d[l] = c*p;
+            } while (fabs(e[l])>eps*tst1);
+        }
+        d[l] += f;
+        e[l] = 0.;
+    }
+
+    // Sort the eigenvalues and eigenvectors in ascending order
+    for (int i = 0; i < n-1; i++){
+        int k = i;
+        Float p = d[i];
+        for (int j = i+1; j < n; j++) if (d[j]<p){
+            k = j;
+            p = d[j];
+        }
+        if (k!=i){
+            d[k] = d[i];
+            d[i] = p;
+            for (int j = 0; j < n; j++) std::swap(V[j*n+i], V[j*n+k]);
+        }
+    }
+    free(e);
+}
+
+#endif
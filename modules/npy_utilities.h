@@ -0,0 +1,305 @@
+// Input/output utilities for grid_covariance.cpp, post_process/, convert_to_xyz/ and merge_subsets/, reading and writing arrays as text or as binary NumPy .npy (and .npz) files
+
+#ifndef NPY_UTILITIES_H
+#define NPY_UTILITIES_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+int npy_header(char* buf, const char* descr, const char* shape){
+    // Fill buf (of at least 256 bytes) with the version 1.0 .npy header for a little-endian C-ordered array with the given shape string, e.g. "(3, 4)", returning its length
+    char dict[192];
+    int dict_len = snprintf(dict, sizeof dict, "{'descr': '%s', 'fortran_order': False, 'shape': %s, }", descr, shape);
+    // Pad with spaces (and a final newline) so that the data starts on a 64-byte boundary, as numpy does
+    int header_len = dict_len + 1;
+    int total_len = 10 + header_len;
+    if (total_len%64!=0) header_len += 64 - total_len%64;
+    unsigned char preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (unsigned char)(header_len & 0xff), (unsigned char)(header_len >> 8)};
+    memcpy(buf, preamble, 10);
+    memcpy(buf+10, dict, dict_len);
+    memset(buf+10+dict_len, ' ', header_len-1-dict_len);
+    buf[9+header_len] = '\n';
+    return 10+header_len;
+}
+
+// Write the version 1.0 .npy header for a little-endian C-ordered array of shape (n_rows,) if n_cols==0 or (n_rows, n_cols) otherwise
+void write_npy_header(FILE* fp, const char* descr, int n_rows, int n_cols){
+    char buf[256], shape[64];
+    if (n_cols==0) snprintf(shape, sizeof shape, "(%d,)", n_rows);
+    else snprintf(shape, sizeof shape, "(%d, %d)", n_rows, n_cols);
+    int len = npy_header(buf, descr, shape);
+    fwrite(buf, 1, len, fp);
+}
+
+FILE* open_output(const char* basename, bool npy){
+    // Open the output file, appending the extension for the chosen format
+    char fname[1100];
+    snprintf(fname, sizeof fname, "%s.%s", basename, npy ? "npy" : "txt");
+    FILE* fp = fopen(fname, npy ? "wb" : "w");
+    if (fp==NULL){
+        fprintf(stderr,"Output file %s could not be opened\n", fname);
+        abort();
+    }
+    return fp;
+}
+
+void save_array(const char* basename, const Float* data, int n_rows, int n_cols, bool npy){
+    // Save a 1D (n_cols==0) or 2D row-major array of Floats, as "%le" text (one row per line) or as a '<f8' .npy file
+    // The .npy payload is the raw in-memory array, so this assumes a little-endian host with Float = double
+    FILE* fp = open_output(basename, npy);
+    if (npy){
+        write_npy_header(fp, "<f8", n_rows, n_cols);
+        fwrite(data, sizeof(Float), (size_t)n_rows*(n_cols==0 ? 1 : n_cols), fp);
+    }
+    else if (n_cols==0){
+        for (int i = 0; i < n_rows; i++) fprintf(fp, "%le\n", data[i]);
+    }
+    else{
+        for (int i = 0; i < n_rows; i++){
+            for (int j = 0; j < n_cols; j++) fprintf(fp, "%le\t", data[i*n_cols+j]);
+            fprintf(fp, "\n"); // new line each end of row
+        }
+    }
+    fclose(fp);
+}
+
+void save_array(const char* basename, const uint64* data, int n_rows, int n_cols, bool npy){
+    // As above, for bin counts, saved as "%llu" text or a '<u8' .npy file
+    FILE* fp = open_output(basename, npy);
+    if (npy){
+        write_npy_header(fp, "<u8", n_rows, n_cols);
+        fwrite(data, sizeof(uint64), (size_t)n_rows*(n_cols==0 ? 1 : n_cols), fp);
+    }
+    else if (n_cols==0){
+        for (int i = 0; i < n_rows; i++) fprintf(fp, "%llu\n", data[i]);
+    }
+    else{
+        for (int i = 0; i < n_rows; i++){
+            for (int j = 0; j < n_cols; j++) fprintf(fp, "%llu\t", data[i*n_cols+j]);
+            fprintf(fp, "\n");
+        }
+    }
+    fclose(fp);
+}
+
+FILE* open_npy(const char* fname, int &n_dims, long long* shape){
+    // Open a '<f8' .npy file and read its header, leaving the file at the start of the C-ordered data; returns NULL if the file does not exist
+    // The array shape is written into shape, which must hold up to 8 dimensions
+    FILE* fp = fopen(fname, "rb");
+    if (fp==NULL) return NULL;
+    unsigned char preamble[10];
+    char header[65536];
+    int header_len = 0;
+    if (fread(preamble, 1, 10, fp)==10 && memcmp(preamble, "\x93NUMPY", 6)==0){
+        if (preamble[6]==1) header_len = preamble[8] | (preamble[9] << 8);
+        else{ // versions 2 and 3 have a 4-byte header length
+            unsigned char len[2];
+            if (fread(len, 1, 2, fp)==2) header_len = preamble[8] | (preamble[9] << 8) | (len[0] << 16) | (len[1] << 24);
+        }
+    }
+    if (header_len<=0 || header_len>=(int)sizeof header || fread(header, 1, header_len, fp)!=(size_t)header_len){
+        fprintf(stderr,"File %s is not a valid .npy file\n", fname);
+        abort();
+    }
+    header[header_len] = '\0';
+    // Check the data type and layout, and read the dimensions from the shape tuple
+    char* shape_string = strstr(header, "'shape'");
+    if (strstr(header, "'descr': '<f8'")==NULL || strstr(header, "'fortran_order': False")==NULL || shape_string==NULL || (shape_string = strchr(shape_string, '('))==NULL){
+        fprintf(stderr,"File %s must hold a C-ordered array of little-endian doubles\n", fname);
+        abort();
+    }
+    n_dims = 0;
+    for (char* p = shape_string+1; *p!=')';){
+        char* end;
+        long long dim = strtoll(p, &end, 10);
+        if (end==p) p++; // skip commas and spaces
+        else{
+            assert(n_dims<8);
+            shape[n_dims++] = dim;
+            p = end;
+        }
+    }
+    return fp;
+}
+
+bool load_npy(const char* fname, Float* data, long long n_elements){
+    // Read a '<f8' .npy file holding n_elements values (in any C-ordered shape) into data; returns false if the file does not exist
+    int n_dims;
+    long long shape[8];
+    FILE* fp = open_npy(fname, n_dims, shape);
+    if (fp==NULL) return false;
+    long long size = 1;
+    for (int i = 0; i < n_dims; i++) size *= shape[i];
+    if (size!=n_elements || fread(data, sizeof(Float), n_elements, fp)!=(size_t)n_elements){
+        fprintf(stderr,"File %s does not hold the expected %lld values\n", fname, n_elements);
+        abort();
+    }
+    fclose(fp);
+    return true;
+}
+
+Float* read_table(const char* fname, int skip_rows, int &n_rows, int &n_cols){
+    // Read a whitespace-separated ASCII table (as numpy.loadtxt), skipping the first skip_rows lines. The returned array must be freed.
+    FILE* fp = fopen(fname, "r");
+    if (fp==NULL){
+        fprintf(stderr,"File %s not found\n", fname);
+        abort();
+    }
+    char *line = NULL;
+    size_t len = 0;
+    int max_values = 1024, n_values = 0;
+    Float *data = (Float *)malloc(sizeof(Float)*max_values);
+    n_rows = 0;
+    n_cols = -1;
+    for (int line_no = 0; getline(&line, &len, fp)!=-1; line_no++){
+        if (line_no<skip_rows) continue;
+        char *p = line, *end;
+        int cols = 0;
+        while (true){
+            Float value = strtod(p, &end);
+            if (end==p) break;
+            if (n_values==max_values){
+                max_values *= 2;
+                data = (Float *)realloc(data, sizeof(Float)*max_values);
+            }
+            data[n_values++] = value;
+            cols++;
+            p = end;
+        }
+        if (cols==0) continue; // blank line
+        if (n_cols>=0 && cols!=n_cols){
+            fprintf(stderr,"Inconsistent number of columns in line %d of file %s\n", line_no+1, fname);
+            abort();
+        }
+        n_cols = cols;
+        n_rows++;
+    }
+    free(line);
+    fclose(fp);
+    return data;
+}
+
+bool is_npy(const char* fname){
+    // Whether a file name has the .npy extension
+    int len = strlen(fname);
+    return len>4 && !strcmp(fname+len-4, ".npy");
+}
+
+class NpzWriter{
+    // Writes arrays of Floats into an uncompressed .npz archive (a zip file of .npy files), as numpy.savez does
+private:
+    static const int max_entries = 32;
+    FILE *fp;
+    char fname[1100];
+    char names[max_entries][64]; // .npy file names within the archive
+    uint32_t crcs[max_entries], sizes[max_entries], offsets[max_entries];
+    int n_entries = 0;
+
+public:
+    NpzWriter(const char* _fname){
+        snprintf(fname, sizeof fname, "%s", _fname);
+        fp = fopen(fname, "wb");
+        if (fp==NULL){
+            fprintf(stderr,"Output file %s could not be opened\n", fname);
+            abort();
+        }
+    }
+
+    ~NpzWriter(){
+        close();
+    }
+
+    void add(const char* name, const Float* data, int n_dims, const int* shape){
+        // Add the array name of the given shape (n_dims = 0 for a scalar)
+        assert(n_entries<max_entries);
+        char shape_string[128], header[256];
+        int len = snprintf(shape_string, sizeof shape_string, "(");
+        long long n_elements = 1;
+        for (int i = 0; i < n_dims; i++){
+            len += snprintf(shape_string+len, sizeof shape_string-len, n_dims==1 ? "%d," : (i==0 ? "%d" : ", %d"), shape[i]);
+            n_elements *= shape[i];
+        }
+        snprintf(shape_string+len, sizeof shape_string-len, ")");
+        int header_len = npy_header(header, "<f8", shape_string);
+        long long size = header_len + n_elements*sizeof(Float);
+        if (ftell(fp)+size>=0xffffffffLL){
+            fprintf(stderr,"Output file %s would exceed the 4GB limit of zip files without the ZIP64 extension\n", fname);
+            abort();
+        }
+
+        snprintf(names[n_entries], sizeof names[n_entries], "%s.npy", name);
+        uint32_t crc = crc32(0, header, header_len);
+        crc = crc32(crc, data, n_elements*sizeof(Float));
+        crcs[n_entries] = crc;
+        sizes[n_entries] = (uint32_t)size;
+        offsets[n_entries] = (uint32_t)ftell(fp);
+
+        // Local file header, stored (uncompressed)
+        put32(0x04034b50); put16(20); put16(0); put16(0); put16(0); put16(0x21); // signature, version, flags, method, time, date (1980-01-01)
+        put32(crc); put32(sizes[n_entries]); put32(sizes[n_entries]);
+        put16(strlen(names[n_entries])); put16(0);
+        fwrite(names[n_entries], 1, strlen(names[n_entries]), fp);
+        fwrite(header, 1, header_len, fp);
+        fwrite(data, sizeof(Float), n_elements, fp);
+        n_entries++;
+    }
+
+    void add(const char* name, Float value){
+        add(name, &value, 0, NULL);
+    }
+
+    void close(){
+        // Write the central directory and close the file
+        if (fp==NULL) return;
+        uint32_t directory_offset = (uint32_t)ftell(fp);
+        for (int i = 0; i < n_entries; i++){
+            put32(0x02014b50); put16(20); put16(20); put16(0); put16(0); put16(0); put16(0x21);
+            put32(crcs[i]); put32(sizes[i]); put32(sizes[i]);
+            put16(strlen(names[i])); put16(0); put16(0); put16(0); put16(0); put32(0); put32(offsets[i]);
+            fwrite(names[i], 1, strlen(names[i]), fp);
+        }
+        uint32_t directory_size = (uint32_t)ftell(fp) - directory_offset;
+        put32(0x06054b50); put16(0); put16(0); put16(n_entries); put16(n_entries);
+        put32(directory_size); put32(directory_offset); put16(0);
+        if (fclose(fp)!=0){
+            fprintf(stderr,"Failed to write output file %s\n", fname);
+            abort();
+        }
+        fp = NULL;
+    }
+
+private:
+    void put16(uint32_t x){
+        // Zip files are little-endian
+        fputc(x & 0xff, fp);
+        fputc((x >> 8) & 0xff, fp);
+    }
+
+    void put32(uint32_t x){
+        put16(x & 0xffff);
+        put16(x >> 16);
+    }
+
+    static uint32_t crc32(uint32_t crc, const void* data, long long n_bytes){
+        // Standard (zlib) CRC-32, continuing from the CRC of the preceding bytes
+        static uint32_t table[256];
+        static bool init = false;
+        if (!init){
+            for (uint32_t i = 0; i < 256; i++){
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+            init = true;
+        }
+        const unsigned char* bytes = (const unsigned char*)data;
+        crc = ~crc;
+        for (long long i = 0; i < n_bytes; i++) crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+// numa_utilities.h - thread pinning and NUMA placement of the shared data for multi-socket machines (Linux only), set with the -pin and -interleave options.
+// The per-thread integrals of compute_integral.h are allocated and zeroed by their own thread, so their pages are placed on the node of that thread; pinning the threads
+// keeps them there. The grids, random draw samplers and jackknife weights are read by all threads but first touched by the master thread, which would place them all on one
+// socket; interleaving spreads their pages round-robin over the memory nodes, so that every socket reads them at the same average cost and all memory controllers are used.
+
+#ifndef NUMA_UTILITIES_H
+#define NUMA_UTILITIES_H
+
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#ifdef __linux__
+static cpu_set_t numa_process_cpus; // CPUs the process was allowed to run on before pinning
+static bool numa_threads_pinned = false;
+#endif
+
+static void numa_parse_list(const char *filename, std::vector<int> &list){
+    // Read a list of CPUs or nodes in the kernel format (e.g. "0-3,8,10-11") from a sysfs file; the list is left empty if the file is not available
+    list.clear();
+    FILE *fp = fopen(filename, "r");
+    if (fp==NULL) return;
+    int first, last;
+    while (fscanf(fp, "%d", &first)==1){
+        last = first;
+        int c = fgetc(fp);
+        if (c=='-'){
+            if (fscanf(fp, "%d", &last)!=1) break;
+            c = fgetc(fp);
+        }
+        for (int i = first; i <= last; i++) list.push_back(i);
+        if (c!=',') break;
+    }
+    fclose(fp);
+}
+
+#if (defined __linux__ && defined OPENMP)
+static void numa_node_cpus(const cpu_set_t *allowed, std::vector<std::vector<int> > &node_cpus){
+    // CPUs of each NUMA node which are in the allowed set, omitting nodes without any; a single node holding all allowed CPUs if the topology is not available
+    std::vector<int> nodes, cpus;
+    node_cpus.clear();
+    numa_parse_list("/sys/devices/system/node/online", nodes);
+    for (size_t n = 0; n < nodes.size(); n++){
+        char filename[100];
+        snprintf(filename, 100, "/sys/devices/system/node/node%d/cpulist", nodes[n]);
+        numa_parse_list(filename, cpus);
+        std::vector<int> usable;
+        for (size_t i = 0; i < cpus.size(); i++) if (cpus[i]<CPU_SETSIZE && CPU_ISSET(cpus[i], allowed)) usable.push_back(cpus[i]);
+        if (usable.size()>0) node_cpus.push_back(usable);
+    }
+    if (node_cpus.size()==0){
+        std::vector<int> usable;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) if (CPU_ISSET(cpu, allowed)) usable.push_back(cpu);
+        node_cpus.push_back(usable);
+    }
+}
+#endif
+
+void pin_threads(const char *scheme, int nthread){
+    // Bind each OpenMP thread to one CPU: "compact" fills the CPUs of one node before using the next one, "spread" assigns consecutive threads to different nodes in turn.
+    // The binding holds for all later parallel regions with the same number of threads, since OpenMP keeps the same threads.
+    if (!strcmp(scheme, "none")) return;
+#if (defined __linux__ && defined OPENMP)
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &numa_process_cpus)!=0){
+        fprintf(stderr, "# WARNING: could not read the CPU affinity of the process, so the threads are not pinned.\n");
+        return;
+    }
+    std::vector<std::vector<int> > node_cpus;
+    numa_node_cpus(&numa_process_cpus, node_cpus);
+    std::vector<int> order; // CPU for each thread (cyclically if there are more threads than CPUs)
+    if (!strcmp(scheme, "compact")){
+        for (size_t n = 0; n < node_cpus.size(); n++) order.insert(order.end(), node_cpus[n].begin(), node_cpus[n].end());
+    }
+    else{
+        size_t max_node_cpus = 0;
+        for (size_t n = 0; n < node_cpus.size(); n++) max_node_cpus = std::max(max_node_cpus, node_cpus[n].size());
+        for (size_t i = 0; i < max_node_cpus; i++)
+            for (size_t n = 0; n < node_cpus.size(); n++) if (i<node_cpus[n].size()) order.push_back(node_cpus[n][i]);
+    }
+    if (order.size()==0) return;
+    numa_threads_pinned = true;
+    int failures = 0;
+#pragma omp parallel num_threads(nthread) reduction(+:failures)
+    {
+        cpu_set_t cpu;
+        CPU_ZERO(&cpu);
+        CPU_SET(order[omp_get_thread_num()%order.size()], &cpu);
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &cpu)!=0) failures++; // 0 is the calling thread
+    }
+    if (failures>0) fprintf(stderr, "# WARNING: could not pin %d of %d threads.\n", failures, nthread);
+    printf("# Pinned %d threads to %d CPUs on %d NUMA node(s) (%s)\n", nthread-failures, (int)std::min(order.size(), (size_t)nthread), (int)node_cpus.size(), scheme);
+    if ((size_t)nthread>order.size()) fprintf(stderr, "# WARNING: more threads (%d) than available CPUs (%d); some CPUs run several threads.\n", nthread, (int)order.size());
+#else
+    fprintf(stderr, "# WARNING: thread pinning needs Linux and compilation with -DOPENMP; the threads are not pinned.\n");
+#endif
+}
+
+void unpin_thread(){
+    // Allow the calling thread to run on all CPUs of the process again, e.g. for helper threads which would otherwise inherit the CPU of the master thread
+#ifdef __linux__
+    if (numa_threads_pinned) sched_setaffinity(0, sizeof(cpu_set_t), &numa_process_cpus);
+#endif
+}
+
+void interleave_memory(const void *ptr, size_t bytes){
+    // Spread the pages of an array over all memory nodes, moving the pages already touched; nothing is done on single-node machines.
+    // Pages shared with neighbouring data at the ends of the array are included, which only changes the placement of that data.
+#ifdef __linux__
+    if (ptr==NULL || bytes==0) return;
+    std::vector<int> nodes;
+    numa_parse_list("/sys/devices/system/node/has_memory", nodes);
+    if (nodes.size()<2) return;
+    const int max_nodes = 1024;
+    const int bits = 8*sizeof(unsigned long);
+    unsigned long mask[max_nodes/bits] = {0};
+    for (size_t n = 0; n < nodes.size(); n++) if (nodes[n]<max_nodes) mask[nodes[n]/bits] |= 1UL<<(nodes[n]%bits);
+    unsigned long page = sysconf(_SC_PAGESIZE);
+    unsigned long start = (unsigned long)ptr & ~(page-1), end = ((unsigned long)ptr+bytes+page-1) & ~(page-1);
+    if (syscall(__NR_mbind, start, end-start, MPOL_INTERLEAVE, mask, max_nodes, MPOL_MF_MOVE)!=0){
+        static bool warned = false;
+        if (!warned) fprintf(stderr, "# WARNING: could not interleave the shared data over the NUMA nodes (mbind failed).\n");
+        warned = true;
+    }
+#endif
+}
+
+#endif
@@ -0,0 +1,109 @@
+// output_writer.h - background thread for saving the subsample integrals computed in compute_integral.h
+
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "numa_utilities.h"
+
+class OutputWriter{
+    // Saves the (normalized) subsample integrals from a dedicated thread, so that the sampling threads only wait on the filesystem if all buffers are in use.
+    // Subsamples are handed over by swapping their arrays into a free buffer, which the writer thread then swaps into its own Integrals object to save.
+    // No arrays are copied; with two buffers, one subsample can be queued while the previous one is being written.
+private:
+    static const int n_buffers = 2;
+    Integrals *buffers[n_buffers]; // hold the subsamples waiting to be (or being) written
+    Integrals *writeint; // the object saving to file, which also owns the subsample containers if used
+    int labels[n_buffers]; // subsample index held in each buffer
+    int queue[n_buffers]; // buffers in order of submission; the first is the one being written
+    int queue_start = 0, queue_len = 0;
+    bool container, done = false;
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::thread thread;
+
+public:
+    OutputWriter(Integrals *_writeint, Integrals *buffer1, Integrals *buffer2, bool _container){
+        writeint = _writeint;
+        buffers[0] = buffer1;
+        buffers[1] = buffer2;
+        container = _container;
+        thread = std::thread(&OutputWriter::run, this);
+    }
+
+    ~OutputWriter(){
+        finish();
+    }
+
+    void submit(Integrals *ints, int index){
+        // Hand over the integrals of subsample index, blocking only if all buffers are occupied.
+        // On return, ints holds the arrays of an already written subsample and must be reset before reuse.
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait(lock, [this]{return queue_len < n_buffers;});
+        int buf = free_buffer();
+        ints->swap_integrals(buffers[buf]);
+        labels[buf] = index;
+        queue[(queue_start+queue_len)%n_buffers] = buf;
+        queue_len++;
+        cond.notify_all();
+    }
+
+    void finish(){
+        // Wait until all submitted subsamples are saved and stop the writer thread
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            done = true;
+            cond.notify_all();
+        }
+        if (thread.joinable()) thread.join();
+    }
+
+private:
+    int free_buffer(){
+        // Find a buffer which is neither queued nor being written (called with the lock held)
+        for (int buf = 0; buf < n_buffers; buf++){
+            bool in_use = false;
+            for (int i = 0; i < queue_len; i++) if (queue[(queue_start+i)%n_buffers]==buf) in_use = true;
+            if (!in_use) return buf;
+        }
+        return -1; // never reached since queue_len < n_buffers
+    }
+
+    void run(){
+        unpin_thread(); // not bound to the CPU of the master thread
+        while (true){
+            int buf;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cond.wait(lock, [this]{return queue_len > 0 || done;});
+                if (queue_len==0) return; // finished and nothing left to write
+                buf = queue[queue_start]; // keep it in the queue while writing so it is not reused
+            }
+            writeint->swap_integrals(buffers[buf]);
+#ifndef LEGENDRE // the Legendre integrals are only saved as text files
+            if (writeint->in_memory()) writeint->store_arrays(1+labels[buf]);
+            else if (container) writeint->save_subsample(labels[buf]);
+            else
+#endif
+            {
+                char output_string[50];
+                snprintf(output_string, 50, "%d", labels[buf]);
+                writeint->save_integrals(output_string, 0);
+#ifdef JACKKNIFE
+                writeint->save_jackknife_integrals(output_string);
+#endif
+            }
+            writeint->swap_integrals(buffers[buf]);
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                queue_start = (queue_start+1)%n_buffers;
+                queue_len--;
+                cond.notify_all();
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,217 @@
+// pair_counter.h - exact weighted pair counts in (r,mu) bins, split by jackknife region, from a single pass over neighbouring cells of the Grid.
+// This replaces the per-region Corrfunc calls of the python scripts, which each count the pairs of the whole survey again.
+
+#ifndef PAIR_COUNTER_H
+#define PAIR_COUNTER_H
+
+#include <algorithm>
+#include <vector>
+
+Particle* read_jackknife_particles(const char* filename, int &np, bool read_jk){
+    // Read particles from a file of space-separated x,y,z,w,JK lines, keeping the original jackknife region IDs (relabelled by jackknife_regions())
+    // If read_jk is false, only x,y,z,w are required and all particles are placed in region 0
+    char line[1000];
+    FILE *fp = fopen(filename, "r");
+    if (fp==NULL){
+        fprintf(stderr,"File %s not found\n", filename);
+        abort();
+    }
+    // Count lines to construct the correct size
+    np = 0;
+    while (fgets(line,1000,fp)!=NULL){
+        if (line[0]=='#') continue;
+        if (line[0]=='\n') continue;
+        np++;
+    }
+    rewind(fp);
+    Particle *p = (Particle *)malloc(sizeof(Particle)*np);
+    printf("# Found %d particles from %s\n", np, filename);
+    int j = 0;
+    double tmp[5];
+    while (fgets(line,1000,fp)!=NULL&&j<np){
+        if (line[0]=='#') continue;
+        if (line[0]=='\n') continue;
+        int cols = sscanf(line, "%lf %lf %lf %lf %lf", tmp, tmp+1, tmp+2, tmp+3, tmp+4);
+        if (cols<(read_jk ? 5 : 4)){
+            fprintf(stderr,"Particle %d has bad format in %s; x,y,z,w%s are required\n", j, filename, read_jk ? ",JK" : "");
+            abort();
+        }
+        p[j].pos.x = tmp[0];
+        p[j].pos.y = tmp[1];
+        p[j].pos.z = tmp[2];
+        p[j].w = tmp[3];
+        p[j].JK = read_jk ? (int)tmp[4] : 0;
+        p[j].rand_class = 0;
+        j++;
+    }
+    fclose(fp);
+    return p;
+}
+
+int jackknife_regions(Particle **p, int *np, int n_sets, int* &regions){
+    // Find the non-empty jackknife regions of all particle sets (in ascending order, as numpy.unique) and relabel each particle's JK by its index in this list
+    std::vector<int> ids;
+    for (int index = 0; index < n_sets; index++)
+        for (int j = 0; j < np[index]; j++) ids.push_back((int)p[index][j].JK);
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    int n_jack = ids.size();
+    regions = (int *)malloc(sizeof(int)*n_jack);
+    for (int x = 0; x < n_jack; x++) regions[x] = ids[x];
+    for (int index = 0; index < n_sets; index++)
+        for (int j = 0; j < np[index]; j++) p[index][j].JK = std::lower_bound(regions, regions+n_jack, (int)p[index][j].JK)-regions;
+    return n_jack;
+}
+
+void pair_count_box(Particle **p, int *np, int n_sets, Float rmax, Float3 &rect_boxsize, Float &cellsize, Float3 &shift, int &nside){
+    // Bounding box and grid of all particle sets for the pair counts. Pairs are never wrapped around the box.
+    // Cells are just over half the maximum separation, so pairs are found within two cells, but capped at 512 cells along the largest dimension.
+    Float3 pmax;
+    shift.x = shift.y = shift.z = INFINITY;
+    pmax.x = pmax.y = pmax.z = -INFINITY;
+    for (int index = 0; index < n_sets; index++)
+        for (int j = 0; j < np[index]; j++){
+            shift.x = fmin(shift.x, p[index][j].pos.x);
+            shift.y = fmin(shift.y, p[index][j].pos.y);
+            shift.z = fmin(shift.z, p[index][j].pos.z);
+            pmax.x = fmax(pmax.x, p[index][j].pos.x);
+            pmax.y = fmax(pmax.y, p[index][j].pos.y);
+            pmax.z = fmax(pmax.z, p[index][j].pos.z);
+        }
+    Float3 prange = pmax-shift;
+    Float biggest = fmax(prange.x, fmax(prange.y, prange.z));
+    cellsize = fmax(1.001*rmax/2., biggest/512.); // the margin keeps cells three apart beyond rmax, even with rounding in the cell assignment
+    rect_boxsize = (floor3(prange/cellsize)+Float3(1.,1.,1.))*cellsize; // the particles at pmax lie inside the last cell
+    nside = ceil(fmax(rect_boxsize.x, fmax(rect_boxsize.y, rect_boxsize.z))/cellsize);
+    printf("# Pair counting box-size is {%6.2f,%6.2f,%6.2f} with cell size %6.2f\n", rect_boxsize.x, rect_boxsize.y, rect_boxsize.z, cellsize);
+}
+
+class PairCounter{
+    // Accumulates the summed weight products of all pairs of particles in each (r,mu) bin, both in total and for each jackknife region.
+    // Each pair adds half of its weight to the region of either particle, so an auto-correlation gives the python RR_aA,
+    // i.e. the counts between particles in region A and the whole survey, and cross-correlations the average of the two such counts.
+    // Auto-correlations count ordered pairs, i.e. each distinct pair twice, as Corrfunc.
+public:
+    int nbin, mbin, nbins, n_jack;
+    Float *r_low, *r_high; // Min and max of each radial bin
+    Float rmin, rmax, mumax, dmu;
+    bool periodic; // whether mu is measured from the z-axis, rather than from the line of sight to the pair midpoint
+    Float *counts; // total weighted pair counts, indexed by bin_r*mbin+bin_mu
+    Float *jack_counts; // weighted pair counts of each jackknife region, indexed by JK*nbins+bin
+
+    PairCounter(int _nbin, Float *_r_low, Float *_r_high, int _mbin, Float _mumax, int _n_jack, bool _periodic){
+        nbin = _nbin;
+        mbin = _mbin;
+        nbins = nbin*mbin;
+        n_jack = _n_jack;
+        r_low = _r_low;
+        r_high = _r_high;
+        rmin = r_low[0];
+        rmax = r_high[nbin-1];
+        mumax = _mumax;
+        dmu = mumax/mbin;
+        periodic = _periodic;
+        int ec=0;
+        ec+=posix_memalign((void **) &counts, PAGE, sizeof(Float)*nbins);
+        ec+=posix_memalign((void **) &jack_counts, PAGE, sizeof(Float)*nbins*n_jack);
+        assert(ec==0);
+        reset();
+    }
+
+    ~PairCounter(){
+        free(counts);
+        free(jack_counts);
+    }
+
+    void reset(){
+        for (int i = 0; i < nbins; i++) counts[i] = 0.;
+        for (int i = 0; i < nbins*n_jack; i++) jack_counts[i] = 0.;
+    }
+
+    void sum_counts(PairCounter *pc){
+        for (int i = 0; i < nbins; i++) counts[i] += pc->counts[i];
+        for (int i = 0; i < nbins*n_jack; i++) jack_counts[i] += pc->jack_counts[i];
+    }
+
+    inline int getbin(Float r, Float mu){
+        // Linearized (r,mu) bin, or -1 if outside the binning
+        Float* r_higher = std::upper_bound(r_high, r_high + nbin, r); // binary search for r_high element higher than r
+        int which_bin = r_higher - r_high;
+        if (which_bin==nbin || r < r_low[which_bin]) return -1;
+        if (mu > mumax) return -1;
+        int mu_bin = std::min((int)(mu/dmu), mbin-1); // mu = mumax is included in the last bin
+        return which_bin*mbin + mu_bin;
+    }
+
+    void count(Grid *grid1, Grid *grid2){
+        // Count all pairs between the particles of grid1 and grid2, which must share the same cells; if grid2==grid1 this is an auto-correlation.
+        // Threads work on different primary cells, each looping over the neighbouring cells within rmax.
+        bool autocorr = (grid1==grid2);
+        assert(grid1->cellsize==grid2->cellsize && grid1->ncells==grid2->ncells);
+        // Cell assignments are computed in single precision (see floor3), so allow a tolerance of 1e-4 cells
+        const Float tol = 1e-4;
+        int cell_range = ceil(rmax/grid1->cellsize+tol);
+        Float rmin2 = rmin*rmin, rmax2 = rmax*rmax;
+        Float pair_factor = autocorr ? 2. : 1.;
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+        {
+        PairCounter local(nbin, r_low, r_high, mbin, mumax, n_jack, periodic);
+#ifdef OPENMP
+#pragma omp for schedule(dynamic,8)
+#endif
+        for (int n1 = 0; n1 < grid1->nf; n1++){
+            int id1 = grid1->filled[n1];
+            integer3 prim_id = grid1->cell_id_from_1d(id1);
+            Cell c1 = grid1->c[id1];
+            Float3 center1 = grid1->cell_center(id1);
+            for (int dx = -cell_range; dx <= cell_range; dx++)
+                for (int dy = -cell_range; dy <= cell_range; dy++)
+                    for (int dz = -cell_range; dz <= cell_range; dz++){
+                        // Auto-correlations only use each pair of cells once
+                        if (autocorr && (dx<0 || (dx==0 && (dy<0 || (dy==0 && dz<0))))) continue;
+                        // Skip cells entirely beyond rmax
+                        Float min_sep2 = 0.;
+                        if (abs(dx)>1) min_sep2 += pow(abs(dx)-1-tol, 2);
+                        if (abs(dy)>1) min_sep2 += pow(abs(dy)-1-tol, 2);
+                        if (abs(dz)>1) min_sep2 += pow(abs(dz)-1-tol, 2);
+                        if (min_sep2*grid1->cellsize*grid1->cellsize>=rmax2) continue;
+                        int id2 = grid2->test_cell(prim_id+integer3(dx,dy,dz));
+                        if (id2<0) continue;
+                        Cell c2 = grid2->c[id2];
+                        Float3 center2 = grid2->cell_center(id2);
+                        bool same_cell = autocorr && dx==0 && dy==0 && dz==0;
+                        for (int i = c1.start; i < c1.start+c1.np; i++){
+                            Particle pi = grid1->particle(i, center1);
+                            for (int j = same_cell ? i+1 : c2.start; j < c2.start+c2.np; j++){
+                                Particle pj = grid2->particle(j, center2);
+                                Float3 sep = pj.pos-pi.pos;
+                                Float r2 = sep.norm2();
+                                if (r2<rmin2 || r2>=rmax2) continue;
+                                Float r = sqrt(r2), mu;
+                                if (periodic) mu = fabs(sep.z)/r;
+                                else{
+                                    Float3 los = pi.pos+pj.pos; // No 1/2 as normalized anyway below
+                                    mu = fabs(sep.dot(los))/(r*los.norm());
+                                }
+                                int bin = local.getbin(r, mu);
+                                if (bin<0) continue;
+                                Float w = pair_factor*pi.w*pj.w;
+                                local.counts[bin] += w;
+                                local.jack_counts[(int)pi.JK*nbins+bin] += 0.5*w;
+                                local.jack_counts[(int)pj.JK*nbins+bin] += 0.5*w;
+                            }
+                        }
+                    }
+        }
+#ifdef OPENMP
+#pragma omp critical
+#endif
+        sum_counts(&local);
+        } // end parallel region
+    }
+};
+
+#endif
@@ -8,6 +8,8 @@
 #include "legendre_mix_utilities.h"
 #endif
 
+struct IntegralArrays; // defined in integrals.h
+
 class Parameters{
 
 public:
@@ -44,6 +46,16 @@ public:
     // The number of threads to run on
 	int nthread = 30;
 
+    // How to pin the threads to CPUs (none, compact or spread) and whether to interleave the shared data over the NUMA nodes (see numa_utilities.h)
+    const char *pin_threads = "none";
+    bool numa_interleave = false;
+
+    // Whether to back the large arrays by huge pages (see huge_pages.h)
+    bool huge_pages = false;
+
+    // Bits per coordinate of the compressed particle positions in the grids (16 or 32), or 0 to keep the particles in full precision (see Grid::compress)
+    int compact_bits = 0;
+
     // The grid size, which should be tuned to match boxsize and rmax.
 	// This uses the maximum width of the cuboidal box.
 	int nside = 71;
@@ -147,6 +159,10 @@ public:
 
     char *jk_weight_file2 = NULL; // w_{aA}^{22} weights
     const char default_jk_weight_file2[500] = "";
+
+    // How to assign particles to jackknife regions: from the fifth column of the particle files ("file"), or from their positions by "healpix", "angular" or "cartesian" tiling
+    const char *jk_assign = "file";
+    Float jk_resolution = 0; // HEALPix NSIDE, number of declination bands or Cartesian tile size for the jk_assign tiling
 #endif
 
     //-------- LEGENDRE MULTI-FIELD PARAMETERS -------------------------------
@@ -219,6 +235,25 @@ public:
 	// The index from which on to invert the sign of the weights
 	int rstart = 0;
 
+#if (!defined LEGENDRE && !defined POWER && !defined THREE_PCF)
+    // Whether to save the integrals as binary NumPy .npy files instead of text files
+    bool npy_output = false;
+
+    // Whether to append the subsample integrals to one container file per output array instead of writing separate files
+    bool container_output = false;
+
+    // If set (by the library interface in librascalc/), the integrals are copied into these arrays instead of being saved to files
+    IntegralArrays *memory_output = NULL;
+
+    // Optional radial binning file of a top-hat basis for the correlation function. If given, the C2, C3 and C4 integrals are also saved
+    // decomposed over the basis elements (and pairs of elements), so that they can be evaluated for other correlation functions afterwards
+    char *xi_basis_file = NULL;
+    int xi_basis_mbin = 1; // number of mu bins of the basis (spaced linearly between 0 and 1)
+    int xi_basis_nbin = 0; // number of radial bins of the basis (set from file)
+    Float *xi_basis_low, *xi_basis_high;
+    Float xi_basis_max_memory = 16.; // largest memory (in GB) allowed for all copies of the decomposed integrals, else the run is refused
+#endif
+
 	//---------------- INTERNAL PARAMETERS -----------------------------------
     // (no more user defined parameters below this line)
 
@@ -265,6 +300,10 @@ public:
         else if (!strcmp(argv[i],"-rs")) rstart = atoi(argv[++i]);
 		else if (!strcmp(argv[i],"-nmax")) nmax = atoll(argv[++i]);
 		else if (!strcmp(argv[i],"-nthread")) nthread = atoi(argv[++i]);
+        else if (!strcmp(argv[i],"-pin")) pin_threads = argv[++i];
+        else if (!strcmp(argv[i],"-interleave")) numa_interleave = 1;
+        else if (!strcmp(argv[i],"-hugepages")) huge_pages = 1;
+        else if (!strcmp(argv[i],"-compact")) compact_bits = atoi(argv[++i]);
 		else if (!strcmp(argv[i],"-mbin_cf")) mbin_cf = atoi(argv[++i]);
 		else if (!strcmp(argv[i],"-save")) savename = argv[++i];
 		else if (!strcmp(argv[i],"-load")) loadname = argv[++i];
@@ -283,9 +322,18 @@ public:
         else if (!strcmp(argv[i],"-jackknife")) jk_weight_file=argv[++i];
         else if (!strcmp(argv[i],"-jackknife12")) jk_weight_file12=argv[++i];
         else if (!strcmp(argv[i],"-jackknife2")) jk_weight_file2=argv[++i];
+        else if (!strcmp(argv[i],"-jk_assign")) {
+            jk_assign=argv[++i];
+            jk_resolution=atof(argv[++i]);
+            }
 #endif
 #ifdef LEGENDRE_MIX
         else if (!strcmp(argv[i],"-mu_bin_legendre_file")) mu_bin_legendre_file=argv[++i];
+#elif defined THREE_PCF // before LEGENDRE, which the 3PCF builds also define
+        else if (!strcmp(argv[i],"-max_l")) max_l=atoi(argv[++i]);
+        else if (!strcmp(argv[i],"-phi_file")) phi_file=argv[++i];
+        else if (!strcmp(argv[i],"-N5")) N5=atof(argv[++i]);
+        else if (!strcmp(argv[i],"-N6")) N6=atof(argv[++i]);
 #elif defined LEGENDRE
         else if (!strcmp(argv[i],"-phi_file")) phi_file=argv[++i];
         else if (!strcmp(argv[i],"-phi_file12")) phi_file12=argv[++i];
@@ -299,17 +347,22 @@ public:
         else if (!strcmp(argv[i],"-power_norm")) power_norm = atof(argv[++i]);
         else if (!strcmp(argv[i],"-power_norm12")) power_norm12 = atof(argv[++i]);
         else if (!strcmp(argv[i],"-power_norm")) power_norm2 = atof(argv[++i]);
-#elif defined THREE_PCF
-        else if (!strcmp(argv[i],"-max_l")) max_l=atoi(argv[++i]);
-        else if (!strcmp(argv[i],"-phi_file")) phi_file=argv[++i];
-        else if (!strcmp(argv[i],"-N5")) N5=atof(argv[++i]);
-        else if (!strcmp(argv[i],"-N6")) N6=atof(argv[++i]);
 #endif
 #if (!defined LEGENDRE && !defined POWER && !defined THREE_PCF)
 		else if (!strcmp(argv[i],"-mbin")) mbin = atoi(argv[++i]);
         else if (!strcmp(argv[i],"-RRbin")) RR_bin_file=argv[++i];
 		else if (!strcmp(argv[i],"-RRbin12")) RR_bin_file12=argv[++i];
 		else if (!strcmp(argv[i],"-RRbin2")) RR_bin_file2=argv[++i];
+        else if (!strcmp(argv[i],"-npy")) npy_output = 1;
+        else if (!strcmp(argv[i],"-container")) container_output = 1;
+        else if (!strcmp(argv[i],"-xi_basis")) xi_basis_file = argv[++i];
+        else if (!strcmp(argv[i],"-xi_basis_mbin")) xi_basis_mbin = atoi(argv[++i]);
+        else if (!strcmp(argv[i],"-xi_basis_max_memory")) xi_basis_max_memory = atof(argv[++i]);
+#else
+        else if ((!strcmp(argv[i],"-xi_basis"))||(!strcmp(argv[i],"-xi_basis_mbin"))||(!strcmp(argv[i],"-xi_basis_max_memory"))){
+            fprintf(stderr, "The correlation function basis option %s is only available in the DEFAULT, JACKKNIFE and LEGENDRE_MIX modes\n", argv[i]);
+            usage();
+        }
 #endif
         else if (!strcmp(argv[i],"-perbox")) perbox = 1;
         else if (!strcmp(argv[i],"-np")) {
@@ -348,6 +401,15 @@ public:
 
 	    assert(i==argc);  // For example, we might have omitted the last argument, causing disaster.
 
+        if (strcmp(pin_threads,"none")&&strcmp(pin_threads,"compact")&&strcmp(pin_threads,"spread")){
+            fprintf(stderr, "Unknown thread pinning scheme %s\n", pin_threads);
+            usage();
+        }
+        if (compact_bits!=0&&compact_bits!=16&&compact_bits!=32){
+            fprintf(stderr, "The compressed particle positions must have 16 or 32 bits, not %d\n", compact_bits);
+            usage();
+        }
+
 	    assert(nside%2!=0); // The probability integrator needs an odd grid size
 
 	    assert(nofznorm>0); // need some galaxies!
@@ -358,12 +420,18 @@ public:
 #endif
 	    assert(mumax<=1); // mu > 1 makes no sense
 
-#if (defined LEGENDRE || defined LEGENDRE_MIX)
+#if ((defined LEGENDRE || defined LEGENDRE_MIX) && !defined THREE_PCF)
         assert(max_l%2==0); // check maximum ell is even
 #endif
 #ifdef LEGENDRE_MIX
         if (mu_bin_legendre_file == NULL) mu_bin_legendre_file = (char *) default_mu_bin_legendre_file; // no mu bin Legendre file specified
         new (&mu_bin_legendre_factors) MuBinLegendreFactors(mu_bin_legendre_file, mbin, max_l); // construct in place
+#elif defined THREE_PCF
+        assert(max_l<=10); // ell>10 not yet implemented!
+        if (phi_file==NULL) {phi_file = (char *) default_phi_file;} // no phi file specified
+        mbin = max_l+1; // number of angular bins is set to number of Legendre bins (including odd bins)
+        if (phi_file2==NULL) {phi_file2 = (char *) default_phi_file2;} // declared with LEGENDRE, and only checked for multiple tracers, which are not supported
+        if (phi_file12==NULL) {phi_file12 = (char *) default_phi_file12;}
 #elif defined LEGENDRE
         assert(max_l<=10); // ell>10 not yet implemented!
         mbin = max_l/2+1; // number of angular bins is set to number of Legendre bins
@@ -385,10 +453,6 @@ public:
             printf("\nTruncation radius (%.0f Mpc/h) is too large for efficient power computation. Exiting.\n\n",R0);
             exit(1);
         }
-#elif defined THREE_PCF
-        assert(max_l<=10); // ell>10 not yet implemented!
-        if (phi_file==NULL) {phi_file = (char *) default_phi_file;} // no phi file specified
-        mbin = max_l+1; // number of angular bins is set to number of Legendre bins (including odd bins)
 #elif defined JACKKNIFE
 	    if (jk_weight_file==NULL) jk_weight_file = (char *) default_jk_weight_file; // No jackknife name was given
 	    if (jk_weight_file12==NULL) jk_weight_file12 = (char *) default_jk_weight_file12; // No jackknife name was given
@@ -531,6 +595,30 @@ public:
 		nthread=1;
 #endif
 
+#if (!defined LEGENDRE && !defined POWER && !defined THREE_PCF)
+        if (xi_basis_file!=NULL){
+            if (xi_basis_mbin<1){
+                fprintf(stderr, "The correlation function basis needs at least one mu bin, not %d\n", xi_basis_mbin);
+                usage();
+            }
+            read_xi_basis(xi_basis_file);
+            int n_basis = xi_basis_nbin*xi_basis_mbin+1; // including the element for separations outside the basis
+            Float sm_bins = nbin*mbin;
+            // Each thread accumulates its own copy of the decomposed integrals c2b, c3b and c4b (see Integrals), and five more are used for summing and writing them (see compute_integral.h)
+            Float copy_size = n_basis*(sm_bins+sm_bins*sm_bins+n_basis*sm_bins*sm_bins)*sizeof(Float)/pow(1024.,3);
+#ifdef JACKKNIFE
+            copy_size *= 2; // the jackknife integrals are decomposed too
+#endif
+            Float basis_memory = (nthread+5)*copy_size;
+            printf("Decomposing the integrals over %d correlation function basis elements (%d radial x %d mu bins and one for all other separations).\n", n_basis, xi_basis_nbin, xi_basis_mbin);
+            printf("The decomposed integrals take %.2f GB per copy and %.2f GB in total for %d threads.\n", copy_size, basis_memory, nthread);
+            if (basis_memory>xi_basis_max_memory){
+                fprintf(stderr, "The decomposed integrals would need %.2f GB, more than the limit of %.2f GB set by -xi_basis_max_memory. Use fewer basis bins or threads, or raise the limit.\n", basis_memory, xi_basis_max_memory);
+                exit(1);
+            }
+        }
+#endif
+
 		// Output for posterity
 		printf("Grid = %d\n", nside);
 		printf("Maximum Radius = %6.5e\n", rmax);
@@ -546,6 +634,31 @@ public:
         printf("Output directory: '%s'\n",out_file);
 
 	}
+    // Constructor for the library interface (librascalc/): the options are set directly after construction, and the radial binning is given as arrays instead of files
+    Parameters(const Float *r_low, const Float *r_high, int _nbin, const Float *r_low_cf, const Float *r_high_cf, int _nbin_cf){
+        nbin = _nbin;
+        nbin_cf = _nbin_cf;
+        int ec=0;
+        ec+=posix_memalign((void **) &radial_bins_low, PAGE, sizeof(Float)*nbin);
+        ec+=posix_memalign((void **) &radial_bins_high, PAGE, sizeof(Float)*nbin);
+        ec+=posix_memalign((void **) &radial_bins_low_cf, PAGE, sizeof(Float)*nbin_cf);
+        ec+=posix_memalign((void **) &radial_bins_high_cf, PAGE, sizeof(Float)*nbin_cf);
+        assert(ec==0);
+        for (int i = 0; i < nbin; i++){
+            radial_bins_low[i] = r_low[i];
+            radial_bins_high[i] = r_high[i];
+        }
+        for (int i = 0; i < nbin_cf; i++){
+            radial_bins_low_cf[i] = r_low_cf[i];
+            radial_bins_high_cf[i] = r_high_cf[i];
+        }
+        rmin = radial_bins_low[0];
+        rmax = radial_bins_high[nbin-1];
+        rmin_cf = radial_bins_low_cf[0];
+        rmax_cf = radial_bins_high_cf[nbin_cf-1];
+        multi_tracers = false;
+    }
+
 private:
 	void usage() {
 	    fprintf(stderr, "\nUsage for grid_covariance:\n\n");
@@ -568,6 +681,10 @@ private:
 	    fprintf(stderr, "          Recommend having several grid cells per rmax.\n");
         fprintf(stderr, "          There are {nside} cells along the longest dimension of the periodic box.\n");
 	    fprintf(stderr, "   -nthread <nthread>: The number of CPU threads ot use for parallelization.\n");
+        fprintf(stderr, "   -pin <scheme>: (Optional) Pin each thread to one CPU, filling one NUMA node after the other (compact) or alternating between the nodes (spread). Default none.\n");
+        fprintf(stderr, "   -interleave: (Optional) Spread the memory of the particle grids, random draw samplers and weights over all NUMA nodes.\n");
+        fprintf(stderr, "   -hugepages: (Optional) Back the particle grids, random draw samplers and integral accumulators by 2 MB transparent huge pages where the system allows.\n");
+        fprintf(stderr, "   -compact <bits>: (Optional) Store the gridded particles compactly, with positions of 16 or 32 bits within their cell and single precision weights. Default 0 (full precision).\n");
         fprintf(stderr, "   -perbox <perbox>: Boolean, whether the box is periodic is not\n");
         fprintf(stderr, "\n");
 
@@ -576,11 +693,16 @@ private:
 	    fprintf(stderr, "   -cor2 <file>: (Optional) File location of input xi_2 correlation function file.\n");
 	    fprintf(stderr, "   -norm2 <nofznorm2>: (Optional) Number of galaxies in the survey for the second tracer set.\n");
 
-#if (defined LEGENDRE || defined LEGENDRE_MIX)
+#ifdef THREE_PCF
+        fprintf(stderr, "   -max_l <max_l>: Maximum legendre multipole\n");
+#elif (defined LEGENDRE || defined LEGENDRE_MIX)
         fprintf(stderr, "   -max_l <max_l>: Maximum legendre multipole (must be even)\n");
 #endif
 #ifdef LEGENDRE_MIX
         fprintf(stderr, "   -mu_bin_legendre_file <filename>: Mu bin Legendre factors file\n");
+#elif defined THREE_PCF
+        fprintf(stderr, "   -phi_file <filename>: Survey correction function coefficient file\n");
+        fprintf(stderr, "\n");
 #elif defined LEGENDRE
         fprintf(stderr, "   -phi_file <filename>: Survey correction function coefficient file\n");
         fprintf(stderr, "\n");
@@ -606,6 +728,7 @@ private:
 #ifdef JACKKNIFE
         fprintf(stderr, "   -jackknife12 <filename>: (Optional) File containing the {1,2} jackknife weights (normally computed from Corrfunc)\n");
         fprintf(stderr, "   -jackknife2 <filename>: (Optional) File containing the {2,2} jackknife weights (normally computed from Corrfunc)\n");
+        fprintf(stderr, "   -jk_assign <scheme> <resolution>: (Optional) Assign the jackknife regions from the particle positions rather than the fifth column of the input files, with scheme healpix (resolution = NSIDE), angular (resolution = number of equal-area declination bands) or cartesian (resolution = tile size)\n");
 #endif
         fprintf(stderr, "   -maxloops <max_loops>: Maximum number of integral loops\n");
         fprintf(stderr, "   -loopspersample <loops_per_sample>: Number of loops to collapse into each subsample. Default 1.\n");
@@ -635,6 +758,13 @@ private:
 	    fprintf(stderr, "   -balance: Rescale the negative weights so that the total weight is zero.\n");
         fprintf(stderr, "   -np <np>: Ignore any file and use np random perioidic points instead.\n");
         fprintf(stderr, "   -rs <rstart>:  If inverting particle weights, this sets the index from which to start weight inversion. Default 0\n");
+#if (!defined LEGENDRE && !defined POWER && !defined THREE_PCF)
+        fprintf(stderr, "   -npy: Save the output integrals as binary NumPy .npy files instead of text files.\n");
+        fprintf(stderr, "   -container: Append the subsample integrals to a single binary file per output array instead of one file per subsample.\n");
+        fprintf(stderr, "   -xi_basis <filename>: (Optional) File containing the radial bins of a top-hat basis for the correlation function. The integrals are then also saved decomposed over the basis, for use with contract_basis.\n");
+        fprintf(stderr, "   -xi_basis_mbin <xi_basis_mbin>: (Optional) The number of mu bins of the correlation function basis (spaced linearly between 0 and 1). Default 1.\n");
+        fprintf(stderr, "   -xi_basis_max_memory <GB>: (Optional) The largest memory allowed for all copies of the decomposed integrals, which are one per thread plus five (twice as large with jackknife weights); larger runs are refused. Default 16.\n");
+#endif
 	    fprintf(stderr, "\n");
 	    fprintf(stderr, "\n");
 
@@ -808,5 +938,50 @@ private:
             rmax = radial_bins_high[line_count-1];
             assert(line_count==nbin);
     }
+
+#if (!defined LEGENDRE && !defined POWER && !defined THREE_PCF)
+    void read_xi_basis(char* binfile_name){
+        // Read the radial bins of the correlation function basis, in the same format as the radial binning file
+        char line[100000];
+
+        FILE *fp;
+        fp = fopen(binfile_name,"r");
+        if (fp==NULL){
+            fprintf(stderr,"Correlation function basis binning file %s not found\n",binfile_name);
+            abort();
+        }
+        fprintf(stderr,"\nReading correlation function basis binning file '%s'\n",binfile_name);
+
+        // Count lines to construct the correct size
+        while (fgets(line,100000,fp)!=NULL){
+            if (line[0]=='#') continue; // comment line
+            if (line[0]=='\n') continue;
+            xi_basis_nbin++;
+        }
+        rewind(fp); // restart file
+
+        int ec=0;
+        ec+=posix_memalign((void **) &xi_basis_low, PAGE, sizeof(Float)*xi_basis_nbin);
+        ec+=posix_memalign((void **) &xi_basis_high, PAGE, sizeof(Float)*xi_basis_nbin);
+        assert(ec==0);
+
+        int line_count=0; // line counter
+        while (fgets(line,100000,fp)!=NULL) {
+            if (line[0]=='#') continue;
+            if (line[0]=='\n') continue;
+            if (sscanf(line, "%lf %lf", &xi_basis_low[line_count], &xi_basis_high[line_count])!=2){
+                fprintf(stderr,"Incorrect file format in line %d of %s\n", line_count+1, binfile_name);
+                abort();
+            }
+            if ((xi_basis_low[line_count]>=xi_basis_high[line_count])||((line_count>0)&&(xi_basis_low[line_count]<xi_basis_high[line_count-1]))){
+                fprintf(stderr,"The correlation function basis bins in %s must be increasing and non-overlapping\n", binfile_name);
+                abort();
+            }
+            line_count++;
+        }
+        fclose(fp);
+        assert(line_count==xi_basis_nbin);
+    }
+#endif
 };
 #endif
@@ -0,0 +1,123 @@
+// perf_counters.h - optional hardware performance counters of the integral loops, enabled by compiling with -DPERF_COUNTERS (Linux only).
+// Each thread opens its own perf_event_open counters around its share of the sampling loops, and the counts are summed over threads
+// and reported per accepted quad in the run summary. Events that the kernel or processor cannot count (e.g. in most virtual machines, or
+// with a restrictive /proc/sys/kernel/perf_event_paranoid) are reported as unavailable rather than stopping the computation.
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+enum PerfEvent {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, N_PERF_EVENTS};
+static const char *perf_event_names[N_PERF_EVENTS] = {"cycles", "instructions", "L1D read misses", "LLC misses", "branch misses"};
+
+class PerfCounters{
+    // Counts of the hardware events of one thread, or summed over threads
+public:
+    double counts[N_PERF_EVENTS]; // counts, scaled up for the time the kernel multiplexed the counter out
+    int threads; // number of threads summed
+    int counted[N_PERF_EVENTS]; // number of these threads on which the event could be counted
+    int fd[N_PERF_EVENTS];
+
+    PerfCounters(){
+        threads = 0;
+        for (int e = 0; e < N_PERF_EVENTS; e++){
+            counts[e] = 0.;
+            counted[e] = 0;
+            fd[e] = -1;
+        }
+    }
+
+    ~PerfCounters(){
+        close_all();
+    }
+
+    void start(){
+        // Open and start the counters of the calling thread (user space only, so that this works with perf_event_paranoid up to 2)
+#ifdef __linux__
+        for (int e = 0; e < N_PERF_EVENTS; e++){
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            switch (e){
+                case PERF_CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+                case PERF_INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+                case PERF_L1D_MISSES:
+                    attr.type = PERF_TYPE_HW_CACHE;
+                    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+                    break;
+                case PERF_LLC_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+                case PERF_BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+            }
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fd[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0); // this thread, any CPU, no group
+            if (fd[e]>=0){
+                ioctl(fd[e], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd[e], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop(){
+        // Stop and read the counters of the calling thread
+        threads++;
+#ifdef __linux__
+        for (int e = 0; e < N_PERF_EVENTS; e++){
+            if (fd[e]<0) continue;
+            ioctl(fd[e], PERF_EVENT_IOC_DISABLE, 0);
+            uint64 values[3]; // value, time enabled, time running
+            if (read(fd[e], values, sizeof(values))==sizeof(values) && values[2]>0){
+                counts[e] += values[0]*((double)values[1]/values[2]);
+                counted[e]++;
+            }
+        }
+#endif
+        close_all();
+    }
+
+    void sum(PerfCounters *other){
+        threads += other->threads;
+        for (int e = 0; e < N_PERF_EVENTS; e++){
+            counts[e] += other->counts[e];
+            counted[e] += other->counted[e];
+        }
+    }
+
+    void report(uint64 accepted_quads){
+        // Print the totals, the counts per accepted quad and the instructions per cycle; events missing on any thread are not reported
+        printf("\nHardware counters of the sampling loops (summed over %d threads):\n", threads);
+        bool any = false;
+        for (int e = 0; e < N_PERF_EVENTS; e++){
+            if (counted[e]<threads || threads==0){
+                printf("  %-16s not available\n", perf_event_names[e]);
+                continue;
+            }
+            any = true;
+            printf("  %-16s %12.4e (%.2f per accepted quad)\n", perf_event_names[e], counts[e], counts[e]/accepted_quads);
+        }
+        if (counted[PERF_CYCLES]==threads && counted[PERF_INSTRUCTIONS]==threads && threads>0) printf("Instructions per cycle: %.3f\n", counts[PERF_INSTRUCTIONS]/counts[PERF_CYCLES]);
+        if (!any) printf("No hardware counters could be opened; check /proc/sys/kernel/perf_event_paranoid, or that the (virtual) machine exposes the performance monitoring unit\n");
+    }
+
+private:
+    void close_all(){
+#ifdef __linux__
+        for (int e = 0; e < N_PERF_EVENTS; e++){
+            if (fd[e]>=0) close(fd[e]);
+            fd[e] = -1;
+        }
+#endif
+    }
+};
+
+#endif
@@ -1,6 +1,8 @@
 // random draws class for grid_covariance.cpp (originally from Alex Wiegand, rewritten by Oliver Philcox)
 #include "correlation_function.h"
 #include "parameters.h"
+#include "numa_utilities.h"
+#include "huge_pages.h"
 #include <gsl/gsl_sf_dawson.h>
 
 #ifndef RANDOM_DRAWS_H
@@ -16,45 +18,47 @@ public:
 	int nside;     // Number of cells in each direction of large draw
 	int nsidecube; // Number of cells in each direction of maxsep cube
 	double boxside;
-    double *x; // Probability grid for 1/r^2 kernel
-	double *xcube; // Probability grid for xi(r) kernel
+    double *x = NULL; // Probability grid for 1/r^2 kernel
+	double *xcube = NULL; // Probability grid for xi(r) kernel
 
 	private:
 		// Sampling of long distance
-		ransampl_ws* ws;
+		ransampl_ws* ws = NULL;
 
 		// Sampling of short distance
-		ransampl_ws* cube;
+		ransampl_ws* cube = NULL;
 
     public:
-        void copy(RandomDraws *rd){
-            // Copy a random draws object and allocate the sampler.
-            // NB: We don't redefine corr here as it is unused post-initialization
-
-            nside=rd->nside;
-            nsidecube=rd->nsidecube;
-            boxside=rd->boxside;
-
-            // Allocate memory:
-            int x_size=pow(nside,3);
-            int xcube_size = pow(nsidecube,3);
-            x = (double *)malloc(sizeof(double)*x_size);
-			xcube = (double *)malloc(sizeof(double)*xcube_size);
-
-            // Read in x, xcube arrays:
-            for(int i=0;i<x_size;i++) x[i]=rd->x[i];
-            for(int i=0;i<xcube_size;i++) xcube[i]=rd->xcube[i];
-
-            // Set up actual samplers
-            ws = ransampl_alloc(x_size);
-            ransampl_set(ws, x);
-
-            // Set up actual sampler
-            cube = ransampl_alloc(xcube_size);
-            ransampl_set(cube, xcube);
+        RandomDraws& operator=(RandomDraws&& rd){
+            // Move assignment: release the samplers of this object and take over those of rd without copying or rebuilding them
+            if (this==&rd) return *this;
+            release();
+            nside=rd.nside;
+            nsidecube=rd.nsidecube;
+            boxside=rd.boxside;
+            x=rd.x;
+            xcube=rd.xcube;
+            ws=rd.ws;
+            cube=rd.cube;
+            rd.x=rd.xcube=NULL;
+            rd.ws=rd.cube=NULL;
+            return *this;
         }
 
+        RandomDraws(RandomDraws&& rd){
+            // Move constructor
+            *this = std::move(rd);
+        }
 
+    private:
+        void release(){
+            if (ws) ransampl_free(ws);
+            if (cube) ransampl_free(cube);
+            free(x);
+            free(xcube);
+            ws=cube=NULL;
+            x=xcube=NULL;
+        }
 
     public:
 	    RandomDraws(){
@@ -111,6 +115,8 @@ public:
 
 		// Set up actual sampler
 		ws = ransampl_alloc( n );
+		advise_huge_pages(ws->prob, sizeof(double)*n);
+		advise_huge_pages(ws->alias, sizeof(int)*n);
 		ransampl_set( ws, x );
 
 		// Normalize grid probabilities to one
@@ -138,6 +144,8 @@ public:
 
         // Set up actual sampler
 		cube = ransampl_alloc( nn );
+		advise_huge_pages(cube->prob, sizeof(double)*nn);
+		advise_huge_pages(cube->alias, sizeof(int)*nn);
 		ransampl_set( cube, xcube );
 
 		// Normalize grid probabilities to one
@@ -153,12 +161,32 @@ public:
 
 
 ~RandomDraws() {
-		ransampl_free( ws );
-		ransampl_free( cube );
-		free(x);
-		free(xcube);
+		release();
 	}
 
+        void huge_page_report(){
+            // Report how much of the large sampler tables is backed by huge pages
+            if (ws){
+                report_huge_pages("Random draw probabilities", x, sizeof(double)*ws->n);
+                report_huge_pages("Random draw sampler", ws->prob, sizeof(double)*ws->n);
+                report_huge_pages("Random draw aliases", ws->alias, sizeof(int)*ws->n);
+            }
+        }
+
+        void interleave(){
+            // Spread the sampler tables, which all threads read, over the NUMA nodes
+            if (ws){
+                interleave_memory(ws->prob, sizeof(double)*ws->n);
+                interleave_memory(ws->alias, sizeof(int)*ws->n);
+                interleave_memory(x, sizeof(double)*ws->n);
+            }
+            if (cube){
+                interleave_memory(cube->prob, sizeof(double)*cube->n);
+                interleave_memory(cube->alias, sizeof(int)*cube->n);
+                interleave_memory(xcube, sizeof(double)*cube->n);
+            }
+        }
+
 		integer3 random_xidraw(gsl_rng* rng, double* p){
 			// Draws the index of a box at some distance which is weighted by the correlation function
 			int n=ransampl_draw( ws, gsl_rng_uniform(rng), gsl_rng_uniform(rng) );
@@ -213,7 +241,8 @@ public:
 
 
 			//Read content of lines and columns
-			*x = (double *)malloc(sizeof(double)*n);
+			int ec=huge_page_alloc((void **) x, sizeof(double)*n);
+			assert(ec==0);
 			printf("# Found %d lines in %s\n", n, filename);
 
 
@@ -239,7 +268,8 @@ public:
             (*np)=(int)pow(nside,3);
 
             // Array to house probabilities
-			*x = (double *)malloc(sizeof(double)*(*np));
+			int ec=huge_page_alloc((void **) x, sizeof(double)*(*np));
+			assert(ec==0);
 
 			printf("\nNumber of Boxes in Probability Grid: %ld\n",(*np));
 			fflush(NULL);
@@ -298,7 +328,8 @@ public:
             (*np)=(int)pow(nside,3);
 
             // Array to house probabilities
-			*x = (double *)malloc(sizeof(double)*(*np));
+			int ec=huge_page_alloc((void **) x, sizeof(double)*(*np));
+			assert(ec==0);
 
 			printf("\nNumber of Boxes in Probability Grid: %ld\n",(*np));
 			fflush(NULL);
@@ -331,7 +362,8 @@ public:
 
         void copyData(double **x, long *n,const double *xin){
 			// Copy probability grid
-			(*x) = (double *)malloc(sizeof(double)*(*n));
+			int ec=huge_page_alloc((void **) x, sizeof(double)*(*n));
+			assert(ec==0);
 			for(int i=0;i<(*n);i++){
 				(*x)[i]=xin[i];
 			}
@@ -357,7 +389,8 @@ public:
 				return;
 			}
 			stat+=fread(n, sizeof(long), 1, fp);
-			*x = (double *)malloc(sizeof(double)*(*n));
+			int ec=huge_page_alloc((void **) x, sizeof(double)*(*n));
+			assert(ec==0);
 			if(*x==NULL){
 				fprintf(stderr,"Allocation error.\n");
 				fflush(NULL);
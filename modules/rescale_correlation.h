@@ -48,6 +48,7 @@ public:
     }
 
     ~correlation_integral(){
+        delete old_cf;
         free(cf_estimate);
         free(rr_estimate);
     }
@@ -132,8 +133,6 @@ private:
     Integrals *integral;
     compute_integral *compute;
     Float *r_centers, *mu_centers, *new_xi_array;
-public:
-    CorrelationFunction *new_cf;
 
 public:
     rescale_correlation(){};
@@ -178,11 +177,10 @@ public:
                     // Rescale correlation function
                     CorrelationFunction output = rescale_xi(par, &all_grid[grid1_index[index]], &all_grid[grid2_index[index]], &all_cf[index], &true_cf, &all_rd[index],n_refine);
                     // Update correlation function
-                    all_cf[index].copy_function(&output);
+                    all_cf[index] = std::move(output);
                 }
                 // Only update random draws on the final iteration for speed
-                RandomDraws tmp_rd(&all_cf[index],par,NULL,0);
-                all_rd[index].copy(&tmp_rd);
+                all_rd[index] = RandomDraws(&all_cf[index],par,NULL,0);
         }
     }
 
@@ -288,8 +286,7 @@ public:
         }
 
         // Now write to cf function
-        new_cf = new CorrelationFunction(new_xi_array, r_centers, mu_centers, nbin, mbin);
-        return new_cf;
+        return CorrelationFunction(new_xi_array, r_centers, mu_centers, nbin, mbin);
     }
 
 };
@@ -0,0 +1,224 @@
+// stage_profile.h - optional instrumentation of the integral loops, enabled by compiling with -DPROFILE.
+// Each thread accumulates cycle counts and event counts of the hot-path stages of a loop into its own counters (no atomics or locks),
+// which are then stored per loop and written to JSON and CSV reports next to the output matrices.
+// Without -DPROFILE the PROFILE_* macros expand to nothing, so the production code is unchanged.
+
+#ifndef STAGE_PROFILE_H
+#define STAGE_PROFILE_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <time.h>
+
+enum ProfileStage {STAGE_DRAW, STAGE_REJECT, STAGE_SECOND, STAGE_THIRD, STAGE_FOURTH, STAGE_XI, STAGE_REDUCTION, STAGE_IO, N_STAGES};
+// draw: accepted cell and particle draws; reject: draws of missing or empty cells; second, third, fourth: the Integrals calls (including their xi evaluations);
+// xi: correlation function evaluations; reduction: summing and normalizing the integrals at the end of each loop (including waiting for the lock and io); io: handing the subsamples to the writer or saving them
+// The times of the draw, reject and xi stages, whose events take only tens of cycles, are estimated from a random sample of their events; all events are counted
+static const char *stage_names[N_STAGES] = {"draw", "reject", "second", "third", "fourth", "xi", "reduction", "io"};
+
+inline uint64 read_cycles(){
+    // Time-stamp counter where available (a few ns per read), else a nanosecond clock
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec*1000000000ull+ts.tv_nsec;
+#endif
+}
+
+class StageCounters{
+    // Cycles spent in and number of events of each stage, accumulated by one thread
+public:
+    uint64 cycles[N_STAGES], events[N_STAGES];
+    uint64 state; // state of the random choice of the sampled events
+    static const int sampling = 16; // one in sampling events of the very short and frequent stages is timed
+
+    StageCounters(){
+        reset();
+        state = 88172645463325252ull;
+    }
+
+    void reset(){
+        for (int s = 0; s < N_STAGES; s++) cycles[s] = events[s] = 0;
+    }
+
+    inline void add(ProfileStage stage, uint64 n_cycles){
+        cycles[stage] += n_cycles;
+        events[stage]++;
+    }
+
+    inline bool sample(){
+        // Randomly choose one in sampling events (with a xorshift generator, so that no periodic pattern of the loops can bias the choice)
+        state ^= state<<13;
+        state ^= state>>7;
+        state ^= state<<17;
+        return state%sampling==0;
+    }
+
+    void sum(StageCounters *other){
+        for (int s = 0; s < N_STAGES; s++){
+            cycles[s] += other->cycles[s];
+            events[s] += other->events[s];
+        }
+    }
+};
+
+thread_local StageCounters *thread_counters = NULL; // counters of the current thread, NULL outside the integral loops
+
+class ScopedStage{
+    // Adds the cycles until the end of the enclosing scope to a stage of the current thread's counters
+private:
+    ProfileStage stage;
+    uint64 start;
+
+public:
+    ScopedStage(ProfileStage _stage){
+        stage = _stage;
+        start = read_cycles();
+    }
+
+    ~ScopedStage(){
+        if (thread_counters!=NULL) thread_counters->add(stage, read_cycles()-start);
+    }
+};
+
+class SampledStage{
+    // As ScopedStage for very short and frequent stages (xi), but counting every event while timing only a random sample of them, to keep the overhead of reading the counter small
+private:
+    ProfileStage stage;
+    uint64 start;
+
+public:
+    SampledStage(ProfileStage _stage){
+        stage = _stage;
+        start = (thread_counters!=NULL && thread_counters->sample()) ? read_cycles() : 0;
+    }
+
+    ~SampledStage(){
+        if (thread_counters==NULL) return;
+        if (start!=0) thread_counters->cycles[stage] += StageCounters::sampling*(read_cycles()-start);
+        thread_counters->events[stage]++;
+    }
+};
+
+#ifdef PROFILE
+#define PROFILE_START(timer) uint64 timer = read_cycles()
+#define PROFILE_STOP(timer, stage) do { if (thread_counters!=NULL) thread_counters->add(stage, read_cycles()-timer); } while (0)
+#define PROFILE_SCOPE(stage) ScopedStage scoped_stage(stage)
+#define PROFILE_SAMPLED_SCOPE(stage) SampledStage sampled_stage(stage)
+#define PROFILE_SAMPLED_START(timer) uint64 timer = (thread_counters!=NULL && thread_counters->sample()) ? read_cycles() : 0
+#define PROFILE_SAMPLED_STOP(timer, stage) do { if (thread_counters!=NULL){ if (timer!=0) thread_counters->cycles[stage] += StageCounters::sampling*(read_cycles()-timer); thread_counters->events[stage]++; } } while (0)
+#else
+#define PROFILE_START(timer)
+#define PROFILE_STOP(timer, stage)
+#define PROFILE_SCOPE(stage)
+#define PROFILE_SAMPLED_SCOPE(stage)
+#define PROFILE_SAMPLED_START(timer)
+#define PROFILE_SAMPLED_STOP(timer, stage)
+#endif
+
+class StageProfile{
+    // Per-loop stage counters of one integral computation, and the JSON and CSV reports
+public:
+    int n_loops;
+    StageCounters *loops; // counters of each loop
+    int *loop_thread; // thread that ran each loop
+    Float *loop_seconds; // wall-clock time of each loop
+    StageCounters final_counters; // stages outside the loops, i.e. saving the full integrals
+    uint64 start_cycles;
+    struct timeval start_time;
+
+    StageProfile(int _n_loops){
+        n_loops = _n_loops;
+        loops = new StageCounters[n_loops];
+        loop_thread = (int *)malloc(sizeof(int)*n_loops);
+        loop_seconds = (Float *)malloc(sizeof(Float)*n_loops);
+        for (int i = 0; i < n_loops; i++){
+            loop_thread[i] = -1;
+            loop_seconds[i] = 0.;
+        }
+        start_cycles = read_cycles();
+        gettimeofday(&start_time, NULL);
+    }
+
+    ~StageProfile(){
+        delete[] loops;
+        free(loop_thread);
+        free(loop_seconds);
+    }
+
+    void record_loop(int n_loop, int thread, StageCounters *counters, Float seconds){
+        // Store the counters of a finished loop; each loop is run by a single thread so needs no lock
+        loops[n_loop] = *counters;
+        loop_thread[n_loop] = thread;
+        loop_seconds[n_loop] = seconds;
+    }
+
+    void save(const char *out_file, int nbin, int mbin, int I1, int I2, int I3, int I4, int nthread){
+        // Write profile_n{nbin}_m{mbin}_{I1}{I2},{I3}{I4}.json and .csv into the output directory, with times converted to seconds using the
+        // counter rate measured over the whole computation
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        Float elapsed = (now.tv_sec-start_time.tv_sec)+1e-6*(now.tv_usec-start_time.tv_usec);
+        Float rate = (read_cycles()-start_cycles)/elapsed; // cycles per second
+        StageCounters total;
+        for (int i = 0; i < n_loops; i++) total.sum(&loops[i]);
+        total.sum(&final_counters);
+
+        char fname[1000];
+        snprintf(fname, sizeof fname, "%sprofile_n%d_m%d_%d%d,%d%d.json", out_file, nbin, mbin, I1, I2, I3, I4);
+        FILE *fp = fopen(fname, "w");
+        if (fp==NULL){
+            fprintf(stderr,"Profile file %s could not be opened\n", fname);
+            abort();
+        }
+        fprintf(fp, "{\n  \"integral\": \"%d%d,%d%d\",\n  \"threads\": %d,\n  \"loops\": %d,\n", I1, I2, I3, I4, nthread, n_loops);
+        fprintf(fp, "  \"cycles_per_second\": %.6e,\n  \"wall_seconds\": %.6f,\n", rate, elapsed);
+        fprintf(fp, "  \"total\": ");
+        write_json_counters(fp, &total, rate);
+        fprintf(fp, ",\n  \"final\": ");
+        write_json_counters(fp, &final_counters, rate);
+        fprintf(fp, ",\n  \"per_loop\": [\n");
+        for (int i = 0; i < n_loops; i++){
+            fprintf(fp, "    {\"loop\": %d, \"thread\": %d, \"wall_seconds\": %.6f, \"stages\": ", i, loop_thread[i], loop_seconds[i]);
+            write_json_counters(fp, &loops[i], rate);
+            fprintf(fp, "}%s\n", i<n_loops-1 ? "," : "");
+        }
+        fprintf(fp, "  ]\n}\n");
+        fclose(fp);
+
+        snprintf(fname, sizeof fname, "%sprofile_n%d_m%d_%d%d,%d%d.csv", out_file, nbin, mbin, I1, I2, I3, I4);
+        fp = fopen(fname, "w");
+        if (fp==NULL){
+            fprintf(stderr,"Profile file %s could not be opened\n", fname);
+            abort();
+        }
+        fprintf(fp, "loop,thread,wall_seconds");
+        for (int s = 0; s < N_STAGES; s++) fprintf(fp, ",%s_seconds,%s_cycles,%s_events", stage_names[s], stage_names[s], stage_names[s]);
+        fprintf(fp, "\n");
+        for (int i = 0; i < n_loops; i++) write_csv_row(fp, i, loop_thread[i], loop_seconds[i], &loops[i], rate);
+        write_csv_row(fp, -1, -1, 0., &final_counters, rate); // loop -1 holds the stages outside the loops
+        fclose(fp);
+
+        printf("\nStage profile (seconds summed over threads, events):\n");
+        for (int s = 0; s < N_STAGES; s++) printf("  %-10s %12.3f %14.4e\n", stage_names[s], total.cycles[s]/rate, (double)total.events[s]);
+        printf("Saved stage profile to %s (and .json)\n", fname);
+    }
+
+private:
+    void write_json_counters(FILE *fp, StageCounters *c, Float rate){
+        fprintf(fp, "{");
+        for (int s = 0; s < N_STAGES; s++) fprintf(fp, "%s\"%s\": {\"seconds\": %.6e, \"cycles\": %llu, \"events\": %llu}", s>0 ? ", " : "", stage_names[s], c->cycles[s]/rate, c->cycles[s], c->events[s]);
+        fprintf(fp, "}");
+    }
+
+    void write_csv_row(FILE *fp, int loop, int thread, Float seconds, StageCounters *c, Float rate){
+        fprintf(fp, "%d,%d,%.6f", loop, thread, seconds);
+        for (int s = 0; s < N_STAGES; s++) fprintf(fp, ",%.6e,%llu,%llu", c->cycles[s]/rate, c->cycles[s], c->events[s]);
+        fprintf(fp, "\n");
+    }
+};
+
+#endif
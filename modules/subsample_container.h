@@ -0,0 +1,246 @@
+// subsample_container.h - appendable binary container holding all subsample estimates of one output array in a single file
+
+#ifndef SUBSAMPLE_CONTAINER_H
+#define SUBSAMPLE_CONTAINER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// File layout (all integers little-endian int64 unless noted, every block a multiple of 64 bytes so that payloads can be memory-mapped):
+//   header (64 bytes):  "RCSUBSMP", uint32 version, char descr[4] (numpy dtype, e.g. "<f8"), n_rows, n_cols (0 for 1D arrays), record_bytes
+//   records:            record k at offset 64 + k*record_bytes, each a 64-byte record header ("RCRECORD", label, checksum of payload) followed by the raw payload
+//   index footer:       "RCINDEX_", n_records, labels[n_records], footer_offset, "RCFOOTER"
+// A record is flushed to disk before the footer referencing it is written, so after a crash readers can
+// either use the last complete footer or recover all valid records by scanning them and checking their checksums.
+
+#define CONTAINER_BLOCK 64
+
+class SubsampleContainer{
+private:
+    FILE *fp;
+    int64_t n_rows, n_cols, payload_bytes, record_bytes;
+    int64_t n_records;
+    int64_t *labels; // labels of the records written so far (subsample indices)
+    int64_t max_records;
+    char fname[1100];
+
+public:
+    SubsampleContainer(const char* basename, const char* descr, int _n_rows, int _n_cols, int element_size){
+        // Create (or overwrite) the container file basename_subsamples.bin for arrays of shape (_n_rows,) if _n_cols==0 or (_n_rows, _n_cols) otherwise
+        n_rows = _n_rows;
+        n_cols = _n_cols;
+        payload_bytes = (int64_t)element_size*n_rows*(n_cols==0 ? 1 : n_cols);
+        record_bytes = CONTAINER_BLOCK + (payload_bytes+CONTAINER_BLOCK-1)/CONTAINER_BLOCK*CONTAINER_BLOCK; // record header + payload padded to the block size
+        n_records = 0;
+        max_records = 16;
+        labels = (int64_t *)malloc(sizeof(int64_t)*max_records);
+
+        snprintf(fname, sizeof fname, "%s_subsamples.bin", basename);
+        fp = fopen(fname, "w+b");
+        if (fp==NULL){
+            fprintf(stderr,"Subsample container file %s could not be opened\n", fname);
+            abort();
+        }
+        char header[CONTAINER_BLOCK];
+        memset(header, 0, CONTAINER_BLOCK);
+        memcpy(header, "RCSUBSMP", 8);
+        uint32_t version = 1;
+        memcpy(header+8, &version, 4);
+        strncpy(header+12, descr, 4);
+        memcpy(header+16, &n_rows, 8);
+        memcpy(header+24, &n_cols, 8);
+        memcpy(header+32, &record_bytes, 8);
+        fwrite(header, 1, CONTAINER_BLOCK, fp);
+        write_footer();
+    }
+
+    ~SubsampleContainer(){
+        fclose(fp);
+        free(labels);
+    }
+
+    void append(int label, const void* data){
+        // Append one subsample estimate, overwriting the previous footer, then write the new footer once the record is safely on disk
+        char record_header[CONTAINER_BLOCK];
+        memset(record_header, 0, CONTAINER_BLOCK);
+        memcpy(record_header, "RCRECORD", 8);
+        int64_t label64 = label;
+        uint64_t sum = checksum(data, payload_bytes);
+        memcpy(record_header+8, &label64, 8);
+        memcpy(record_header+16, &sum, 8);
+
+        fseek(fp, CONTAINER_BLOCK+n_records*record_bytes, SEEK_SET);
+        fwrite(record_header, 1, CONTAINER_BLOCK, fp);
+        fwrite(data, 1, payload_bytes, fp);
+        for (int64_t i = CONTAINER_BLOCK+payload_bytes; i < record_bytes; i++) fputc(0, fp); // pad to the block size
+        sync();
+
+        if (n_records==max_records){
+            max_records *= 2;
+            labels = (int64_t *)realloc(labels, sizeof(int64_t)*max_records);
+        }
+        labels[n_records++] = label64;
+        write_footer();
+    }
+
+    static bool load(const char* basename, int label, void* data, int64_t n_bytes){
+        // Read the (last) record with the given label from the container basename_subsamples.bin into data, which must hold n_bytes
+        // Returns false if there is no such container or record; the index footer is used if complete, else the records are scanned
+        char fname[1100];
+        snprintf(fname, sizeof fname, "%s_subsamples.bin", basename);
+        FILE* fp = fopen(fname, "rb");
+        if (fp==NULL) return false;
+        char header[CONTAINER_BLOCK];
+        int64_t n_rows, n_cols, record_bytes;
+        if (fread(header, 1, CONTAINER_BLOCK, fp)!=CONTAINER_BLOCK || memcmp(header, "RCSUBSMP", 8)!=0){
+            fprintf(stderr,"File %s is not a subsample container\n", fname);
+            abort();
+        }
+        memcpy(&n_rows, header+16, 8);
+        memcpy(&n_cols, header+24, 8);
+        memcpy(&record_bytes, header+32, 8);
+        int64_t payload_bytes = (header[14]-'0')*n_rows*(n_cols==0 ? 1 : n_cols); // descr is e.g. "<f8"
+        if (payload_bytes!=n_bytes){
+            fprintf(stderr,"Records of subsample container %s hold %lld bytes instead of the expected %lld\n", fname, (long long)payload_bytes, (long long)n_bytes);
+            abort();
+        }
+        fseek(fp, 0, SEEK_END);
+        int64_t file_size = ftell(fp);
+
+        // Find the record from the index footer if complete
+        int64_t record = -1;
+        bool footer = find_record(fp, file_size, record_bytes, label, record);
+        bool found = false;
+        if (footer){
+            if (record>=0){
+                fseek(fp, CONTAINER_BLOCK+record*record_bytes+CONTAINER_BLOCK, SEEK_SET);
+                found = fread(data, 1, n_bytes, fp)==(size_t)n_bytes;
+            }
+        }
+        else{
+            // Scan the records up to the first incomplete one, keeping the last valid match
+            fprintf(stderr,"WARNING: index of %s is incomplete, recovering records by scanning the file\n", fname);
+            char record_header[CONTAINER_BLOCK];
+            char *payload = (char *)malloc(n_bytes);
+            for (int64_t offset = CONTAINER_BLOCK; offset+record_bytes<=file_size; offset += record_bytes){
+                fseek(fp, offset, SEEK_SET);
+                int64_t this_label;
+                uint64_t sum;
+                if (fread(record_header, 1, CONTAINER_BLOCK, fp)!=CONTAINER_BLOCK || memcmp(record_header, "RCRECORD", 8)!=0) break;
+                memcpy(&this_label, record_header+8, 8);
+                memcpy(&sum, record_header+16, 8);
+                if (fread(payload, 1, n_bytes, fp)!=(size_t)n_bytes || checksum(payload, n_bytes)!=sum) break;
+                if (this_label==label){
+                    memcpy(data, payload, n_bytes);
+                    found = true;
+                }
+            }
+            free(payload);
+        }
+        fclose(fp);
+        return found;
+    }
+
+    static bool shape(const char* basename, int64_t &n_rows, int64_t &n_cols){
+        // Read the shape of the records of the container basename_subsamples.bin (n_cols = 0 for 1D arrays); returns false if there is no such container
+        char fname[1100];
+        snprintf(fname, sizeof fname, "%s_subsamples.bin", basename);
+        FILE* fp = fopen(fname, "rb");
+        if (fp==NULL) return false;
+        char header[CONTAINER_BLOCK];
+        if (fread(header, 1, CONTAINER_BLOCK, fp)!=CONTAINER_BLOCK || memcmp(header, "RCSUBSMP", 8)!=0){
+            fprintf(stderr,"File %s is not a subsample container\n", fname);
+            abort();
+        }
+        memcpy(&n_rows, header+16, 8);
+        memcpy(&n_cols, header+24, 8);
+        fclose(fp);
+        return true;
+    }
+
+    static bool contains(const char* basename, int label){
+        // Whether the container basename_subsamples.bin holds a record with the given label, reading only the header and the index footer
+        // (the records are only scanned, by load, if the footer is incomplete)
+        char fname[1100];
+        snprintf(fname, sizeof fname, "%s_subsamples.bin", basename);
+        FILE* fp = fopen(fname, "rb");
+        if (fp==NULL) return false;
+        char header[CONTAINER_BLOCK];
+        if (fread(header, 1, CONTAINER_BLOCK, fp)!=CONTAINER_BLOCK || memcmp(header, "RCSUBSMP", 8)!=0){
+            fprintf(stderr,"File %s is not a subsample container\n", fname);
+            abort();
+        }
+        int64_t n_rows, n_cols, record_bytes;
+        memcpy(&n_rows, header+16, 8);
+        memcpy(&n_cols, header+24, 8);
+        memcpy(&record_bytes, header+32, 8);
+        fseek(fp, 0, SEEK_END);
+        int64_t file_size = ftell(fp);
+        int64_t record = -1;
+        bool footer = find_record(fp, file_size, record_bytes, label, record);
+        fclose(fp);
+        if (footer) return record>=0;
+        int64_t n_bytes = (header[14]-'0')*n_rows*(n_cols==0 ? 1 : n_cols);
+        char *data = (char *)malloc(n_bytes);
+        bool found = load(basename, label, data, n_bytes);
+        free(data);
+        return found;
+    }
+
+    static uint64_t checksum(const void* data, int64_t n_bytes){
+        // 64-bit FNV-1a hash of the payload, used by readers to detect records truncated by a crash
+        const unsigned char* bytes = (const unsigned char*)data;
+        uint64_t hash = 14695981039346656037ULL;
+        for (int64_t i = 0; i < n_bytes; i++){
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+private:
+    static bool find_record(FILE* fp, int64_t file_size, int64_t record_bytes, int label, int64_t &record){
+        // Look up the (last) record with the given label in the index footer, setting record to its number or -1 if absent
+        // Returns false if the footer is incomplete (e.g. after a crash), in which case the records must be scanned
+        int64_t footer_offset = 0, n = 0;
+        char tag[8];
+        record = -1;
+        if (file_size<CONTAINER_BLOCK+32) return false;
+        fseek(fp, file_size-16, SEEK_SET);
+        if (fread(&footer_offset, 8, 1, fp)!=1 || fread(tag, 1, 8, fp)!=8 || memcmp(tag, "RCFOOTER", 8)!=0 || footer_offset<CONTAINER_BLOCK || footer_offset>=file_size || (footer_offset-CONTAINER_BLOCK)%record_bytes!=0) return false;
+        fseek(fp, footer_offset, SEEK_SET);
+        if (fread(tag, 1, 8, fp)!=8 || memcmp(tag, "RCINDEX_", 8)!=0 || fread(&n, 8, 1, fp)!=1 || footer_offset!=CONTAINER_BLOCK+n*record_bytes) return false;
+        for (int64_t i = 0; i < n; i++){
+            int64_t this_label;
+            if (fread(&this_label, 8, 1, fp)!=1){
+                record = -1;
+                return false;
+            }
+            if (this_label==label) record = i;
+        }
+        return true;
+    }
+
+    void write_footer(){
+        int64_t footer_offset = CONTAINER_BLOCK+n_records*record_bytes;
+        fseek(fp, footer_offset, SEEK_SET);
+        fwrite("RCINDEX_", 1, 8, fp);
+        fwrite(&n_records, 8, 1, fp);
+        fwrite(labels, 8, n_records, fp);
+        fwrite(&footer_offset, 8, 1, fp);
+        fwrite("RCFOOTER", 1, 8, fp);
+        sync();
+    }
+
+    void sync(){
+        // Flush to the operating system and then to disk
+        if (fflush(fp)!=0 || fsync(fileno(fp))!=0){
+            fprintf(stderr,"Failed to write to subsample container file %s\n", fname);
+            abort();
+        }
+    }
+};
+
+#endif
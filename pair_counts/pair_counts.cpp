@@ -0,0 +1,335 @@
+// pair_counts.cpp -- native pair counts for RascalC, using the Grid of grid_covariance.cpp.
+// In jackknife mode this computes the same RR_a, RR_aA and w_aA files as python/jackknife_weights.py (for the -RRbin and -jackknife options of grid_covariance),
+// but counts all pairs once, in a single multi-threaded pass, rather than once per jackknife region.
+// In xi and xi_jack modes this computes the Landy-Szalay correlation functions of python/xi_estimator_aperiodic.py and python/xi_estimator_jack(_cross).py (for the -cor options).
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include "../threevector.hh"
+
+// For multi-threading:
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+#define PAGE 4096     // To force some memory alignment.
+
+typedef unsigned long long int uint64;
+
+// Could swap between single and double precision here.
+typedef double Float;
+typedef double3 Float3;
+
+#include "../STimer.cc"
+#include "../modules/cell_utilities.h"
+#include "../modules/grid.h"
+#include "../modules/pair_counter.h"
+#include "../modules/jackknife_assignment.h"
+
+STimer TotalTime;
+
+int read_binning(const char* binfile, Float* &r_low, Float* &r_high){
+    // Read the radial bin edges from the two-column binning file, returning the number of bins
+    FILE *fp = fopen(binfile, "r");
+    if (fp==NULL){
+        fprintf(stderr,"Radial binning file %s not found\n", binfile);
+        abort();
+    }
+    char line[10000];
+    int nbin = 0, max_bins = 64;
+    r_low = (Float *)malloc(sizeof(Float)*max_bins);
+    r_high = (Float *)malloc(sizeof(Float)*max_bins);
+    while (fgets(line,10000,fp)!=NULL){
+        if (line[0]=='#') continue; // comment line
+        if (line[0]=='\n') continue;
+        if (nbin==max_bins){
+            max_bins *= 2;
+            r_low = (Float *)realloc(r_low, sizeof(Float)*max_bins);
+            r_high = (Float *)realloc(r_high, sizeof(Float)*max_bins);
+        }
+        if (sscanf(line, "%lf %lf", r_low+nbin, r_high+nbin)!=2){
+            fprintf(stderr,"Radial bin %d has bad format in %s\n", nbin, binfile);
+            abort();
+        }
+        nbin++;
+    }
+    fclose(fp);
+    printf("%d radial bins are used in this file.\n", nbin);
+    return nbin;
+}
+
+void usage(){
+    fprintf(stderr,"\nUsage:\n");
+    fprintf(stderr,"    ./pair_counts jackknife {RANDOM_PARTICLE_FILE} {BIN_FILE} {MU_MAX} {N_MU_BINS} {NTHREADS} {PERIODIC} {OUTPUT_DIR}\n");
+    fprintf(stderr,"    ./pair_counts xi {GALAXY_FILE} {RANDOM_FILE_DR} {RANDOM_FILE_RR} {BIN_FILE} {MU_MAX} {N_MU_BINS} {NTHREADS} {PERIODIC} {OUTPUT_DIR} [{GALAXY_FILE_2} {RANDOM_FILE_2_DR} {RANDOM_FILE_2_RR}]\n");
+    fprintf(stderr,"    ./pair_counts xi_jack {GALAXY_FILE} {RANDOM_FILE_DR} {RANDOM_FILE_RR} {BIN_FILE} {MU_MAX} {N_MU_BINS} {NTHREADS} {PERIODIC} {OUTPUT_DIR} [{GALAXY_FILE_2} {RANDOM_FILE_2_DR} {RANDOM_FILE_2_RR}]\n");
+    fprintf(stderr,"The particle files have space-separated x,y,z,weight,jackknife_ID columns (jackknife_ID is not needed in xi mode). If PERIODIC is 1, mu is measured from the z-axis, else from the line of sight.\n");
+    fprintf(stderr,"In jackknife and xi_jack modes, the options -jk_assign {SCHEME} {RESOLUTION} may be appended to assign the jackknife regions from the particle positions (as with the -jk_assign option of the main code) instead of reading them.\n\n");
+    exit(1);
+}
+
+JackknifeAssignment* parse_jk_assign(int &argc, char *argv[]){
+    // Read (and remove) the optional trailing -jk_assign {SCHEME} {RESOLUTION} arguments
+    if (argc>4&&!strcmp(argv[argc-3],"-jk_assign")){
+        argc -= 3;
+        return new JackknifeAssignment(argv[argc+1], atof(argv[argc+2]));
+    }
+    return new JackknifeAssignment("file", 0);
+}
+
+Particle* read_particles(const char* fname, int &np, bool jackknife, JackknifeAssignment *assign){
+    // Read the particles, assigning their jackknife regions if required
+    bool assigned = jackknife&&assign->scheme!=JackknifeAssignment::FILE_COLUMN;
+    Particle *p = read_jackknife_particles(fname, np, jackknife&&!assigned);
+    if (assigned) assign->assign(p, np);
+    return p;
+}
+
+void set_threads(int nthread){
+#ifdef OPENMP
+    omp_set_num_threads(nthread);
+    printf("# Running on %d threads\n", omp_get_max_threads());
+#endif
+}
+
+int jackknife_weights(int argc, char *argv[]){
+    // Compute the jackknife weights and RR pair counts of a single random field
+    JackknifeAssignment *assign = parse_jk_assign(argc, argv);
+    if (argc!=9) usage();
+    const char *fname = argv[2], *binfile = argv[3], *outdir = argv[8];
+    Float mumax = atof(argv[4]);
+    int mbin = atoi(argv[5]);
+    bool periodic = atoi(argv[7]);
+    assert(mumax>0 && mumax<=1);
+    assert(mbin>0);
+
+    TotalTime.Start();
+    set_threads(atoi(argv[6]));
+
+    Float *r_low, *r_high;
+    int nbin = read_binning(binfile, r_low, r_high);
+    int nbins = nbin*mbin;
+
+    printf("Reading in data\n");
+    int np;
+    Particle *orig_p = read_particles(fname, np, true, assign);
+    int *regions;
+    int n_jack = jackknife_regions(&orig_p, &np, 1, regions);
+    printf("Number of random particles %.1e in %d non-empty jackknife regions\n", (double)np, n_jack);
+    printf(periodic ? "Using periodic input data\n" : "Using non-periodic input data\n");
+
+    // Sort the particles into the grid
+    Float3 rect_boxsize, shift;
+    Float cellsize;
+    int nside;
+    pair_count_box(&orig_p, &np, 1, r_high[nbin-1], rect_boxsize, cellsize, shift, nside);
+    Grid grid(orig_p, np, rect_boxsize, cellsize, nside, shift, 1.);
+    free(orig_p);
+    Float weight_sum = grid.sum_weights;
+
+    printf("Computing pair counts\n");
+    PairCounter RR(nbin, r_low, r_high, mbin, mumax, n_jack, periodic);
+    RR.count(&grid, &grid);
+    TotalTime.Stop();
+    printf("Pair counts computed after %.1f s\n", TotalTime.Elapsed());
+
+    // Now compute weights from pair counts and save the output files, in the format of python/jackknife_weights.py
+    mkdir(outdir, 0777);
+    char fname_out[1100];
+    snprintf(fname_out, sizeof fname_out, "%s/jackknife_weights_n%d_m%d_j%d_11.dat", outdir, nbin, mbin, n_jack);
+    printf("Saving jackknife weight as %s\n", fname_out);
+    FILE *fp = fopen(fname_out, "w");
+    for (int x = 0; x < n_jack; x++){
+        fprintf(fp, "%d\t", regions[x]);
+        for (int i = 0; i < nbins; i++) fprintf(fp, "%.8e%c", RR.jack_counts[x*nbins+i]/RR.counts[i], i==nbins-1 ? '\n' : '\t'); // jackknife weighting for bin and region
+    }
+    fclose(fp);
+
+    snprintf(fname_out, sizeof fname_out, "%s/binned_pair_counts_n%d_m%d_j%d_11.dat", outdir, nbin, mbin, n_jack);
+    printf("Saving binned pair counts as %s\n", fname_out);
+    fp = fopen(fname_out, "w");
+    for (int i = 0; i < nbins; i++) fprintf(fp, "%.8e\n", RR.counts[i]);
+    fclose(fp);
+
+    snprintf(fname_out, sizeof fname_out, "%s/jackknife_pair_counts_n%d_m%d_j%d_11.dat", outdir, nbin, mbin, n_jack);
+    printf("Saving normalized jackknife pair counts as %s\n", fname_out);
+    fp = fopen(fname_out, "w");
+    for (int x = 0; x < n_jack; x++){
+        fprintf(fp, "%d\t", regions[x]);
+        for (int i = 0; i < nbins; i++) fprintf(fp, "%.8e%c", RR.jack_counts[x*nbins+i]/(weight_sum*weight_sum), i==nbins-1 ? '\n' : '\t');
+    }
+    fclose(fp);
+    printf("Jackknife weights and pair counts written successfully to the %s directory\n", outdir);
+
+    delete assign;
+    free(regions);
+    free(r_low);
+    free(r_high);
+    return 0;
+}
+
+void landy_szalay(int n_rows, int nbins, Float *DD, Float nDD, Float *D1R2, Float nD1R2, Float *D2R1, Float nD2R1, Float *RR, Float nRR, Float *xi){
+    // Landy-Szalay estimate xi = (DD - D1R2 - D2R1)/RR + 1 from n_rows sets of pair counts, each normalized by the product of summed weights
+    for (int i = 0; i < n_rows*nbins; i++){
+        Float rr = RR[i]/nRR;
+        xi[i] = (DD[i]/nDD - D1R2[i]/nD1R2 - D2R1[i]/nD2R1)/rr + 1.;
+    }
+}
+
+void write_xi(const char* fname_out, Float *r_low, Float *r_high, int nbin, int mbin, Float mumax, int n_rows, int n_cols, Float *xi){
+    // Save a correlation function in the format read by CorrelationFunction, i.e. the radial and mu bin centers followed by rows of xi values
+    FILE *fp = fopen(fname_out, "w");
+    if (fp==NULL){
+        fprintf(stderr,"Unable to open %s for writing\n", fname_out);
+        abort();
+    }
+    for (int i = 0; i < nbin; i++) fprintf(fp, "%.8e ", 0.5*(r_low[i]+r_high[i]));
+    fprintf(fp, "\n");
+    for (int j = 0; j < mbin; j++) fprintf(fp, "%.8e ", (j+0.5)*mumax/mbin);
+    fprintf(fp, "\n");
+    for (int x = 0; x < n_rows; x++){
+        for (int i = 0; i < n_cols; i++) fprintf(fp, "%.8e ", xi[x*n_cols+i]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+}
+
+int correlation_functions(int argc, char *argv[], bool jackknife){
+    // Compute the Landy-Szalay correlation functions of one or two fields, and their jackknife estimates if required
+    JackknifeAssignment *assign = parse_jk_assign(argc, argv);
+    if (argc!=11&&argc!=14) usage();
+    bool multifield = (argc==14);
+    const char *binfile = argv[5], *outdir = argv[10];
+    Float mumax = atof(argv[6]);
+    int mbin = atoi(argv[7]);
+    bool periodic = atoi(argv[9]);
+    assert(mumax>0 && mumax<=1);
+    assert(mbin>0);
+
+    TotalTime.Start();
+    set_threads(atoi(argv[8]));
+
+    Float *r_low, *r_high;
+    int nbin = read_binning(binfile, r_low, r_high);
+    int nbins = nbin*mbin;
+
+    // Particle sets are galaxies, DR randoms and RR randoms for each field; files given twice are only read once
+    int n_sets = multifield ? 6 : 3;
+    const char *fnames[6] = {argv[2], argv[3], argv[4], NULL, NULL, NULL};
+    if (multifield){
+        fnames[3] = argv[11];
+        fnames[4] = argv[12];
+        fnames[5] = argv[13];
+    }
+    int source[6], n_read = 0, read_index[6];
+    Particle *orig_p[6];
+    int np[6];
+    for (int s = 0; s < n_sets; s++){
+        source[s] = -1;
+        for (int t = 0; t < s; t++)
+            if (strcmp(fnames[s], fnames[t])==0){
+                source[s] = source[t];
+                break;
+            }
+        if (source[s]>=0) continue;
+        printf("Reading in %s\n", fnames[s]);
+        orig_p[n_read] = read_particles(fnames[s], np[n_read], jackknife, assign);
+        read_index[n_read] = s;
+        source[s] = n_read++;
+    }
+    int *regions;
+    int n_jack = jackknife_regions(orig_p, np, n_read, regions);
+    if (jackknife) printf("Using %d non-empty jackknife regions\n", n_jack);
+    printf(periodic ? "Using periodic input data\n" : "Using non-periodic input data\n");
+
+    // Sort all particle sets into grids with the same cells
+    Float3 rect_boxsize, shift;
+    Float cellsize;
+    int nside;
+    pair_count_box(orig_p, np, n_read, r_high[nbin-1], rect_boxsize, cellsize, shift, nside);
+    Grid *grids[6] = {NULL}, *g[6];
+    for (int n = 0; n < n_read; n++){
+        grids[n] = new Grid(orig_p[n], np[n], rect_boxsize, cellsize, nside, shift, 1.);
+        printf("Number of particles in %s: %.1e\n", fnames[read_index[n]], (double)np[n]);
+        free(orig_p[n]);
+    }
+    for (int s = 0; s < n_sets; s++) g[s] = grids[source[s]];
+
+    // Pair counts are DD, DR, RR for each field and D1D2, D1R2, D2R1, R1R2 for the cross-correlation
+    int n_counts = multifield ? 10 : 3;
+    Grid *pairs[10][2] = {{g[0],g[0]}, {g[0],g[1]}, {g[2],g[2]}};
+    if (multifield){
+        Grid *cross_pairs[7][2] = {{g[3],g[3]}, {g[3],g[4]}, {g[5],g[5]}, {g[0],g[3]}, {g[0],g[4]}, {g[3],g[1]}, {g[2],g[5]}};
+        for (int c = 0; c < 7; c++){
+            pairs[c+3][0] = cross_pairs[c][0];
+            pairs[c+3][1] = cross_pairs[c][1];
+        }
+    }
+    const char *count_names[10] = {"DD", "DR", "RR", "DD (field 2)", "DR (field 2)", "RR (field 2)", "D1D2", "D1R2", "D2R1", "R1R2"};
+    PairCounter *counts[10];
+    Float norm[10];
+    for (int c = 0; c < n_counts; c++){
+        printf("Computing %s pair counts\n", count_names[c]);
+        counts[c] = new PairCounter(nbin, r_low, r_high, mbin, mumax, n_jack, periodic);
+        counts[c]->count(pairs[c][0], pairs[c][1]);
+        norm[c] = pairs[c][0]->sum_weights*pairs[c][1]->sum_weights; // normalize by product of sum of weights
+    }
+    TotalTime.Stop();
+    printf("Pair counts computed after %.1f s\n", TotalTime.Elapsed());
+
+    // Now compute and save the correlation functions, in the format of the python scripts
+    mkdir(outdir, 0777);
+    const char *suffices[3] = {"11", "22", "12"};
+    int first_count[3] = {0, 3, 6};
+    int n_rows = jackknife ? n_jack : 1;
+    Float *xi = (Float *)malloc(sizeof(Float)*n_rows*nbins);
+    char fname_out[1100];
+    for (int index = 0; index < (multifield ? 3 : 1); index++){
+        int c = first_count[index];
+        if (index<2){
+            Float *DD = jackknife ? counts[c]->jack_counts : counts[c]->counts;
+            Float *DR = jackknife ? counts[c+1]->jack_counts : counts[c+1]->counts;
+            Float *RR = jackknife ? counts[c+2]->jack_counts : counts[c+2]->counts;
+            landy_szalay(n_rows, nbins, DD, norm[c], DR, norm[c+1], DR, norm[c+1], RR, norm[c+2], xi);
+        }
+        else{
+            Float *counts_ptr[4];
+            for (int k = 0; k < 4; k++) counts_ptr[k] = jackknife ? counts[c+k]->jack_counts : counts[c+k]->counts;
+            landy_szalay(n_rows, nbins, counts_ptr[0], norm[c], counts_ptr[1], norm[c+1], counts_ptr[2], norm[c+2], counts_ptr[3], norm[c+3], xi);
+        }
+        if (!jackknife) snprintf(fname_out, sizeof fname_out, "%s/xi_n%d_m%d_%s.dat", outdir, nbin, mbin, suffices[index]);
+        else if (multifield) snprintf(fname_out, sizeof fname_out, "%s/xi_jack_n%d_m%d_%s.dat", outdir, nbin, mbin, suffices[index]);
+        else snprintf(fname_out, sizeof fname_out, "%s/xi_jack_n%d_m%d_j%d_%s.dat", outdir, nbin, mbin, n_jack, suffices[index]);
+        printf("Saving %s correlation function to %s\n", suffices[index], fname_out);
+        if (jackknife) write_xi(fname_out, r_low, r_high, nbin, mbin, mumax, n_jack, nbins, xi);
+        else write_xi(fname_out, r_low, r_high, nbin, mbin, mumax, nbin, mbin, xi);
+    }
+    printf("All correlation functions computed successfully.\n");
+
+    free(xi);
+    for (int c = 0; c < n_counts; c++) delete counts[c];
+    for (int n = 0; n < n_read; n++) delete grids[n];
+    delete assign;
+    free(regions);
+    free(r_low);
+    free(r_high);
+    return 0;
+}
+
+// ================================ main() =============================
+
+int main(int argc, char *argv[]) {
+    if (argc<2) usage();
+    const char* mode = argv[1];
+    if (!strcmp(mode,"jackknife")) return jackknife_weights(argc, argv);
+    else if (!strcmp(mode,"xi")) return correlation_functions(argc, argv, false);
+    else if (!strcmp(mode,"xi_jack")) return correlation_functions(argc, argv, true);
+    usage();
+    return 1;
+}
@@ -0,0 +1,816 @@
+// post_process.cpp -- native post-processing of the single-field integrals computed by grid_covariance.cpp.
+// This computes the same products as python/post_process_default.py, post_process_legendre.py, post_process_jackknife.py
+// and post_process_legendre_mix_jackknife.py: the full (and jackknife) theory covariance matrices, the bias-corrected precision matrices,
+// the effective number of mocks N_eff and (in jackknife modes) the optimal shot-noise rescaling alpha, saved in the same .npz format.
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+// For multi-threading:
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+#define PAGE 4096     // To force some memory alignment.
+
+typedef unsigned long long int uint64;
+
+// Could swap between single and double precision here.
+typedef double Float;
+
+#include "../STimer.cc"
+#include "../modules/npy_utilities.h"
+#include "../modules/subsample_container.h"
+#include "../modules/matrix_utilities.h"
+
+STimer TotalTime;
+
+// ========================== Input files ==============================
+
+void load_matrix(const char* basename, const char* index, Float* data, long long n_elements){
+    // Load an integral saved by the C++ code, preferring the binary .npy version (-npy option) or subsample container (-container option) over the text file
+    char fname[1100];
+    snprintf(fname, sizeof fname, "%s_%s.npy", basename, index);
+    if (load_npy(fname, data, n_elements)) return;
+    if (strcmp(index, "full")!=0 && SubsampleContainer::load(basename, atoi(index), data, n_elements*sizeof(Float))) return;
+    snprintf(fname, sizeof fname, "%s_%s.txt", basename, index);
+    int n_rows, n_cols;
+    Float *tmp = read_table(fname, 0, n_rows, n_cols);
+    if ((long long)n_rows*n_cols!=n_elements){
+        fprintf(stderr,"File %s holds %d values instead of the expected %lld\n", fname, n_rows*n_cols, n_elements);
+        abort();
+    }
+    memcpy(data, tmp, sizeof(Float)*n_elements);
+    free(tmp);
+}
+
+// ========================== Covariance matrices ==============================
+
+class CovarianceIntegrals{
+    // The full and individual subsample estimates of the (symmetrized) c2, c3 and c4 integrals for one set of covariance matrices
+    // (CovMatricesAll/ or CovMatricesJack/), and the quantities derived from them for a given shot-noise rescaling alpha
+public:
+    int n_bins, n_samples;
+    Float *c2, *c3, *c4; // full estimates
+    Float *c2s, *c3s, *c4s; // subsample estimates, n_samples x n_bins x n_bins
+
+    CovarianceIntegrals(int _n_bins, int _n_samples){
+        n_bins = _n_bins;
+        n_samples = _n_samples;
+        size_t nn = (size_t)n_bins*n_bins;
+        int ec=0;
+        ec+=posix_memalign((void **) &c2, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &c3, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &c4, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &c2s, PAGE, sizeof(Float)*nn*n_samples);
+        ec+=posix_memalign((void **) &c3s, PAGE, sizeof(Float)*nn*n_samples);
+        ec+=posix_memalign((void **) &c4s, PAGE, sizeof(Float)*nn*n_samples);
+        assert(ec==0);
+    }
+
+    ~CovarianceIntegrals(){
+        free(c2);
+        free(c3);
+        free(c4);
+        free(c2s);
+        free(c3s);
+        free(c4s);
+    }
+
+    void covariance(Float alpha, Float* cov, int sample=-1){
+        // Full (sample = -1) or subsample covariance alpha^2 c2 + alpha c3 + c4
+        size_t nn = (size_t)n_bins*n_bins, offset = sample<0 ? 0 : nn*sample;
+        const Float *C2 = (sample<0 ? c2 : c2s)+offset, *C3 = (sample<0 ? c3 : c3s)+offset, *C4 = (sample<0 ? c4 : c4s)+offset;
+        for (size_t i = 0; i < nn; i++) cov[i] = alpha*alpha*C2[i]+alpha*C3[i]+C4[i];
+    }
+
+    bool check_convergence(const char* name){
+        // Eigenvalue test for the convergence of the 4-point matrix, min eig(C4) >= -min eig(C2)
+        Float *eigvals = (Float *)malloc(sizeof(Float)*n_bins), *eigvecs;
+        int ec=posix_memalign((void **) &eigvecs, PAGE, sizeof(Float)*n_bins*n_bins);
+        assert(ec==0);
+        symmetric_eigensystem(c4, n_bins, eigvals, eigvecs);
+        Float min_c4 = eigvals[0];
+        symmetric_eigensystem(c2, n_bins, eigvals, eigvecs);
+        Float min_c2 = eigvals[0];
+        free(eigvals);
+        free(eigvecs);
+        if (min_c4<-min_c2){
+            printf("%s 4-point covariance matrix has not converged properly via the eigenvalue test. Exiting\n", name);
+            printf("Min eigenvalue of C4 = %.2e, min eigenvalue of C2 = %.2e\n", min_c4, min_c2);
+            return false;
+        }
+        return true;
+    }
+
+    void D_matrix(Float alpha, Float* partial_cov, Float* D){
+        // Quadratic bias correction matrix D of O'Connell & Eisenstein 2018 from the leave-one-out subsample covariances,
+        // D = (N-1)/N [-I + 1/N sum_i C_{excl i}^{-1} C_i], also filling partial_cov with the N subsample covariances C_i.
+        // Each leave-one-out covariance is a downdate of the summed covariance, C_{excl i} = (sum_j C_j - C_i)/(N-1),
+        // which is Cholesky factorized and solved against all columns of C_i at once, distributing the subsamples among the threads.
+        int n = n_bins, N = n_samples;
+        size_t nn = (size_t)n*n;
+        Float *sum_cov, *tmp;
+        int ec=0;
+        ec+=posix_memalign((void **) &sum_cov, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &tmp, PAGE, sizeof(Float)*nn);
+        assert(ec==0);
+        for (int i = 0; i < N; i++) covariance(alpha, partial_cov+nn*i, i);
+        for (size_t j = 0; j < nn; j++){
+            sum_cov[j] = 0.;
+            tmp[j] = 0.;
+        }
+        for (int i = 0; i < N; i++)
+            for (size_t j = 0; j < nn; j++) sum_cov[j] += partial_cov[nn*i+j];
+
+#ifdef OPENMP
+#pragma omp parallel shared(sum_cov,tmp,partial_cov)
+#endif
+        { // start parallel loop
+        MatrixFactorization factor(n);
+        Float *c_excl, *solution, *local_tmp; // local_tmp accumulates sum_i C_{excl i}^{-1} C_i for this thread
+        int ec=0;
+        ec+=posix_memalign((void **) &c_excl, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &solution, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &local_tmp, PAGE, sizeof(Float)*nn);
+        assert(ec==0);
+        for (size_t j = 0; j < nn; j++) local_tmp[j] = 0.;
+
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int i = 0; i < N; i++){
+            const Float *Ci = partial_cov+nn*i;
+            for (size_t j = 0; j < nn; j++) c_excl[j] = (sum_cov[j]-Ci[j])/(N-1.);
+            factor.factorize(c_excl);
+            factor.solve_matrix(Ci, solution);
+            for (size_t j = 0; j < nn; j++) local_tmp[j] += solution[j];
+        }
+
+#ifdef OPENMP
+#pragma omp critical
+#endif
+        for (size_t j = 0; j < nn; j++) tmp[j] += local_tmp[j];
+
+        free(c_excl);
+        free(solution);
+        free(local_tmp);
+        } // end parallel region
+
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) D[i*n+j] = (N-1.)/N*(-1.*(i==j)+tmp[i*n+j]/N);
+        free(sum_cov);
+        free(tmp);
+    }
+
+    void precision(Float alpha, const Float* D, Float* prec){
+        // Bias-corrected precision matrix (I - D) C^{-1} for the full covariance C at the given alpha
+        int n = n_bins;
+        size_t nn = (size_t)n*n;
+        Float *cov, *inv_cov, *I_minus_D;
+        int ec=0;
+        ec+=posix_memalign((void **) &cov, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &inv_cov, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &I_minus_D, PAGE, sizeof(Float)*nn);
+        assert(ec==0);
+        covariance(alpha, cov);
+        MatrixFactorization factor(n);
+        factor.factorize(cov);
+        factor.inverse(inv_cov);
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) I_minus_D[i*n+j] = (i==j)-D[i*n+j];
+        matrix_multiply(I_minus_D, inv_cov, prec, n);
+        free(cov);
+        free(inv_cov);
+        free(I_minus_D);
+    }
+};
+
+class IntegralLoader{
+    // Reads the integrals of grid_covariance.cpp from the CovMatricesAll/ and CovMatricesJack/ subdirectories
+public:
+    const char* file_root;
+    int n; // radial bins
+    char bin_string[32]; // e.g. "m10" for mu bins or "l4" for Legendre multipoles
+    bool legendre; // c2 is stored as a full matrix in Legendre modes, otherwise as its diagonal
+    int n_bins;
+    // Jackknife disconnected term inputs (DEFAULT mode only)
+    int n_jack = 0;
+    Float *RR = NULL, *weights = NULL;
+
+    IntegralLoader(const char* _file_root, int _n, int n_angular, bool _legendre){
+        file_root = _file_root;
+        n = _n;
+        legendre = _legendre;
+        if (legendre){
+            snprintf(bin_string, sizeof bin_string, "l%d", n_angular);
+            n_bins = n*(n_angular/2+1);
+        }
+        else{
+            snprintf(bin_string, sizeof bin_string, "m%d", n_angular);
+            n_bins = n*n_angular;
+        }
+    }
+
+    void load(CovarianceIntegrals* ints, bool jack){
+        // Load the full and subsample estimates, in parallel over the subsamples
+        load_matrices("full", jack, ints->c2, ints->c3, ints->c4);
+        size_t nn = (size_t)n_bins*n_bins;
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int i = 0; i < ints->n_samples; i++){
+            char index[16];
+            snprintf(index, sizeof index, "%d", i);
+            load_matrices(index, jack, ints->c2s+nn*i, ints->c3s+nn*i, ints->c4s+nn*i);
+        }
+    }
+
+private:
+    void load_matrices(const char* index, bool jack, Float* c2, Float* c3, Float* c4){
+        char root[1100], name[1200];
+        int nb = n_bins;
+        snprintf(root, sizeof root, "%s/%s/", file_root, jack ? "CovMatricesJack" : "CovMatricesAll");
+        if (legendre){
+            snprintf(name, sizeof name, "%sc2_n%d_%s_11", root, n, bin_string);
+            load_matrix(name, index, c2, (long long)nb*nb);
+        }
+        else{
+            Float *c2_diag = (Float *)malloc(sizeof(Float)*nb);
+            snprintf(name, sizeof name, "%sc2_n%d_%s_11", root, n, bin_string);
+            load_matrix(name, index, c2_diag, nb);
+            for (int i = 0; i < nb; i++)
+                for (int j = 0; j < nb; j++) c2[i*nb+j] = (i==j) ? c2_diag[i] : 0.;
+            free(c2_diag);
+        }
+        snprintf(name, sizeof name, "%sc3_n%d_%s_1,11", root, n, bin_string);
+        load_matrix(name, index, c3, (long long)nb*nb);
+        snprintf(name, sizeof name, "%sc4_n%d_%s_11,11", root, n, bin_string);
+        load_matrix(name, index, c4, (long long)nb*nb);
+        if (jack && !legendre) add_disconnected(root, index, c4);
+
+        // Now symmetrize the matrices
+        for (int i = 0; i < nb; i++)
+            for (int j = 0; j < i; j++){
+                c3[i*nb+j] = c3[j*nb+i] = 0.5*(c3[i*nb+j]+c3[j*nb+i]);
+                c4[i*nb+j] = c4[j*nb+i] = 0.5*(c4[i*nb+j]+c4[j*nb+i]);
+            }
+    }
+
+    void add_disconnected(const char* root, const char* index, Float* c4){
+        // Add the disconnected jackknife term from the EE and RR integrals
+        int nb = n_bins;
+        size_t n_elements = (size_t)n_jack*nb;
+        Float *EE1 = (Float *)malloc(sizeof(Float)*n_elements), *EE2 = (Float *)malloc(sizeof(Float)*n_elements);
+        Float *RR1 = (Float *)malloc(sizeof(Float)*n_elements), *RR2 = (Float *)malloc(sizeof(Float)*n_elements);
+        char name[1200];
+        snprintf(name, sizeof name, "%sEE1_n%d_%s_11", root, n, bin_string);
+        load_matrix(name, index, EE1, n_elements);
+        snprintf(name, sizeof name, "%sEE2_n%d_%s_11", root, n, bin_string);
+        load_matrix(name, index, EE2, n_elements);
+        snprintf(name, sizeof name, "%sRR1_n%d_%s_11", root, n, bin_string);
+        load_matrix(name, index, RR1, n_elements);
+        snprintf(name, sizeof name, "%sRR2_n%d_%s_11", root, n, bin_string);
+        load_matrix(name, index, RR2, n_elements);
+
+        // diff = EE_aA - w_aA sum_B EE_aB with w_aA = RR_aA / sum_B RR_aB (stored in EE1 and EE2)
+        for (int b = 0; b < nb; b++){
+            Float sum_EE1 = 0., sum_EE2 = 0., sum_RR1 = 0., sum_RR2 = 0.;
+            for (int A = 0; A < n_jack; A++){
+                sum_EE1 += EE1[A*nb+b];
+                sum_EE2 += EE2[A*nb+b];
+                sum_RR1 += RR1[A*nb+b];
+                sum_RR2 += RR2[A*nb+b];
+            }
+            for (int A = 0; A < n_jack; A++){
+                EE1[A*nb+b] -= RR1[A*nb+b]/sum_RR1*sum_EE1;
+                EE2[A*nb+b] -= RR2[A*nb+b]/sum_RR2*sum_EE2;
+            }
+        }
+        // The normalization is the matrix product of (1 - sum_A w_aA w_cA) and RR_c RR_b, as in the python scripts, i.e. RR_b sum_c (1 - sum_A w_aA w_cA) RR_c
+        Float *norm = (Float *)malloc(sizeof(Float)*nb);
+        for (int a = 0; a < nb; a++){
+            norm[a] = 0.;
+            for (int c = 0; c < nb; c++){
+                Float ww = 0.;
+                for (int A = 0; A < n_jack; A++) ww += weights[A*nb+a]*weights[A*nb+c];
+                norm[a] += (1.-ww)*RR[c];
+            }
+        }
+        for (int a = 0; a < nb; a++)
+            for (int b = 0; b < nb; b++){
+                Float cx = 0.;
+                for (int A = 0; A < n_jack; A++) cx += EE1[A*nb+a]*EE2[A*nb+b];
+                c4[a*nb+b] += cx/(norm[a]*RR[b]);
+            }
+        free(norm);
+        free(EE1);
+        free(EE2);
+        free(RR1);
+        free(RR2);
+    }
+};
+
+// ========================== Shot-noise rescaling ==============================
+
+class JackknifeLikelihood{
+    // -log L1(alpha) = trace(Psi^J(alpha) C^data) - log det Psi^J(alpha), comparing the theory and data jackknife covariances
+public:
+    CovarianceIntegrals *ints;
+    const Float *data_cov;
+    Float *partial_cov, *D, *prec;
+
+private:
+    // Local model of the likelihood about alpha_k, used by optimize_fast()
+    Float alpha_k, sign_I_minus_D_k, logdet_I_minus_D_k, trace_dD_k;
+    Float *data_I_minus_D_k, *data_dD_k; // C^data (I - D_k) and C^data D'_k
+
+public:
+    JackknifeLikelihood(CovarianceIntegrals *_ints, const Float* _data_cov){
+        ints = _ints;
+        data_cov = _data_cov;
+        size_t nn = (size_t)ints->n_bins*ints->n_bins;
+        int ec=0;
+        ec+=posix_memalign((void **) &partial_cov, PAGE, sizeof(Float)*nn*ints->n_samples);
+        ec+=posix_memalign((void **) &D, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &prec, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &data_I_minus_D_k, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &data_dD_k, PAGE, sizeof(Float)*nn);
+        assert(ec==0);
+    }
+
+    ~JackknifeLikelihood(){
+        free(partial_cov);
+        free(D);
+        free(prec);
+        free(data_I_minus_D_k);
+        free(data_dD_k);
+    }
+
+    void Psi(Float alpha){
+        // Bias-corrected jackknife precision matrix, stored in prec
+        ints->D_matrix(alpha, partial_cov, D);
+        ints->precision(alpha, D, prec);
+    }
+
+    Float neg_log_L1(Float alpha){
+        int n = ints->n_bins;
+        Psi(alpha);
+        MatrixFactorization factor(n);
+        factor.factorize(prec);
+        Float sign, logdet;
+        factor.log_determinant(sign, logdet);
+        if (sign<=0) return INFINITY; // Remove any dodgy inversions
+        Float trace = 0.;
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) trace += prec[i*n+j]*data_cov[j*n+i];
+        return trace-logdet;
+    }
+
+    Float optimize(Float x0){
+        // Minimize -log L1 as scipy.optimize.fmin with its default tolerances, as in the python scripts
+        int iterations, n_fun;
+        Float alpha = simplex(&JackknifeLikelihood::neg_log_L1, x0, 1e-4, 1e-4, iterations, n_fun);
+        printf("Optimization terminated after %d iterations and %d function evaluations\n", iterations, n_fun);
+        return alpha;
+    }
+
+    Float optimize_fast(Float x0){
+        // Minimize -log L1 using a sequence of local models, each needing the D matrix (and thus the n_samples matrix factorizations) only once.
+        // About alpha_k the model uses the exact C(alpha) but D(alpha) = D_k + (alpha-alpha_k) D'_k, with D'_k estimated from the previous model.
+        // D depends only weakly on alpha, so the models converge in a few steps, and their final stationary point is that of the full likelihood.
+        const Float xtol = 1e-4;
+        const int max_models = 20;
+        int n = ints->n_bins;
+        Float *D_prev = (Float *)malloc(sizeof(Float)*n*n);
+        Float alpha = x0, alpha_prev = 0.;
+        for (int model = 0; model < max_models; model++){
+            ints->D_matrix(alpha, partial_cov, D);
+            local_model(alpha, model>0 ? D_prev : NULL, alpha_prev);
+            int iterations, n_fun;
+            Float alpha_next = simplex(&JackknifeLikelihood::model_neg_log_L1, alpha, 1e-6, 1e-6, iterations, n_fun);
+            printf("Local model %d about alpha = %.6f has its minimum at alpha = %.6f\n", model+1, alpha, alpha_next);
+            for (int i = 0; i < n*n; i++) D_prev[i] = D[i];
+            alpha_prev = alpha;
+            alpha = alpha_next;
+            if (fabs(alpha-alpha_prev)<=xtol){
+                printf("Optimization terminated after %d evaluations of the D matrix\n", model+1);
+                free(D_prev);
+                return alpha;
+            }
+        }
+        printf("Local models have not converged, using the full optimization\n");
+        free(D_prev);
+        return optimize(alpha);
+    }
+
+private:
+    void local_model(Float alpha, const Float* D_prev, Float alpha_prev){
+        // Set up the model of -log L1 about alpha, with D holding D(alpha) and D_prev the D matrix at alpha_prev (if not NULL)
+        int n = ints->n_bins;
+        size_t nn = (size_t)n*n;
+        Float *I_minus_D, *dD, *tmp;
+        int ec=0;
+        ec+=posix_memalign((void **) &I_minus_D, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &dD, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &tmp, PAGE, sizeof(Float)*nn);
+        assert(ec==0);
+        alpha_k = alpha;
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) I_minus_D[i*n+j] = (i==j)-D[i*n+j];
+        for (size_t i = 0; i < nn; i++) dD[i] = (D_prev==NULL) ? 0. : (D[i]-D_prev[i])/(alpha-alpha_prev);
+
+        // log det (I - D(alpha)) = log det (I - D_k) - (alpha-alpha_k) trace((I - D_k)^{-1} D'_k) to first order
+        MatrixFactorization factor(n);
+        factor.factorize(I_minus_D);
+        factor.log_determinant(sign_I_minus_D_k, logdet_I_minus_D_k);
+        factor.solve_matrix(dD, tmp);
+        trace_dD_k = 0.;
+        for (int i = 0; i < n; i++) trace_dD_k += tmp[i*n+i];
+
+        // trace(Psi C^data) = trace(C(alpha)^{-1} C^data (I - D(alpha))), which is linear in D
+        matrix_multiply(data_cov, I_minus_D, data_I_minus_D_k, n);
+        matrix_multiply(data_cov, dD, data_dD_k, n);
+        free(I_minus_D);
+        free(dD);
+        free(tmp);
+    }
+
+    Float model_neg_log_L1(Float alpha){
+        // Local model of -log L1 about alpha_k, needing a single factorization of C(alpha)
+        int n = ints->n_bins;
+        size_t nn = (size_t)n*n;
+        Float delta = alpha-alpha_k;
+        Float *cov, *M;
+        int ec=0;
+        ec+=posix_memalign((void **) &cov, PAGE, sizeof(Float)*nn);
+        ec+=posix_memalign((void **) &M, PAGE, sizeof(Float)*nn);
+        assert(ec==0);
+        ints->covariance(alpha, cov);
+        for (size_t i = 0; i < nn; i++) M[i] = data_I_minus_D_k[i]-delta*data_dD_k[i];
+        MatrixFactorization factor(n);
+        factor.factorize(cov);
+        Float sign, logdet_cov;
+        factor.log_determinant(sign, logdet_cov);
+        factor.solve_matrix(M, M);
+        Float trace = 0.;
+        for (int i = 0; i < n; i++) trace += M[i*n+i];
+        free(cov);
+        free(M);
+        sign *= sign_I_minus_D_k;
+        if (sign<=0) return INFINITY; // as for the full likelihood
+        return trace-(logdet_I_minus_D_k-delta*trace_dD_k-logdet_cov);
+    }
+
+    Float simplex(Float (JackknifeLikelihood::*func)(Float), Float x0, Float xtol, Float ftol, int &iterations, int &n_fun){
+        // Downhill simplex minimization in one dimension, following scipy.optimize.fmin
+        const Float rho = 1., chi = 2., psi = 0.5, sigma = 0.5;
+        const int max_iter = 200, max_fun = 200;
+        Float sim[2] = {x0, x0!=0 ? 1.05*x0 : 0.00025}, fsim[2];
+        for (int i = 0; i < 2; i++) fsim[i] = (this->*func)(sim[i]);
+        n_fun = 2;
+        iterations = 1;
+        if (fsim[1]<fsim[0]){
+            std::swap(sim[0], sim[1]);
+            std::swap(fsim[0], fsim[1]);
+        }
+        while (n_fun<max_fun && iterations<max_iter){
+            if (fabs(sim[1]-sim[0])<=xtol && fabs(fsim[0]-fsim[1])<=ftol) break;
+            Float xbar = sim[0];
+            Float xr = (1.+rho)*xbar-rho*sim[1], fxr = (this->*func)(xr);
+            n_fun++;
+            if (fxr<fsim[0]){
+                // Expansion
+                Float xe = (1.+rho*chi)*xbar-rho*chi*sim[1], fxe = (this->*func)(xe);
+                n_fun++;
+                if (fxe<fxr){
+                    sim[1] = xe;
+                    fsim[1] = fxe;
+                }
+                else{
+                    sim[1] = xr;
+                    fsim[1] = fxr;
+                }
+            }
+            else{
+                bool shrink = false;
+                if (fxr<fsim[1]){
+                    // Outside contraction
+                    Float xc = (1.+psi*rho)*xbar-psi*rho*sim[1], fxc = (this->*func)(xc);
+                    n_fun++;
+                    if (fxc<=fxr){
+                        sim[1] = xc;
+                        fsim[1] = fxc;
+                    }
+                    else shrink = true;
+                }
+                else{
+                    // Inside contraction
+                    Float xcc = (1.-psi)*xbar+psi*sim[1], fxcc = (this->*func)(xcc);
+                    n_fun++;
+                    if (fxcc<fsim[1]){
+                        sim[1] = xcc;
+                        fsim[1] = fxcc;
+                    }
+                    else shrink = true;
+                }
+                if (shrink){
+                    sim[1] = sim[0]+sigma*(sim[1]-sim[0]);
+                    fsim[1] = (this->*func)(sim[1]);
+                    n_fun++;
+                }
+            }
+            iterations++;
+            if (fsim[1]<fsim[0]){
+                std::swap(sim[0], sim[1]);
+                std::swap(fsim[0], fsim[1]);
+            }
+        }
+        return sim[0];
+    }
+};
+
+Float* jackknife_data_covariance(const char* jackknife_file, const char* weight_file, int n_bins_smu, int n_jack, Float* &weights){
+    // Data covariance matrix from the individual jackknife correlation function estimates, also returning the (renormalized) jackknife weights of the used regions
+    int rows, cols;
+    Float *xi_jack = read_table(jackknife_file, 2, rows, cols);
+    printf("Loading jackknife weights from %s\n", weight_file);
+    Float *weight_table = read_table(weight_file, 0, rows, cols);
+    if (rows!=n_jack || cols!=n_bins_smu+1){
+        fprintf(stderr,"Jackknife weights file %s does not match the %d jackknives and %d bins of the correlation functions\n", weight_file, n_jack, n_bins_smu);
+        abort();
+    }
+    // First exclude any dodgy jackknife regions
+    int nb = n_bins_smu, n_good = 0;
+    weights = (Float *)malloc(sizeof(Float)*n_jack*nb);
+    for (int A = 0; A < n_jack; A++){
+        bool good = true;
+        for (int b = 0; b < nb; b++) if (!isfinite(xi_jack[A*nb+b])) good = false; // all xi in jackknife have to be normal numbers
+        if (!good) continue;
+        for (int b = 0; b < nb; b++){
+            xi_jack[n_good*nb+b] = xi_jack[A*nb+b];
+            weights[n_good*nb+b] = weight_table[A*(nb+1)+b+1];
+        }
+        n_good++;
+    }
+    printf("Using %d out of %d jackknives\n", n_good, n_jack);
+    // Renormalize weights after possibly discarding some jackknives
+    for (int b = 0; b < nb; b++){
+        Float sum = 0.;
+        for (int A = 0; A < n_good; A++) sum += weights[A*nb+b];
+        for (int A = 0; A < n_good; A++) weights[A*nb+b] /= sum;
+    }
+    for (int A = n_good; A < n_jack; A++)
+        for (int b = 0; b < nb; b++) weights[A*nb+b] = 0.;
+
+    printf("Computing data covariance matrix\n");
+    for (int b = 0; b < nb; b++){
+        Float mean_xi = 0.;
+        for (int A = 0; A < n_good; A++) mean_xi += weights[A*nb+b]*xi_jack[A*nb+b];
+        for (int A = 0; A < n_good; A++) xi_jack[A*nb+b] = weights[A*nb+b]*(xi_jack[A*nb+b]-mean_xi);
+    }
+    Float *data_cov = (Float *)malloc(sizeof(Float)*nb*nb);
+    for (int a = 0; a < nb; a++)
+        for (int b = 0; b < nb; b++){
+            Float cov = 0., denom = 0.;
+            for (int A = 0; A < n_good; A++){
+                cov += xi_jack[A*nb+a]*xi_jack[A*nb+b];
+                denom += weights[A*nb+a]*weights[A*nb+b];
+            }
+            data_cov[a*nb+b] = cov/(1.-denom);
+        }
+    free(xi_jack);
+    free(weight_table);
+    return data_cov;
+}
+
+// ========================== Output ==============================
+
+Float effective_N(const Float* D, int n_bins){
+    // Effective number of mocks from the determinant of the bias correction matrix D
+    MatrixFactorization factor(n_bins);
+    factor.factorize(D);
+    Float sign, logdet;
+    factor.log_determinant(sign, logdet);
+    if (sign<0){
+        printf("N_eff is negative! Setting to zero\n");
+        return 0.;
+    }
+    Float N_eff = (n_bins+1.)/(sign*exp(logdet/n_bins))+1.;
+    printf("Total N_eff Estimate: %.4e\n", N_eff);
+    return N_eff;
+}
+
+void usage(){
+    fprintf(stderr,"\nUsage:\n");
+    fprintf(stderr,"    ./post_process default {COVARIANCE_DIR} {N_R_BINS} {N_MU_BINS} {N_SUBSAMPLES} {OUTPUT_DIR} [{SHOT_NOISE_RESCALING}]\n");
+    fprintf(stderr,"    ./post_process legendre {COVARIANCE_DIR} {N_R_BINS} {MAX_L} {N_SUBSAMPLES} {OUTPUT_DIR} [{SHOT_NOISE_RESCALING}]\n");
+    fprintf(stderr,"    ./post_process jackknife {XI_JACKKNIFE_FILE} {WEIGHTS_DIR} {COVARIANCE_DIR} {N_MU_BINS} {N_SUBSAMPLES} {OUTPUT_DIR} [-fast]\n");
+    fprintf(stderr,"    ./post_process legendre_mix_jackknife {XI_JACKKNIFE_FILE} {WEIGHTS_DIR} {COVARIANCE_DIR} {N_MU_BINS} {MAX_L} {N_SUBSAMPLES} {OUTPUT_DIR} [-fast]\n");
+    fprintf(stderr,"With -fast, the shot-noise rescaling is optimized using local models of the likelihood rather than the full likelihood at each step.\n");
+    fprintf(stderr,"The number of threads is set by the OMP_NUM_THREADS environment variable.\n\n");
+    exit(1);
+}
+
+// ================================ main() =============================
+
+int main(int argc, char *argv[]) {
+    if (argc<2) usage();
+    const char* mode = argv[1];
+    bool jackknife, legendre, fast = false;
+    if (!strcmp(mode,"default") || !strcmp(mode,"legendre")){
+        if (argc!=7 && argc!=8) usage();
+        jackknife = false;
+        legendre = !strcmp(mode,"legendre");
+    }
+    else if (!strcmp(mode,"jackknife") || !strcmp(mode,"legendre_mix_jackknife")){
+        legendre = !strcmp(mode,"legendre_mix_jackknife");
+        if (argc==(legendre ? 10 : 9) && !strcmp(argv[argc-1],"-fast")){
+            fast = true;
+            argc--;
+        }
+        if (argc!=(legendre ? 9 : 8)) usage();
+        jackknife = true;
+    }
+    else usage();
+
+    TotalTime.Start();
+#ifdef OPENMP
+    printf("# Running on %d threads\n", omp_get_max_threads());
+#endif
+    int n, n_mu = 0, max_l = 0, n_samples, n_jack = 0;
+    const char *file_root, *outdir, *jackknife_file = NULL, *weight_dir = NULL;
+    Float alpha = 1.;
+    if (!jackknife){
+        file_root = argv[2];
+        n = atoi(argv[3]);
+        if (legendre) max_l = atoi(argv[4]);
+        else n_mu = atoi(argv[4]);
+        n_samples = atoi(argv[5]);
+        outdir = argv[6];
+        if (argc==8) alpha = atof(argv[7]);
+    }
+    else{
+        jackknife_file = argv[2];
+        weight_dir = argv[3];
+        file_root = argv[4];
+        n_mu = atoi(argv[5]);
+        if (legendre) max_l = atoi(argv[6]);
+        n_samples = atoi(argv[legendre ? 7 : 6]);
+        outdir = argv[legendre ? 8 : 7];
+        // The radial bins and number of jackknives are set by the correlation function file
+        int cols;
+        printf("Loading correlation function jackknife estimates from %s\n", jackknife_file);
+        free(read_table(jackknife_file, 2, n_jack, cols));
+        n = cols/n_mu;
+    }
+    if (legendre) assert(max_l%2==0); // Only even multipoles supported
+    assert(n_samples>1);
+
+    // Create output directory
+    mkdir(outdir, 0777);
+
+    IntegralLoader loader(file_root, n, legendre ? max_l : n_mu, legendre);
+    int n_bins = loader.n_bins;
+    size_t nn = (size_t)n_bins*n_bins;
+    Float *data_cov = NULL;
+    char output_name[1100];
+
+    if (jackknife){
+        char weight_file[1100];
+        snprintf(weight_file, sizeof weight_file, "%s/jackknife_weights_n%d_m%d_j%d_11.dat", weight_dir, n, n_mu, n_jack);
+        data_cov = jackknife_data_covariance(jackknife_file, weight_file, n*n_mu, n_jack, loader.weights);
+        loader.n_jack = n_jack;
+        if (legendre){
+            // Project the data jackknife covariance from mu bins to Legendre multipoles, staying within the same radial bins
+            char mu_bin_legendre_file[1100];
+            snprintf(mu_bin_legendre_file, sizeof mu_bin_legendre_file, "%s/mu_bin_legendre_factors_m%d_l%d.txt", weight_dir, n_mu, max_l);
+            printf("Loading mu bin Legendre factors from %s\n", mu_bin_legendre_file);
+            int rows, n_l;
+            Float *factors = read_table(mu_bin_legendre_file, 0, rows, n_l); // rows correspond to mu bins, columns to multipoles
+            assert(rows==n_mu && n_l==max_l/2+1);
+            int nb = n*n_mu;
+            Float *projected = (Float *)malloc(sizeof(Float)*nn), *half = (Float *)malloc(sizeof(Float)*nb*n_bins);
+            for (int a = 0; a < nb; a++) // project the columns
+                for (int j = 0; j < n; j++)
+                    for (int q = 0; q < n_l; q++){
+                        Float sum = 0.;
+                        for (int mu = 0; mu < n_mu; mu++) sum += data_cov[a*nb+j*n_mu+mu]*factors[mu*n_l+q];
+                        half[a*n_bins+j*n_l+q] = sum;
+                    }
+            for (int i = 0; i < n; i++) // then the rows
+                for (int p = 0; p < n_l; p++)
+                    for (int b = 0; b < n_bins; b++){
+                        Float sum = 0.;
+                        for (int mu = 0; mu < n_mu; mu++) sum += factors[mu*n_l+p]*half[(i*n_mu+mu)*n_bins+b];
+                        projected[(i*n_l+p)*n_bins+b] = sum;
+                    }
+            free(data_cov);
+            free(half);
+            free(factors);
+            data_cov = projected;
+        }
+        else{
+            char RR_file[1100];
+            snprintf(RR_file, sizeof RR_file, "%s/binned_pair_counts_n%d_m%d_j%d_11.dat", weight_dir, n, n_mu, n_jack);
+            printf("Loading pair counts from %s\n", RR_file);
+            int rows, cols;
+            loader.RR = read_table(RR_file, 0, rows, cols);
+            assert(rows*cols==n_bins);
+        }
+
+        // Load in the jackknife theoretical matrices
+        printf("Loading jackknife covariance matrices\n");
+        CovarianceIntegrals jack(n_bins, n_samples);
+        loader.load(&jack, true);
+        if (!jack.check_convergence("Jackknife")) exit(1);
+
+        // Now optimize for shot-noise rescaling parameter alpha
+        printf("Optimizing for the shot-noise rescaling parameter\n");
+        JackknifeLikelihood likelihood(&jack, data_cov);
+        alpha = fast ? likelihood.optimize_fast(1.) : likelihood.optimize(1.);
+        printf("Optimization complete - optimal rescaling parameter is %.6f\n", alpha);
+
+        // Compute the jackknife covariance and precision matrices at the optimal alpha
+        likelihood.Psi(alpha);
+        Float *jack_cov = (Float *)malloc(sizeof(Float)*nn);
+        jack.covariance(alpha, jack_cov);
+
+        if (legendre) snprintf(output_name, sizeof output_name, "%s/Rescaled_Covariance_Matrices_Legendre_Jackknife_n%d_l%d_j%d.npz", outdir, n, max_l, n_jack);
+        else snprintf(output_name, sizeof output_name, "%s/Rescaled_Covariance_Matrices_Jackknife_n%d_m%d_j%d.npz", outdir, n, n_mu, n_jack);
+        NpzWriter npz(output_name);
+        int shape[3] = {n_bins, n_bins, 0}, partial_shape[3] = {n_samples, n_bins, n_bins};
+        npz.add("jackknife_theory_covariance", jack_cov, 2, shape);
+        npz.add("jackknife_data_covariance", data_cov, 2, shape);
+        npz.add("jackknife_theory_precision", likelihood.prec, 2, shape);
+        npz.add("individual_theory_jackknife_covariances", likelihood.partial_cov, 3, partial_shape);
+        free(jack_cov);
+
+        // Now the full matrices at the same alpha, writing the remaining entries
+        printf("Loading full covariance matrices\n");
+        CovarianceIntegrals full(n_bins, n_samples);
+        loader.load(&full, false);
+        if (!full.check_convergence("Full")) exit(1);
+        printf("Computing the full precision matrix estimate:\n");
+        Float *full_cov = (Float *)malloc(sizeof(Float)*nn), *partial_cov = (Float *)malloc(sizeof(Float)*nn*n_samples);
+        Float *D = (Float *)malloc(sizeof(Float)*nn), *prec = (Float *)malloc(sizeof(Float)*nn);
+        full.covariance(alpha, full_cov);
+        full.D_matrix(alpha, partial_cov, D);
+        full.precision(alpha, D, prec);
+        printf("Full precision matrix estimate computed\n");
+        npz.add("full_theory_covariance", full_cov, 2, shape);
+        npz.add("shot_noise_rescaling", alpha);
+        npz.add("full_theory_precision", prec, 2, shape);
+        npz.add("N_eff", effective_N(D, n_bins));
+        npz.add("full_theory_D_matrix", D, 2, shape);
+        npz.add("individual_theory_covariances", partial_cov, 3, partial_shape);
+        npz.close();
+        free(full_cov);
+        free(partial_cov);
+        free(D);
+        free(prec);
+        free(data_cov);
+        free(loader.weights);
+        free(loader.RR);
+    }
+    else{
+        printf("Loading covariance matrices\n");
+        CovarianceIntegrals full(n_bins, n_samples);
+        loader.load(&full, false);
+        if (!full.check_convergence("Full")) exit(1);
+        printf("Computing the full precision matrix estimate:\n");
+        Float *full_cov = (Float *)malloc(sizeof(Float)*nn), *partial_cov = (Float *)malloc(sizeof(Float)*nn*n_samples);
+        Float *D = (Float *)malloc(sizeof(Float)*nn), *prec = (Float *)malloc(sizeof(Float)*nn);
+        full.covariance(alpha, full_cov);
+        full.D_matrix(alpha, partial_cov, D);
+        full.precision(alpha, D, prec);
+        printf("Full precision matrix estimate computed\n");
+
+        if (legendre) snprintf(output_name, sizeof output_name, "%s/Rescaled_Covariance_Matrices_Legendre_n%d_l%d.npz", outdir, n, max_l);
+        else snprintf(output_name, sizeof output_name, "%s/Rescaled_Covariance_Matrices_Default_n%d_m%d.npz", outdir, n, n_mu);
+        NpzWriter npz(output_name);
+        int shape[2] = {n_bins, n_bins}, partial_shape[3] = {n_samples, n_bins, n_bins};
+        npz.add("full_theory_covariance", full_cov, 2, shape);
+        npz.add("shot_noise_rescaling", alpha);
+        npz.add("full_theory_precision", prec, 2, shape);
+        npz.add("N_eff", effective_N(D, n_bins));
+        npz.add("full_theory_D_matrix", D, 2, shape);
+        npz.add("individual_theory_covariances", partial_cov, 3, partial_shape);
+        npz.close();
+        free(full_cov);
+        free(partial_cov);
+        free(D);
+        free(prec);
+    }
+    printf("Saved output covariance matrices as %s\n", output_name);
+
+    TotalTime.Stop();
+    printf("\nTotal process time: %.2f s\n", TotalTime.Elapsed());
+    return 0;
+}
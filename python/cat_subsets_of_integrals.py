@@ -7,6 +7,8 @@ import numpy as np
 import sys,os
 from tqdm import trange
 from shutil import copy2
+from glob import glob
+from subsample_container import has_subsample, load_subsample
 
 # PARAMETERS
 if len(sys.argv)<6: # if too few
@@ -40,6 +42,41 @@ output_root_jack = os.path.join(output_root, 'CovMatricesJack/')
 os.makedirs(output_root_all, exist_ok=1)
 if any([os.path.exists(input_root_jack) for input_root_jack in input_roots_jack]): os.makedirs(output_root_jack, exist_ok=1)
 
+# Read and write binary .npy integrals (saved by the C++ code with the -npy option, or unpacked from the subsample containers) if any are present, otherwise text files
+binary = any(glob(input_root_all+'c4_*.npy') or glob(input_root_all+'c4_*_subsamples.bin') for input_root_all in input_roots_all)
+
+def find_file(root, name):
+    """Return the path of an integral file given without extension, preferring the binary .npy version"""
+    if os.path.isfile(root+name+'.npy'): return root+name+'.npy'
+    return root+name+'.txt'
+
+def split_subsample(name):
+    """Split the name of a subsample estimate into the base name of its container and its index (None if it is not a subsample)"""
+    basename, _, index = name.rpartition('_')
+    return (basename, int(index)) if index.isdigit() else (name, None)
+
+def has_matrix(root, name):
+    """Whether the integral is present, either as its own file or, for a subsample estimate, in a container written with the -container option"""
+    if os.path.isfile(find_file(root, name)): return True
+    basename, index = split_subsample(name)
+    return index is not None and has_subsample(root+basename, index)
+
+def load_matrix(root, name):
+    filename = find_file(root, name)
+    if os.path.isfile(filename): return np.load(filename) if filename.endswith('.npy') else np.loadtxt(filename)
+    basename, index = split_subsample(name)
+    if index is None: raise IOError("%s not found" % filename)
+    return load_subsample(root+basename, index) # fall back to the container
+
+def save_matrix(name, data):
+    if binary: np.save(name+'.npy', data)
+    else: np.savetxt(name+'.txt', data)
+
+def copy_matrix(root, name, out_name):
+    filename = find_file(root, name)
+    if os.path.isfile(filename): copy2(filename, out_name+os.path.splitext(filename)[1]) # keep the format of the input file
+    else: np.save(out_name+'.npy', load_matrix(root, name)) # unpack subsample estimates from the container
+
 # input indices
 I1 = [1,1,1,1,1,2,2]
 I2 = [1,2,2,2,1,1,2]
@@ -57,22 +94,22 @@ for ii in range(len(I1)): # loop over all field combinations
     # read
     for input_root_all, n_samples in zip(input_roots_all, ns_samples):
         read_all = True
-        if collapse_factor == 1 and not os.path.isfile(input_root_all+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, n_samples)) and os.path.isfile(input_root_all+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, n_samples-1)):
+        if collapse_factor == 1 and not has_matrix(input_root_all, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, n_samples)) and has_matrix(input_root_all, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, n_samples-1)):
             # if don't want to collapse and there are no more and no less samples than we are using, can read averages from full file
             # note: logic can still be broken by a gap in the samples, but there probably would not be a full file then
             try:
-                c2.append(np.loadtxt(input_root_all+'c2_n%d_%s_%s_full.txt' % (n, mstr, index2)))
-                c3.append(np.loadtxt(input_root_all+'c3_n%d_%s_%s_full.txt' % (n, mstr, index3)))
-                c4.append(np.loadtxt(input_root_all+'c4_n%d_%s_%s_full.txt' % (n, mstr, index4)))
+                c2.append(load_matrix(input_root_all, 'c2_n%d_%s_%s_full' % (n, mstr, index2)))
+                c3.append(load_matrix(input_root_all, 'c3_n%d_%s_%s_full' % (n, mstr, index3)))
+                c4.append(load_matrix(input_root_all, 'c4_n%d_%s_%s_full' % (n, mstr, index4)))
                 repeats.append(n_samples)
                 read_all = False
             except (FileNotFoundError, IOError): pass
         if read_all:
-            if os.path.isfile(input_root_all+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, n_samples-1)):
+            if has_matrix(input_root_all, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, n_samples-1)):
                 for i in trange(n_samples, desc="Loading %s full samples" % index4):
-                    c2.append(np.loadtxt(input_root_all+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i)))
-                    c3.append(np.loadtxt(input_root_all+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i)))
-                    c4.append(np.loadtxt(input_root_all+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i)))
+                    c2.append(load_matrix(input_root_all, 'c2_n%d_%s_%s_%s' % (n, mstr, index2, i)))
+                    c3.append(load_matrix(input_root_all, 'c3_n%d_%s_%s_%s' % (n, mstr, index3, i)))
+                    c4.append(load_matrix(input_root_all, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, i)))
                     repeats.append(1)
             else: break # end loop if last c4 full not found
     if len(c4) == 0: break # end loop if no full integral has been found
@@ -82,24 +119,24 @@ for ii in range(len(I1)): # loop over all field combinations
     c2, c3, c4, repeats = [np.array(a) for a in (c2, c3, c4, repeats)]
     # average and save
     c2f, c3f, c4f = [np.average(a, axis=0, weights=repeats) for a in (c2, c3, c4)]
-    np.savetxt(output_root_all+'c2_n%d_%s_%s_full.txt' % (n, mstr, index2), c2f)
-    np.savetxt(output_root_all+'c3_n%d_%s_%s_full.txt' % (n, mstr, index3), c3f)
-    np.savetxt(output_root_all+'c4_n%d_%s_%s_full.txt' % (n, mstr, index4), c4f)
+    save_matrix(output_root_all+'c2_n%d_%s_%s_full' % (n, mstr, index2), c2f)
+    save_matrix(output_root_all+'c3_n%d_%s_%s_full' % (n, mstr, index3), c3f)
+    save_matrix(output_root_all+'c4_n%d_%s_%s_full' % (n, mstr, index4), c4f)
     if collapse_factor > 1:
         c2, c3, c4 = [np.mean(a.reshape(n_samples_out, collapse_factor, *np.shape(a)[1:]), axis=1) for a in (c2, c3, c4)] # average adjacent chunks of collapse_factor samples; repeats must be trivial in this case
         # write the collapsed data
         for i in trange(n_samples_out, desc="Writing %s full samples" % index4):
-            np.savetxt(output_root_all+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), c2[i])
-            np.savetxt(output_root_all+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i), c3[i])
-            np.savetxt(output_root_all+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i), c4[i])
+            save_matrix(output_root_all+'c2_n%d_%s_%s_%s' % (n, mstr, index2, i), c2[i])
+            save_matrix(output_root_all+'c3_n%d_%s_%s_%s' % (n, mstr, index3, i), c3[i])
+            save_matrix(output_root_all+'c4_n%d_%s_%s_%s' % (n, mstr, index4, i), c4[i])
     else: # can copy files, which should be faster
         c2, c3, c4 = [None] * 3 # won't be needed, so can free memory
         for input_root_all, n_samples, sample_offset in zip(input_roots_all, ns_samples, sample_offsets):
             if os.path.samefile(input_root_all, output_root_all): continue # skip copying, files are already there
             for i in trange(n_samples, desc="Copying %s full samples" % index4):
-                copy2(input_root_all+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), output_root_all+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i + sample_offset))
-                copy2(input_root_all+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i), output_root_all+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i + sample_offset))
-                copy2(input_root_all+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i), output_root_all+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i + sample_offset))
+                copy_matrix(input_root_all, 'c2_n%d_%s_%s_%s' % (n, mstr, index2, i), output_root_all+'c2_n%d_%s_%s_%s' % (n, mstr, index2, i + sample_offset))
+                copy_matrix(input_root_all, 'c3_n%d_%s_%s_%s' % (n, mstr, index3, i), output_root_all+'c3_n%d_%s_%s_%s' % (n, mstr, index3, i + sample_offset))
+                copy_matrix(input_root_all, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, i), output_root_all+'c4_n%d_%s_%s_%s' % (n, mstr, index4, i + sample_offset))
     print("Done with %s full" % index4)
 
     # jackknife integrals
@@ -108,22 +145,22 @@ for ii in range(len(I1)): # loop over all field combinations
     # read
     for input_root_jack, n_samples in zip(input_roots_jack, ns_samples):
         read_all = True
-        if collapse_factor == 1 and not os.path.isfile(input_root_jack+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, n_samples)) and os.path.isfile(input_root_jack+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, n_samples-1)):
+        if collapse_factor == 1 and not has_matrix(input_root_jack, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, n_samples)) and has_matrix(input_root_jack, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, n_samples-1)):
             # if don't want to collapse and there are no more and no less samples than we are using, can read averages from full file
             # note: logic can still be broken by a gap in the samples, but there probably would not be a full file then
             try:
-                c2j.append(np.loadtxt(input_root_jack+'c2_n%d_%s_%s_full.txt' % (n, mstr, index2)))
-                c3j.append(np.loadtxt(input_root_jack+'c3_n%d_%s_%s_full.txt' % (n, mstr, index3)))
-                c4j.append(np.loadtxt(input_root_jack+'c4_n%d_%s_%s_full.txt' % (n, mstr, index4)))
+                c2j.append(load_matrix(input_root_jack, 'c2_n%d_%s_%s_full' % (n, mstr, index2)))
+                c3j.append(load_matrix(input_root_jack, 'c3_n%d_%s_%s_full' % (n, mstr, index3)))
+                c4j.append(load_matrix(input_root_jack, 'c4_n%d_%s_%s_full' % (n, mstr, index4)))
                 repeats.append(n_samples)
                 read_all = False
             except (FileNotFoundError, IOError): pass
         if read_all:
-            if os.path.isfile(input_root_jack+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, n_samples-1)):
+            if has_matrix(input_root_jack, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, n_samples-1)):
                 for i in trange(n_samples, desc="Loading %s jack samples" % index4):
-                    c2j.append(np.loadtxt(input_root_jack+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i)))
-                    c3j.append(np.loadtxt(input_root_jack+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i)))
-                    c4j.append(np.loadtxt(input_root_jack+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i)))
+                    c2j.append(load_matrix(input_root_jack, 'c2_n%d_%s_%s_%s' % (n, mstr, index2, i)))
+                    c3j.append(load_matrix(input_root_jack, 'c3_n%d_%s_%s_%s' % (n, mstr, index3, i)))
+                    c4j.append(load_matrix(input_root_jack, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, i)))
                     repeats.append(1)
             else: break # end loop if last c4 jack not found
     if len(c4j) == 0: continue # skip rest of the loop if no jack integral has been found
@@ -133,24 +170,24 @@ for ii in range(len(I1)): # loop over all field combinations
     c2j, c3j, c4j, repeats = [np.array(a) for a in (c2j, c3j, c4j, repeats)]
     # average and save
     c2jf, c3jf, c4jf = [np.average(a, axis=0, weights=repeats) for a in (c2j, c3j, c4j)]
-    np.savetxt(output_root_jack+'c2_n%d_%s_%s_full.txt' % (n, mstr, index2), c2jf)
-    np.savetxt(output_root_jack+'c3_n%d_%s_%s_full.txt' % (n, mstr, index3), c3jf)
-    np.savetxt(output_root_jack+'c4_n%d_%s_%s_full.txt' % (n, mstr, index4), c4jf)
+    save_matrix(output_root_jack+'c2_n%d_%s_%s_full' % (n, mstr, index2), c2jf)
+    save_matrix(output_root_jack+'c3_n%d_%s_%s_full' % (n, mstr, index3), c3jf)
+    save_matrix(output_root_jack+'c4_n%d_%s_%s_full' % (n, mstr, index4), c4jf)
     if collapse_factor > 1:
         c2j, c3j, c4j = [np.mean(a.reshape(n_samples_out, collapse_factor, *np.shape(a)[1:]), axis=1) for a in (c2j, c3j, c4j)] # average adjacent chunks of collapse_factor samples
         # write the collapsed data
         for i in trange(n_samples_out, desc="Writing %s jack samples" % index4):
-            np.savetxt(output_root_jack+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), c2j[i])
-            np.savetxt(output_root_jack+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i), c3j[i])
-            np.savetxt(output_root_jack+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i), c4j[i])
+            save_matrix(output_root_jack+'c2_n%d_%s_%s_%s' % (n, mstr, index2, i), c2j[i])
+            save_matrix(output_root_jack+'c3_n%d_%s_%s_%s' % (n, mstr, index3, i), c3j[i])
+            save_matrix(output_root_jack+'c4_n%d_%s_%s_%s' % (n, mstr, index4, i), c4j[i])
     else: # can copy files, which should be faster
         c2j, c3j, c4j = [None] * 3 # won't be needed, so can free memory
         for input_root_jack, n_samples, sample_offset in zip(input_roots_jack, ns_samples, sample_offsets):
             if os.path.samefile(input_root_jack, output_root_jack): continue # skip copying, files are already there
             for i in trange(n_samples, desc="Copying %s jack samples" % index4):
-                copy2(input_root_jack+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), output_root_jack+'c2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i + sample_offset))
-                copy2(input_root_jack+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i), output_root_jack+'c3_n%d_%s_%s_%s.txt' % (n, mstr, index3, i + sample_offset))
-                copy2(input_root_jack+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i), output_root_jack+'c4_n%d_%s_%s_%s.txt' % (n, mstr, index4, i + sample_offset))
+                copy_matrix(input_root_jack, 'c2_n%d_%s_%s_%s' % (n, mstr, index2, i), output_root_jack+'c2_n%d_%s_%s_%s' % (n, mstr, index2, i + sample_offset))
+                copy_matrix(input_root_jack, 'c3_n%d_%s_%s_%s' % (n, mstr, index3, i), output_root_jack+'c3_n%d_%s_%s_%s' % (n, mstr, index3, i + sample_offset))
+                copy_matrix(input_root_jack, 'c4_n%d_%s_%s_%s' % (n, mstr, index4, i), output_root_jack+'c4_n%d_%s_%s_%s' % (n, mstr, index4, i + sample_offset))
     print("Done with %s jack" % index4)
 
     # disconnected jackknife integrals (cxj). Done separately because absent in mixed Jackknife (JACKKNIFE_MIX)
@@ -159,24 +196,24 @@ for ii in range(len(I1)): # loop over all field combinations
     # read
     for input_root_jack, n_samples in zip(input_roots_jack, ns_samples):
         read_all = True
-        if collapse_factor == 1 and not os.path.isfile(input_root_jack+'EE1_n%d_%s_%s_%d.txt' % (n, mstr, index2, n_samples)) and os.path.isfile(input_root_jack+'EE1_n%d_%s_%s_%d.txt' % (n, mstr, index2, n_samples-1)):
+        if collapse_factor == 1 and not has_matrix(input_root_jack, 'EE1_n%d_%s_%s_%d' % (n, mstr, index2, n_samples)) and has_matrix(input_root_jack, 'EE1_n%d_%s_%s_%d' % (n, mstr, index2, n_samples-1)):
             # if don't want to collapse and there are no more and no less samples than we are using, can read averages from full file
             # note: logic can still be broken by a gap in the samples, but there probably would not be a full file then
             try:
-                EEaA1.append(np.loadtxt(input_root_jack+'EE1_n%d_%s_%s_full.txt' % (n, mstr, index2)))
-                EEaA2.append(np.loadtxt(input_root_jack+'EE2_n%d_%s_%s_full.txt' % (n, mstr, index2)))
-                RRaA1.append(np.loadtxt(input_root_jack+'RR1_n%d_%s_%s_full.txt' % (n, mstr, index2)))
-                RRaA2.append(np.loadtxt(input_root_jack+'RR2_n%d_%s_%s_full.txt' % (n, mstr, index2)))
+                EEaA1.append(load_matrix(input_root_jack, 'EE1_n%d_%s_%s_full' % (n, mstr, index2)))
+                EEaA2.append(load_matrix(input_root_jack, 'EE2_n%d_%s_%s_full' % (n, mstr, index2)))
+                RRaA1.append(load_matrix(input_root_jack, 'RR1_n%d_%s_%s_full' % (n, mstr, index2)))
+                RRaA2.append(load_matrix(input_root_jack, 'RR2_n%d_%s_%s_full' % (n, mstr, index2)))
                 repeats.append(n_samples)
                 read_all = False
             except (FileNotFoundError, IOError): pass
         if read_all:
-            if os.path.isfile(input_root_jack+'EE1_n%d_%s_%s_%s.txt' % (n, mstr, index2, n_samples-1)):
+            if has_matrix(input_root_jack, 'EE1_n%d_%s_%s_%s' % (n, mstr, index2, n_samples-1)):
                 for i in trange(n_samples, desc="Reading %s disconnected jack samples" % index2):
-                    EEaA1.append(np.loadtxt(input_root_jack+'EE1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i)))
-                    EEaA2.append(np.loadtxt(input_root_jack+'EE2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i)))
-                    RRaA1.append(np.loadtxt(input_root_jack+'RR1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i)))
-                    RRaA2.append(np.loadtxt(input_root_jack+'RR2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i)))
+                    EEaA1.append(load_matrix(input_root_jack, 'EE1_n%d_%s_%s_%s' % (n, mstr, index2, i)))
+                    EEaA2.append(load_matrix(input_root_jack, 'EE2_n%d_%s_%s_%s' % (n, mstr, index2, i)))
+                    RRaA1.append(load_matrix(input_root_jack, 'RR1_n%d_%s_%s_%s' % (n, mstr, index2, i)))
+                    RRaA2.append(load_matrix(input_root_jack, 'RR2_n%d_%s_%s_%s' % (n, mstr, index2, i)))
                     repeats.append(1)
             else: break # end loop if last c4 jack not found
     if len(EEaA1) == 0: continue # skip rest of the loop if no jack integral has been found
@@ -186,25 +223,25 @@ for ii in range(len(I1)): # loop over all field combinations
     EEaA1, EEaA2, RRaA1, RRaA2, repeats = [np.array(a) for a in (EEaA1, EEaA2, RRaA1, RRaA2, repeats)]
     # average and save
     EEaA1f, EEaA2f, RRaA1f, RRaA2f = [np.average(a, axis=0, weights=repeats) for a in (EEaA1, EEaA2, RRaA1, RRaA2)]
-    np.savetxt(output_root_jack+'EE1_n%d_%s_%s_full.txt' % (n, mstr, index2), EEaA1f)
-    np.savetxt(output_root_jack+'EE2_n%d_%s_%s_full.txt' % (n, mstr, index2), EEaA2f)
-    np.savetxt(output_root_jack+'RR1_n%d_%s_%s_full.txt' % (n, mstr, index2), RRaA1f)
-    np.savetxt(output_root_jack+'RR2_n%d_%s_%s_full.txt' % (n, mstr, index2), RRaA2f)
+    save_matrix(output_root_jack+'EE1_n%d_%s_%s_full' % (n, mstr, index2), EEaA1f)
+    save_matrix(output_root_jack+'EE2_n%d_%s_%s_full' % (n, mstr, index2), EEaA2f)
+    save_matrix(output_root_jack+'RR1_n%d_%s_%s_full' % (n, mstr, index2), RRaA1f)
+    save_matrix(output_root_jack+'RR2_n%d_%s_%s_full' % (n, mstr, index2), RRaA2f)
     if collapse_factor > 1:
         EEaA1, EEaA2, RRaA1, RRaA2 = [np.mean(a.reshape(n_samples_out, collapse_factor, *np.shape(a)[1:]), axis=1) for a in (EEaA1, EEaA2, RRaA1, RRaA2)] # average adjacent chunks of collapse_factor samples
         # write the collapsed data
         for i in trange(n_samples_out, desc="Writing %s disconnected jack samples" % index2):
-            np.savetxt(output_root_jack+'EE1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), EEaA1[i])
-            np.savetxt(output_root_jack+'EE2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), EEaA2[i])
-            np.savetxt(output_root_jack+'RR1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), RRaA1[i])
-            np.savetxt(output_root_jack+'RR2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), RRaA2[i])
+            save_matrix(output_root_jack+'EE1_n%d_%s_%s_%s' % (n, mstr, index2, i), EEaA1[i])
+            save_matrix(output_root_jack+'EE2_n%d_%s_%s_%s' % (n, mstr, index2, i), EEaA2[i])
+            save_matrix(output_root_jack+'RR1_n%d_%s_%s_%s' % (n, mstr, index2, i), RRaA1[i])
+            save_matrix(output_root_jack+'RR2_n%d_%s_%s_%s' % (n, mstr, index2, i), RRaA2[i])
     else: # can copy files, which should be faster
         EEaA1, EEaA2, RRaA1, RRaA2 = [None] * 4 # won't be needed, so can free memory
         for input_root_jack, n_samples, sample_offset in zip(input_roots_jack, ns_samples, sample_offsets):
             if os.path.samefile(input_root_jack, output_root_jack): continue # skip copying, files are already there
             for i in trange(n_samples, desc="Copying %s disconnected jack samples" % index2):
-                copy2(input_root_jack+'EE1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), output_root_jack+'EE1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i + sample_offset))
-                copy2(input_root_jack+'EE2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), output_root_jack+'EE2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i + sample_offset))
-                copy2(input_root_jack+'RR1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), output_root_jack+'RR1_n%d_%s_%s_%s.txt' % (n, mstr, index2, i + sample_offset))
-                copy2(input_root_jack+'RR2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i), output_root_jack+'RR2_n%d_%s_%s_%s.txt' % (n, mstr, index2, i + sample_offset))
+                copy_matrix(input_root_jack, 'EE1_n%d_%s_%s_%s' % (n, mstr, index2, i), output_root_jack+'EE1_n%d_%s_%s_%s' % (n, mstr, index2, i + sample_offset))
+                copy_matrix(input_root_jack, 'EE2_n%d_%s_%s_%s' % (n, mstr, index2, i), output_root_jack+'EE2_n%d_%s_%s_%s' % (n, mstr, index2, i + sample_offset))
+                copy_matrix(input_root_jack, 'RR1_n%d_%s_%s_%s' % (n, mstr, index2, i), output_root_jack+'RR1_n%d_%s_%s_%s' % (n, mstr, index2, i + sample_offset))
+                copy_matrix(input_root_jack, 'RR2_n%d_%s_%s_%s' % (n, mstr, index2, i), output_root_jack+'RR2_n%d_%s_%s_%s' % (n, mstr, index2, i + sample_offset))
     print("Done with %s disconnected jack" % index2)
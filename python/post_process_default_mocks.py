@@ -3,6 +3,7 @@
 
 import numpy as np
 import sys,os
+from subsample_container import load_matrix
 from tqdm import trange
 
 # PARAMETERS
@@ -29,9 +30,9 @@ if not os.path.exists(outdir):
 def load_matrices(index):
     """Load intermediate or full covariance matrices"""
     cov_root = os.path.join(file_root, 'CovMatricesAll/')
-    c2 = np.diag(np.loadtxt(cov_root+'c2_n%d_m%d_11_%s.txt'%(n,m,index))[skip_bins:])
-    c3 = np.loadtxt(cov_root+'c3_n%d_m%d_1,11_%s.txt'%(n,m,index))[skip_bins:, skip_bins:]
-    c4 = np.loadtxt(cov_root+'c4_n%d_m%d_11,11_%s.txt'%(n,m,index))[skip_bins:, skip_bins:]
+    c2 = np.diag(load_matrix(cov_root+'c2_n%d_m%d_11_%s.txt'%(n,m,index))[skip_bins:])
+    c3 = load_matrix(cov_root+'c3_n%d_m%d_1,11_%s.txt'%(n,m,index))[skip_bins:, skip_bins:]
+    c4 = load_matrix(cov_root+'c4_n%d_m%d_11,11_%s.txt'%(n,m,index))[skip_bins:, skip_bins:]
 
     # Now symmetrize and return matrices
     return c2,0.5*(c3+c3.T),0.5*(c4+c4.T)
@@ -3,6 +3,7 @@
 
 import numpy as np
 import sys,os
+from subsample_container import load_matrix
 from tqdm import trange
 
 # PARAMETERS
@@ -33,9 +34,9 @@ def load_matrices(index, field):
     suffix2 = '_n%d_m%d_%s%s_%s.txt' % (n, m, field, field, index)
     suffix3 = '_n%d_m%d_%s,%s%s_%s.txt' % (n, m, field, field, field, index)
     suffix4 = '_n%d_m%d_%s%s,%s%s_%s.txt' % (n, m, field, field, field, field, index)
-    c2 = np.diag(np.loadtxt(cov_root + 'c2' + suffix2)[skip_bins:])
-    c3 = np.loadtxt(cov_root + 'c3' + suffix3)[skip_bins:, skip_bins:]
-    c4 = np.loadtxt(cov_root + 'c4' + suffix4)[skip_bins:, skip_bins:]
+    c2 = np.diag(load_matrix(cov_root + 'c2' + suffix2)[skip_bins:])
+    c3 = load_matrix(cov_root + 'c3' + suffix3)[skip_bins:, skip_bins:]
+    c4 = load_matrix(cov_root + 'c4' + suffix4)[skip_bins:, skip_bins:]
 
     # Now symmetrize and return matrices
     return c2, 0.5*(c3+c3.T), 0.5*(c4+c4.T)
@@ -148,9 +149,9 @@ def matrix_readin(suffix='full'):
             #print("Reading in integral components for C_{%s}, iteration %s"%(index4,suffix))
 
         # Load full integrals
-        c2 = np.diag(np.loadtxt(file_root_all + 'c2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))[skip_bins:])
-        c3 = np.loadtxt(file_root_all + 'c3_n%d_m%d_%s_%s.txt' % (n, m, index3, suffix))[skip_bins:, skip_bins:]
-        c4 = np.loadtxt(file_root_all + 'c4_n%d_m%d_%s_%s.txt' % (n, m, index4, suffix))[skip_bins:, skip_bins:]
+        c2 = np.diag(load_matrix(file_root_all + 'c2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))[skip_bins:])
+        c3 = load_matrix(file_root_all + 'c3_n%d_m%d_%s_%s.txt' % (n, m, index3, suffix))[skip_bins:, skip_bins:]
+        c4 = load_matrix(file_root_all + 'c4_n%d_m%d_%s_%s.txt' % (n, m, index4, suffix))[skip_bins:, skip_bins:]
 
         # Now save components
         c2s[j1, j2] += c2
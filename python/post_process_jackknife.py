@@ -3,6 +3,7 @@
 
 import numpy as np
 import sys,os
+from subsample_container import load_matrix
 from tqdm import trange
 
 # PARAMETERS
@@ -58,14 +59,14 @@ def load_matrices(index,jack=True):
         cov_root = os.path.join(file_root, 'CovMatricesJack/')
     else:
         cov_root = os.path.join(file_root, 'CovMatricesAll/')
-    c2 = np.diag(np.loadtxt(cov_root+'c2_n%d_m%d_11_%s.txt'%(n,m,index)))
-    c3 = np.loadtxt(cov_root+'c3_n%d_m%d_1,11_%s.txt'%(n,m,index))
-    c4 = np.loadtxt(cov_root+'c4_n%d_m%d_11,11_%s.txt'%(n,m,index))
+    c2 = np.diag(load_matrix(cov_root+'c2_n%d_m%d_11_%s.txt'%(n,m,index)))
+    c3 = load_matrix(cov_root+'c3_n%d_m%d_1,11_%s.txt'%(n,m,index))
+    c4 = load_matrix(cov_root+'c4_n%d_m%d_11,11_%s.txt'%(n,m,index))
     if jack:
-        EEaA1 = np.loadtxt(cov_root+'EE1_n%d_m%d_11_%s.txt' %(n,m,index))
-        EEaA2 = np.loadtxt(cov_root+'EE2_n%d_m%d_11_%s.txt' %(n,m,index))
-        RRaA1 = np.loadtxt(cov_root+'RR1_n%d_m%d_11_%s.txt' %(n,m,index))
-        RRaA2 = np.loadtxt(cov_root+'RR2_n%d_m%d_11_%s.txt' %(n,m,index))
+        EEaA1 = load_matrix(cov_root+'EE1_n%d_m%d_11_%s.txt' %(n,m,index))
+        EEaA2 = load_matrix(cov_root+'EE2_n%d_m%d_11_%s.txt' %(n,m,index))
+        RRaA1 = load_matrix(cov_root+'RR1_n%d_m%d_11_%s.txt' %(n,m,index))
+        RRaA2 = load_matrix(cov_root+'RR2_n%d_m%d_11_%s.txt' %(n,m,index))
     
         # Compute disconnected term
         w_aA1 = RRaA1/np.sum(RRaA1,axis=0)
@@ -4,6 +4,7 @@
 
 import numpy as np
 import sys,os
+from subsample_container import load_matrix
 from tqdm import tqdm
 
 # PARAMETERS
@@ -88,14 +89,14 @@ def load_matrices(index,field,jack=True):
     suffix2 = '_n%d_m%d_%s%s_%s.txt'%(n,m,field,field,index)
     suffix3 = '_n%d_m%d_%s,%s%s_%s.txt'%(n,m,field,field,field,index)
     suffix4 = '_n%d_m%d_%s%s,%s%s_%s.txt'%(n,m,field,field,field,field,index)
-    c2 = np.diag(np.loadtxt(cov_root+'c2'+suffix2))
-    c3 = np.loadtxt(cov_root+'c3'+suffix3)
-    c4 = np.loadtxt(cov_root+'c4'+suffix4)
+    c2 = np.diag(load_matrix(cov_root+'c2'+suffix2))
+    c3 = load_matrix(cov_root+'c3'+suffix3)
+    c4 = load_matrix(cov_root+'c4'+suffix4)
     if jack:
-        EEaA1 = np.loadtxt(cov_root+'EE1'+suffix2)
-        EEaA2 = np.loadtxt(cov_root+'EE2'+suffix2)
-        RRaA1 = np.loadtxt(cov_root+'RR1'+suffix2)
-        RRaA2 = np.loadtxt(cov_root+'RR2'+suffix2)
+        EEaA1 = load_matrix(cov_root+'EE1'+suffix2)
+        EEaA2 = load_matrix(cov_root+'EE2'+suffix2)
+        RRaA1 = load_matrix(cov_root+'RR1'+suffix2)
+        RRaA2 = load_matrix(cov_root+'RR2'+suffix2)
 
         # Compute disconnected term
         w_aA1 = RRaA1/np.sum(RRaA1,axis=0)
@@ -241,20 +242,20 @@ def matrix_readin(suffix='full'):
         rr_true = np.loadtxt(rr_true_file)
 
         # Load full integrals
-        c2 = np.diag(np.loadtxt(file_root_all + 'c2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix)))
-        c3 = np.loadtxt(file_root_all + 'c3_n%d_m%d_%s_%s.txt' % (n, m, index3, suffix))
-        c4 = np.loadtxt(file_root_all + 'c4_n%d_m%d_%s_%s.txt' % (n, m, index4, suffix))
+        c2 = np.diag(load_matrix(file_root_all + 'c2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix)))
+        c3 = load_matrix(file_root_all + 'c3_n%d_m%d_%s_%s.txt' % (n, m, index3, suffix))
+        c4 = load_matrix(file_root_all + 'c4_n%d_m%d_%s_%s.txt' % (n, m, index4, suffix))
 
         # Load jackknife integrals
-        c2j = np.diag(np.loadtxt(file_root_jack + 'c2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix)))
-        c3j = np.loadtxt(file_root_jack + 'c3_n%d_m%d_%s_%s.txt' % (n, m, index3, suffix))
-        c4j = np.loadtxt(file_root_jack + 'c4_n%d_m%d_%s_%s.txt' % (n, m, index4, suffix))
+        c2j = np.diag(load_matrix(file_root_jack + 'c2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix)))
+        c3j = load_matrix(file_root_jack + 'c3_n%d_m%d_%s_%s.txt' % (n, m, index3, suffix))
+        c4j = load_matrix(file_root_jack + 'c4_n%d_m%d_%s_%s.txt' % (n, m, index4, suffix))
 
         # Define cxj components
-        EEaA1 = np.loadtxt(file_root_jack + 'EE1_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
-        EEaA2 = np.loadtxt(file_root_jack + 'EE2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
-        RRaA1 = np.loadtxt(file_root_jack + 'RR1_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
-        RRaA2 = np.loadtxt(file_root_jack + 'RR2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
+        EEaA1 = load_matrix(file_root_jack + 'EE1_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
+        EEaA2 = load_matrix(file_root_jack + 'EE2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
+        RRaA1 = load_matrix(file_root_jack + 'RR1_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
+        RRaA2 = load_matrix(file_root_jack + 'RR2_n%d_m%d_%s_%s.txt' % (n, m, index2, suffix))
         w_aA1 = RRaA1/np.sum(RRaA1,axis=0)
         w_aA2 = RRaA2/np.sum(RRaA2,axis=0)
         EEa1 = np.sum(EEaA1, axis=0)
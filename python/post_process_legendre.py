@@ -3,6 +3,7 @@
 
 import numpy as np
 import sys, os
+from subsample_container import load_matrix
 from tqdm import trange
 
 # PARAMETERS
@@ -26,9 +27,9 @@ if not os.path.exists(outdir):
 def load_matrices(index):
     """Load intermediate or full covariance matrices"""
     cov_root = os.path.join(file_root, 'CovMatricesAll/')
-    c2 = np.loadtxt(cov_root+'c2_n%d_l%d_11_%s.txt'%(n,max_l,index))
-    c3 = np.loadtxt(cov_root+'c3_n%d_l%d_1,11_%s.txt'%(n,max_l,index))
-    c4 = np.loadtxt(cov_root+'c4_n%d_l%d_11,11_%s.txt'%(n,max_l,index))
+    c2 = load_matrix(cov_root+'c2_n%d_l%d_11_%s.txt'%(n,max_l,index))
+    c3 = load_matrix(cov_root+'c3_n%d_l%d_1,11_%s.txt'%(n,max_l,index))
+    c4 = load_matrix(cov_root+'c4_n%d_l%d_11,11_%s.txt'%(n,max_l,index))
 
     N = len(c2)
     assert N % n == 0, "Number of bins mismatch"
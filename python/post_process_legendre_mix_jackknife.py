@@ -3,6 +3,7 @@
 
 import numpy as np
 import sys, os
+from subsample_container import load_matrix
 
 # PARAMETERS
 if len(sys.argv) != 8:
@@ -66,9 +67,9 @@ def load_matrices(index,jack=True):
         cov_root = os.path.join(file_root, 'CovMatricesJack/')
     else:
         cov_root = os.path.join(file_root, 'CovMatricesAll/')
-    c2 = np.loadtxt(cov_root+'c2_n%d_l%d_11_%s.txt' % (n, max_l, index))
-    c3 = np.loadtxt(cov_root+'c3_n%d_l%d_1,11_%s.txt' % (n, max_l, index))
-    c4 = np.loadtxt(cov_root+'c4_n%d_l%d_11,11_%s.txt' % (n, max_l, index))
+    c2 = load_matrix(cov_root+'c2_n%d_l%d_11_%s.txt' % (n, max_l, index))
+    c3 = load_matrix(cov_root+'c3_n%d_l%d_1,11_%s.txt' % (n, max_l, index))
+    c4 = load_matrix(cov_root+'c4_n%d_l%d_11,11_%s.txt' % (n, max_l, index))
     # Now symmetrize and return matrices
     return c2, 0.5*(c3+c3.T), 0.5*(c4+c4.T)
 
@@ -3,6 +3,7 @@
 
 import numpy as np
 import sys,os
+from subsample_container import load_matrix
 from tqdm import trange
 
 # PARAMETERS
@@ -66,9 +67,9 @@ def matrix_readin(suffix='full'):
             #print("Reading in integral components for C_{%s}, iteration %s"%(index4,suffix))
 
         # Load full integrals
-        c2 = np.loadtxt(file_root_all + 'c2_n%d_l%d_%s_%s.txt' % (n, max_l, index2, suffix))
-        c3 = np.loadtxt(file_root_all + 'c3_n%d_l%d_%s_%s.txt' % (n, max_l, index3, suffix))
-        c4 = np.loadtxt(file_root_all + 'c4_n%d_l%d_%s_%s.txt' % (n, max_l, index4, suffix))
+        c2 = load_matrix(file_root_all + 'c2_n%d_l%d_%s_%s.txt' % (n, max_l, index2, suffix))
+        c3 = load_matrix(file_root_all + 'c3_n%d_l%d_%s_%s.txt' % (n, max_l, index3, suffix))
+        c4 = load_matrix(file_root_all + 'c4_n%d_l%d_%s_%s.txt' % (n, max_l, index4, suffix))
 
         # Now save components
         c2s[j1, j2] += c2
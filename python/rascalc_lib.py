@@ -0,0 +1,92 @@
+## Python interface to librascalc (see librascalc/rascalc.h), computing the covariance integrals of a single field from NumPy arrays without any input or output files.
+## The arrays are passed to the library without copying if they are already C-contiguous float64 (int32 for labels); the outputs are allocated here and filled by the library.
+## Usage: import rascalc_lib; lib = rascalc_lib.RascalCLibrary("librascalc/librascalc.so"); results = lib.compute(...)
+
+import numpy as np
+import ctypes as ct
+
+_double_p = ct.POINTER(ct.c_double)
+_int_p = ct.POINTER(ct.c_int)
+
+class _Inputs(ct.Structure):
+    _fields_ = [("positions", _double_p), ("weights", _double_p), ("jackknife_regions", _int_p), ("n_particles", ct.c_int), ("n_galaxies", ct.c_double),
+                ("r_low", _double_p), ("r_high", _double_p), ("n_r_bins", ct.c_int), ("n_mu_bins", ct.c_int),
+                ("r_low_cf", _double_p), ("r_high_cf", _double_p), ("n_r_bins_cf", ct.c_int), ("n_mu_bins_cf", ct.c_int),
+                ("xi", _double_p), ("xi_r", _double_p), ("xi_mu", _double_p),
+                ("RR", _double_p), ("jackknife_labels", _int_p), ("jackknife_weights", _double_p), ("n_jackknives", ct.c_int),
+                ("max_l", ct.c_int), ("mu_bin_legendre_factors", _double_p),
+                ("nside", ct.c_int), ("nthread", ct.c_int), ("max_loops", ct.c_int), ("loops_per_sample", ct.c_int), ("N2", ct.c_int), ("N3", ct.c_int), ("N4", ct.c_int), ("cf_loops", ct.c_int),
+                ("xicutoff", ct.c_double), ("boxsize", ct.c_double)]
+
+OUTPUT_NAMES = ["c2", "c3", "c4", "RR", "c2j", "c3j", "c4j", "EE1", "EE2", "RR1", "RR2"]
+
+class _Outputs(ct.Structure):
+    _fields_ = [(name, _double_p) for name in OUTPUT_NAMES] + [("counts", ct.c_ulonglong * 3)]
+
+class _Sizes(ct.Structure):
+    _fields_ = [("n_blocks", ct.c_int), ("c2", ct.c_long), ("c3", ct.c_long), ("c4", ct.c_long), ("RR", ct.c_long), ("jack", ct.c_long)]
+
+class RascalCLibrary:
+    """Wrapper of a compiled librascalc.so; the mode (e.g. 'jackknife' or 'legendre_mix_periodic') is fixed at compilation and given by the mode attribute."""
+
+    def __init__(self, path="librascalc.so"):
+        self.lib = ct.CDLL(path)
+        self.lib.rascalc_mode.restype = ct.c_char_p
+        self.lib.rascalc_output_sizes.argtypes = [ct.POINTER(_Inputs), ct.POINTER(_Sizes)]
+        self.lib.rascalc_compute.argtypes = [ct.POINTER(_Inputs), ct.POINTER(_Outputs)]
+        self.mode = self.lib.rascalc_mode().decode()
+
+    def compute(self, positions, weights, n_galaxies, r_bins, n_mu_bins, xi, xi_r, xi_mu, r_bins_cf, RR,
+                jackknife_regions=None, jackknife_labels=None, jackknife_weights=None, max_l=0, mu_bin_legendre_factors=None,
+                nside=51, nthread=10, max_loops=120, loops_per_sample=1, N2=20, N3=40, N4=80, cf_loops=10, xicutoff=250., boxsize=0.):
+        """Compute the integrals. Arguments are as the inputs of the main code: positions (n,3), weights (n), r_bins (n_r_bins,2) and r_bins_cf (n_r_bins_cf,2)
+        as in the binning files, xi (n_r_bins_cf,n_mu_bins_cf) with its radial and mu bin centers xi_r and xi_mu, RR (n_r_bins*n_mu_bins) and, in the JACKKNIFE modes,
+        jackknife_regions (n), jackknife_labels (n_jackknives) and jackknife_weights (n_jackknives,n_r_bins*n_mu_bins) as in the jackknife weights file.
+        Returns a dictionary of arrays of the integrals, each of shape (1+n_subsamples, ...) holding the full integral followed by the subsample integrals,
+        and of the total pair, triple and quad counts."""
+        keep = [] # arrays that must stay alive during the call
+        def double_array(a, shape=None):
+            if a is None: return None
+            a = np.ascontiguousarray(a, dtype=np.float64)
+            if shape is not None: assert a.shape == shape, "expected shape %s, got %s" % (shape, a.shape)
+            keep.append(a)
+            return a.ctypes.data_as(_double_p)
+        def int_array(a):
+            if a is None: return None
+            a = np.ascontiguousarray(a, dtype=np.int32)
+            keep.append(a)
+            return a.ctypes.data_as(_int_p)
+
+        n = len(positions)
+        r_bins, r_bins_cf = np.asarray(r_bins, dtype=np.float64), np.asarray(r_bins_cf, dtype=np.float64)
+        n_r_bins, n_r_bins_cf = len(r_bins), len(r_bins_cf)
+        n_mu_bins_cf = len(xi_mu)
+        n_jackknives = 0 if jackknife_labels is None else len(jackknife_labels)
+
+        inputs = _Inputs(positions=double_array(positions, (n, 3)), weights=double_array(weights, (n,)), jackknife_regions=int_array(jackknife_regions), n_particles=n, n_galaxies=n_galaxies,
+                         r_low=double_array(r_bins[:, 0]), r_high=double_array(r_bins[:, 1]), n_r_bins=n_r_bins, n_mu_bins=n_mu_bins,
+                         r_low_cf=double_array(r_bins_cf[:, 0]), r_high_cf=double_array(r_bins_cf[:, 1]), n_r_bins_cf=n_r_bins_cf, n_mu_bins_cf=n_mu_bins_cf,
+                         xi=double_array(xi, (n_r_bins_cf, n_mu_bins_cf)), xi_r=double_array(xi_r, (n_r_bins_cf,)), xi_mu=double_array(xi_mu),
+                         RR=double_array(RR, (n_r_bins*n_mu_bins,)), jackknife_labels=int_array(jackknife_labels),
+                         jackknife_weights=double_array(jackknife_weights, None if jackknife_weights is None else (n_jackknives, n_r_bins*n_mu_bins)), n_jackknives=n_jackknives,
+                         max_l=max_l, mu_bin_legendre_factors=double_array(mu_bin_legendre_factors),
+                         nside=nside, nthread=nthread, max_loops=max_loops, loops_per_sample=loops_per_sample, N2=N2, N3=N3, N4=N4, cf_loops=cf_loops,
+                         xicutoff=xicutoff, boxsize=boxsize)
+
+        sizes = _Sizes()
+        if self.lib.rascalc_output_sizes(ct.byref(inputs), ct.byref(sizes)) != 0: raise ValueError("invalid inputs for librascalc (see the error message)")
+
+        # Allocate the outputs computed in this mode, in the shapes of the output files
+        no_bins = int(round(np.sqrt(sizes.c3)))
+        shapes = {"c2": (sizes.c2,) if sizes.c2 == no_bins else (no_bins, no_bins), "c3": (no_bins, no_bins), "c4": (no_bins, no_bins), "RR": (sizes.RR,)}
+        if "jackknife" in self.mode or "legendre_mix" in self.mode:
+            shapes.update({"c2j": shapes["c2"], "c3j": shapes["c3"], "c4j": shapes["c4"]})
+        if sizes.jack > 0:
+            shapes.update({name: (n_jackknives, no_bins) for name in ["EE1", "EE2", "RR1", "RR2"]})
+        if sizes.RR == 0: del shapes["RR"]
+        results = {name: np.zeros((sizes.n_blocks,) + shape) for name, shape in shapes.items()}
+        outputs = _Outputs(**{name: array.ctypes.data_as(_double_p) for name, array in results.items()})
+
+        if self.lib.rascalc_compute(ct.byref(inputs), ct.byref(outputs)) != 0: raise ValueError("invalid inputs for librascalc (see the error message)")
+        results["counts"] = np.array(outputs.counts[:], dtype=np.uint64)
+        return results
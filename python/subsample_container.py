@@ -0,0 +1,112 @@
+## Reader for the subsample container files written by the C++ code with the -container option, e.g. CovMatricesAll/c4_n36_m10_11,11_subsamples.bin.
+## Each container holds all subsample estimates of one output array; the records are memory-mapped rather than read into memory.
+## Can be imported (read_container) or run as a script to unpack a container into the usual per-subsample .npy files.
+
+import numpy as np
+import sys, os
+from functools import lru_cache
+
+BLOCK = 64
+
+def read_container(filename):
+    """Return the subsample labels and a memory-mapped array of shape (n_records, n_rows[, n_cols]) holding the records of the container.
+    If the index footer is missing or corrupt (e.g. the run crashed while writing), the valid records are recovered by scanning the file."""
+    with open(filename, 'rb') as f:
+        header = f.read(BLOCK)
+        if header[:8] != b'RCSUBSMP': raise IOError("%s is not a subsample container" % filename)
+        descr = header[12:16].rstrip(b'\0').decode()
+        n_rows, n_cols, record_bytes = np.frombuffer(header[16:40], dtype='<i8')
+        shape = (n_rows,) if n_cols == 0 else (n_rows, n_cols)
+        payload_bytes = np.dtype(descr).itemsize * int(np.prod(shape))
+        file_size = os.fstat(f.fileno()).st_size
+
+        # Try the index footer first
+        labels = None
+        if file_size >= BLOCK + 32:
+            f.seek(file_size - 16)
+            footer_offset = int(np.frombuffer(f.read(8), dtype='<i8')[0])
+            if f.read(8) == b'RCFOOTER' and (footer_offset - BLOCK) % record_bytes == 0 and BLOCK <= footer_offset < file_size:
+                f.seek(footer_offset)
+                if f.read(8) == b'RCINDEX_':
+                    n_records = int(np.frombuffer(f.read(8), dtype='<i8')[0])
+                    if footer_offset == BLOCK + n_records * record_bytes:
+                        labels = np.frombuffer(f.read(8 * n_records), dtype='<i8')
+
+    if labels is None:
+        # Recover by scanning the records, stopping at the first incomplete one
+        print("WARNING: index of %s is incomplete, recovering records by scanning the file" % filename)
+        n_candidates = (file_size - BLOCK) // record_bytes
+        labels = np.zeros(0, dtype='<i8')
+        if n_candidates > 0:
+            raw = np.memmap(filename, dtype=np.uint8, mode='r', offset=BLOCK, shape=(n_candidates, record_bytes))
+            valid = np.all(raw[:, :8] == np.frombuffer(b'RCRECORD', dtype=np.uint8), axis=1)
+            checksums = raw[:, 16:24].copy().view('<u8')[:, 0]
+            valid &= fnv1a(raw[:, BLOCK:BLOCK + payload_bytes]) == checksums
+            n_valid = n_candidates if np.all(valid) else int(np.argmin(valid))
+            labels = raw[:n_valid, 8:16].copy().view('<i8')[:, 0]
+            del raw
+
+    if len(labels) == 0: return labels, np.zeros((0,) + shape, dtype=descr)
+    record_dtype = np.dtype([('header', 'V%d' % BLOCK), ('data', descr, shape), ('pad', 'V%d' % (record_bytes - BLOCK - payload_bytes))])
+    records = np.memmap(filename, dtype=record_dtype, mode='r', offset=BLOCK, shape=(len(labels),))
+    return labels, records['data']
+
+def fnv1a(records, chunk_bytes = 1<<26):
+    """64-bit FNV-1a hashes, as used by the C++ code for the record checksums, of each row of a 2D uint8 array.
+    The hash is sequential in the bytes, so the rows are hashed together, one byte column at a time, in chunks of rows to bound the memory."""
+    hashes = np.empty(len(records), dtype=np.uint64)
+    prime = np.uint64(1099511628211)
+    chunk = max(1, chunk_bytes // max(1, records.shape[1]))
+    for start in range(0, len(records), chunk):
+        block = np.ascontiguousarray(records[start:start+chunk].T) # byte columns, contiguous
+        h = np.full(block.shape[1], 14695981039346656037, dtype=np.uint64)
+        with np.errstate(over='ignore'):
+            for column in block:
+                h ^= column
+                h *= prime # wraps modulo 2^64
+        hashes[start:start+chunk] = h
+    return hashes
+
+@lru_cache(maxsize=None)
+def _read_container_cached(filename, mtime_ns, size):
+    return read_container(filename)
+
+def _read_container_of(basename):
+    filename = basename + '_subsamples.bin'
+    st = os.stat(filename)
+    return _read_container_cached(filename, st.st_mtime_ns, st.st_size)
+
+def has_subsample(basename, index):
+    """Whether the container of the array with the given base name exists and holds subsample estimate index"""
+    if not os.path.isfile(basename + '_subsamples.bin'): return False
+    labels, _ = _read_container_of(basename)
+    return np.any(labels == int(index))
+
+def load_subsample(basename, index):
+    """Load subsample estimate index of the array with the given base name (without subsample suffix and extension) from its container.
+    The container is parsed once per file (and again only if it has changed since), so loading all subsamples in turn is cheap."""
+    labels, data = _read_container_of(basename)
+    where = np.where(labels == int(index))[0]
+    if len(where) == 0: raise IOError("Subsample %s not found in %s_subsamples.bin" % (index, basename))
+    return np.array(data[where[-1]])
+
+def load_matrix(filename):
+    """Load an integral saved by the C++ code, preferring the binary .npy version (-npy option) or subsample container (-container option) over the text file"""
+    npy_name = os.path.splitext(filename)[0]+'.npy'
+    if os.path.isfile(npy_name): return np.load(npy_name)
+    root, index = os.path.splitext(filename)[0].rsplit('_', 1)
+    if index.isdigit() and os.path.isfile(root+'_subsamples.bin'): return load_subsample(root, index)
+    return np.loadtxt(filename)
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        print("Usage: python subsample_container.py {CONTAINER_FILE}")
+        print("Unpacks the container into the individual {NAME}_{INDEX}.npy files read by the post-processing scripts")
+        sys.exit(1)
+    container_file = str(sys.argv[1])
+    assert container_file.endswith('_subsamples.bin'), "Container file names end in _subsamples.bin"
+    basename = container_file[:-len('_subsamples.bin')]
+    labels, data = read_container(container_file)
+    for label, record in zip(labels, data):
+        np.save(basename + '_%d.npy' % label, record)
+    print("Unpacked %d subsamples from %s" % (len(labels), container_file))
@@ -506,7 +506,7 @@ int main(int argc, char *argv[]) {
             else filename=par.fname2;
             orig_p = read_particles(par.rescale, &par.np, filename, par.rstart, par.nmax);
             assert(par.np>0);
-            par.perbox = compute_bounding_box(orig_p, par.np, par.rect_boxsize, par.cellsize, par.rmax, shift, par.nside);
+            par.perbox = compute_bounding_box(&orig_p, &par.np, 1, par.rect_boxsize, par.cellsize, par.rmax, shift, par.nside);
         } else {
         // If you want to just make random particles instead:
         assert(par.np>0);
@@ -519,10 +519,11 @@ int main(int argc, char *argv[]) {
         if (par.qbalance) balance_weights(orig_p, par.np);
 
         // Now ready to compute!
-        // Sort the particles into the grid.
+        // Sort the particles into the grid, reordering them in place; the grid takes ownership of them.
         Float nofznorm=par.nofznorm;
         if(index==1) nofznorm=par.nofznorm2;
-        Grid tmp_grid(orig_p, par.np, par.rect_boxsize, par.cellsize, par.nside, shift, nofznorm);
+        all_grid[index] = Grid(orig_p, par.np, par.rect_boxsize, par.cellsize, par.nside, shift, nofznorm, true);
+        Grid &tmp_grid = all_grid[index];
 
         Float grid_density = (double)par.np/tmp_grid.nf;
         printf("\n RANDOM CATALOG %d DIAGNOSTICS:\n",index+1);
@@ -544,11 +545,6 @@ int main(int argc, char *argv[]) {
         printf("# Weights: Positive particles sum to %f\n", tmp_grid.sumw_pos);
         printf("#          Negative particles sum to %f\n", tmp_grid.sumw_neg);
 
-        // Now save grid to global memory:
-        all_grid[index].copy(&tmp_grid);
-        
-        free(orig_p); // Particles are now only stored in grid
-        
         fflush(NULL);
     }
     
@@ -556,10 +552,8 @@ int main(int argc, char *argv[]) {
     CorrelationFunction all_cf[max_no_functions];
     RandomDraws all_rd[max_no_functions];
     
-    CorrelationFunction tmp_cf(par.corname, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
-    all_cf[0].copy_function(&tmp_cf);
-    RandomDraws tmp_rd(&tmp_cf,&par,NULL,0);
-    all_rd[0].copy(&tmp_rd);
+    all_cf[0] = CorrelationFunction(par.corname, par.nbin_cf, par.radial_bins_low_cf, par.radial_bins_high_cf, par.mbin_cf, par.mumax-par.mumin);
+    all_rd[0] = RandomDraws(&all_cf[0],&par,NULL,0);
     
     // Run main modules
     compute_triples(&all_grid[0],&par,&all_cf[0],&all_rd[0]);